@@ -0,0 +1,148 @@
+#include "Acceptor.hpp"
+#include "Admission.hpp"
+#include "Proxy.hpp"
+#include "Logger.hpp"
+
+// 文件描述符用尽、又腾不出位置时，隔多久再接受（毫秒）
+static const unsigned kRetryInterval = 100;
+
+//////////////////////////////////////////////////////////////////////////
+
+Acceptor::Acceptor(EventLoop &loop, SOCKET sd)
+    : m_loop(loop), m_sd(sd) {
+
+}
+
+Acceptor::Acceptor(EventLoop &loop, SOCKET sd, std::vector<EventLoop *> workers)
+    : m_loop(loop), m_sd(sd), m_workers(std::move(workers)),
+      m_batches(m_workers.size()) {
+
+}
+
+Acceptor::~Acceptor() {
+    if (m_retry != 0) {
+        m_loop.CancelTimer(m_retry);
+    }
+
+#ifndef _WIN32
+    if (m_reserve != -1) {
+        close(m_reserve);
+    }
+#endif
+
+    if (m_sd != INVALID_SOCKET) {
+        m_loop.Remove(m_sd);
+        closesocket(m_sd);
+    }
+}
+
+bool Acceptor::Start() {
+    if (!SetNonBlocking(m_sd)) {
+        Logger::LogError(WSAGetLastErrorMessage(__FUNC__ "SetNonBlocking() failed"));
+        return false;
+    }
+
+#ifndef _WIN32
+    m_reserve = open("/dev/null", O_RDONLY | O_CLOEXEC);
+#endif
+
+    return m_loop.Add(m_sd, EventLoop::EV_READ, this);
+}
+
+void Acceptor::OnEvents(SOCKET, int) {
+    // 边缘触发：必须一直接受到没有新连接为止
+    while (true) {
+        SOCKET sd = AcceptNonBlocking(m_sd);
+        if (sd == INVALID_SOCKET) {
+            if (AcceptAborted()) {
+                continue;
+            }
+
+            if (WouldBlock()) {
+                break;
+            }
+
+            if (OutOfDescriptors() && ShedPending()) {
+                continue;
+            }
+
+            if (!WouldBlock()) {
+                Logger::LogError(WSAGetLastErrorMessage(__FUNC__ "accept() failed"));
+                RetryLater();
+            }
+
+            break;
+        }
+
+        if (m_workers.empty()) {
+            auto proxy = new MyProxy(m_loop, sd);
+            proxy->Start();
+        }
+        else if (Admission::Enqueue()) {
+            m_batches[m_nextWorker++ % m_workers.size()].push_back(sd);
+        }
+        else {
+            // 工作循环已经积压了太多连接
+            Admission::Reject(sd);
+        }
+    }
+
+    Dispatch();
+}
+
+void Acceptor::Dispatch() {
+    for (size_t i = 0; i < m_workers.size(); i++) {
+        if (m_batches[i].empty()) {
+            continue;
+        }
+
+        EventLoop *loop = m_workers[i];
+        std::vector<SOCKET> sds;
+        sds.swap(m_batches[i]);
+
+        loop->Post([loop, sds] {
+            for (SOCKET sd : sds) {
+                Admission::Dequeue();
+
+                auto proxy = new MyProxy(*loop, sd);
+                proxy->Start();
+            }
+        });
+    }
+}
+
+bool Acceptor::ShedPending() {
+#ifdef _WIN32
+    return false;
+#else
+    if (m_reserve == -1) {
+        return false;
+    }
+
+    close(m_reserve);
+
+    SOCKET sd = AcceptNonBlocking(m_sd);
+    int error = errno;
+
+    if (sd != INVALID_SOCKET) {
+        Admission::Reject(sd);
+    }
+
+    // 拿不回来就只能等 RetryLater()
+    m_reserve = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    errno = error;
+    return sd != INVALID_SOCKET || AcceptAborted();
+#endif
+}
+
+void Acceptor::RetryLater() {
+    if (m_retry != 0) {
+        return;
+    }
+
+    m_retry = m_loop.AddTimer(kRetryInterval, [this] {
+        m_retry = 0;
+        OnEvents(m_sd, EventLoop::EV_READ);
+    });
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include "EventLoop.hpp"
+#include "ws-util.h"
+
+#include <vector>
+
+/// 监听 SOCKET 的接受者
+/// 
+/// 挂在某个事件循环上。默认接受到的连接都交由同一个事件循环处理；
+/// 也可以指定一组工作循环，把连接轮流分给它们，尚未被接手的连接数
+/// 受 Admission::ACCEPT_QUEUE 限制。
+/// 
+/// 监听 SOCKET 是边缘触发的，积压的连接没有接受完就不会再有通知，因此
+/// 除了“没有连接了”，任何错误都不能让它停下：排队中失效的连接直接跳过；
+/// 文件描述符用尽时先释放预留的一个，接受一个连接并以 503 回应，
+/// 仍然不行就稍后再试。
+class Acceptor : public EventLoop::Handler {
+public:
+
+    /// 构造函数
+    /// 
+    /// @param sd 监听 SOCKET，所有权转移给本对象
+    Acceptor(EventLoop &loop, SOCKET sd);
+
+    /// 构造函数
+    /// 
+    /// 接受到的连接轮流分给 @a workers，每处理一批事件只向每个工作循环
+    /// 投递一次。
+    /// 
+    /// @param sd 监听 SOCKET，所有权转移给本对象
+    Acceptor(EventLoop &loop, SOCKET sd, std::vector<EventLoop *> workers);
+
+    /// 析构函数
+    ~Acceptor();
+
+    /// 开始接受连接
+    /// 
+    /// 必须在 @a loop 所在的线程中（或其运行之前）调用。
+    bool Start();
+
+    /// 接受所有已就绪的连接
+    virtual void OnEvents(SOCKET sd, int events) override;
+
+private:
+
+    // 把这一批接受到的连接交给各个工作循环
+    void Dispatch();
+
+    // 文件描述符用尽时，借预留的描述符接受一个连接并拒绝之
+    // 
+    // @return 拒绝了一个连接、应当接着接受时返回 true
+    bool ShedPending();
+
+    // 稍后再接受（预留的描述符也不够用时）
+    void RetryLater();
+
+    EventLoop &m_loop;
+    SOCKET m_sd;
+
+    // 预留的文件描述符，用尽时腾出位置
+    int m_reserve = -1;
+
+    // 重试的定时器
+    EventLoop::TimerId m_retry = 0;
+
+    // 为空时由 m_loop 自己处理
+    std::vector<EventLoop *> m_workers;
+    size_t m_nextWorker = 0;
+
+    // 每个工作循环这一批分到的连接
+    std::vector<std::vector<SOCKET>> m_batches;
+};
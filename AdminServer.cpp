@@ -0,0 +1,398 @@
+#include "AdminServer.hpp"
+#include "Admission.hpp"
+#include "Proxy.hpp"
+#include "DNSCache.hpp"
+#include "ResponseCache.hpp"
+#include "DiskCache.hpp"
+#include "Resolver.hpp"
+#include "ConnectionPool.hpp"
+#include "HttpParser.hpp"
+#include "Logger.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <thread>
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// 工作线程数
+int gs_numWorkers = 0;
+
+// 请求头部的最大长度
+const size_t kMaxRequestSize = 8192;
+
+// 连接的最长存活时间（毫秒）
+const unsigned kConnectionTimeout = 10000;
+
+// 一个管理连接：读取请求，写出回应，然后关闭
+class AdminConnection : public EventLoop::Handler {
+public:
+
+    AdminConnection(EventLoop &loop, SOCKET sd)
+        : m_loop(loop), m_sd(sd), m_parser(HttpParser::REQUEST) {}
+
+    ~AdminConnection() {
+        m_loop.CancelTimer(m_timer);
+        m_loop.Remove(m_sd);
+        ShutdownConnection(m_sd, false);
+    }
+
+    bool Start() {
+        if (!SetNonBlocking(m_sd) ||
+            !m_loop.Add(m_sd, EventLoop::EV_READ, this)) {
+            return false;
+        }
+
+        m_timer = m_loop.AddTimer(kConnectionTimeout, [this]() {
+            m_timer = 0;
+            delete this;
+        });
+
+        return true;
+    }
+
+    virtual void OnEvents(SOCKET, int events) override {
+        if ((events & EventLoop::EV_ERROR) || !Drive()) {
+            delete this;
+        }
+    }
+
+private:
+
+    // @return 连接应当关闭时返回 false
+    bool Drive() {
+        if (m_response.empty()) {
+            if (!ReadRequest()) {
+                return false;
+            }
+
+            if (m_response.empty()) {
+                return true; // 请求还不完整
+            }
+        }
+
+        while (m_sent < m_response.size()) {
+            int n = send(m_sd, m_response.data() + m_sent,
+                         (int) (m_response.size() - m_sent), MSG_NOSIGNAL);
+            if (n > 0) {
+                m_sent += n;
+            }
+            else if (n == SOCKET_ERROR && WouldBlock()) {
+                return m_loop.Modify(m_sd, EventLoop::EV_WRITE);
+            }
+            else {
+                return false;
+            }
+        }
+
+        return false; // 回应已经发完
+    }
+
+    // 读取、解析请求，完整后准备好回应
+    bool ReadRequest() {
+        while (true) {
+            char buf[1024];
+            int n = recv(m_sd, buf, sizeof(buf), 0);
+            if (n > 0) {
+                m_request.append(buf, n);
+            }
+            else if (n == SOCKET_ERROR && WouldBlock()) {
+                break;
+            }
+            else {
+                return false;
+            }
+        }
+
+        auto pr = m_parser.Parse(&m_request[0], m_request.size());
+        if (pr == HttpParser::PARSE_AGAIN) {
+            return m_request.size() < kMaxRequestSize;
+        }
+        else if (pr == HttpParser::PARSE_ERROR) {
+            return false;
+        }
+
+        auto target = m_parser.Target();
+        if (!m_parser.Method().Equals("GET")) {
+            m_response = Response("405 Method Not Allowed", "text/plain",
+                                  "Only GET is supported.\n");
+        }
+        else if (target.Equals("/metrics") ||
+                 (target.size > 9 && memcmp(target.data, "/metrics?", 9) == 0)) {
+            m_response = Response("200 OK",
+                                  "text/plain; version=0.0.4; charset=utf-8",
+                                  AdminServer::Render());
+        }
+        else {
+            m_response = Response("404 Not Found", "text/plain",
+                                  "Try /metrics.\n");
+        }
+
+        return true;
+    }
+
+    static string Response(const char *status, const char *type,
+                           const string &body) {
+        ostringstream ss;
+        ss << "HTTP/1.1 " << status << "\r\n"
+           << "Content-Type: " << type << "\r\n"
+           << "Content-Length: " << body.size() << "\r\n"
+           << "Connection: close\r\n\r\n"
+           << body;
+
+        return ss.str();
+    }
+
+    EventLoop &m_loop;
+    SOCKET m_sd;
+    EventLoop::TimerId m_timer = 0;
+
+    string m_request;
+    HttpParser m_parser;
+
+    string m_response;
+    size_t m_sent = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+// 输出一个只有一个值的指标
+void WriteMetric(ostream &os, const char *name, const char *type,
+                 const char *help, unsigned long long value) {
+    os << "# HELP " << name << ' ' << help << '\n'
+       << "# TYPE " << name << ' ' << type << '\n'
+       << name << ' ' << value << '\n';
+}
+
+// 输出一个直方图，以秒为单位
+// 
+// 内部的对数分桶太细，按固定的边界重新汇总。内部的桶跨过边界时算在
+// 较大的一侧，所以各个边界上的计数略为偏小。
+void WriteHistogram(ostream &os, const char *name, const char *help,
+                    const Metrics::Histogram &h) {
+    static const unsigned long long kBounds[] = { // 微秒
+        100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+        100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000,
+    };
+
+    os << "# HELP " << name << ' ' << help << '\n'
+       << "# TYPE " << name << " histogram\n";
+
+    size_t bucket = 0;
+    unsigned long long cumulative = 0;
+    char le[32];
+
+    for (auto bound : kBounds) {
+        while (bucket < Metrics::Histogram::kBucketCount &&
+               Metrics::Histogram::UpperBound(bucket) <= bound) {
+            cumulative += h.counts[bucket++];
+        }
+
+        snprintf(le, sizeof(le), "%g", bound / 1e6);
+        os << name << "_bucket{le=\"" << le << "\"} " << cumulative << '\n';
+    }
+
+    char sum[32];
+    snprintf(sum, sizeof(sum), "%.6f", h.sum / 1e6);
+
+    os << name << "_bucket{le=\"+Inf\"} " << h.count << '\n'
+       << name << "_sum " << sum << '\n'
+       << name << "_count " << h.count << '\n';
+}
+
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+
+AdminServer::AdminServer(EventLoop &loop, SOCKET sd)
+    : m_loop(loop), m_sd(sd) {
+
+}
+
+bool AdminServer::Start(const string &addr, int nWorkers) {
+    gs_numWorkers = nWorkers;
+
+    string host("127.0.0.1"), port(addr);
+    auto colon = addr.rfind(':');
+    if (colon != string::npos) {
+        host = addr.substr(0, colon);
+        port = addr.substr(colon + 1);
+    }
+
+    addrinfo hints, *result;
+    ZeroMemory(&hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0) {
+        Logger::LogError(__FUNC__ "Invalid admin address: " + addr);
+        return false;
+    }
+
+    SOCKET sd = socket(result->ai_family, result->ai_socktype,
+                       result->ai_protocol);
+    if (sd == INVALID_SOCKET) {
+        Logger::LogError(WSAGetLastErrorMessage(__FUNC__ "socket() failed"));
+        freeaddrinfo(result);
+
+        return false;
+    }
+
+    int opt = 1;
+    setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, (const char *) &opt, sizeof(opt));
+
+    if (bind(sd, result->ai_addr, (int) result->ai_addrlen) != 0 ||
+        listen(sd, SOMAXCONN) != 0 || !SetNonBlocking(sd)) {
+        Logger::LogError(WSAGetLastErrorMessage(__FUNC__ "Listening failed"));
+        freeaddrinfo(result);
+        closesocket(sd);
+
+        return false;
+    }
+
+    freeaddrinfo(result);
+
+    // 管理端口自有一个事件循环，随进程一直存在
+    auto loop = new EventLoop;
+    if (!loop->IsOk()) {
+        Logger::LogError(__FUNC__ "Creating event loop failed");
+        closesocket(sd);
+
+        return false;
+    }
+
+    auto server = new AdminServer(*loop, sd);
+    if (!loop->Add(sd, EventLoop::EV_READ, server)) {
+        closesocket(sd);
+        delete server;
+        delete loop;
+
+        return false;
+    }
+
+    thread([loop] { loop->Run(); }).detach();
+    return true;
+}
+
+void AdminServer::OnEvents(SOCKET, int) {
+    // 边缘触发：必须一直接受到没有新连接为止
+    while (true) {
+        SOCKET sd = accept(m_sd, nullptr, nullptr);
+        if (sd == INVALID_SOCKET) {
+            if (!WouldBlock()) {
+                Logger::LogError(WSAGetLastErrorMessage(__FUNC__ "accept() failed"));
+            }
+
+            return;
+        }
+
+        auto conn = new AdminConnection(m_loop, sd);
+        if (!conn->Start()) {
+            delete conn;
+        }
+    }
+}
+
+string AdminServer::Render() {
+    auto stat = MyProxy::GetStatistics();
+    auto dns = DNSCache::GetStatistics();
+    auto resolver = Resolver::GetStatistics();
+    auto cache = ResponseCache::GetStatistics();
+    auto disk = DiskCache::GetStatistics();
+
+    ostringstream os;
+
+    WriteMetric(os, "myproxy_workers", "gauge",
+                "Number of worker event loops.", gs_numWorkers);
+    WriteMetric(os, "myproxy_connections", "gauge",
+                "Browser connections currently open.", stat.connections);
+    WriteMetric(os, "myproxy_requests_total", "counter",
+                "Requests received from browsers, including CONNECT.",
+                stat.requests);
+    WriteMetric(os, "myproxy_received_bytes_total", "counter",
+                "Bytes read from browsers.", stat.inBytes);
+    WriteMetric(os, "myproxy_sent_bytes_total", "counter",
+                "Bytes handed to browsers.", stat.outBytes);
+    WriteMetric(os, "myproxy_timeouts_total", "counter",
+                "Browser connections closed by a timeout.", stat.timeouts);
+    WriteMetric(os, "myproxy_rejected_total", "counter",
+                "Browser connections turned away with a 503 under overload.",
+                stat.rejected);
+    WriteMetric(os, "myproxy_accept_queue", "gauge",
+                "Accepted connections waiting to be picked up by a worker.",
+                Admission::Queued());
+
+    WriteMetric(os, "myproxy_upstream_lookups_total", "counter",
+                "Origin server address lookups.", stat.dnsQueries);
+    WriteMetric(os, "myproxy_upstream_cached_connects_total", "counter",
+                "Origin connections made with addresses from the DNS cache.",
+                stat.dnsCacheHit);
+
+    WriteMetric(os, "myproxy_dns_cache_entries", "gauge",
+                "Entries in the DNS cache.", dns.size);
+    WriteMetric(os, "myproxy_dns_cache_hits_total", "counter",
+                "DNS cache hits.", dns.hits);
+    WriteMetric(os, "myproxy_dns_cache_misses_total", "counter",
+                "DNS cache misses, including expired entries.", dns.misses);
+    WriteMetric(os, "myproxy_dns_cache_evictions_total", "counter",
+                "DNS cache entries evicted for lack of room.", dns.evictions);
+    WriteMetric(os, "myproxy_resolver_queries_total", "counter",
+                "DNS queries actually sent.", resolver.queries);
+    WriteMetric(os, "myproxy_resolver_coalesced_total", "counter",
+                "Lookups that joined a query already in flight.",
+                resolver.coalesced);
+
+    WriteMetric(os, "myproxy_cache_entries", "gauge",
+                "Responses in the cache.", cache.size);
+    WriteMetric(os, "myproxy_cache_bytes", "gauge",
+                "Bytes held by the response cache.", cache.bytes);
+    WriteMetric(os, "myproxy_cache_hits_total", "counter",
+                "Requests answered from the response cache.", cache.hits);
+    WriteMetric(os, "myproxy_cache_misses_total", "counter",
+                "Cacheable requests the cache could not answer.", cache.misses);
+    WriteMetric(os, "myproxy_cache_stores_total", "counter",
+                "Responses stored in the cache.", cache.stores);
+    WriteMetric(os, "myproxy_cache_evictions_total", "counter",
+                "Cached responses evicted for lack of room.", cache.evictions);
+    WriteMetric(os, "myproxy_cache_collapsed_total", "counter",
+                "Misses that joined a fetch already in flight.",
+                cache.collapsed);
+    WriteMetric(os, "myproxy_cache_revalidations_total", "counter",
+                "Stale responses revalidated with the origin.",
+                cache.revalidations);
+
+    WriteMetric(os, "myproxy_disk_cache_hits_total", "counter",
+                "Requests answered from the disk cache.", disk.hits);
+    WriteMetric(os, "myproxy_disk_cache_misses_total", "counter",
+                "Disk cache lookups that found nothing usable.", disk.misses);
+    WriteMetric(os, "myproxy_disk_cache_stores_total", "counter",
+                "Responses written to the disk cache.", disk.stores);
+    WriteMetric(os, "myproxy_disk_cache_written_bytes_total", "counter",
+                "Bytes written to the disk cache segments.",
+                disk.bytesWritten);
+
+    WriteMetric(os, "myproxy_pool_idle_connections", "gauge",
+                "Idle keep-alive origin connections in the pool.",
+                ConnectionPool::Size());
+
+    WriteMetric(os, "myproxy_log_dropped_total", "counter",
+                "Log records dropped because a thread's log buffer was full.",
+                Logger::Dropped());
+
+    WriteHistogram(os, "myproxy_connect_seconds",
+                   "Time to connect to origin servers, excluding DNS.",
+                   stat.connectTime);
+    WriteHistogram(os, "myproxy_first_byte_seconds",
+                   "Time from sending a request to the first response byte.",
+                   stat.firstByteTime);
+    WriteHistogram(os, "myproxy_request_seconds",
+                   "Time from complete request headers to the end of the response.",
+                   stat.requestTime);
+
+    return os.str();
+}
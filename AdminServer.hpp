@@ -0,0 +1,33 @@
+#pragma once
+#include "EventLoop.hpp"
+#include "ws-util.h"
+
+#include <string>
+
+/// 管理端口
+/// 
+/// 以 Prometheus 的文本格式提供统计信息（GET /metrics）。运行在单独的
+/// 线程与事件循环中，渲染时只读取各处的计数器，不占用代理的事件循环。
+class AdminServer : public EventLoop::Handler {
+public:
+
+    /// 在 @a addr 上开始提供服务
+    /// 
+    /// @param addr "[主机:]端口"，主机默认为 127.0.0.1
+    /// @param nWorkers 工作线程数，作为指标输出
+    /// @return 监听失败时返回 false
+    static bool Start(const std::string &addr, int nWorkers);
+
+    /// 按 Prometheus 的文本格式输出所有指标
+    static std::string Render();
+
+    /// 接受所有已就绪的连接
+    virtual void OnEvents(SOCKET sd, int events) override;
+
+private:
+
+    AdminServer(EventLoop &loop, SOCKET sd);
+
+    EventLoop &m_loop;
+    SOCKET m_sd;
+};
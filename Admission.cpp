@@ -0,0 +1,150 @@
+#include "Admission.hpp"
+#include "Metrics.hpp"
+#include "Logger.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////
+
+unsigned Admission::MAX_CONNECTIONS = 0;
+unsigned Admission::MAX_PER_CLIENT = 0;
+unsigned Admission::ACCEPT_QUEUE = 1024;
+
+namespace {
+
+// 分片数
+const size_t kShards = 16;
+
+// 一个分片：各个客户端当前的连接数，降为 0 时删除
+struct alignas(64) Shard {
+    mutex m;
+    unordered_map<string, unsigned> counts;
+};
+
+Shard gs_shards[kShards];
+
+Shard &GetShard(const string &client) {
+    return gs_shards[hash<string>()(client) % kShards];
+}
+
+atomic<unsigned> gs_connections(0);
+atomic<unsigned> gs_queued(0);
+
+// 对方的地址（原始字节），取不到时返回空串
+string GetClient(SOCKET sd) {
+    sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+
+    if (getpeername(sd, (sockaddr *) &ss, &len) != 0) {
+        return string();
+    }
+
+    if (ss.ss_family == AF_INET) {
+        auto sin = (const sockaddr_in *) &ss;
+        return string((const char *) &sin->sin_addr, sizeof(sin->sin_addr));
+    }
+
+    if (ss.ss_family == AF_INET6) {
+        auto sin6 = (const sockaddr_in6 *) &ss;
+        return string((const char *) &sin6->sin6_addr, sizeof(sin6->sin6_addr));
+    }
+
+    return string();
+}
+
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+
+Admission::Ticket::~Ticket() {
+    if (m_counted) {
+        gs_connections--;
+    }
+
+    if (!m_client.empty()) {
+        auto &shard = GetShard(m_client);
+        lock_guard<mutex> lock(shard.m);
+
+        auto it(shard.counts.find(m_client));
+        if (it != shard.counts.end() && --it->second == 0) {
+            shard.counts.erase(it);
+        }
+    }
+}
+
+bool Admission::Admit(SOCKET sd, Ticket &ticket) {
+    if (MAX_CONNECTIONS > 0) {
+        if (gs_connections.fetch_add(1) >= MAX_CONNECTIONS) {
+            gs_connections--;
+            return false;
+        }
+
+        ticket.m_counted = true;
+    }
+
+    if (MAX_PER_CLIENT > 0) {
+        auto client = GetClient(sd);
+        if (!client.empty()) {
+            auto &shard = GetShard(client);
+            lock_guard<mutex> lock(shard.m);
+
+            auto &count = shard.counts[client];
+            if (count >= MAX_PER_CLIENT) {
+                return false; // 全局的名额随 ticket 归还
+            }
+
+            count++;
+            ticket.m_client = move(client);
+        }
+    }
+
+    return true;
+}
+
+bool Admission::Enqueue() {
+    if (gs_queued.fetch_add(1) >= ACCEPT_QUEUE && ACCEPT_QUEUE > 0) {
+        gs_queued--;
+        return false;
+    }
+
+    return true;
+}
+
+void Admission::Dequeue() {
+    gs_queued--;
+}
+
+unsigned Admission::Queued() {
+    return gs_queued;
+}
+
+void Admission::Reject(SOCKET sd) {
+    static const char kResponse[] =
+        "HTTP/1.1 503 Service Unavailable\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: 20\r\n"
+        "Retry-After: 1\r\n"
+        "Connection: close\r\n"
+        "\r\n"
+        "Server is too busy.\n";
+
+    Metrics::Add(Metrics::REJECTED);
+
+    // 只读几次，源源不断发来数据的连接也不会拖住调用者
+    char buf[kBufferSize];
+    for (int i = 0; i < 4; i++) {
+        if (recv(sd, buf, sizeof(buf), 0) <= 0) {
+            break;
+        }
+    }
+
+    send(sd, kResponse, (int) strlen(kResponse), MSG_NOSIGNAL);
+
+    if (!ShutdownConnection(sd, false)) {
+        Logger::LogError(__FUNC__ "Connection shutdown failed");
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include "ws-util.h"
+
+#include <string>
+
+/// 准入控制
+/// 
+/// 限制同时处理的浏览器连接数（全局的与每个客户端 IP 的），以及已经接受、
+/// 尚未被工作循环接手的连接数。超出限制的连接立即得到 503 回应并被关闭：
+/// 过载时丢弃新来的连接，而不是让所有的连接一起变慢、内存无限增长。
+/// 
+/// 每个客户端的计数与 DNSCache 一样按地址的哈希值分片，每片各有一把锁。
+/// 两个上限都不设置时不做任何计数。
+class Admission {
+public:
+
+    /// 同时处理的连接数上限，默认 0（不限）
+    static unsigned MAX_CONNECTIONS;
+
+    /// 每个客户端 IP 同时处理的连接数上限，默认 0（不限）
+    static unsigned MAX_PER_CLIENT;
+
+    /// 已经接受、等待交给工作循环的连接数上限，默认 1024，0 表示不限
+    /// 
+    /// 工作循环忙不过来时，新的连接不再排队，直接拒绝。
+    static unsigned ACCEPT_QUEUE;
+
+    /// 准入凭证，销毁时归还名额
+    class Ticket {
+    public:
+        Ticket() = default;
+        ~Ticket();
+
+    private:
+        Ticket(const Ticket &) = delete;
+        Ticket &operator=(const Ticket &) = delete;
+
+        friend class Admission;
+
+        bool m_counted = false; // 占用了全局的名额
+        std::string m_client; // 占用了名额的客户端地址（原始字节）
+    };
+
+    /// 能否接纳 @a sd 上的新连接
+    /// 
+    /// @param ticket 接纳时占用名额，由连接一直持有到结束
+    /// @return 超出上限时返回 false，调用者应当 Reject()
+    static bool Admit(SOCKET sd, Ticket &ticket);
+
+    /// 一个接受到的连接开始等待交给工作循环
+    /// 
+    /// @return 等待的连接已经太多时返回 false，调用者应当 Reject()
+    static bool Enqueue();
+
+    /// 工作循环接手了一个等待中的连接
+    static void Dequeue();
+
+    /// 等待交给工作循环的连接数
+    static unsigned Queued();
+
+    /// 以 503 回应并关闭连接
+    /// 
+    /// 尽力而为：回应只尝试发送一次，不等待。已经到达的请求数据先读走，
+    /// 以免关闭时对方收到 RST 而丢掉回应。
+    static void Reject(SOCKET sd);
+};
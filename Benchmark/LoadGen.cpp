@@ -0,0 +1,585 @@
+//////////////////////////////////////////////////////////////////////////
+// LoadGen.cpp - 端到端的吞吐量与延迟基准
+//
+// 在本机起一个源服务器，经由代理向它发送请求，报告每秒请求数、
+// 吞吐量以及延迟的分位数。代理需要事先运行，例如：
+//
+//     MyProxy 1990 &
+//     LoadGen -c 64 -d 10 -rsp 16384 -keepalive 0.9
+//
+// 选项：
+//   -proxy HOST:PORT  代理的地址（默认 127.0.0.1:1990）
+//   -c N              并发的连接数（默认 32）
+//   -d SECONDS        持续的秒数（默认 10）
+//   -keepalive R      请求之后保持连接的比例，0 ~ 1（默认 1）
+//   -req BYTES        请求数据体的大小，大于 0 时使用 POST（默认 0）
+//   -rsp BYTES        回应数据体的大小（默认 1024）
+//   -chunked BYTES    回应使用分段传输，每段 BYTES 字节（默认不分段）
+//   -connect          经由 CONNECT 隧道发送请求
+//   -max-age SECONDS  回应带上 Cache-Control: max-age，可由代理缓存
+//////////////////////////////////////////////////////////////////////////
+
+#include "../HttpParser.hpp"
+#include "../ChunkedDecoder.hpp"
+#include "../ws-util.h"
+
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+//// Options /////////////////////////////////////////////////////////////
+
+struct Options {
+    string proxyHost = "127.0.0.1";
+    string proxyPort = "1990";
+    int concurrency = 32;
+    int duration = 10;
+    double keepAlive = 1.0;
+    size_t reqSize = 0;
+    size_t rspSize = 1024;
+    size_t chunkSize = 0; // 0 表示使用 Content-Length
+    bool connect = false;
+    int maxAge = 0; // 0 表示回应不可缓存
+};
+
+static Options gs_opt;
+
+// 源服务器的端口
+static unsigned short gs_originPort;
+
+// 源服务器处理的请求数，与客户端的请求数相比可以看出缓存的效果
+static atomic<unsigned long long> gs_originRequests(0);
+
+static bool ParseOptions(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (strcmp(arg, "-connect") == 0) {
+            gs_opt.connect = true;
+        }
+        else if (!hasValue) {
+            return false;
+        }
+        else if (strcmp(arg, "-proxy") == 0) {
+            string addr = argv[++i];
+            auto colon = addr.rfind(':');
+            if (colon == string::npos) {
+                return false;
+            }
+
+            gs_opt.proxyHost = addr.substr(0, colon);
+            gs_opt.proxyPort = addr.substr(colon + 1);
+        }
+        else if (strcmp(arg, "-c") == 0) {
+            gs_opt.concurrency = max(atoi(argv[++i]), 1);
+        }
+        else if (strcmp(arg, "-d") == 0) {
+            gs_opt.duration = max(atoi(argv[++i]), 1);
+        }
+        else if (strcmp(arg, "-keepalive") == 0) {
+            gs_opt.keepAlive = atof(argv[++i]);
+        }
+        else if (strcmp(arg, "-req") == 0) {
+            gs_opt.reqSize = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(arg, "-rsp") == 0) {
+            gs_opt.rspSize = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(arg, "-chunked") == 0) {
+            gs_opt.chunkSize = max(strtoul(argv[++i], nullptr, 10), 1UL);
+        }
+        else if (strcmp(arg, "-max-age") == 0) {
+            gs_opt.maxAge = max(atoi(argv[++i]), 0);
+        }
+        else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//// Stream //////////////////////////////////////////////////////////////
+
+// 阻塞 SOCKET 上带缓冲的读取
+class Stream {
+public:
+
+    explicit Stream(SOCKET sd) : m_sd(sd), m_buf(kCapacity) {}
+
+    // 读取一个完整的头部，数据体从缓冲区中接着读
+    bool ReadHeaders(HttpParser &parser) {
+        // 把未读的数据挪到开头，解析器要求头部从缓冲区的开头开始
+        if (m_begin > 0) {
+            memmove(m_buf.data(), m_buf.data() + m_begin, m_end - m_begin);
+            m_end -= m_begin;
+            m_begin = 0;
+        }
+
+        parser.Reset();
+
+        while (true) {
+            auto pr = parser.Parse(m_buf.data(), m_end);
+            if (pr == HttpParser::PARSE_DONE) {
+                m_begin = parser.HeaderSize();
+                return true;
+            }
+            else if (pr == HttpParser::PARSE_ERROR || m_end == kCapacity) {
+                return false;
+            }
+
+            if (!Fill()) {
+                return false;
+            }
+        }
+    }
+
+    // 跳过 @a n 个字节的数据体
+    bool Skip(long long n) {
+        while (n > 0) {
+            if (m_begin == m_end && !Fill()) {
+                return false;
+            }
+
+            auto len = (size_t) min((long long) (m_end - m_begin), n);
+            m_begin += len;
+            n -= len;
+        }
+
+        return true;
+    }
+
+    // 跳过分段传输的数据体
+    bool SkipChunked(long long &bytes) {
+        ChunkedDecoder decoder;
+
+        while (true) {
+            if (m_begin == m_end && !Fill()) {
+                return false;
+            }
+
+            size_t consumed;
+            auto dr = decoder.Feed(m_buf.data() + m_begin, m_end - m_begin,
+                                   consumed);
+            m_begin += consumed;
+            bytes += consumed;
+
+            if (dr == ChunkedDecoder::DECODE_DONE) {
+                return true;
+            }
+            else if (dr == ChunkedDecoder::DECODE_ERROR) {
+                return false;
+            }
+        }
+    }
+
+private:
+
+    static const size_t kCapacity = 64 * 1024;
+
+    bool Fill() {
+        if (m_begin == m_end) {
+            m_begin = m_end = 0;
+        }
+
+        int n = recv(m_sd, m_buf.data() + m_end, (int) (kCapacity - m_end), 0);
+        if (n <= 0) {
+            return false;
+        }
+
+        m_end += n;
+        return true;
+    }
+
+    SOCKET m_sd;
+    vector<char> m_buf;
+    size_t m_begin = 0, m_end = 0;
+};
+
+static bool SendAll(SOCKET sd, const char *buf, size_t len) {
+    while (len > 0) {
+        int n = send(sd, buf, (int) len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+
+        buf += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+static void SetTimeouts(SOCKET sd) {
+#ifdef _WIN32
+    DWORD tv = 10000;
+#else
+    timeval tv;
+    tv.tv_sec = 10;
+    tv.tv_usec = 0;
+#endif
+
+    setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, (const char *) &tv, sizeof(tv));
+    setsockopt(sd, SOL_SOCKET, SO_SNDTIMEO, (const char *) &tv, sizeof(tv));
+
+    int opt = 1;
+    setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, (const char *) &opt, sizeof(opt));
+}
+
+// 一段填充用的数据
+static const string &Filler() {
+    static const string filler(64 * 1024, 'x');
+    return filler;
+}
+
+//// Origin //////////////////////////////////////////////////////////////
+
+// 请求目标的格式："/大小" 或 "/大小c每段的大小"
+static void ParseTarget(StrView target, size_t &size, size_t &chunk) {
+    string s = target.ToString();
+    char *end;
+
+    size = strtoul(s.c_str() + 1, &end, 10);
+    chunk = (*end == 'c') ? strtoul(end + 1, nullptr, 10) : 0;
+}
+
+static void BuildResponse(size_t size, size_t chunk, string &rsp) {
+    rsp = "HTTP/1.1 200 OK\r\n";
+
+    if (gs_opt.maxAge > 0) {
+        rsp += "Cache-Control: max-age=" + to_string(gs_opt.maxAge) + "\r\n";
+    }
+
+    if (chunk == 0) {
+        rsp += "Content-Length: " + to_string(size) + "\r\n\r\n";
+        for (size_t n = 0; n < size; n += Filler().size()) {
+            rsp.append(Filler(), 0, min(Filler().size(), size - n));
+        }
+
+        return;
+    }
+
+    rsp += "Transfer-Encoding: chunked\r\n\r\n";
+
+    char line[32];
+    for (size_t n = 0; n < size; n += chunk) {
+        size_t len = min(chunk, size - n);
+        snprintf(line, sizeof(line), "%zx\r\n", len);
+
+        rsp += line;
+        for (size_t m = 0; m < len; m += Filler().size()) {
+            rsp.append(Filler(), 0, min(Filler().size(), len - m));
+        }
+
+        rsp += "\r\n";
+    }
+
+    rsp += "0\r\n\r\n";
+}
+
+static void ServeConnection(SOCKET sd) {
+    SetTimeouts(sd);
+
+    Stream stream(sd);
+    HttpParser req(HttpParser::REQUEST);
+
+    // 同一连接上的请求一般都相同，回应缓存起来
+    string rsp, lastTarget;
+
+    while (stream.ReadHeaders(req)) {
+        if (!stream.Skip(max(req.contentLength, 0LL))) {
+            break;
+        }
+
+        string target = req.Target().ToString();
+        if (target != lastTarget) {
+            size_t size, chunk;
+            ParseTarget(req.Target(), size, chunk);
+            BuildResponse(size, chunk, rsp);
+
+            lastTarget = target;
+        }
+
+        gs_originRequests++;
+
+        if (!SendAll(sd, rsp.data(), rsp.size()) || !req.KeepAlive()) {
+            break;
+        }
+    }
+
+    ShutdownConnection(sd, false);
+}
+
+static bool StartOrigin() {
+    SOCKET sd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sd == INVALID_SOCKET) {
+        return false;
+    }
+
+    sockaddr_in addr;
+    ZeroMemory(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    socklen_t len = sizeof(addr);
+    if (bind(sd, (sockaddr *) &addr, len) != 0 || listen(sd, SOMAXCONN) != 0 ||
+        getsockname(sd, (sockaddr *) &addr, &len) != 0) {
+        closesocket(sd);
+        return false;
+    }
+
+    gs_originPort = ntohs(addr.sin_port);
+
+    thread([sd]() {
+        while (true) {
+            SOCKET conn = accept(sd, nullptr, nullptr);
+            if (conn != INVALID_SOCKET) {
+                thread(ServeConnection, conn).detach();
+            }
+        }
+    }).detach();
+
+    return true;
+}
+
+//// Client //////////////////////////////////////////////////////////////
+
+struct ClientResult {
+    size_t requests = 0;
+    size_t errors = 0;
+    long long bytes = 0; // 请求与回应的数据体
+    vector<unsigned> latencies; // 微秒
+};
+
+static SOCKET ConnectProxy() {
+    addrinfo hints, *result;
+    ZeroMemory(&hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(gs_opt.proxyHost.c_str(), gs_opt.proxyPort.c_str(),
+                    &hints, &result) != 0) {
+        return INVALID_SOCKET;
+    }
+
+    SOCKET sd = socket(result->ai_family, result->ai_socktype,
+                       result->ai_protocol);
+    if (sd != INVALID_SOCKET) {
+        if (connect(sd, result->ai_addr, (int) result->ai_addrlen) != 0) {
+            closesocket(sd);
+            sd = INVALID_SOCKET;
+        }
+        else {
+            SetTimeouts(sd);
+        }
+    }
+
+    freeaddrinfo(result);
+    return sd;
+}
+
+// 建立隧道
+static bool OpenTunnel(SOCKET sd, Stream &stream, HttpParser &rsp) {
+    string origin = "127.0.0.1:" + to_string(gs_originPort);
+    string req = "CONNECT " + origin + " HTTP/1.1\r\nHost: " + origin + "\r\n\r\n";
+
+    // CONNECT 的回应没有数据体
+    return SendAll(sd, req.data(), req.size()) && stream.ReadHeaders(rsp) &&
+           rsp.status_code == 200;
+}
+
+static void RunClient(unsigned seed, const atomic_bool &stop,
+                      ClientResult &result) {
+    mt19937 rng(seed);
+    uniform_real_distribution<double> dist(0.0, 1.0);
+
+    string target = "/" + to_string(gs_opt.rspSize);
+    if (gs_opt.chunkSize > 0) {
+        target += "c" + to_string(gs_opt.chunkSize);
+    }
+
+    if (!gs_opt.connect) {
+        target = "http://127.0.0.1:" + to_string(gs_originPort) + target;
+    }
+
+    string head = (gs_opt.reqSize > 0 ? "POST " : "GET ") + target +
+                  " HTTP/1.1\r\nHost: 127.0.0.1:" + to_string(gs_originPort) +
+                  "\r\nUser-Agent: LoadGen\r\n";
+    if (gs_opt.reqSize > 0) {
+        head += "Content-Length: " + to_string(gs_opt.reqSize) + "\r\n";
+    }
+
+    string reqKeepAlive = head + "\r\n";
+    string reqClose = head + "Connection: close\r\n\r\n";
+
+    HttpParser rsp(HttpParser::RESPONSE);
+    SOCKET sd = INVALID_SOCKET;
+    unique_ptr<Stream> stream;
+
+    while (!stop) {
+        auto start = Clock::now();
+        bool ok = true;
+
+        if (sd == INVALID_SOCKET) {
+            sd = ConnectProxy();
+            if (sd == INVALID_SOCKET) {
+                result.errors++;
+                this_thread::sleep_for(chrono::milliseconds(10));
+
+                continue;
+            }
+
+            stream.reset(new Stream(sd));
+            if (gs_opt.connect) {
+                ok = OpenTunnel(sd, *stream, rsp);
+            }
+        }
+
+        bool closing = dist(rng) >= gs_opt.keepAlive;
+        const string &req = closing ? reqClose : reqKeepAlive;
+
+        ok = ok && SendAll(sd, req.data(), req.size());
+        for (size_t n = 0; ok && n < gs_opt.reqSize; n += Filler().size()) {
+            ok = SendAll(sd, Filler().data(),
+                         min(Filler().size(), gs_opt.reqSize - n));
+        }
+
+        ok = ok && stream->ReadHeaders(rsp) && rsp.status_code == 200;
+        if (ok) {
+            long long bytes = 0;
+            if (rsp.IsChunked()) {
+                ok = stream->SkipChunked(bytes);
+            }
+            else {
+                bytes = max(rsp.contentLength, 0LL);
+                ok = stream->Skip(bytes);
+            }
+
+            result.bytes += bytes + gs_opt.reqSize;
+        }
+
+        if (ok) {
+            auto us = chrono::duration_cast<chrono::microseconds>
+                (Clock::now() - start);
+
+            result.requests++;
+            result.latencies.push_back((unsigned) us.count());
+        }
+        else if (!stop) {
+            result.errors++;
+        }
+
+        if (!ok || closing || !rsp.KeepAlive()) {
+            closesocket(sd);
+            sd = INVALID_SOCKET;
+        }
+    }
+
+    if (sd != INVALID_SOCKET) {
+        closesocket(sd);
+    }
+}
+
+//// main ////////////////////////////////////////////////////////////////
+
+static unsigned Percentile(const vector<unsigned> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+
+    auto i = (size_t) (p * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+int main(int argc, char *argv[]) {
+    if (!ParseOptions(argc, argv)) {
+        fprintf(stderr, "usage: LoadGen [-proxy HOST:PORT] [-c N] [-d SECONDS] "
+                        "[-keepalive R] [-req BYTES] [-rsp BYTES] "
+                        "[-chunked BYTES] [-connect] [-max-age SECONDS]\n");
+        return 1;
+    }
+
+#ifdef _WIN32
+    WSAData wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        return 255;
+    }
+#else
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    if (!StartOrigin()) {
+        fprintf(stderr, "%s\n", WSAGetLastErrorMessage("Cannot start origin").c_str());
+        return 1;
+    }
+
+    printf("Proxy %s:%s, origin 127.0.0.1:%u, %d connections, %d s\n",
+           gs_opt.proxyHost.c_str(), gs_opt.proxyPort.c_str(), gs_originPort,
+           gs_opt.concurrency, gs_opt.duration);
+    printf("%s, request body %zu B, response body %zu B (%s), keep-alive %.2f\n\n",
+           gs_opt.connect ? "CONNECT tunnel" : "plain HTTP",
+           gs_opt.reqSize, gs_opt.rspSize,
+           gs_opt.chunkSize ? "chunked" : "Content-Length", gs_opt.keepAlive);
+
+    atomic_bool stop(false);
+    vector<ClientResult> results(gs_opt.concurrency);
+    vector<thread> clients;
+
+    auto start = Clock::now();
+    for (int i = 0; i < gs_opt.concurrency; i++) {
+        clients.emplace_back(RunClient, (unsigned) i + 1, cref(stop),
+                             ref(results[i]));
+    }
+
+    this_thread::sleep_for(chrono::seconds(gs_opt.duration));
+    stop = true;
+
+    for (auto &t : clients) {
+        t.join();
+    }
+
+    chrono::duration<double> elapsed = Clock::now() - start;
+
+    ClientResult total;
+    for (auto &r : results) {
+        total.requests += r.requests;
+        total.errors += r.errors;
+        total.bytes += r.bytes;
+        total.latencies.insert(total.latencies.end(), r.latencies.begin(),
+                               r.latencies.end());
+    }
+
+    sort(total.latencies.begin(), total.latencies.end());
+
+    double secs = elapsed.count();
+    printf("Requests:   %zu (%zu errors)\n", total.requests, total.errors);
+    printf("Throughput: %.1f req/s, %.2f MB/s\n", total.requests / secs,
+           total.bytes / secs / 1e6);
+    printf("Latency:    p50 %u us, p99 %u us, p999 %u us, max %u us\n",
+           Percentile(total.latencies, 0.5), Percentile(total.latencies, 0.99),
+           Percentile(total.latencies, 0.999),
+           total.latencies.empty() ? 0 : total.latencies.back());
+    printf("Origin:     %llu requests\n", gs_originRequests.load());
+
+#ifdef _WIN32
+    WSACleanup();
+#endif
+
+    return total.requests > 0 ? 0 : 1;
+}
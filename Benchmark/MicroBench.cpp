@@ -0,0 +1,828 @@
+//////////////////////////////////////////////////////////////////////////
+// MicroBench.cpp - 热点例程的微基准
+//
+// 用法：MicroBench [过滤字符串]
+// 只运行名字中包含过滤字符串的基准。
+//
+// 每项报告每次操作的耗时、堆分配次数，以及（如适用）吞吐量。
+// 多线程的基准按 1, 2, 4... 个线程分别运行，报告总的吞吐量。
+//////////////////////////////////////////////////////////////////////////
+
+#include "../HttpParser.hpp"
+#include "../Scanner.hpp"
+#include "../ChunkedDecoder.hpp"
+#include "../RequestRewriter.hpp"
+#include "../DNSCache.hpp"
+#include "../TimerWheel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+//// Allocation counter //////////////////////////////////////////////////
+
+// 当前线程调用 operator new 的次数
+static thread_local size_t t_allocs;
+
+void *operator new(size_t size) {
+    t_allocs++;
+
+    if (void *p = malloc(size ? size : 1)) {
+        return p;
+    }
+
+    throw bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+//// Harness /////////////////////////////////////////////////////////////
+
+static const char *gs_filter = "";
+
+// 防止编译器把被测代码优化掉
+static volatile size_t gs_sink;
+
+// 反复运行 @a fn 至少 200 毫秒，报告每次的耗时与吞吐量
+//
+// @param bytes 每次处理的字节数，为 0 时不报告吞吐量
+static void Run(const string &name, size_t bytes, const function<size_t()> &fn) {
+    if (!strstr(name.c_str(), gs_filter)) {
+        return;
+    }
+
+    // 预热
+    for (int i = 0; i < 100; i++) {
+        gs_sink += fn();
+    }
+
+    size_t iterations = 0;
+    size_t batch = 64;
+    size_t allocs = t_allocs;
+    auto start = Clock::now();
+    chrono::duration<double> elapsed;
+
+    do {
+        for (size_t i = 0; i < batch; i++) {
+            gs_sink += fn();
+        }
+
+        iterations += batch;
+        batch *= 2;
+        elapsed = Clock::now() - start;
+    } while (elapsed.count() < 0.2);
+
+    double ns = elapsed.count() * 1e9 / iterations;
+    double allocsPerOp = (double) (t_allocs - allocs) / iterations;
+
+    if (bytes > 0) {
+        printf("%-52s %10.1f ns/op %7.2f allocs/op %10.1f MB/s\n",
+               name.c_str(), ns, allocsPerOp, bytes / ns * 1e3);
+    }
+    else {
+        printf("%-52s %10.1f ns/op %7.2f allocs/op\n",
+               name.c_str(), ns, allocsPerOp);
+    }
+}
+
+// 分别用 1, 2, 4... 个线程同时运行 @a fn 200 毫秒
+//
+// @a fn 的参数是线程的序号。报告每个线程每次操作的耗时与总的吞吐量。
+static void RunThreads(const string &name,
+                       const function<size_t(unsigned)> &fn) {
+    if (!strstr(name.c_str(), gs_filter)) {
+        return;
+    }
+
+    unsigned maxThreads = max(thread::hardware_concurrency(), 2U);
+
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+        atomic_uint ready(0);
+        atomic_bool go(false), stop(false);
+        vector<size_t> ops(threads), allocs(threads);
+        vector<thread> workers;
+
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                // 预热
+                for (int i = 0; i < 100; i++) {
+                    gs_sink += fn(t);
+                }
+
+                ready++;
+                while (!go) {
+                    this_thread::yield();
+                }
+
+                size_t n = 0, before = t_allocs;
+                while (!stop) {
+                    for (int i = 0; i < 64; i++) {
+                        gs_sink += fn(t);
+                    }
+
+                    n += 64;
+                }
+
+                ops[t] = n;
+                allocs[t] = t_allocs - before;
+            });
+        }
+
+        while (ready < threads) {
+            this_thread::yield();
+        }
+
+        auto start = Clock::now();
+        go = true;
+        this_thread::sleep_for(chrono::milliseconds(200));
+        stop = true;
+
+        for (auto &w : workers) {
+            w.join();
+        }
+
+        chrono::duration<double> elapsed = Clock::now() - start;
+
+        size_t totalOps = 0, totalAllocs = 0;
+        for (unsigned t = 0; t < threads; t++) {
+            totalOps += ops[t];
+            totalAllocs += allocs[t];
+        }
+
+        double ns = elapsed.count() * 1e9 * threads / totalOps;
+        char label[128];
+        snprintf(label, sizeof(label), "%s [%u threads]", name.c_str(), threads);
+
+        printf("%-52s %10.1f ns/op %7.2f allocs/op %10.2f Mops/s\n", label,
+               ns, (double) totalAllocs / totalOps,
+               totalOps / elapsed.count() / 1e6);
+    }
+}
+
+// 依次在每一级扫描内核下运行
+static void RunAllLevels(const string &name, size_t bytes,
+                         const function<size_t()> &fn) {
+    auto best = Scanner::GetBestLevel();
+
+    for (int level = Scanner::SCALAR; level <= best; level++) {
+        Scanner::SetLevel((Scanner::Level) level);
+        Run(name + " [" + Scanner::GetLevelName((Scanner::Level) level) + "]",
+            bytes, fn);
+    }
+
+    Scanner::SetLevel(best);
+}
+
+//// Corpora /////////////////////////////////////////////////////////////
+
+// 命令行工具发出的小请求
+static const char *kCurlRequest =
+    "GET http://example.com/ HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "User-Agent: curl/7.88.1\r\n"
+    "Accept: */*\r\n"
+    "Proxy-Connection: Keep-Alive\r\n"
+    "\r\n";
+
+// 浏览器发出的典型请求，带有较长的 Cookie
+static const char *kBrowserRequest =
+    "GET http://www.example.com/assets/js/app.min.js?v=20240131 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Proxy-Connection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/121.0.0.0 Safari/537.36\r\n"
+    "Accept: */*\r\n"
+    "Referer: http://www.example.com/products/list?page=3&sort=price\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Cookie: _ga=GA1.2.1234567890.1700000000; _gid=GA1.2.987654321.1706000000; "
+    "session=eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9.eyJ1aWQiOjEyMzQ1Njc4OTAsImV4"
+    "cCI6MTcwNjcwMDAwMH0.dGhpcyBpcyBub3QgYSByZWFsIHNpZ25hdHVyZQ; lang=zh-CN; "
+    "theme=dark; cart=3f2a9c1e-77b4-4c1d-9e0a-5b8d6f4e2a10\r\n"
+    "If-None-Match: W/\"5e1f-18d5a3c2b40\"\r\n"
+    "If-Modified-Since: Wed, 31 Jan 2024 08:00:00 GMT\r\n"
+    "\r\n";
+
+// 服务器的回应头部
+static const char *kResponse =
+    "HTTP/1.1 200 OK\r\n"
+    "Date: Thu, 01 Feb 2024 12:00:00 GMT\r\n"
+    "Content-Type: text/html; charset=utf-8\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: private, max-age=0, must-revalidate\r\n"
+    "Content-Security-Policy: default-src 'self'; script-src 'self' "
+    "'unsafe-inline' https://cdn.example.com https://www.google-analytics.com; "
+    "img-src 'self' data: https:; style-src 'self' 'unsafe-inline'\r\n"
+    "Set-Cookie: session=abcdef0123456789abcdef0123456789; Path=/; HttpOnly; "
+    "SameSite=Lax\r\n"
+    "Set-Cookie: csrftoken=0123456789abcdef0123456789abcdef; Path=/; "
+    "Max-Age=31449600\r\n"
+    "Strict-Transport-Security: max-age=31536000; includeSubDomains\r\n"
+    "X-Content-Type-Options: nosniff\r\n"
+    "X-Frame-Options: SAMEORIGIN\r\n"
+    "Vary: Accept-Encoding, Cookie\r\n"
+    "Server: nginx/1.24.0\r\n"
+    "\r\n";
+
+// 字段很多的请求：在浏览器请求的末尾追加 64 个自定义字段
+static string LargeRequest() {
+    string req(kBrowserRequest, strlen(kBrowserRequest) - 2);
+
+    char line[128];
+    for (int i = 0; i < 64; i++) {
+        snprintf(line, sizeof(line), "X-Trace-Context-%02d: "
+                 "00-4bf92f3577b34da6a3ce929d0e0e%04d-00f067aa0ba902b7-01\r\n",
+                 i, i * 37);
+        req += line;
+    }
+
+    return req + "\r\n";
+}
+
+// 许多很小的分段，例如逐条推送的流式回应
+static string TinyChunks() {
+    mt19937 rng(1);
+    string body;
+    char line[16];
+
+    for (int i = 0; i < 4096; i++) {
+        size_t len = 1 + rng() % 16;
+        snprintf(line, sizeof(line), "%zx\r\n", len);
+
+        body += line;
+        body.append(len, 'x');
+        body += "\r\n";
+    }
+
+    return body + "0\r\n\r\n";
+}
+
+// 长尾的域名集合，访问时按 Zipf 分布挑选：少数域名占了大部分访问
+static const size_t kHostCount = 20000;
+
+static vector<string> Hostnames() {
+    static const char *kLabels[] = {
+        "www", "cdn", "img", "api", "static", "s", "assets-edge",
+        "tracking-pixel", "m", "video-delivery-eu-west",
+    };
+
+    const size_t kLabelCount = sizeof(kLabels) / sizeof(kLabels[0]);
+
+    vector<string> hosts;
+    char name[128];
+
+    for (size_t i = 0; i < kHostCount; i++) {
+        snprintf(name, sizeof(name), "%s.site%zu.example.com",
+                 kLabels[i % kLabelCount], i / kLabelCount);
+        hosts.push_back(name);
+    }
+
+    return hosts;
+}
+
+//// Legacy routines /////////////////////////////////////////////////////
+
+// 原先的 MyProxy::Headers::Parse()，作为对照
+static bool LegacyParse(const char *buf, map<string, string> &m) {
+    m.clear();
+
+    const char *p = strstr(buf, "\r\n\r\n");
+    if (p) {
+        const char *b = strstr(buf, "\r\n") + 2;
+
+        while (*b != '\r') {
+            const char *e = strstr(b, "\r\n");
+            const char *colon = strstr(b, ": ");
+            if (!colon || colon > e) {
+                colon = strchr(b, ':');
+            }
+
+            if (colon && colon + 2 < e) {
+                string k(b, colon), v(colon + 2, e);
+                m.emplace(make_pair(k, v));
+            }
+
+            b = e + 2;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+// 逐行查找 LF 与冒号的原始做法
+static size_t LegacyScanLines(const char *buf, size_t len) {
+    size_t n = 0;
+    const char *end = buf + len;
+
+    for (const char *b = buf; b < end;) {
+        auto lf = (const char *) memchr(b, '\n', end - b);
+        if (!lf) {
+            break;
+        }
+
+        auto colon = (const char *) memchr(b, ':', lf - b);
+        n += colon ? colon - b : 0;
+        b = lf + 1;
+    }
+
+    return n;
+}
+
+// 原先用来比较字段名的做法
+static string ToLower(const string &s) {
+    string ret(s);
+
+    for (auto &ch : ret) {
+        ch = tolower(ch);
+    }
+
+    return ret;
+}
+
+// 原先的 SendBrowserHeaders()：改动解析出来的 map，再拼出整个头部
+static string LegacyRewrite(const char *buf, map<string, string> &m) {
+    ostringstream ss;
+
+    string first_line(buf, strstr(buf, "\r\n"));
+    string needle(" http://" + m["Host"]);
+
+    auto pos = first_line.find(needle);
+    if (pos != string::npos) {
+        first_line.replace(pos, needle.length(), " ", 1);
+    }
+
+    ss << first_line << "\r\n";
+
+    auto it(m.find("Proxy-Connection"));
+    if (it != m.end()) {
+        auto conn = it->second;
+        m.erase(it);
+
+        if (m.find("Connection") == m.end()) {
+            m.emplace("Connection", conn);
+        }
+    }
+
+    for (auto header : m) {
+        ss << header.first << ": " << header.second << "\r\n";
+    }
+
+    ss << "\r\n";
+    return ss.str();
+}
+
+// 原先的 CountChunkRest() 在整个数据体都已收到时的走法
+static size_t LegacyCountChunks(const char *buf) {
+    size_t n = 0;
+    const char *p = buf;
+
+    while (true) {
+        char *endptr;
+        long nChunk = strtol(p, &endptr, 16);
+        if (nChunk == 0) {
+            break;
+        }
+
+        endptr = strstr(endptr, "\r\n");
+        if (!endptr) {
+            break;
+        }
+
+        p = endptr + 2 + nChunk + 2;
+        n++;
+    }
+
+    return n;
+}
+
+//// Benchmarks //////////////////////////////////////////////////////////
+
+static void BenchHeaders(const char *label, const char *corpus,
+                         HttpParser::Type type) {
+    size_t len = strlen(corpus);
+
+    // 解析器会就地修改 obs-fold，用一份副本
+    vector<char> buf(corpus, corpus + len + 1);
+
+    map<string, string> m;
+    Run(string("parse/") + label + " [legacy strstr+map]", len, [&]() {
+        LegacyParse(buf.data(), m);
+        return m.size();
+    });
+
+    HttpParser parser(type);
+    RunAllLevels(string("parse/") + label, len, [&]() {
+        parser.Reset();
+        parser.Parse(buf.data(), len);
+        return parser.FieldCount();
+    });
+
+    // 一次一个字节地到达，检验解析是否是线性的
+    RunAllLevels(string("parse/") + label + " bytewise", len, [&]() {
+        parser.Reset();
+        for (size_t i = 1; i <= len; i++) {
+            parser.Parse(buf.data(), i);
+        }
+
+        return parser.FieldCount();
+    });
+}
+
+static void BenchLineScan() {
+    // 把各种头部拼在一起，模拟较大的输入
+    string corpus;
+    while (corpus.size() < 16 * 1024) {
+        corpus += kBrowserRequest;
+        corpus += kResponse;
+    }
+
+    const char *buf = corpus.data();
+    size_t len = corpus.size();
+
+    Run("scan/lines [memchr x2]", len, [&]() {
+        return LegacyScanLines(buf, len);
+    });
+
+    RunAllLevels("scan/lines", len, [&]() {
+        size_t n = 0;
+        const char *end = buf + len;
+
+        for (const char *b = buf; b < end;) {
+            const char *colon;
+            auto lf = Scanner::FindLineEnd(b, end - b, &colon);
+            if (!lf) {
+                break;
+            }
+
+            n += colon ? colon - b : 0;
+            b = lf + 1;
+        }
+
+        return n;
+    });
+}
+
+static void BenchChunkSize() {
+    static const char *kSizes[] = {
+        "0\r\n", "1a\r\n", "400\r\n", "1F40\r\n", "ffff\r\n",
+        "10000;ext=1\r\n", "7fffffff\r\n", "2000\r\n",
+    };
+
+    const size_t kCount = sizeof(kSizes) / sizeof(kSizes[0]);
+
+    // 分段大小之后紧跟着数据，不会只剩几个字节
+    vector<string> lines;
+    for (auto s : kSizes) {
+        lines.push_back(string(s) + string(32, 'x'));
+    }
+
+    Run("chunk-size [strtol]", 0, [&]() {
+        size_t sum = 0;
+        for (auto &line : lines) {
+            sum += strtol(line.c_str(), nullptr, 16);
+        }
+
+        return sum / kCount;
+    });
+
+    RunAllLevels("chunk-size", 0, [&]() {
+        size_t sum = 0;
+        for (auto &line : lines) {
+            unsigned long long value;
+            Scanner::ParseHex(line.data(), line.size(), value);
+            sum += (size_t) value;
+        }
+
+        return sum / kCount;
+    });
+}
+
+static void BenchChunkedBody() {
+    auto body = TinyChunks();
+    const char *buf = body.c_str();
+    size_t len = body.size();
+
+    Run("chunked/tiny chunks [legacy strtol+strstr]", len, [&]() {
+        return LegacyCountChunks(buf);
+    });
+
+    ChunkedDecoder decoder;
+
+    // 一次送入整个数据体
+    RunAllLevels("chunked/tiny chunks", len, [&]() {
+        decoder.Reset();
+
+        size_t pos = 0;
+        while (pos < len) {
+            size_t consumed;
+            auto dr = decoder.Feed(buf + pos, len - pos, consumed);
+            pos += consumed;
+
+            if (dr != ChunkedDecoder::DECODE_AGAIN) {
+                break;
+            }
+        }
+
+        return pos;
+    });
+
+    // 按一个 TCP 报文段的大小分批送入
+    const size_t kSegment = 1460;
+    RunAllLevels("chunked/tiny chunks per segment", len, [&]() {
+        decoder.Reset();
+
+        size_t pos = 0;
+        for (size_t seg = 0; seg < len; seg += kSegment) {
+            size_t segEnd = min(seg + kSegment, len);
+
+            while (pos < segEnd) {
+                size_t consumed;
+                auto dr = decoder.Feed(buf + pos, segEnd - pos, consumed);
+                pos += consumed;
+
+                if (dr != ChunkedDecoder::DECODE_AGAIN) {
+                    return pos;
+                }
+            }
+        }
+
+        return pos;
+    });
+}
+
+static void BenchRewrite(const char *label, const char *corpus) {
+    size_t len = strlen(corpus);
+    vector<char> buf(corpus, corpus + len + 1);
+
+    // 原先的做法会改动 map，每次都要重新解析
+    map<string, string> m;
+    Run(string("rewrite/") + label + " [legacy map+ostringstream]", len, [&]() {
+        LegacyParse(buf.data(), m);
+        return LegacyRewrite(buf.data(), m).size();
+    });
+
+    HttpParser parser(HttpParser::REQUEST);
+    IoSlice slices[kMaxIoSlices];
+
+    Run(string("rewrite/") + label + " [parse+slices]", len, [&]() {
+        parser.Reset();
+        parser.Parse(buf.data(), len);
+        return RequestRewriter::ToOrigin(parser, buf.data() + parser.HeaderSize(),
+                                         buf.data() + len, slices);
+    });
+
+    Run(string("rewrite/") + label + " [slices only]", len, [&]() {
+        return RequestRewriter::ToOrigin(parser, buf.data() + parser.HeaderSize(),
+                                         buf.data() + len, slices);
+    });
+}
+
+// 在每个字段名中查找代理关心的几个字段
+static void BenchFieldCompare(const char *corpus) {
+    static const char *kNames[] = {
+        "Connection", "Proxy-Connection", "Transfer-Encoding",
+    };
+
+    size_t len = strlen(corpus);
+    vector<char> buf(corpus, corpus + len + 1);
+
+    HttpParser parser(HttpParser::REQUEST);
+    parser.Parse(buf.data(), len);
+
+    Run("compare/field names [ToLower]", 0, [&]() {
+        size_t n = 0;
+        for (size_t i = 0; i < parser.FieldCount(); i++) {
+            auto name = ToLower(parser.FieldName(i).ToString());
+            for (auto s : kNames) {
+                n += name == ToLower(s);
+            }
+        }
+
+        return n;
+    });
+
+    Run("compare/field names [EqualsNoCase]", 0, [&]() {
+        size_t n = 0;
+        for (size_t i = 0; i < parser.FieldCount(); i++) {
+            auto name = parser.FieldName(i);
+            for (auto s : kNames) {
+                n += name.EqualsNoCase(s);
+            }
+        }
+
+        return n;
+    });
+}
+
+static void BenchDNSCache() {
+    auto hosts = Hostnames();
+
+    // 按 Zipf 分布（s = 1）为每个线程预先挑好要访问的域名
+    vector<double> cdf(hosts.size());
+    double sum = 0;
+    for (size_t i = 0; i < hosts.size(); i++) {
+        sum += 1.0 / (i + 1);
+        cdf[i] = sum;
+    }
+
+    const size_t kPicks = 64 * 1024; // 2 的幂
+    unsigned maxThreads = max(thread::hardware_concurrency(), 2U);
+    vector<vector<unsigned>> picks(maxThreads);
+
+    for (unsigned t = 0; t < maxThreads; t++) {
+        mt19937 rng(t + 1);
+        uniform_real_distribution<double> dist(0, sum);
+
+        for (size_t i = 0; i < kPicks; i++) {
+            auto it = lower_bound(cdf.begin(), cdf.end(), dist(rng));
+            picks[t].push_back((unsigned) min((size_t) (it - cdf.begin()),
+                                              hosts.size() - 1));
+        }
+    }
+
+    Resolver::Result result;
+    result.ttl = 300;
+
+    Resolver::Endpoint ep;
+    ZeroMemory(&ep, sizeof(ep));
+    auto sin = (sockaddr_in *) &ep.addr;
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(80);
+    sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ep.addrlen = sizeof(sockaddr_in);
+    ep.family = AF_INET;
+    ep.socktype = SOCK_STREAM;
+    ep.protocol = IPPROTO_TCP;
+    result.endpoints.push_back(ep);
+
+    auto capacity = DNSCache::CAPACITY;
+
+    // 所有的域名都在缓存中
+    DNSCache::CAPACITY = hosts.size() * 2;
+    for (auto &host : hosts) {
+        DNSCache::Add(host, result);
+    }
+
+    RunThreads("dns/resolve all hits", [&](unsigned t) {
+        static thread_local size_t i;
+        auto &host = hosts[picks[t][i++ & (kPicks - 1)]];
+
+        return (size_t) (DNSCache::Resolve(host) != nullptr);
+    });
+
+    // 容量只有域名数的十分之一：冷门的域名不断被淘汰、重新加入
+    for (auto &host : hosts) {
+        DNSCache::Remove(host);
+    }
+
+    DNSCache::CAPACITY = hosts.size() / 10;
+
+    RunThreads("dns/resolve+add long tail", [&](unsigned t) {
+        static thread_local size_t i;
+        auto &host = hosts[picks[t][i++ & (kPicks - 1)]];
+
+        if (DNSCache::Resolve(host)) {
+            return (size_t) 1;
+        }
+
+        DNSCache::Add(host, result);
+        return (size_t) 0;
+    });
+
+    for (auto &host : hosts) {
+        DNSCache::Remove(host);
+    }
+
+    DNSCache::CAPACITY = capacity;
+}
+
+// 原先 EventLoop 的定时器：按时间排序的 multimap，另以哈希表按标识查找
+class LegacyTimers {
+public:
+    typedef unsigned long long TimerId;
+
+    TimerId Add(unsigned long long when, function<void()> fn) {
+        auto id = ++m_lastId;
+        m_timers.emplace(id, m_queue.emplace(when, Timer{ id, move(fn) }));
+        return id;
+    }
+
+    void Cancel(TimerId id) {
+        auto it(m_timers.find(id));
+        if (it != m_timers.end()) {
+            m_queue.erase(it->second);
+            m_timers.erase(it);
+        }
+    }
+
+private:
+    struct Timer {
+        TimerId id;
+        function<void()> fn;
+    };
+
+    typedef multimap<unsigned long long, Timer> Queue;
+
+    Queue m_queue;
+    unordered_map<TimerId, Queue::iterator> m_timers;
+    TimerId m_lastId = 0;
+};
+
+// 十万个连接各有一个超时，每次操作取消其中一个、再设置一个新的
+static void BenchTimers() {
+    const size_t kTimers = 100000;
+
+    mt19937 rng(1);
+    uniform_int_distribution<unsigned> dist(1, 60000);
+
+    vector<unsigned> delays(kTimers);
+    for (auto &delay : delays) {
+        delay = dist(rng);
+    }
+
+    {
+        LegacyTimers timers;
+        vector<LegacyTimers::TimerId> ids;
+        for (size_t i = 0; i < kTimers; i++) {
+            ids.push_back(timers.Add(delays[i], []() {}));
+        }
+
+        size_t i = 0, now = 0;
+        Run("timers/re-arm 100k [legacy multimap]", 0, [&]() {
+            auto &id = ids[i++ % kTimers];
+            timers.Cancel(id);
+            id = timers.Add(++now + delays[i % kTimers], []() {});
+            return (size_t) 1;
+        });
+    }
+
+    {
+        TimerWheel timers;
+        vector<TimerWheel::Id> ids;
+        for (size_t i = 0; i < kTimers; i++) {
+            ids.push_back(timers.Add(delays[i], []() {}));
+        }
+
+        size_t i = 0, now = 0;
+        Run("timers/re-arm 100k [timer wheel]", 0, [&]() {
+            auto &id = ids[i++ % kTimers];
+            timers.Cancel(id);
+            id = timers.Add(++now + delays[i % kTimers], []() {});
+            return (size_t) 1;
+        });
+    }
+}
+
+//// main ////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        gs_filter = argv[1];
+    }
+
+    printf("Best scanner: %s\n\n",
+           Scanner::GetLevelName(Scanner::GetBestLevel()));
+
+    auto largeRequest = LargeRequest();
+
+    BenchHeaders("curl request", kCurlRequest, HttpParser::REQUEST);
+    BenchHeaders("browser request", kBrowserRequest, HttpParser::REQUEST);
+    BenchHeaders("large request", largeRequest.c_str(), HttpParser::REQUEST);
+    BenchHeaders("response", kResponse, HttpParser::RESPONSE);
+
+    BenchLineScan();
+    BenchChunkSize();
+    BenchChunkedBody();
+
+    BenchRewrite("curl request", kCurlRequest);
+    BenchRewrite("browser request", kBrowserRequest);
+    BenchRewrite("large request", largeRequest.c_str());
+    BenchFieldCompare(largeRequest.c_str());
+
+    BenchDNSCache();
+    BenchTimers();
+
+    return 0;
+}
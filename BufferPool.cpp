@@ -0,0 +1,203 @@
+#include "BufferPool.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#ifdef _WIN32
+#include <malloc.h> // for _aligned_malloc()
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+
+// 类中初始化的常量被取引用（如传给 std::min()）时仍需要定义
+const size_t BufferPool::SLAB_SIZE;
+const size_t BufferPool::ALIGNMENT;
+
+size_t BufferPool::MAX_IDLE = 64;
+
+namespace {
+
+// 空闲的缓冲区，链表的指针就存放在缓冲区本身中
+struct FreeSlab {
+    FreeSlab *next;
+};
+
+char *AllocateSlab() {
+    void *p;
+
+#ifdef _WIN32
+    p = _aligned_malloc(BufferPool::SLAB_SIZE, BufferPool::ALIGNMENT);
+#else
+    if (posix_memalign(&p, BufferPool::ALIGNMENT, BufferPool::SLAB_SIZE) != 0) {
+        p = nullptr;
+    }
+#endif
+
+    if (!p) {
+        throw std::bad_alloc();
+    }
+
+    return (char *) p;
+}
+
+void FreeSlabMemory(void *p) {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+// 线程的空闲链表
+struct LocalPool {
+    ~LocalPool();
+
+    FreeSlab *head = nullptr;
+    size_t idle = 0;
+};
+
+thread_local LocalPool gs_pool;
+
+// 线程退出、gs_pool 已被析构
+thread_local bool gs_exited = false;
+
+LocalPool::~LocalPool() {
+    while (head) {
+        auto next = head->next;
+        FreeSlabMemory(head);
+        head = next;
+    }
+
+    idle = 0;
+    gs_exited = true;
+}
+
+}
+
+char *BufferPool::Acquire() {
+    if (!gs_exited) {
+        auto &pool = gs_pool;
+        if (pool.head) {
+            auto slab = pool.head;
+            pool.head = slab->next;
+            pool.idle--;
+
+            return (char *) slab;
+        }
+    }
+
+    return AllocateSlab();
+}
+
+void BufferPool::Release(char *slab) {
+    if (!slab) {
+        return;
+    }
+
+    if (!gs_exited) {
+        auto &pool = gs_pool;
+        if (pool.idle < MAX_IDLE) {
+            auto node = (FreeSlab *) slab;
+            node->next = pool.head;
+            pool.head = node;
+            pool.idle++;
+
+            return;
+        }
+    }
+
+    FreeSlabMemory(slab);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// 释放 IoBuffer 的内存
+static void FreeBuffer(char *data, size_t capacity) {
+    if (capacity == BufferPool::SLAB_SIZE) {
+        BufferPool::Release(data);
+    }
+    else {
+        free(data);
+    }
+}
+
+char *IoBuffer::Prepare(size_t n) {
+    if (Room() >= n) {
+        return m_data + m_end;
+    }
+
+    size_t len = size();
+
+    // 把数据挪到开头就够了
+    if (m_data && len + n <= m_capacity) {
+        memmove(m_data, m_data + m_begin, len);
+    }
+    else {
+        size_t capacity = BufferPool::SLAB_SIZE;
+        while (capacity < len + n) {
+            capacity *= 2;
+        }
+
+        char *data;
+        if (capacity == BufferPool::SLAB_SIZE) {
+            data = BufferPool::Acquire();
+        }
+        else {
+            data = (char *) malloc(capacity);
+            if (!data) {
+                throw std::bad_alloc();
+            }
+        }
+
+        if (len > 0) {
+            memcpy(data, m_data + m_begin, len);
+        }
+
+        if (m_data) {
+            FreeBuffer(m_data, m_capacity);
+        }
+
+        m_data = data;
+        m_capacity = capacity;
+    }
+
+    m_begin = 0;
+    m_end = len;
+
+    return m_data + m_end;
+}
+
+void IoBuffer::Append(const char *buf, size_t len) {
+    if (len > 0) {
+        memcpy(Prepare(len), buf, len);
+        Commit(len);
+    }
+}
+
+void IoBuffer::Consume(size_t n) {
+    m_begin += n;
+
+    if (m_begin >= m_end) {
+        Clear();
+    }
+}
+
+void IoBuffer::Clear() {
+    if (m_data) {
+        FreeBuffer(m_data, m_capacity);
+
+        m_data = nullptr;
+        m_capacity = 0;
+    }
+
+    m_begin = m_end = 0;
+}
+
+void IoBuffer::Swap(IoBuffer &other) {
+    std::swap(m_data, other.m_data);
+    std::swap(m_capacity, other.m_capacity);
+    std::swap(m_begin, other.m_begin);
+    std::swap(m_end, other.m_end);
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <cstddef>
+
+/// 线程局部的 I/O 缓冲区池
+/// 
+/// 缓冲区（slab）大小固定为 SLAB_SIZE，按缓存行对齐。每个线程有自己的
+/// 空闲链表，借还都不需要加锁，也不需要调用 malloc()。线程中空闲的缓冲区
+/// 超过 MAX_IDLE 个时，多出来的直接还给系统，内存占用不会停留在峰值。
+/// 
+/// 缓冲区可以在别的线程归还，此时它进入归还线程的空闲链表。
+class BufferPool {
+public:
+
+    /// 缓冲区的大小
+    static const size_t SLAB_SIZE = 16 * 1024;
+
+    /// 缓冲区的对齐
+    static const size_t ALIGNMENT = 64;
+
+    /// 每个线程最多保留的空闲缓冲区数，默认 64（1 MiB）
+    static size_t MAX_IDLE;
+
+    /// 借一个缓冲区
+    static char *Acquire();
+
+    /// 归还由 Acquire() 借来的缓冲区
+    static void Release(char *slab);
+};
+
+/// 从池中借来的一个缓冲区，离开作用域时自动归还
+class PooledSlab {
+public:
+
+    PooledSlab() : m_data(BufferPool::Acquire()) {}
+    ~PooledSlab() {
+        BufferPool::Release(m_data);
+    }
+
+    PooledSlab(const PooledSlab &) = delete;
+    PooledSlab &operator=(const PooledSlab &) = delete;
+
+    char *data() {
+        return m_data;
+    }
+
+    static size_t size() {
+        return BufferPool::SLAB_SIZE;
+    }
+
+private:
+
+    char *m_data;
+};
+
+/// 连续的、可增长的字节缓冲区
+/// 
+/// 数据不超过 BufferPool::SLAB_SIZE 时使用池中的缓冲区，更大时才从堆上
+/// 分配。数据被取空时立即归还内存，空闲的连接不占用缓冲区。
+class IoBuffer {
+public:
+
+    IoBuffer() = default;
+    ~IoBuffer() {
+        Clear();
+    }
+
+    IoBuffer(const IoBuffer &) = delete;
+    IoBuffer &operator=(const IoBuffer &) = delete;
+
+    char *data() {
+        return m_data + m_begin;
+    }
+
+    const char *data() const {
+        return m_data + m_begin;
+    }
+
+    size_t size() const {
+        return m_end - m_begin;
+    }
+
+    bool empty() const {
+        return m_end == m_begin;
+    }
+
+    /// 末尾的空闲空间
+    size_t Room() const {
+        return m_capacity - m_end;
+    }
+
+    /// 保证末尾至少有 @a n 个字节的空闲空间
+    /// 
+    /// @return 空闲空间的开头，写入数据后调用 Commit()
+    char *Prepare(size_t n);
+
+    /// 末尾新写入了 @a n 个字节
+    void Commit(size_t n) {
+        m_end += n;
+    }
+
+    /// 在末尾追加数据
+    void Append(const char *buf, size_t len);
+
+    /// 移除开头的 @a n 个字节
+    /// 
+    /// 取空时归还内存。
+    void Consume(size_t n);
+
+    /// 清空并归还内存
+    void Clear();
+
+    /// 与 @a other 交换内容，不复制数据
+    void Swap(IoBuffer &other);
+
+private:
+
+    char *m_data = nullptr;
+    size_t m_capacity = 0;
+
+    // 有效的数据位于 [m_begin, m_end)
+    size_t m_begin = 0;
+    size_t m_end = 0;
+};
@@ -0,0 +1,230 @@
+#include "ChunkedDecoder.hpp"
+#include "Scanner.hpp"
+
+#include <cstring>
+
+//////////////////////////////////////////////////////////////////////////
+
+static inline int HexValue(char ch) {
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+
+    ch |= 0x20; // 转为小写
+    if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+    }
+
+    return -1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+ChunkedDecoder::ChunkedDecoder() {
+    Reset();
+}
+
+void ChunkedDecoder::Reset() {
+    m_state = ST_SIZE;
+    m_size = m_rest = 0;
+    m_digits = 0;
+    m_lineSize = 0;
+}
+
+ChunkedDecoder::Result ChunkedDecoder::Feed(const char *data, size_t len,
+                                            size_t &consumed) {
+    size_t pos = 0;
+
+    while (pos < len && m_state != ST_DONE) {
+        if (m_state == ST_DATA) {
+            // 分段数据整块跳过
+            size_t n = len - pos;
+            if (n > m_rest) {
+                n = (size_t) m_rest;
+            }
+
+            pos += n;
+            m_rest -= n;
+
+            if (m_rest == 0) {
+                m_state = ST_DATA_CR;
+            }
+
+            continue;
+        }
+
+        if (m_state == ST_SIZE && m_digits == 0) {
+            // 分段大小完整地位于本次的数据中时，一次解析完
+            unsigned long long size;
+            size_t n = Scanner::ParseHex(data + pos, len - pos, size);
+
+            if (n > 0 && pos + n < len) {
+                m_size = size;
+                m_digits = m_lineSize = n;
+                m_state = ST_SIZE_WS;
+
+                pos += n;
+                continue;
+            }
+        }
+        else if (m_state == ST_EXTENSION || m_state == ST_TRAILER_FIELD) {
+            // 忽略的内容，直接跳到行尾
+            auto lf = (const char *) memchr(data + pos, '\n', len - pos);
+            size_t n = (lf ? lf - data : len) - pos;
+
+            if (n > 0) {
+                m_lineSize += n;
+                if (m_lineSize > kMaxLineSize) {
+                    consumed = pos;
+                    return DECODE_ERROR;
+                }
+
+                pos += n;
+                continue;
+            }
+        }
+
+        if (!OnByte(data[pos])) {
+            consumed = pos;
+            return DECODE_ERROR;
+        }
+
+        pos++;
+    }
+
+    consumed = pos;
+    return m_state == ST_DONE ? DECODE_DONE : DECODE_AGAIN;
+}
+
+bool ChunkedDecoder::OnByte(char ch) {
+    if (++m_lineSize > kMaxLineSize) {
+        return false;
+    }
+
+    switch (m_state) {
+    case ST_SIZE: {
+        int v = HexValue(ch);
+        if (v >= 0) {
+            // 最多 15 个数字，不会溢出
+            if (m_digits == 15) {
+                return false;
+            }
+
+            m_size = (m_size << 4) | (unsigned) v;
+            m_digits++;
+
+            return true;
+        }
+
+        if (m_digits == 0) {
+            return false;
+        }
+
+        m_state = ST_SIZE_WS;
+    }
+    // 继续处理数字之后的这个字节
+    // fallthrough
+
+    case ST_SIZE_WS:
+        if (ch == ' ' || ch == '\t') {
+            return true;
+        }
+        else if (ch == ';') {
+            m_state = ST_EXTENSION;
+            return true;
+        }
+        else if (ch == '\r') {
+            m_state = ST_SIZE_LF;
+            return true;
+        }
+        else if (ch == '\n') {
+            OnSizeLine();
+            return true;
+        }
+
+        return false;
+
+    case ST_EXTENSION:
+        if (ch == '\n') {
+            OnSizeLine();
+        }
+
+        return true;
+
+    case ST_SIZE_LF:
+        if (ch != '\n') {
+            return false;
+        }
+
+        OnSizeLine();
+        return true;
+
+    case ST_DATA_CR:
+        if (ch == '\r') {
+            m_state = ST_DATA_LF;
+            return true;
+        }
+        else if (ch != '\n') {
+            return false;
+        }
+    // 只有 LF
+    // fallthrough
+
+    case ST_DATA_LF:
+        if (ch != '\n') {
+            return false;
+        }
+
+        // 下一个分段
+        m_state = ST_SIZE;
+        m_size = 0;
+        m_digits = 0;
+        m_lineSize = 0;
+
+        return true;
+
+    case ST_TRAILER:
+        if (ch == '\r') {
+            m_state = ST_FINAL_LF;
+        }
+        else if (ch == '\n') {
+            m_state = ST_DONE;
+        }
+        else {
+            m_state = ST_TRAILER_FIELD;
+        }
+
+        return true;
+
+    case ST_TRAILER_FIELD:
+        if (ch == '\n') {
+            m_state = ST_TRAILER;
+            m_lineSize = 0;
+        }
+
+        return true;
+
+    case ST_FINAL_LF:
+        if (ch != '\n') {
+            return false;
+        }
+
+        m_state = ST_DONE;
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+void ChunkedDecoder::OnSizeLine() {
+    m_lineSize = 0;
+
+    if (m_size == 0) {
+        m_state = ST_TRAILER; // 最后一个分段
+    }
+    else {
+        m_rest = m_size;
+        m_state = ST_DATA;
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <cstddef>
+
+/// HTTP 分段传输（chunked）的解码状态机
+/// 
+/// 每次读到多少数据就处理多少：分段大小、扩展、数据、CRLF 以及结尾的
+/// trailer 被拆散在任意多次读取之间都没有关系，不需要缓存任何数据。
+/// 解码器只负责找出消息的边界，数据本身原样转发。
+/// 
+/// 兼容只以 LF 结尾的行。
+class ChunkedDecoder {
+public:
+
+    /// 解码结果
+    enum Result {
+        DECODE_AGAIN, ///< 消息尚未结束，需要更多的数据
+        DECODE_DONE, ///< 消息已结束
+        DECODE_ERROR, ///< 格式错误
+    };
+
+    /// 分段大小行、trailer 中每一行的最大长度
+    static const size_t kMaxLineSize = 8 * 1024;
+
+    /// 构造函数
+    ChunkedDecoder();
+
+    /// 重置，准备解码下一个消息
+    void Reset();
+
+    /// 处理 @a data 中的 @a len 个字节
+    /// 
+    /// @param consumed 返回属于当前消息的字节数。消息结束时其后的字节
+    ///                 不会被处理，属于下一个消息（或者是垃圾数据）。
+    Result Feed(const char *data, size_t len, size_t &consumed);
+
+    /// 消息是否已结束
+    bool Done() const {
+        return m_state == ST_DONE;
+    }
+
+private:
+
+    enum State {
+        ST_SIZE, // 分段大小
+        ST_SIZE_WS, // 分段大小之后的空白
+        ST_EXTENSION, // 分段扩展，忽略
+        ST_SIZE_LF, // 分段大小行的 LF
+        ST_DATA, // 分段数据
+        ST_DATA_CR, // 分段数据之后的 CR
+        ST_DATA_LF, // 分段数据之后的 LF
+        ST_TRAILER, // trailer 中一行的开头
+        ST_TRAILER_FIELD, // trailer 中的一个字段，忽略
+        ST_FINAL_LF, // 结尾空行的 LF
+        ST_DONE,
+    };
+
+    // 处理一个不属于分段数据的字节
+    bool OnByte(char ch);
+
+    // 分段大小行结束
+    void OnSizeLine();
+
+private:
+
+    State m_state;
+
+    // 当前分段的大小，以及分段数据尚未收到的字节数
+    unsigned long long m_size;
+    unsigned long long m_rest;
+
+    // 分段大小的数字个数
+    size_t m_digits;
+
+    // 当前行已收到的字节数
+    size_t m_lineSize;
+};
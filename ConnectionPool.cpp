@@ -0,0 +1,177 @@
+#include "ConnectionPool.hpp"
+#include "Logger.hpp"
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////
+
+size_t ConnectionPool::MAX_PER_HOST = 8;
+size_t ConnectionPool::MAX_TOTAL = 1024;
+double ConnectionPool::IDLE_TIMEOUT = 30;
+
+typedef chrono::steady_clock Clock;
+
+namespace {
+
+// 一个空闲连接
+struct Idle {
+    SOCKET sd;
+    Clock::time_point ts; // 归还的时间
+};
+
+// 队尾是最近归还的连接
+typedef deque<Idle> IdleList;
+
+unordered_map<string, IdleList> gs_pool;
+size_t gs_size = 0;
+Clock::time_point gs_lastPurge;
+
+mutex gs_poolMutex;
+
+// 两次清理之间的最小间隔
+const auto kPurgeInterval = chrono::seconds(1);
+
+bool IsExpired(const Idle &idle, Clock::time_point now) {
+    chrono::duration<double> idleTime = now - idle.ts;
+    return idleTime.count() > ConnectionPool::IDLE_TIMEOUT;
+}
+
+// 连接是否仍然可用
+// 
+// 空闲的连接上不应有任何数据。读到 0 表明服务器已关闭连接，
+// 读到数据则说明连接的状态已不可信。
+bool IsAlive(SOCKET sd) {
+    char ch;
+    int n = recv(sd, &ch, 1, MSG_PEEK);
+
+    return n == SOCKET_ERROR && WouldBlock();
+}
+
+// 在锁外关闭连接
+void CloseAll(const IdleList &list) {
+    for (auto &idle : list) {
+        closesocket(idle.sd);
+    }
+}
+
+// 摘下所有超时的连接（调用者须持有锁）
+void CollectExpired(Clock::time_point now, IdleList &expired) {
+    for (auto it = gs_pool.begin(); it != gs_pool.end();) {
+        auto &list = it->second;
+
+        // 队首的连接最旧
+        while (!list.empty() && IsExpired(list.front(), now)) {
+            expired.push_back(list.front());
+            list.pop_front();
+            gs_size--;
+        }
+
+        if (list.empty()) {
+            it = gs_pool.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    gs_lastPurge = now;
+}
+
+} // namespace
+
+SOCKET ConnectionPool::Checkout(const string &host) {
+    auto now = Clock::now();
+    IdleList stale;
+    SOCKET sd = INVALID_SOCKET;
+
+    {
+        lock_guard<mutex> lock(gs_poolMutex);
+
+        if (now - gs_lastPurge > kPurgeInterval) {
+            CollectExpired(now, stale);
+        }
+
+        auto it(gs_pool.find(host));
+        if (it != gs_pool.end()) {
+            auto &list = it->second;
+
+            // 最近归还的连接最有可能仍然可用
+            while (!list.empty()) {
+                Idle idle = list.back();
+                list.pop_back();
+                gs_size--;
+
+                if (!IsExpired(idle, now) && IsAlive(idle.sd)) {
+                    sd = idle.sd;
+                    break;
+                }
+
+                stale.push_back(idle);
+            }
+
+            if (list.empty()) {
+                gs_pool.erase(it);
+            }
+        }
+    }
+
+    CloseAll(stale);
+    return sd;
+}
+
+void ConnectionPool::Checkin(const string &host, SOCKET sd) {
+    auto now = Clock::now();
+    IdleList stale;
+
+    {
+        lock_guard<mutex> lock(gs_poolMutex);
+
+        if (now - gs_lastPurge > kPurgeInterval) {
+            CollectExpired(now, stale);
+        }
+
+        if (gs_size < MAX_TOTAL) {
+            auto &list = gs_pool[host];
+
+            // 挤掉最旧的连接
+            if (list.size() >= MAX_PER_HOST && !list.empty()) {
+                stale.push_back(list.front());
+                list.pop_front();
+                gs_size--;
+            }
+
+            if (list.size() < MAX_PER_HOST) {
+                list.push_back(Idle{ sd, now });
+                gs_size++;
+
+                sd = INVALID_SOCKET;
+            }
+        }
+    }
+
+    if (sd != INVALID_SOCKET) {
+        closesocket(sd); // 池已满
+    }
+
+    CloseAll(stale);
+}
+
+void ConnectionPool::Purge() {
+    IdleList expired;
+
+    {
+        lock_guard<mutex> lock(gs_poolMutex);
+        CollectExpired(Clock::now(), expired);
+    }
+
+    CloseAll(expired);
+}
+
+size_t ConnectionPool::Size() {
+    lock_guard<mutex> lock(gs_poolMutex);
+    return gs_size;
+}
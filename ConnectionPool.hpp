@@ -0,0 +1,40 @@
+#pragma once
+#include "ws-util.h"
+#include <string>
+
+/// 服务器连接池
+/// 
+/// 在所有浏览器连接之间共享保持连接（keep-alive）的服务器 SOCKET，
+/// 以主机全名（加上端口）为键。
+class ConnectionPool {
+public:
+
+    /// 每个主机最多保留的空闲连接数
+    static size_t MAX_PER_HOST;
+
+    /// 池中最多保留的空闲连接数
+    static size_t MAX_TOTAL;
+
+    /// 空闲连接的存活时间（秒）
+    /// 
+    /// 服务器通常会关闭空闲过久的连接，超时的连接不再复用。
+    static double IDLE_TIMEOUT;
+
+    /// 取出一个连接到 @a host 的空闲连接
+    /// 
+    /// 返回前会确认连接仍然可用。
+    /// @return 没有可用的连接时返回 INVALID_SOCKET
+    static SOCKET Checkout(const std::string &host);
+
+    /// 归还一个空闲的连接
+    /// 
+    /// @a sd 必须是非阻塞的，且已不在任何事件循环中。
+    /// 池已满时连接会被直接关闭。
+    static void Checkin(const std::string &host, SOCKET sd);
+
+    /// 关闭所有超时的空闲连接
+    static void Purge();
+
+    /// 池中的空闲连接数
+    static size_t Size();
+};
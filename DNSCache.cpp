@@ -1,79 +1,212 @@
 #include "DNSCache.hpp"
 #include "Logger.hpp"
 
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <list>
 #include <mutex>
+#include <unordered_map>
 using namespace std;
 
 //////////////////////////////////////////////////////////////////////////
 
-double DNSCache::EXPIRATION = 60 * 60 * 1;
-DNSCache::Cache DNSCache::ms_cache;
-static mutex gs_loggerMutex;
+size_t DNSCache::CAPACITY = 10000;
+unsigned DNSCache::MIN_TTL = 5;
+unsigned DNSCache::MAX_TTL = 60 * 60 * 1;
+unsigned DNSCache::DEFAULT_TTL = 60;
+unsigned DNSCache::NEGATIVE_TTL = 5;
 
+namespace {
 
-const DNSCache::Entry *DNSCache::Resolve(const string &dname) {
-    lock_guard<mutex> lock(gs_loggerMutex);
+// 分片数
+const size_t kShards = 16;
 
-    auto it(ms_cache.find(dname));
-    if (it != ms_cache.end()) {
-        auto curr = time(nullptr);
-        if (difftime(curr, it->second.ts) > EXPIRATION) {
-            ms_cache.erase(it);
+// 一个缓存节点
+struct Node {
+    string dname;
+    DNSCache::EntryPtr entry;
+};
+
+// 一个分片
+// 
+// 按缓存行对齐，避免不同分片的锁互相干扰。
+struct alignas(64) Shard {
+    typedef list<Node> LRU;
+
+    mutex m;
+
+    LRU lru; // 队首是最近访问的节点
+    unordered_map<string, LRU::iterator> index;
+
+    unsigned long long hits = 0;
+    unsigned long long misses = 0;
+    unsigned long long evictions = 0;
+};
+
+Shard gs_shards[kShards];
+
+Shard &GetShard(const string &dname) {
+    return gs_shards[hash<string>()(dname) % kShards];
+}
+
+// 每个分片的容量
+size_t GetShardCapacity() {
+    return max((size_t) 1, (DNSCache::CAPACITY + kShards - 1) / kShards);
+}
+
+// 值得缓存的错误：域名不存在、服务器出错或超时
+// 
+// 内存不足之类的本地错误不缓存。
+bool IsCacheableError(int error) {
+    switch (error) {
+    case EAI_NONAME:
+    case EAI_AGAIN:
+    case EAI_FAIL:
+#if defined(EAI_NODATA) && EAI_NODATA != EAI_NONAME
+    case EAI_NODATA:
+#endif
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// 确定条目的有效期（秒）
+unsigned GetTTL(const Resolver::Result &result) {
+    if (result.error != 0) {
+        return DNSCache::NEGATIVE_TTL;
+    }
+
+    unsigned ttl = result.ttl > 0 ? result.ttl : DNSCache::DEFAULT_TTL;
+    ttl = max(ttl, DNSCache::MIN_TTL);
+    ttl = min(ttl, DNSCache::MAX_TTL);
+
+    return ttl;
+}
+
+} // namespace
+
+DNSCache::EntryPtr DNSCache::Resolve(const string &dname) {
+    auto &shard = GetShard(dname);
+    EntryPtr expired; // 在锁外销毁
+
+    lock_guard<mutex> lock(shard.m);
+
+    auto it(shard.index.find(dname));
+    if (it != shard.index.end()) {
+        auto node = it->second;
+
+        // 有效期是固定的，访问并不会延长它
+        if (time(nullptr) >= node->entry->expires) {
+            expired = move(node->entry);
+
+            shard.lru.erase(node);
+            shard.index.erase(it);
+            shard.misses++;
 
             return nullptr;
         }
 
-        // ӳЧڣΪǰʱ
-        it->second.ts = curr;
+        // 移到队首
+        shard.lru.splice(shard.lru.begin(), shard.lru, node);
+        shard.hits++;
 
-        return &(it->second);
+        return node->entry;
     }
 
+    shard.misses++;
     return nullptr;
 }
 
-void DNSCache::Add(const std::string &dname, const addrinfo &ai) {
-    gs_loggerMutex.lock();
-    ms_cache.emplace(dname, &ai);
-    gs_loggerMutex.unlock();
+void DNSCache::Add(const std::string &dname, const Resolver::Result &result) {
+    if (result.error != 0 ? !IsCacheableError(result.error)
+                          : result.endpoints.empty()) {
+        return;
+    }
+
+    auto expires = time(nullptr) + GetTTL(result);
+    EntryPtr entry(make_shared<Entry>(result, expires));
+
+    auto &shard = GetShard(dname);
+    Shard::LRU evicted; // 在锁外销毁
+
+    lock_guard<mutex> lock(shard.m);
+
+    auto it(shard.index.find(dname));
+    if (it != shard.index.end()) {
+        auto node = it->second;
+        node->entry.swap(entry);
+
+        shard.lru.splice(shard.lru.begin(), shard.lru, node);
+        return;
+    }
+
+    shard.lru.push_front(Node{ dname, entry });
+    shard.index.emplace(dname, shard.lru.begin());
+
+    // 淘汰最久没有访问的条目
+    auto capacity = GetShardCapacity();
+    while (shard.lru.size() > capacity) {
+        auto last = prev(shard.lru.end());
+
+        shard.index.erase(last->dname);
+        evicted.splice(evicted.end(), shard.lru, last);
+        shard.evictions++;
+    }
 }
 
 bool DNSCache::Remove(const std::string &dname) {
-    lock_guard<mutex> lock(gs_loggerMutex);
+    auto &shard = GetShard(dname);
+    Shard::LRU removed; // 在锁外销毁
+
+    lock_guard<mutex> lock(shard.m);
+
+    auto it(shard.index.find(dname));
+    if (it != shard.index.end()) {
+        removed.splice(removed.end(), shard.lru, it->second);
+        shard.index.erase(it);
 
-    auto it(ms_cache.find(dname));
-    if (it != ms_cache.end()) {
-        ms_cache.erase(it);
         return true;
     }
 
     return false;
 }
 
-//////////////////////////////////////////////////////////////////////////
-
-DNSCache::Entry::Entry(const addrinfo *ai_other) {
-    if (ai_other) {
-        ai = *ai_other;
-        ai.ai_addr = new sockaddr(*(ai_other->ai_addr));
+DNSCache::Statistics DNSCache::GetStatistics() {
+    Statistics stat = {};
 
-        // ûʹֵ
-        ai.ai_canonname = nullptr;
-        ai.ai_next = nullptr;
+    for (auto &shard : gs_shards) {
+        lock_guard<mutex> lock(shard.m);
 
-        ts = time(nullptr);
-    }
-    else {
-        memset(&ai, 0, sizeof(addrinfo));
+        stat.size += shard.lru.size();
+        stat.hits += shard.hits;
+        stat.misses += shard.misses;
+        stat.evictions += shard.evictions;
     }
+
+    return stat;
 }
 
-DNSCache::Entry::~Entry() {
-    if (IsOk()) {
-        delete ai.ai_addr;
-    }
+//////////////////////////////////////////////////////////////////////////
+
+DNSCache::Entry::Entry(const Resolver::Result &result, time_t expires)
+    : endpoints(result.endpoints), error(result.error),
+      expires(expires), m_next(0) {}
+
+bool DNSCache::Entry::IsNegative() const {
+    return error != 0;
 }
 
-bool DNSCache::Entry::IsOk() const {
-    return ai.ai_addr != nullptr;
+void DNSCache::Entry::GetEndpoints(vector<Resolver::Endpoint> &eps) const {
+    if (endpoints.empty()) {
+        return;
+    }
+
+    // 各地址族内部轮换，两种地址族仍然交替排列
+    vector<Resolver::Endpoint> rotated(endpoints);
+    Resolver::Interleave(rotated, m_next++);
+
+    eps.insert(eps.end(), rotated.begin(), rotated.end());
 }
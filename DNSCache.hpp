@@ -1,48 +1,86 @@
 #pragma once
-#include "ws-util.h"
+#include "Resolver.hpp"
+
+#include <atomic>
+#include <ctime>
 #include <string>
-#include <map>
+#include <memory>
+#include <vector>
 
-/// DNS 
+/// DNS 缓存
+/// 
+/// 按域名的哈希值分成若干片，每片各有一把锁和一条 LRU 链表，
+/// 以免所有工作线程争用同一把锁。
 class DNSCache {
 public:
 
-    /// ĿʧЧʱ
+    /// 缓存最多容纳的条目数
+    /// 
+    /// 超出时淘汰最久没有访问的条目。
+    static size_t CAPACITY;
+
+    /// TTL 的下限与上限（秒）
     /// 
-    /// ĬΪһСʱ֮ûκηĿʧЧ
-    /// ÿηʶʱ
-    static double EXPIRATION;
+    /// 条目按记录的 TTL 过期，过短或过长的 TTL 被限制在此范围之内。
+    static unsigned MIN_TTL, MAX_TTL;
 
-    /// һĿ
+    /// 未知 TTL 时（例如使用系统的解析器）采用的 TTL（秒）
+    static unsigned DEFAULT_TTL;
+
+    /// 解析失败（域名不存在、服务器出错）的结果缓存多久（秒）
+    static unsigned NEGATIVE_TTL;
+
+    /// 一个缓存条目
     struct Entry {
-        /// 캯
-        Entry(const addrinfo *ai_other);
+        /// 构造函数
+        Entry(const Resolver::Result &result, time_t expires);
 
-        /// øƹ캯
+        /// 禁用复制构造函数
         Entry(const Entry &other) = delete;
 
-        /// 
-        ~Entry();
+        /// 是否为解析失败的结果
+        bool IsNegative() const;
+
+        /// 取出所有地址
+        /// 
+        /// 每次调用都从下一个地址开始，使连接轮流分布到各个地址上。
+        void GetEndpoints(std::vector<Resolver::Endpoint> &endpoints) const;
 
-        /// ĿǷЧ
-        bool IsOk() const;
+        const std::vector<Resolver::Endpoint> endpoints;
+        const int error; ///< 解析失败时的错误码
+        const time_t expires; ///< 过期时间
 
-        addrinfo ai;
-        bool home = false;
-        time_t ts = 0; ///< 뻺ʱ
+    private:
+
+        mutable std::atomic_uint m_next; // 下一次轮到的地址
     };
 
-    /// 
-    static const Entry *Resolve(const std::string &dname);
+    /// 条目的引用
+    /// 
+    /// 条目被删除或淘汰后，持有者手中的引用仍然有效。
+    typedef std::shared_ptr<const Entry> EntryPtr;
+
+    /// 解析域名
+    /// 
+    /// @return 缓存中没有时返回空引用
+    static EntryPtr Resolve(const std::string &dname);
 
-    /// Ӧ IP ַ뻺
-    static void Add(const std::string &dname, const addrinfo &ai);
+    /// 将域名的解析结果加入缓存
+    /// 
+    /// 解析失败的结果也会缓存 NEGATIVE_TTL 秒。
+    static void Add(const std::string &dname, const Resolver::Result &result);
 
-    /// ɾʧЧĿ
+    /// 删除失效条目
     static bool Remove(const std::string &dname);
 
-private:
+    /// 统计信息
+    struct Statistics {
+        size_t size; ///< 当前的条目数
+        unsigned long long hits; ///< 命中数
+        unsigned long long misses; ///< 未命中数（包括已过期）
+        unsigned long long evictions; ///< 因容量不足而被淘汰的条目数
+    };
 
-    typedef std::map<std::string, Entry> Cache;
-    static Cache ms_cache;
+    /// 获取统计信息（汇总所有分片）
+    static Statistics GetStatistics();
 };
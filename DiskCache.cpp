@@ -0,0 +1,618 @@
+#include "DiskCache.hpp"
+#include "Logger.hpp"
+#include "ws-util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////
+
+string DiskCache::DIRECTORY;
+size_t DiskCache::CAPACITY = 1024 * 1024 * 1024;
+size_t DiskCache::SEGMENT_SIZE = 64 * 1024 * 1024;
+
+namespace {
+
+const uint32_t kIndexMagic = 0x4350594d; // "MYPC"
+const uint32_t kIndexVersion = 1;
+const uint32_t kRecordMagic = 0x5250594d; // "MYPR"
+
+// 段数的上限
+const size_t kMaxSegments = 1024;
+
+// 每个桶的索引项数
+const size_t kBucketSlots = 8;
+
+// 按平均每个回应这么多字节来确定索引项数
+const size_t kBytesPerSlot = 16 * 1024;
+
+// 索引的锁按桶分片
+const size_t kStripes = 16;
+
+// 记录中头部的上限，超过的记录视为损坏
+const size_t kMaxMetaSize = 256 * 1024;
+
+// 索引文件的开头
+struct IndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t segmentSize;
+    uint32_t segments;
+    uint32_t buckets;
+
+    uint32_t writeSegment; // 正在写入的段
+    uint32_t reserved;
+    uint64_t writeOffset; // 段内下一个记录的位置
+
+    uint32_t generations[kMaxSegments]; // 各段当前的代数，从 1 开始
+};
+
+// 一个索引项
+struct Slot {
+    uint64_t hash; // 键的哈希值，0 表示空
+    uint64_t offset; // 记录在段内的偏移
+    uint32_t size; // 记录的总长度
+    uint32_t segment;
+    uint32_t generation; // 写入时段的代数
+    uint32_t expires; // 过期的时间，桶满时先替换最早过期的
+};
+
+// 段中每个记录的开头
+// 
+// 随后依次是键、ETag、Last-Modified、回应头部与数据体。
+struct RecordHeader {
+    uint32_t magic;
+    uint32_t keySize;
+    uint32_t etagSize;
+    uint32_t lastModifiedSize;
+    uint32_t headSize;
+    int32_t status;
+    uint64_t bodySize;
+    int64_t responseTime;
+    int64_t initialAge;
+    int64_t freshness;
+};
+
+struct State {
+    bool open = false;
+
+    vector<int> fds; // 各段的文件
+    IndexHeader *header = nullptr;
+    Slot *slots = nullptr;
+    size_t buckets = 0;
+
+    // 保护写入位置、代数与 pins
+    mutex alloc;
+
+    // 各段正在读写的对象数，不为 0 的段不能重用
+    vector<unsigned> pins;
+
+    mutex stripes[kStripes];
+
+    atomic<unsigned long long> hits{ 0 }, misses{ 0 }, stores{ 0 };
+    atomic<unsigned long long> bytesWritten{ 0 };
+};
+
+State gs_state;
+
+// FNV-1a：写在磁盘上的哈希值不能随实现而变
+uint64_t Hash(const string &key) {
+    uint64_t h = 14695981039346656037ULL;
+    for (auto c : key) {
+        h = (h ^ (unsigned char) c) * 1099511628211ULL;
+    }
+
+    return h != 0 ? h : 1;
+}
+
+size_t GetBucket(uint64_t hash) {
+    return (size_t) (hash % gs_state.buckets);
+}
+
+mutex &GetStripe(size_t bucket) {
+    return gs_state.stripes[bucket % kStripes];
+}
+
+void Unpin(uint32_t segment) {
+    lock_guard<mutex> lock(gs_state.alloc);
+    gs_state.pins[segment]--;
+}
+
+#ifndef _WIN32
+
+bool ReadAll(int fd, void *buf, size_t len, off_t offset) {
+    auto p = (char *) buf;
+
+    while (len > 0) {
+        auto n = pread(fd, p, len, offset);
+        if (n > 0) {
+            p += n;
+            len -= (size_t) n;
+            offset += n;
+        }
+        else if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool WriteAll(int fd, const void *buf, size_t len, off_t offset) {
+    auto p = (const char *) buf;
+
+    while (len > 0) {
+        auto n = pwrite(fd, p, len, offset);
+        if (n > 0) {
+            p += n;
+            len -= (size_t) n;
+            offset += n;
+        }
+        else if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// 打开段文件，不够大时预先分配空间
+int OpenSegment(const string &path, size_t size) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    if ((size_t) st.st_size < size) {
+        bool ok = false;
+
+#ifdef __linux__
+        // 真正分配磁盘块，写入时不会因为空间不足而失败
+        ok = posix_fallocate(fd, 0, (off_t) size) == 0;
+#endif
+
+        if (!ok && ftruncate(fd, (off_t) size) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    return fd;
+}
+
+#else
+
+bool ReadAll(int, void *, size_t, off_t) {
+    return false;
+}
+
+bool WriteAll(int, const void *, size_t, off_t) {
+    return false;
+}
+
+#endif
+
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+
+bool DiskCache::Open() {
+    if (DIRECTORY.empty()) {
+        return true;
+    }
+
+#ifdef _WIN32
+    Logger::LogError(__FUNC__ "Disk cache is not supported on this platform");
+    return false;
+#else
+    auto segments = min(max(CAPACITY / SEGMENT_SIZE, (size_t) 2), kMaxSegments);
+    auto buckets = max(CAPACITY / kBytesPerSlot / kBucketSlots, (size_t) 64);
+
+    if (mkdir(DIRECTORY.c_str(), 0755) != 0 && errno != EEXIST) {
+        Logger::LogError(__FUNC__ "Creating " + DIRECTORY + " failed: " +
+                         strerror(errno));
+        return false;
+    }
+
+    for (size_t i = 0; i < segments; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "/segment.%03u", (unsigned) i);
+
+        int fd = OpenSegment(DIRECTORY + name, SEGMENT_SIZE);
+        if (fd < 0) {
+            Logger::LogError(__FUNC__ "Opening " + DIRECTORY + name +
+                             " failed: " + strerror(errno));
+            return false;
+        }
+
+        gs_state.fds.push_back(fd);
+    }
+
+    // 索引整个映射进来，修改直接落到文件里
+    auto path = DIRECTORY + "/index";
+    size_t size = sizeof(IndexHeader) + buckets * kBucketSlots * sizeof(Slot);
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        Logger::LogError(__FUNC__ "Opening " + path + " failed: " +
+                         strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    bool resized = fstat(fd, &st) != 0 || (size_t) st.st_size != size;
+
+    if (resized && ftruncate(fd, (off_t) size) != 0) {
+        Logger::LogError(__FUNC__ "Sizing " + path + " failed: " +
+                         strerror(errno));
+        close(fd);
+
+        return false;
+    }
+
+    auto base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED) {
+        Logger::LogError(__FUNC__ "mmap() of " + path + " failed: " +
+                         strerror(errno));
+        return false;
+    }
+
+    auto header = (IndexHeader *) base;
+
+    // 配置变了的话，原有的索引项都不可信
+    if (resized || header->magic != kIndexMagic ||
+        header->version != kIndexVersion ||
+        header->segmentSize != SEGMENT_SIZE ||
+        header->segments != segments || header->buckets != buckets) {
+        memset(base, 0, size);
+
+        header->magic = kIndexMagic;
+        header->version = kIndexVersion;
+        header->segmentSize = SEGMENT_SIZE;
+        header->segments = (uint32_t) segments;
+        header->buckets = (uint32_t) buckets;
+
+        for (auto &generation : header->generations) {
+            generation = 1;
+        }
+    }
+
+    gs_state.header = header;
+    gs_state.slots = (Slot *) (header + 1);
+    gs_state.buckets = buckets;
+    gs_state.pins.assign(segments, 0);
+    gs_state.open = true;
+
+    return true;
+#endif
+}
+
+bool DiskCache::IsEnabled() {
+    return gs_state.open;
+}
+
+DiskCache::Body::Body(int fd, off_t offset, size_t size, uint32_t segment)
+    : fd(fd), offset(offset), size(size), m_segment(segment) {}
+
+DiskCache::Body::~Body() {
+    Unpin(m_segment);
+}
+
+unique_ptr<DiskCache::Body>
+DiskCache::Lookup(const string &key, const HttpParser &request,
+                  ResponseCache::EntryPtr &entry) {
+    if (!IsEnabled()) {
+        return nullptr;
+    }
+
+    auto hash = Hash(key);
+    auto bucket = GetBucket(hash);
+
+    Slot slot = {};
+
+    {
+        lock_guard<mutex> lock(GetStripe(bucket));
+
+        auto slots = gs_state.slots + bucket * kBucketSlots;
+        for (size_t i = 0; i < kBucketSlots; i++) {
+            if (slots[i].hash == hash) {
+                slot = slots[i];
+                break;
+            }
+        }
+    }
+
+    if (slot.hash == 0 || slot.expires <= (uint32_t) time(nullptr) ||
+        slot.segment >= gs_state.fds.size()) {
+        gs_state.misses++;
+        return nullptr;
+    }
+
+    // 段已被重用的话，索引项即已失效
+    {
+        lock_guard<mutex> lock(gs_state.alloc);
+
+        if (gs_state.header->generations[slot.segment] != slot.generation) {
+            gs_state.misses++;
+            return nullptr;
+        }
+
+        gs_state.pins[slot.segment]++;
+    }
+
+    int fd = gs_state.fds[slot.segment];
+    unique_ptr<Body> body(new Body(fd, 0, 0, slot.segment));
+
+    RecordHeader rh;
+    if (!ReadAll(fd, &rh, sizeof(rh), (off_t) slot.offset) ||
+        rh.magic != kRecordMagic) {
+        gs_state.misses++;
+        return nullptr;
+    }
+
+    size_t metaSize = (size_t) rh.keySize + rh.etagSize + rh.lastModifiedSize +
+                      rh.headSize;
+
+    if (metaSize > kMaxMetaSize || rh.keySize != key.size() ||
+        sizeof(rh) + metaSize + rh.bodySize != slot.size) {
+        gs_state.misses++;
+        return nullptr;
+    }
+
+    string meta(metaSize, '\0');
+    if (!ReadAll(fd, &meta[0], metaSize, (off_t) (slot.offset + sizeof(rh))) ||
+        meta.compare(0, key.size(), key) != 0) {
+        gs_state.misses++;
+        return nullptr;
+    }
+
+    shared_ptr<ResponseCache::Entry> e(make_shared<ResponseCache::Entry>());
+
+    size_t pos = rh.keySize;
+    e->etag.assign(meta, pos, rh.etagSize);
+    pos += rh.etagSize;
+    e->lastModified.assign(meta, pos, rh.lastModifiedSize);
+    pos += rh.lastModifiedSize;
+    e->head.assign(meta, pos, rh.headSize);
+
+    e->status = rh.status;
+    e->responseTime = (time_t) rh.responseTime;
+    e->initialAge = (time_t) rh.initialAge;
+    e->freshness = (time_t) rh.freshness;
+
+    if (!ResponseCache::IsFresh(*e, request)) {
+        gs_state.misses++;
+        return nullptr;
+    }
+
+    body->offset = (off_t) (slot.offset + sizeof(rh) + metaSize);
+    body->size = (size_t) rh.bodySize;
+
+    entry = move(e);
+    gs_state.hits++;
+
+    return body;
+}
+
+DiskCache::Writer::Writer(uint32_t segment, uint32_t generation,
+                          off_t start, size_t metaSize, size_t bodySize,
+                          uint64_t hash, uint32_t expires)
+    : m_fd(gs_state.fds[segment]), m_offset(start + (off_t) metaSize),
+      m_segment(segment), m_generation(generation), m_start(start),
+      m_size(metaSize + bodySize), m_rest(bodySize), m_hash(hash),
+      m_expires(expires) {}
+
+DiskCache::Writer::~Writer() {
+    Unpin(m_segment);
+}
+
+bool DiskCache::Writer::Write(const char *data, size_t len) {
+    if (m_failed || len > m_rest || !WriteAll(m_fd, data, len, m_offset)) {
+        m_failed = true;
+        return false;
+    }
+
+    m_offset += len;
+    m_rest -= len;
+    gs_state.bytesWritten += len;
+
+    return true;
+}
+
+bool DiskCache::Writer::Commit() {
+    if (m_failed || m_rest != 0) {
+        return false;
+    }
+
+    auto bucket = GetBucket(m_hash);
+    lock_guard<mutex> lock(GetStripe(bucket));
+
+    // 优先替换同一个键、已失效的项，否则挤掉最早过期的
+    auto slots = gs_state.slots + bucket * kBucketSlots;
+    Slot *victim = nullptr;
+
+    {
+        lock_guard<mutex> alloc(gs_state.alloc);
+        auto generations = gs_state.header->generations;
+
+        for (size_t i = 0; i < kBucketSlots; i++) {
+            auto &slot = slots[i];
+
+            if (slot.hash == m_hash || slot.hash == 0 ||
+                slot.segment >= gs_state.fds.size() ||
+                generations[slot.segment] != slot.generation) {
+                victim = &slot;
+
+                if (slot.hash == m_hash) {
+                    break;
+                }
+            }
+        }
+    }
+
+    if (!victim) {
+        victim = slots;
+        for (size_t i = 1; i < kBucketSlots; i++) {
+            if (slots[i].expires < victim->expires) {
+                victim = slots + i;
+            }
+        }
+    }
+
+    victim->hash = m_hash;
+    victim->offset = (uint64_t) m_start;
+    victim->size = (uint32_t) m_size;
+    victim->segment = m_segment;
+    victim->generation = m_generation;
+    victim->expires = m_expires;
+
+    gs_state.stores++;
+    return true;
+}
+
+unique_ptr<DiskCache::Writer>
+DiskCache::Store(const string &key, const ResponseCache::Entry &entry,
+                 size_t bodySize) {
+    // 没有 Vary 的名字就算不出带 Vary 的键
+    if (!IsEnabled() || !entry.varyNames.empty()) {
+        return nullptr;
+    }
+
+    RecordHeader rh = {};
+    rh.magic = kRecordMagic;
+    rh.keySize = (uint32_t) key.size();
+    rh.etagSize = (uint32_t) entry.etag.size();
+    rh.lastModifiedSize = (uint32_t) entry.lastModified.size();
+    rh.headSize = (uint32_t) entry.head.size();
+    rh.status = entry.status;
+    rh.bodySize = bodySize;
+    rh.responseTime = entry.responseTime;
+    rh.initialAge = entry.initialAge;
+    rh.freshness = entry.freshness;
+
+    string meta;
+    meta.reserve(sizeof(rh) + key.size() + entry.etag.size() +
+                 entry.lastModified.size() + entry.head.size());
+
+    meta.append((const char *) &rh, sizeof(rh));
+    meta += key;
+    meta += entry.etag;
+    meta += entry.lastModified;
+    meta += entry.head;
+
+    size_t size = meta.size() + bodySize;
+    if (size > SEGMENT_SIZE || meta.size() - sizeof(rh) > kMaxMetaSize) {
+        return nullptr;
+    }
+
+    uint32_t segment, generation;
+    off_t offset;
+
+    {
+        lock_guard<mutex> lock(gs_state.alloc);
+        auto &header = *gs_state.header;
+
+        if (header.writeOffset + size > SEGMENT_SIZE) {
+            // 换到下一个没有人在读写的段，其中原有的回应随之失效
+            auto segments = gs_state.fds.size();
+            size_t next = segments;
+
+            for (size_t i = 1; i <= segments; i++) {
+                auto candidate = (header.writeSegment + i) % segments;
+                if (gs_state.pins[candidate] == 0) {
+                    next = candidate;
+                    break;
+                }
+            }
+
+            if (next == segments) {
+                return nullptr;
+            }
+
+            header.generations[next]++;
+            header.writeSegment = (uint32_t) next;
+            header.writeOffset = 0;
+        }
+
+        segment = header.writeSegment;
+        generation = header.generations[segment];
+        offset = (off_t) header.writeOffset;
+
+        header.writeOffset += (size + 7) & ~(size_t) 7;
+        gs_state.pins[segment]++;
+    }
+
+    auto expires = entry.responseTime + entry.freshness - entry.initialAge;
+
+    unique_ptr<Writer> writer(new Writer(segment, generation, offset,
+                                         meta.size(), bodySize, Hash(key),
+                                         (uint32_t) max(expires, (time_t) 0)));
+
+    // 头部先写好，数据体随后追加
+    if (!WriteAll(gs_state.fds[segment], meta.data(), meta.size(), offset)) {
+        Logger::LogError(__FUNC__ "Writing to the disk cache failed");
+        return nullptr;
+    }
+
+    gs_state.bytesWritten += meta.size();
+    return writer;
+}
+
+bool DiskCache::Remove(const string &key) {
+    if (!IsEnabled()) {
+        return false;
+    }
+
+    auto hash = Hash(key);
+    auto bucket = GetBucket(hash);
+
+    lock_guard<mutex> lock(GetStripe(bucket));
+
+    auto slots = gs_state.slots + bucket * kBucketSlots;
+    for (size_t i = 0; i < kBucketSlots; i++) {
+        if (slots[i].hash == hash) {
+            slots[i] = Slot {};
+            return true;
+        }
+    }
+
+    return false;
+}
+
+DiskCache::Statistics DiskCache::GetStatistics() {
+    Statistics stat;
+    stat.hits = gs_state.hits;
+    stat.misses = gs_state.misses;
+    stat.stores = gs_state.stores;
+    stat.bytesWritten = gs_state.bytesWritten;
+
+    return stat;
+}
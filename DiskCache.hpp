@@ -0,0 +1,138 @@
+#pragma once
+#include "ResponseCache.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+
+/// 磁盘上的第二级回应缓存
+/// 
+/// 回应依次追加到预先分配好的若干个段文件中，段循环使用：写满最后一个段
+/// 之后回到第一个，覆盖其中最旧的回应（FIFO）。段的代数（generation）
+/// 随每次重用递增，索引项记下写入时的代数，代数不符的索引项即已失效，
+/// 不必逐个清除。
+/// 
+/// 索引是一个按桶组织的定长哈希表，保存在文件中并整个 mmap 进来，
+/// 写入位置与各段的代数也在其中，所以重启之后缓存仍然是热的。
+/// 
+/// 命中时头部读进内存，数据体留在段文件中，由调用者用 sendfile()
+/// 直接发给浏览器。只存储有 Content-Length、不带 Vary 的回应。
+/// 仅支持 POSIX 系统。
+class DiskCache {
+public:
+
+    /// 缓存所在的目录，为空时不使用磁盘缓存
+    static std::string DIRECTORY;
+
+    /// 总容量（字节），默认 1 GiB
+    static size_t CAPACITY;
+
+    /// 每个段文件的大小（字节），默认 64 MiB，也是单个回应的上限
+    static size_t SEGMENT_SIZE;
+
+    /// 打开（必要时创建）段文件与索引
+    /// 
+    /// 须在工作线程启动之前调用。没有设置 DIRECTORY 时什么也不做。
+    /// 索引与当前的配置不符时清空重建。
+    static bool Open();
+
+    /// 是否已经打开
+    static bool IsEnabled();
+
+    /// 命中的数据体在段文件中的位置
+    /// 
+    /// 对象存在期间，它所在的段不会被重用。
+    class Body {
+    public:
+        /// 构造函数（由 Lookup() 调用，所在的段已被锁定）
+        Body(int fd, off_t offset, size_t size, uint32_t segment);
+        ~Body();
+
+        int fd; ///< 段文件
+        off_t offset; ///< 数据体在文件中的偏移
+        size_t size; ///< 数据体的字节数
+
+    private:
+        Body(const Body &) = delete;
+        Body &operator=(const Body &) = delete;
+
+        uint32_t m_segment;
+    };
+
+    /// 查找新鲜的回应
+    /// 
+    /// 会读取磁盘（通常在页缓存中），但只读回应的头部。
+    /// 
+    /// @param entry 命中时设置为条目，其中的数据体为空
+    /// @return 没有可用的回应时返回空指针
+    static std::unique_ptr<Body> Lookup(const std::string &key,
+                                        const HttpParser &request,
+                                        ResponseCache::EntryPtr &entry);
+
+    /// 正在写入的回应
+    /// 
+    /// 数据体写完后 Commit() 才加入索引；中途销毁则放弃，
+    /// 占用的空间在段被重用时回收。
+    class Writer {
+    public:
+        /// 构造函数（由 Store() 调用）
+        /// 
+        /// @param start 记录在段内的偏移，记录开头的 @a metaSize 个字节
+        ///              已由调用者写入
+        Writer(uint32_t segment, uint32_t generation, off_t start,
+               size_t metaSize, size_t bodySize, uint64_t hash,
+               uint32_t expires);
+        ~Writer();
+
+        /// 追加一段数据体
+        /// 
+        /// @return 出错或者超出了预留的长度时返回 false，此后不能再写
+        bool Write(const char *data, size_t len);
+
+        /// 数据体已经完整，加入索引
+        /// 
+        /// @return 数据体不完整或者写入出过错时返回 false
+        bool Commit();
+
+    private:
+        Writer(const Writer &) = delete;
+        Writer &operator=(const Writer &) = delete;
+
+        int m_fd;
+        off_t m_offset; // 下一次写入的位置
+        uint32_t m_segment, m_generation;
+        off_t m_start; // 记录的开头
+        size_t m_size; // 记录的总长度
+        size_t m_rest; // 尚未写入的数据体字节数
+        uint64_t m_hash;
+        uint32_t m_expires;
+        bool m_failed = false;
+    };
+
+    /// 开始存储一个回应
+    /// 
+    /// 立即预留空间并写入头部。
+    /// 
+    /// @param entry ResponseCache::Prepare() 得到的条目，只用其中的
+    ///              头部与元数据
+    /// @param bodySize 数据体的长度（Content-Length）
+    /// @return 不能存储（带有 Vary、太大、所有段都正被读取）时返回空指针
+    static std::unique_ptr<Writer> Store(const std::string &key,
+                                         const ResponseCache::Entry &entry,
+                                         size_t bodySize);
+
+    /// 删除某个键的回应（见 ResponseCache::Remove()）
+    static bool Remove(const std::string &key);
+
+    /// 统计信息
+    struct Statistics {
+        unsigned long long hits; ///< 命中数
+        unsigned long long misses; ///< 未命中数
+        unsigned long long stores; ///< 写入完成的回应数
+        unsigned long long bytesWritten; ///< 写入的字节数
+    };
+
+    /// 获取统计信息
+    static Statistics GetStatistics();
+};
@@ -0,0 +1,936 @@
+#include "EventLoop.hpp"
+#include "Logger.hpp"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#elif defined(_WIN32)
+#define poll WSAPoll
+#else
+#include <poll.h>
+#endif
+
+#include <algorithm>
+#include <climits>
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////
+
+// 一次最多取回的事件数
+static const int kMaxEvents = 256;
+
+bool EventLoop::IO_URING = false;
+
+#ifdef __linux__
+
+static uint32_t ToEpollEvents(int events) {
+    uint32_t ev = EPOLLET | EPOLLRDHUP;
+
+    if (events & EventLoop::EV_READ) {
+        ev |= EPOLLIN;
+    }
+
+    if (events & EventLoop::EV_WRITE) {
+        ev |= EPOLLOUT;
+    }
+
+    return ev;
+}
+
+#ifdef HAVE_IO_URING
+
+// io_uring 的提交队列长度
+static const unsigned kRingEntries = 256;
+
+// 缓冲区环中的块数（2 的幂），每块 BufferPool::SLAB_SIZE
+static const unsigned kRecvBuffers = 128;
+
+// 代号占 30 位
+static const uint32_t kGenMask = (1u << 30) - 1;
+
+// 完成项所属的操作
+enum {
+    OP_POLL,
+    OP_RECV,
+    OP_SEND,
+};
+
+static uint32_t ToPollEvents(int events) {
+    uint32_t ev = POLLRDHUP;
+
+    if (events & EventLoop::EV_READ) {
+        ev |= POLLIN;
+    }
+
+    if (events & EventLoop::EV_WRITE) {
+        ev |= POLLOUT;
+    }
+
+    return ev;
+}
+
+// 完成项的 user_data：最高 2 位为操作，其下 30 位为代号，低 32 位为 SOCKET
+// 撤销操作本身的完成项 user_data 为 0，直接忽略
+static inline uint64_t MakeUserData(unsigned op, SOCKET sd, uint32_t gen) {
+    return ((uint64_t) op << 62) | ((uint64_t) gen << 32) | (uint32_t) sd;
+}
+
+#endif // HAVE_IO_URING
+
+EventLoop::EventLoop() : m_stop(false) {
+    m_epfd = -1;
+    m_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (IO_URING) {
+#ifdef HAVE_IO_URING
+        m_ring.reset(new IoUring(kRingEntries));
+        if (m_ring->IsOk()) {
+            if (m_wakeup != -1) {
+                ArmWakeup();
+            }
+
+            SetUpAsyncIo();
+            return;
+        }
+
+        m_ring.reset();
+#endif
+
+        Logger::LogInfo("io_uring is not available, falling back to epoll");
+    }
+
+    m_epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (m_epfd != -1 && m_wakeup != -1) {
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = m_wakeup;
+
+        epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_wakeup, &ev);
+    }
+}
+
+EventLoop::~EventLoop() {
+#ifdef HAVE_IO_URING
+    // 先关闭实例，内核不再使用缓冲区环中的块
+    m_ring.reset();
+
+    for (auto buf : m_recvBuffers) {
+        BufferPool::Release(buf);
+    }
+#endif
+
+    if (m_wakeup != -1) {
+        close(m_wakeup);
+    }
+
+    if (m_epfd != -1) {
+        close(m_epfd);
+    }
+}
+
+bool EventLoop::IsOk() const {
+#ifdef HAVE_IO_URING
+    if (m_ring) {
+        return m_wakeup != -1;
+    }
+#endif
+
+    return m_epfd != -1 && m_wakeup != -1;
+}
+
+bool EventLoop::Add(SOCKET sd, int events, Handler *handler) {
+#ifdef HAVE_IO_URING
+    if (m_ring) {
+        auto gen = NextGen();
+        if (!ArmPoll(sd, events, gen)) {
+            return false;
+        }
+
+        m_handlers[sd] = Registration(handler, events, gen);
+        return true;
+    }
+#endif
+
+    epoll_event ev;
+    ev.events = ToEpollEvents(events);
+    ev.data.fd = sd;
+
+    if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, sd, &ev) != 0) {
+        Logger::LogError(WSAGetLastErrorMessage(__FUNC__ "epoll_ctl() failed"));
+        return false;
+    }
+
+    m_handlers[sd] = Registration(handler, events);
+    return true;
+}
+
+bool EventLoop::Modify(SOCKET sd, int events) {
+    auto it(m_handlers.find(sd));
+    if (it == m_handlers.end()) {
+        return false;
+    }
+
+    if (it->second.events == events) {
+        return true;
+    }
+
+#ifdef HAVE_IO_URING
+    if (m_ring) {
+        // 撤销旧的 poll 再登记新的，新的 poll 会立即报告已经就绪的事件
+        auto gen = NextGen();
+        CancelPoll(sd, it->second.gen);
+        if (!ArmPoll(sd, events, gen)) {
+            return false;
+        }
+
+        it->second.events = events;
+        it->second.gen = gen;
+
+        return true;
+    }
+#endif
+
+    epoll_event ev;
+    ev.events = ToEpollEvents(events);
+    ev.data.fd = sd;
+
+    if (epoll_ctl(m_epfd, EPOLL_CTL_MOD, sd, &ev) != 0) {
+        Logger::LogError(WSAGetLastErrorMessage(__FUNC__ "epoll_ctl() failed"));
+        return false;
+    }
+
+    it->second.events = events;
+    return true;
+}
+
+void EventLoop::Remove(SOCKET sd) {
+    auto it(m_handlers.find(sd));
+    if (it == m_handlers.end()) {
+        return;
+    }
+
+#ifdef HAVE_IO_URING
+    if (m_ring) {
+        auto &r = it->second;
+        CancelPoll(sd, r.gen);
+
+        // 还在发送的数据要保留到完成项返回
+        if (r.out && !r.out->sending.empty()) {
+            auto userData = MakeUserData(OP_SEND, sd, r.out->gen);
+            Cancel(userData);
+            m_orphans[userData] = move(r.out);
+        }
+
+        bool receiving = r.recvGen != 0;
+        if (receiving) {
+            Cancel(MakeUserData(OP_RECV, sd, r.recvGen));
+        }
+
+        m_handlers.erase(it);
+
+        // 连接可能随即交给别的线程复用（见 ConnectionPool），
+        // 不能等到下一次等待时才撤销接收，否则数据会被这里读走
+        if (receiving) {
+            m_ring->Submit(0);
+        }
+
+        return;
+    }
+#endif
+
+    m_handlers.erase(it);
+    epoll_ctl(m_epfd, EPOLL_CTL_DEL, sd, nullptr);
+}
+
+void EventLoop::Wakeup() {
+    uint64_t one = 1;
+    if (write(m_wakeup, &one, sizeof(one)) < 0) {
+        // 计数器已满，事件循环必然会被唤醒
+    }
+}
+
+bool EventLoop::Dispatch(int timeout) {
+#ifdef HAVE_IO_URING
+    if (m_ring) {
+        return DispatchRing(timeout);
+    }
+#endif
+
+    epoll_event events[kMaxEvents];
+
+    int n = epoll_wait(m_epfd, events, kMaxEvents, timeout);
+    if (n < 0) {
+        if (errno == EINTR) {
+            return true;
+        }
+
+        Logger::LogError(WSAGetLastErrorMessage(__FUNC__ "epoll_wait() failed"));
+        return false;
+    }
+
+    for (int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        if (fd == m_wakeup) {
+            uint64_t count;
+            while (read(m_wakeup, &count, sizeof(count)) > 0);
+
+            continue;
+        }
+
+        // 处理者可能已在本轮分发中被移除
+        auto it(m_handlers.find(fd));
+        if (it == m_handlers.end()) {
+            continue;
+        }
+
+        int ev = 0;
+        uint32_t e = events[i].events;
+
+        if (e & (EPOLLIN | EPOLLRDHUP)) {
+            ev |= EV_READ;
+        }
+
+        if (e & EPOLLOUT) {
+            ev |= EV_WRITE;
+        }
+
+        if (e & (EPOLLERR | EPOLLHUP)) {
+            ev |= EV_ERROR;
+        }
+
+        it->second.handler->OnEvents(fd, ev);
+    }
+
+    return true;
+}
+
+#ifdef HAVE_IO_URING
+
+uint32_t EventLoop::NextGen() {
+    m_lastGen = (m_lastGen + 1) & kGenMask;
+    if (m_lastGen == 0) {
+        m_lastGen = 1;
+    }
+
+    return m_lastGen;
+}
+
+void EventLoop::SetUpAsyncIo() {
+    // multishot recv 与 SEND_ZC 同在 6.0 中加入，以后者为准
+    if (!m_ring->Supports(IORING_OP_SEND_ZC)) {
+        Logger::LogInfo("io_uring cannot receive with multishot recv, "
+                        "relaying on readiness");
+        return;
+    }
+
+    m_recvBuffers.resize(kRecvBuffers);
+    for (auto &buf : m_recvBuffers) {
+        buf = BufferPool::Acquire();
+    }
+
+    if (!m_ring->SetUpBuffers(m_recvBuffers.data(), kRecvBuffers,
+                              BufferPool::SLAB_SIZE)) {
+        Logger::LogInfo("io_uring cannot register a buffer ring, "
+                        "relaying on readiness");
+
+        for (auto buf : m_recvBuffers) {
+            BufferPool::Release(buf);
+        }
+
+        m_recvBuffers.clear();
+        return;
+    }
+
+    m_asyncIo = true;
+}
+
+bool EventLoop::ArmPoll(SOCKET sd, int events, uint32_t gen) {
+    auto sqe = m_ring->GetSqe();
+    if (!sqe) {
+        Logger::LogError(__FUNC__ "io_uring submission queue is full");
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = sd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = ToPollEvents(events);
+    sqe->user_data = MakeUserData(OP_POLL, sd, gen);
+
+    return true;
+}
+
+void EventLoop::CancelPoll(SOCKET sd, uint32_t gen) {
+    auto sqe = m_ring->GetSqe();
+    if (!sqe) {
+        return; // 随后的完成项会因代号不符而被忽略
+    }
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = MakeUserData(OP_POLL, sd, gen);
+    sqe->user_data = 0;
+}
+
+void EventLoop::Cancel(uint64_t userData) {
+    auto sqe = m_ring->GetSqe();
+    if (!sqe) {
+        return; // 同上
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = userData;
+    sqe->user_data = 0;
+}
+
+bool EventLoop::ArmRecv(SOCKET sd, size_t limit, uint32_t gen) {
+    auto sqe = m_ring->GetSqe();
+    if (!sqe) {
+        Logger::LogError(__FUNC__ "io_uring submission queue is full");
+        return false;
+    }
+
+    // 由内核从缓冲区环中挑选缓冲区
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = IoUring::kBufferGroup;
+    sqe->user_data = MakeUserData(OP_RECV, sd, gen);
+
+    if (limit == 0) {
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+    }
+    else {
+        sqe->len = (uint32_t) min(limit, BufferPool::SLAB_SIZE);
+    }
+
+    return true;
+}
+
+bool EventLoop::ArmSend(SOCKET sd, const Outgoing &out) {
+    auto sqe = m_ring->GetSqe();
+    if (!sqe) {
+        Logger::LogError(__FUNC__ "io_uring submission queue is full");
+        return false;
+    }
+
+    // 数据不大，复制的开销比 SEND_ZC 锁定页面、多一个通知完成项要小
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = sd;
+    sqe->addr = (uint64_t) (uintptr_t) out.sending.data();
+    sqe->len = (uint32_t) min(out.sending.size(), (size_t) INT_MAX);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = MakeUserData(OP_SEND, sd, out.gen);
+
+    return true;
+}
+
+void EventLoop::CompleteRecv(SOCKET sd, uint32_t gen, const io_uring_cqe &cqe) {
+    char *data = nullptr;
+    int bid = -1;
+
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+        bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        data = m_recvBuffers[bid];
+    }
+
+    long len = cqe.res;
+    auto it(m_handlers.find(sd));
+
+    if (it != m_handlers.end() && it->second.recvGen == gen) {
+        auto &r = it->second;
+        auto handler = r.handler;
+
+        // 内核没有设置 F_MORE 说明这次接收已经结束
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            bool restart;
+            if (r.recvStopping) {
+                restart = r.recvRestart;
+                if (len < 0) {
+                    len = -ECANCELED;
+                }
+            }
+            else {
+                // 缓冲区暂时用尽、完成队列溢出时重新开始
+                restart = len == -ENOBUFS || (len > 0 && r.recvLimit == 0);
+            }
+
+            r.recvGen = 0;
+            r.recvStopping = false;
+            r.recvRestart = false;
+
+            if (restart) {
+                auto next = NextGen();
+                if (ArmRecv(sd, r.recvLimit, next)) {
+                    r.recvGen = next;
+                }
+                else if (len <= 0) {
+                    len = -EBUSY;
+                }
+            }
+
+            if (len == -ENOBUFS && r.recvGen != 0) {
+                return;
+            }
+        }
+
+        handler->OnRecv(sd, data, len);
+    }
+
+    // 处理者可能已经不在了，缓冲区照样归还
+    if (bid >= 0) {
+        m_ring->RecycleBuffer(bid);
+    }
+}
+
+void EventLoop::CompleteSend(SOCKET sd, uint32_t gen, const io_uring_cqe &cqe) {
+    auto it(m_handlers.find(sd));
+    if (it == m_handlers.end() || !it->second.out || it->second.out->gen != gen) {
+        // 连接已被移除
+        m_orphans.erase(MakeUserData(OP_SEND, sd, gen));
+        return;
+    }
+
+    auto &r = it->second;
+    auto &out = *r.out;
+    int error = 0;
+
+    if (cqe.res > 0) {
+        // 只发出一部分时接着发送剩下的
+        out.sending.Consume(cqe.res);
+        if (out.sending.empty()) {
+            out.sending.Swap(out.queued);
+        }
+
+        if (!out.sending.empty()) {
+            if (ArmSend(sd, out)) {
+                return;
+            }
+
+            error = EBUSY;
+        }
+    }
+    else {
+        error = cqe.res < 0 ? -cqe.res : EPIPE;
+    }
+
+    if (error != 0) {
+        out.sending.Clear();
+        out.queued.Clear();
+    }
+
+    r.handler->OnSent(sd, error);
+}
+
+void EventLoop::ArmWakeup() {
+    auto sqe = m_ring->GetSqe();
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = m_wakeup;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = MakeUserData(OP_POLL, m_wakeup, 0);
+}
+
+bool EventLoop::DispatchRing(int timeout) {
+    // 之前积攒的增删改与等待一并提交
+    if (!m_ring->Submit(timeout)) {
+        Logger::LogError(WSAGetLastErrorMessage(__FUNC__ "io_uring_enter() failed"));
+        return false;
+    }
+
+    io_uring_cqe cqe;
+    while (m_ring->PopCqe(cqe)) {
+        if (cqe.user_data == 0) {
+            continue;
+        }
+
+        auto op = (unsigned) (cqe.user_data >> 62);
+        auto sd = (SOCKET) (uint32_t) cqe.user_data;
+        auto gen = (uint32_t) (cqe.user_data >> 32) & kGenMask;
+
+        if (op == OP_RECV) {
+            CompleteRecv(sd, gen, cqe);
+            continue;
+        }
+
+        if (op == OP_SEND) {
+            CompleteSend(sd, gen, cqe);
+            continue;
+        }
+
+        // 内核没有设置 F_MORE 说明这个 poll 已经结束
+        bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+
+        if (gen == 0) {
+            uint64_t count;
+            while (read(m_wakeup, &count, sizeof(count)) > 0);
+
+            if (!more) {
+                ArmWakeup();
+            }
+
+            continue;
+        }
+
+        // 处理者可能已被移除，或者关注的事件已经改变
+        auto it(m_handlers.find(sd));
+        if (it == m_handlers.end() || it->second.gen != gen) {
+            continue;
+        }
+
+        int ev = 0;
+
+        if (cqe.res >= 0) {
+            uint32_t e = cqe.res;
+
+            if (e & (POLLIN | POLLRDHUP)) {
+                ev |= EV_READ;
+            }
+
+            if (e & POLLOUT) {
+                ev |= EV_WRITE;
+            }
+
+            if (e & (POLLERR | POLLHUP)) {
+                ev |= EV_ERROR;
+            }
+
+            // 例如完成队列溢出时，重新登记
+            if (!more) {
+                it->second.gen = NextGen();
+                ArmPoll(sd, it->second.events, it->second.gen);
+            }
+        }
+        else if (cqe.res != -ECANCELED) {
+            ev = EV_ERROR | EV_READ;
+        }
+
+        if (ev != 0) {
+            it->second.handler->OnEvents(sd, ev);
+        }
+    }
+
+    return true;
+}
+
+#endif // HAVE_IO_URING
+
+#else // !__linux__
+
+EventLoop::EventLoop() : m_stop(false) {
+    // 没有 eventfd，用一个连接到自身的 UDP SOCKET 代替
+    m_wakeup = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (m_wakeup == INVALID_SOCKET) {
+        return;
+    }
+
+    sockaddr_in addr;
+    ZeroMemory(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    socklen_t len = sizeof(addr);
+    if (bind(m_wakeup, (sockaddr *) &addr, len) != 0 ||
+        getsockname(m_wakeup, (sockaddr *) &addr, &len) != 0 ||
+        connect(m_wakeup, (sockaddr *) &addr, len) != 0 ||
+        !SetNonBlocking(m_wakeup)) {
+        closesocket(m_wakeup);
+        m_wakeup = INVALID_SOCKET;
+    }
+}
+
+EventLoop::~EventLoop() {
+    if (m_wakeup != INVALID_SOCKET) {
+        closesocket(m_wakeup);
+    }
+}
+
+bool EventLoop::IsOk() const {
+    return m_wakeup != INVALID_SOCKET;
+}
+
+bool EventLoop::Add(SOCKET sd, int events, Handler *handler) {
+    m_handlers[sd] = Registration(handler, events);
+    return true;
+}
+
+bool EventLoop::Modify(SOCKET sd, int events) {
+    auto it(m_handlers.find(sd));
+    if (it == m_handlers.end()) {
+        return false;
+    }
+
+    it->second.events = events;
+    return true;
+}
+
+void EventLoop::Remove(SOCKET sd) {
+    m_handlers.erase(sd);
+}
+
+void EventLoop::Wakeup() {
+    char ch = 0;
+    send(m_wakeup, &ch, 1, 0);
+}
+
+bool EventLoop::Dispatch(int timeout) {
+    vector<pollfd> fds;
+    fds.reserve(m_handlers.size() + 1);
+
+    pollfd pfd;
+    pfd.fd = m_wakeup;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    fds.push_back(pfd);
+
+    for (auto &r : m_handlers) {
+        pfd.fd = r.first;
+        pfd.events = 0;
+
+        if (r.second.events & EV_READ) {
+            pfd.events |= POLLIN;
+        }
+
+        if (r.second.events & EV_WRITE) {
+            pfd.events |= POLLOUT;
+        }
+
+        fds.push_back(pfd);
+    }
+
+    int n = poll(fds.data(), fds.size(), timeout);
+    if (n == SOCKET_ERROR) {
+        if (WouldBlock()) {
+            return true;
+        }
+
+        Logger::LogError(WSAGetLastErrorMessage(__FUNC__ "poll() failed"));
+        return false;
+    }
+
+    if (fds[0].revents) {
+        char buf[64];
+        while (recv(m_wakeup, buf, sizeof(buf), 0) > 0);
+    }
+
+    for (size_t i = 1; i < fds.size() && n > 0; i++) {
+        short e = fds[i].revents;
+        if (e == 0) {
+            continue;
+        }
+
+        auto it(m_handlers.find(fds[i].fd));
+        if (it == m_handlers.end()) {
+            continue;
+        }
+
+        int ev = 0;
+
+        if (e & POLLIN) {
+            ev |= EV_READ;
+        }
+
+        if (e & POLLOUT) {
+            ev |= EV_WRITE;
+        }
+
+        if (e & (POLLERR | POLLHUP | POLLNVAL)) {
+            ev |= EV_ERROR | EV_READ;
+        }
+
+        it->second.handler->OnEvents(fds[i].fd, ev);
+    }
+
+    return true;
+}
+
+#endif // __linux__
+
+bool EventLoop::HasAsyncIo() const {
+#ifdef HAVE_IO_URING
+    return m_asyncIo;
+#else
+    return false;
+#endif
+}
+
+bool EventLoop::StartRecv(SOCKET sd, size_t limit) {
+#ifdef HAVE_IO_URING
+    auto it(m_handlers.find(sd));
+    if (!m_asyncIo || it == m_handlers.end()) {
+        return false;
+    }
+
+    auto &r = it->second;
+    r.recvLimit = limit;
+
+    // 撤销尚未生效时等它结束再重新开始，接收不能同时有两个
+    if (r.recvGen != 0) {
+        if (r.recvStopping) {
+            r.recvRestart = true;
+        }
+
+        return true;
+    }
+
+    auto gen = NextGen();
+    if (!ArmRecv(sd, limit, gen)) {
+        return false;
+    }
+
+    r.recvGen = gen;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void EventLoop::StopRecv(SOCKET sd) {
+#ifdef HAVE_IO_URING
+    auto it(m_handlers.find(sd));
+    if (it == m_handlers.end() || it->second.recvGen == 0) {
+        return;
+    }
+
+    auto &r = it->second;
+    r.recvRestart = false;
+
+    if (!r.recvStopping) {
+        r.recvStopping = true;
+        Cancel(MakeUserData(OP_RECV, sd, r.recvGen));
+    }
+#endif
+}
+
+bool EventLoop::IsReceiving(SOCKET sd) const {
+    auto it(m_handlers.find(sd));
+    return it != m_handlers.end() && it->second.recvGen != 0;
+}
+
+bool EventLoop::Send(SOCKET sd, IoBuffer &data) {
+#ifdef HAVE_IO_URING
+    auto it(m_handlers.find(sd));
+    if (!m_asyncIo || it == m_handlers.end()) {
+        return false;
+    }
+
+    if (data.empty()) {
+        return true;
+    }
+
+    auto &r = it->second;
+    if (!r.out) {
+        r.out.reset(new Outgoing);
+        r.out->gen = NextGen();
+    }
+
+    auto &out = *r.out;
+    if (!out.sending.empty()) {
+        if (out.queued.empty()) {
+            out.queued.Swap(data);
+        }
+        else {
+            out.queued.Append(data.data(), data.size());
+            data.Clear();
+        }
+
+        return true;
+    }
+
+    out.sending.Swap(data);
+    return ArmSend(sd, out);
+#else
+    return false;
+#endif
+}
+
+size_t EventLoop::Unsent(SOCKET sd) const {
+    auto it(m_handlers.find(sd));
+    if (it == m_handlers.end() || !it->second.out) {
+        return 0;
+    }
+
+    auto &out = *it->second.out;
+    return out.sending.size() + out.queued.size();
+}
+
+EventLoop::TimerId EventLoop::AddTimer(unsigned ms, function<void()> fn) {
+    return m_timers.Add(Ticks() + ms, move(fn));
+}
+
+void EventLoop::CancelTimer(TimerId id) {
+    m_timers.Cancel(id);
+}
+
+int EventLoop::NextTimeout() const {
+    TimerWheel::Tick next;
+    if (!m_timers.NextTick(next)) {
+        return -1;
+    }
+
+    // 下一个时刻也可能只是把定时器下移一层，醒来得早一些无妨
+    auto now = Ticks();
+    if (next <= now) {
+        return 0;
+    }
+
+    return (int) min(next - now, (TimerWheel::Tick) INT_MAX);
+}
+
+void EventLoop::RunTimers() {
+    m_timers.Advance(Ticks());
+}
+
+TimerWheel::Tick EventLoop::Ticks() const {
+    auto elapsed = Clock::now() - m_start;
+    return chrono::duration_cast<chrono::milliseconds>(elapsed).count();
+}
+
+void EventLoop::Post(function<void()> fn) {
+    bool wasEmpty;
+
+    {
+        lock_guard<mutex> lock(m_postMutex);
+
+        wasEmpty = m_posted.empty();
+        m_posted.push_back(move(fn));
+    }
+
+    if (wasEmpty) {
+        Wakeup();
+    }
+}
+
+void EventLoop::RunPosted() {
+    vector<function<void()>> posted;
+
+    {
+        lock_guard<mutex> lock(m_postMutex);
+        posted.swap(m_posted);
+    }
+
+    for (auto &fn : posted) {
+        fn();
+    }
+}
+
+void EventLoop::Run() {
+    while (!m_stop) {
+        if (!Dispatch(NextTimeout())) {
+            break;
+        }
+
+        RunTimers();
+        RunPosted();
+    }
+}
+
+void EventLoop::Stop() {
+    m_stop = true;
+    Wakeup();
+}
@@ -0,0 +1,249 @@
+#pragma once
+#include "ws-util.h"
+#include "IoUring.hpp"
+#include "TimerWheel.hpp"
+#include "BufferPool.hpp"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+/// 事件循环
+/// 
+/// Linux 下使用边缘触发的 epoll，其他平台退而使用 poll/WSAPoll。
+/// Linux 上也可以选用 io_uring：关注的事件以 multishot poll 的形式登记，
+/// 事件的增删改只是填写提交项，与等待合并为一次 io_uring_enter()。
+/// 内核支持时（6.0 以上）还可以按完成的方式收发数据，见 HasAsyncIo()。
+/// 每个工作线程运行一个事件循环，注册在其上的 SOCKET 只在该线程中处理。
+/// 另外提供毫秒精度的一次性定时器，由分层的时间轮（见 TimerWheel）管理，
+/// 数以十万计的连接各自设置、取消超时也只是常数时间。
+class EventLoop {
+public:
+
+    /// 事件类型
+    enum Events {
+        EV_READ = 1, ///< 可读
+        EV_WRITE = 2, ///< 可写
+        EV_ERROR = 4, ///< 出错或对方已挂断（只作为结果出现）
+    };
+
+    /// 事件处理者
+    class Handler {
+    public:
+
+        virtual ~Handler() {}
+
+        /// @a sd 上发生了 @a events 所示的事件
+        virtual void OnEvents(SOCKET sd, int events) = 0;
+
+        /// StartRecv() 收到了数据
+        /// 
+        /// @a data 只在调用期间有效，可以就地修改。@a len 为 0 表示对方已经
+        /// 关闭连接，为负时表示出错（-errno，StopRecv() 撤销的是 -ECANCELED），
+        /// 这两种情况下 @a data 为空。
+        virtual void OnRecv(SOCKET /*sd*/, char * /*data*/, long /*len*/) {}
+
+        /// Send() 交付的数据已经全部发出（@a error 为 0），或者发送出错
+        virtual void OnSent(SOCKET /*sd*/, int /*error*/) {}
+    };
+
+    /// Linux 上是否使用 io_uring 代替 epoll
+    /// 
+    /// 默认关闭。内核不支持（早于 5.13 或被禁用）时自动退回 epoll。
+    static bool IO_URING;
+
+    /// 构造函数
+    EventLoop();
+
+    /// 析构函数
+    ~EventLoop();
+
+    /// 事件循环是否可用
+    bool IsOk() const;
+
+    /// 开始关注 @a sd 上的事件
+    /// 
+    /// 以下三个函数都只能在事件循环所在的线程中调用。
+    bool Add(SOCKET sd, int events, Handler *handler);
+
+    /// 修改 @a sd 关注的事件
+    bool Modify(SOCKET sd, int events);
+
+    /// 不再关注 @a sd 上的事件
+    /// 
+    /// 进行中的接收与发送随之撤销，未发出的数据被丢弃。
+    void Remove(SOCKET sd);
+
+    /// 是否可以用下面的函数以完成的方式收发数据
+    /// 
+    /// 仅限 io_uring（6.0 以上）。数据由内核直接收进事件循环登记的缓冲区环
+    /// （由 BufferPool 的块组成），发送只是填写提交项，收发都不再各需一次
+    /// 系统调用，而是与等待合并进同一次 io_uring_enter()。
+    bool HasAsyncIo() const;
+
+    /// 开始接收 @a sd 上的数据，交给 Handler::OnRecv()
+    /// 
+    /// 以下五个函数都只能在事件循环所在的线程中调用，@a sd 必须已经 Add()。
+    /// 
+    /// @param limit 为 0 时持续接收（multishot recv），直至出错、对方关闭
+    ///        或者 StopRecv()；否则只接收一次、最多 @a limit 个字节，
+    ///        不会读走属于后面的数据，之后需要再次调用
+    bool StartRecv(SOCKET sd, size_t limit = 0);
+
+    /// 停止接收
+    /// 
+    /// 撤销生效之前收到的数据仍会交付。接收结束之前 IsReceiving() 一直
+    /// 返回 true，此时不能再用 recv() 读取 @a sd。
+    void StopRecv(SOCKET sd);
+
+    /// 接收是否尚未结束
+    bool IsReceiving(SOCKET sd) const;
+
+    /// 发送 @a data 中的数据，@a data 随即被清空
+    /// 
+    /// 数据由事件循环保管到发出为止，排在之前交付而尚未发完的数据之后。
+    /// 全部发出之后调用 Handler::OnSent()。
+    bool Send(SOCKET sd, IoBuffer &data);
+
+    /// 交给 Send() 而尚未发出的字节数
+    size_t Unsent(SOCKET sd) const;
+
+    /// 定时器标识，0 表示无效
+    typedef TimerWheel::Id TimerId;
+
+    /// @a ms 毫秒之后执行 @a fn（只执行一次）
+    /// 
+    /// 以下两个函数都只能在事件循环所在的线程中调用。
+    TimerId AddTimer(unsigned ms, std::function<void()> fn);
+
+    /// 取消尚未触发的定时器
+    void CancelTimer(TimerId id);
+
+    /// 在事件循环所在的线程中执行 @a fn
+    /// 
+    /// 可以在任意线程中调用。
+    void Post(std::function<void()> fn);
+
+    /// 运行事件循环，直至 Stop() 被调用
+    void Run();
+
+    /// 停止事件循环
+    /// 
+    /// 可以在任意线程中调用。
+    void Stop();
+
+private:
+
+    struct Outgoing;
+
+    // 唤醒阻塞在等待事件中的事件循环
+    void Wakeup();
+
+    // 执行其他线程投递过来的任务
+    void RunPosted();
+
+    // 等待并分发事件
+    // 
+    // @param timeout 最长等待的毫秒数，-1 表示一直等待
+    bool Dispatch(int timeout);
+
+    // 距离最近的定时器触发还有多少毫秒，没有定时器时返回 -1
+    int NextTimeout() const;
+
+    // 执行所有已到期的定时器
+    void RunTimers();
+
+    // 自事件循环创建以来经过的毫秒数，即时间轮的时刻
+    TimerWheel::Tick Ticks() const;
+
+#ifdef HAVE_IO_URING
+    // 登记 @a sd 的 multishot poll，完成项以 @a gen 标识
+    bool ArmPoll(SOCKET sd, int events, uint32_t gen);
+
+    // 撤销一个 poll
+    void CancelPoll(SOCKET sd, uint32_t gen);
+
+    // 撤销 user_data 为 @a userData 的操作
+    void Cancel(uint64_t userData);
+
+    // 登记缓冲区环，内核支持时打开 HasAsyncIo()
+    void SetUpAsyncIo();
+
+    // 登记 @a sd 的接收，完成项以 @a gen 标识
+    bool ArmRecv(SOCKET sd, size_t limit, uint32_t gen);
+
+    // 提交 @a out 中正在发送的数据
+    bool ArmSend(SOCKET sd, const Outgoing &out);
+
+    // 处理接收、发送的完成项
+    void CompleteRecv(SOCKET sd, uint32_t gen, const io_uring_cqe &cqe);
+    void CompleteSend(SOCKET sd, uint32_t gen, const io_uring_cqe &cqe);
+
+    // 登记 eventfd 的 poll
+    void ArmWakeup();
+
+    // 由 io_uring 等待并分发事件
+    bool DispatchRing(int timeout);
+
+    // 分配新的代号，0 留给 eventfd
+    uint32_t NextGen();
+#endif
+
+private:
+
+    // 交给 Send() 的数据
+    struct Outgoing {
+        IoBuffer sending; // 已经提交给内核
+        IoBuffer queued; // 等待 sending 发完
+        uint32_t gen;
+    };
+
+    struct Registration {
+        explicit Registration(Handler *handler = nullptr, int events = 0,
+                              uint32_t gen = 0)
+            : handler(handler), events(events), gen(gen) {}
+
+        Handler *handler;
+        int events;
+        uint32_t gen; // io_uring 下用于识别过时的完成项
+        uint32_t recvGen = 0; // 进行中的接收，0 表示没有
+        size_t recvLimit = 0;
+        bool recvStopping = false; // 已经撤销，等待结束
+        bool recvRestart = false; // 结束之后重新开始
+        std::unique_ptr<Outgoing> out;
+    };
+
+    std::unordered_map<SOCKET, Registration> m_handlers;
+
+    typedef std::chrono::steady_clock Clock;
+
+    const Clock::time_point m_start = Clock::now();
+    TimerWheel m_timers;
+
+    std::mutex m_postMutex;
+    std::vector<std::function<void()>> m_posted;
+
+    std::atomic_bool m_stop;
+
+#ifdef __linux__
+    int m_epfd;
+    int m_wakeup; // eventfd
+
+#ifdef HAVE_IO_URING
+    std::unique_ptr<IoUring> m_ring;
+    uint32_t m_lastGen = 0;
+
+    bool m_asyncIo = false;
+    std::vector<char *> m_recvBuffers; // 缓冲区环中的块
+
+    // 连接移除时还在发送的数据，保留到完成项返回，以 user_data 为键
+    std::unordered_map<uint64_t, std::unique_ptr<Outgoing>> m_orphans;
+#endif
+#else
+    SOCKET m_wakeup; // 连接到自身的 UDP SOCKET
+#endif
+};
@@ -0,0 +1,359 @@
+#include "HttpParser.hpp"
+#include "Scanner.hpp"
+
+#include <cstring>
+
+//////////////////////////////////////////////////////////////////////////
+
+static inline char LowerAscii(char ch) {
+    return (ch >= 'A' && ch <= 'Z') ? (char) (ch - 'A' + 'a') : ch;
+}
+
+static inline bool IsWhiteSpace(char ch) {
+    return ch == ' ' || ch == '\t';
+}
+
+bool StrView::Equals(const char *s) const {
+    return strlen(s) == size && memcmp(data, s, size) == 0;
+}
+
+bool StrView::EqualsNoCase(const char *s) const {
+    for (size_t i = 0; i < size; i++) {
+        if (s[i] == 0 || LowerAscii(data[i]) != LowerAscii(s[i])) {
+            return false;
+        }
+    }
+
+    return s[size] == 0;
+}
+
+bool StrView::HasToken(const char *token) const {
+    size_t b = 0;
+
+    while (b < size) {
+        auto comma = (const char *) memchr(data + b, ',', size - b);
+        size_t e = comma ? comma - data : size;
+        size_t next = e + 1;
+
+        while (b < e && IsWhiteSpace(data[b])) {
+            b++;
+        }
+
+        while (e > b && IsWhiteSpace(data[e - 1])) {
+            e--;
+        }
+
+        if (StrView(data + b, e - b).EqualsNoCase(token)) {
+            return true;
+        }
+
+        b = next;
+    }
+
+    return false;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+HttpParser::HttpParser(Type type) : m_type(type) {
+    Reset();
+}
+
+void HttpParser::Reset() {
+    status_code = 0;
+    contentLength = -1;
+
+    m_state = ST_START_LINE;
+    m_base = nullptr;
+    m_pos = 0;
+    m_lineBegin = 0;
+    m_headerSize = 0;
+
+    m_method = m_target = m_version = Span{ 0, 0 };
+    m_minorVersion = 0;
+
+    m_fieldCount = 0;
+    m_colon = kNoColon;
+
+    m_keepAlive = false;
+    m_chunked = false;
+}
+
+HttpParser::Result HttpParser::Parse(char *buf, size_t len) {
+    m_base = buf;
+
+    if (m_state == ST_DONE) {
+        return PARSE_DONE;
+    }
+
+    while (m_pos < len) {
+        const char *colon;
+        auto lf = Scanner::FindLineEnd(buf + m_pos, len - m_pos, &colon);
+
+        if (colon && m_colon == kNoColon) {
+            m_colon = colon - buf;
+        }
+
+        if (!lf) {
+            m_pos = len;
+            break;
+        }
+
+        size_t end = lf - buf;
+        size_t next = end + 1;
+
+        // 兼容只以 LF 结尾的行
+        if (end > m_lineBegin && buf[end - 1] == '\r') {
+            end--;
+        }
+
+        if (!OnLine(buf, m_lineBegin, end, next)) {
+            return PARSE_ERROR;
+        }
+
+        m_lineBegin = m_pos = next;
+        m_colon = kNoColon;
+
+        if (m_state == ST_DONE) {
+            return PARSE_DONE;
+        }
+    }
+
+    return m_pos > kMaxHeaderSize ? PARSE_ERROR : PARSE_AGAIN;
+}
+
+bool HttpParser::OnLine(char *buf, size_t begin, size_t end, size_t next) {
+    if (next > kMaxHeaderSize) {
+        return false;
+    }
+
+    bool ok;
+
+    if (m_state == ST_START_LINE) {
+        // 忽略起始行之前的空行
+        if (begin == end) {
+            return true;
+        }
+
+        ok = (m_type == REQUEST) ? ParseRequestLine(buf, begin, end)
+                                 : ParseStatusLine(buf, begin, end);
+        m_state = ST_FIELDS;
+    }
+    else if (begin == end) {
+        m_headerSize = next;
+        m_state = ST_DONE;
+
+        return OnHeadersComplete();
+    }
+    else if (IsWhiteSpace(buf[begin])) {
+        ok = FoldLine(buf, begin, end);
+    }
+    else {
+        ok = ParseField(buf, begin, end);
+    }
+
+    return ok;
+}
+
+// 解析 "HTTP/1.x"，返回 x
+static int ParseVersion(const char *s, size_t len) {
+    if (len != 8 || memcmp(s, "HTTP/1.", 7) != 0 ||
+        s[7] < '0' || s[7] > '9') {
+        return -1;
+    }
+
+    return s[7] - '0';
+}
+
+bool HttpParser::ParseRequestLine(const char *buf, size_t begin, size_t end) {
+    auto sp1 = (const char *) memchr(buf + begin, ' ', end - begin);
+    if (!sp1) {
+        return false;
+    }
+
+    size_t m = sp1 - buf;
+    auto sp2 = (const char *) memchr(sp1 + 1, ' ', end - m - 1);
+    if (!sp2) {
+        return false;
+    }
+
+    size_t t = sp2 - buf;
+    if (m == begin || t == m + 1) {
+        return false;
+    }
+
+    m_method = Span{ (uint32_t) begin, (uint32_t) (m - begin) };
+    m_target = Span{ (uint32_t) (m + 1), (uint32_t) (t - m - 1) };
+    m_version = Span{ (uint32_t) (t + 1), (uint32_t) (end - t - 1) };
+
+    m_minorVersion = ParseVersion(buf + t + 1, end - t - 1);
+    return m_minorVersion >= 0;
+}
+
+bool HttpParser::ParseStatusLine(const char *buf, size_t begin, size_t end) {
+    // HTTP/1.1 200 OK
+    if (end - begin < 12 || buf[begin + 8] != ' ') {
+        return false;
+    }
+
+    m_version = Span{ (uint32_t) begin, 8 };
+    m_minorVersion = ParseVersion(buf + begin, 8);
+    if (m_minorVersion < 0) {
+        return false;
+    }
+
+    const char *code = buf + begin + 9;
+    status_code = 0;
+
+    for (int i = 0; i < 3; i++) {
+        if (code[i] < '0' || code[i] > '9') {
+            return false;
+        }
+
+        status_code = status_code * 10 + (code[i] - '0');
+    }
+
+    return end - begin == 12 || code[3] == ' ';
+}
+
+bool HttpParser::ParseField(const char *buf, size_t begin, size_t end) {
+    if (m_fieldCount == kMaxFields) {
+        return false;
+    }
+
+    size_t c = m_colon;
+    if (c == kNoColon || c == begin || c >= end) {
+        return false;
+    }
+
+    // 字段名与冒号之间不允许有空白
+    if (IsWhiteSpace(buf[c - 1])) {
+        return false;
+    }
+
+    size_t b = c + 1, e = end;
+    while (b < e && IsWhiteSpace(buf[b])) {
+        b++;
+    }
+
+    while (e > b && IsWhiteSpace(buf[e - 1])) {
+        e--;
+    }
+
+    auto &field = m_fields[m_fieldCount++];
+    field.name = Span{ (uint32_t) begin, (uint32_t) (c - begin) };
+    field.value = Span{ (uint32_t) b, (uint32_t) (e - b) };
+
+    return true;
+}
+
+bool HttpParser::FoldLine(char *buf, size_t begin, size_t end) {
+    if (m_fieldCount == 0) {
+        return false;
+    }
+
+    size_t b = begin, e = end;
+    while (b < e && IsWhiteSpace(buf[b])) {
+        b++;
+    }
+
+    while (e > b && IsWhiteSpace(buf[e - 1])) {
+        e--;
+    }
+
+    if (b == e) {
+        return true; // 空的续行
+    }
+
+    auto &value = m_fields[m_fieldCount - 1].value;
+    if (value.length == 0) {
+        value = Span{ (uint32_t) b, (uint32_t) (e - b) };
+        return true;
+    }
+
+    // 把值与续行之间的空白和换行替换为空格，值就又是连续的了
+    for (size_t i = value.offset + value.length; i < b; i++) {
+        buf[i] = ' ';
+    }
+
+    value.length = (uint32_t) (e - value.offset);
+    return true;
+}
+
+bool HttpParser::OnHeadersComplete() {
+    StrView connection;
+
+    for (size_t i = 0; i < m_fieldCount; i++) {
+        auto name = FieldName(i);
+
+        if (name.EqualsNoCase("Content-Length")) {
+            auto value = FieldValue(i);
+            if (value.Empty() || value.size > 18) {
+                return false;
+            }
+
+            long long n = 0;
+            for (size_t j = 0; j < value.size; j++) {
+                if (value.data[j] < '0' || value.data[j] > '9') {
+                    return false;
+                }
+
+                n = n * 10 + (value.data[j] - '0');
+            }
+
+            // 多个互相矛盾的 Content-Length
+            if (contentLength != -1 && contentLength != n) {
+                return false;
+            }
+
+            contentLength = n;
+        }
+        else if (name.EqualsNoCase("Transfer-Encoding")) {
+            m_chunked = FieldValue(i).HasToken("chunked");
+        }
+        else if (name.EqualsNoCase("Connection")) {
+            connection = FieldValue(i);
+        }
+        else if (m_type == REQUEST && connection.Empty() &&
+                 name.EqualsNoCase("Proxy-Connection")) {
+            connection = FieldValue(i);
+        }
+    }
+
+    // Transfer-Encoding 优先于 Content-Length
+    if (m_chunked) {
+        contentLength = -1;
+    }
+
+    // HTTP/1.1 默认保持连接，HTTP/1.0 默认不保持
+    if (m_minorVersion >= 1) {
+        m_keepAlive = !connection.HasToken("close");
+    }
+    else {
+        m_keepAlive = connection.HasToken("keep-alive");
+    }
+
+    return true;
+}
+
+StrView HttpParser::Find(const char *name) const {
+    for (size_t i = 0; i < m_fieldCount; i++) {
+        if (FieldName(i).EqualsNoCase(name)) {
+            return FieldValue(i);
+        }
+    }
+
+    return StrView();
+}
+
+bool HttpParser::DetermineFinishedByStatusCode() const {
+    if (status_code == 0) {
+        return false;
+    }
+
+    if (status_code < 200 || status_code == 204 || status_code == 304) {
+        return true;
+    }
+
+    return false;
+}
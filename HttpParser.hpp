@@ -0,0 +1,197 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// 指向某个缓冲区中一段字符的视图（不拥有数据）
+struct StrView {
+    StrView() : data(nullptr), size(0) {}
+    StrView(const char *data, size_t size) : data(data), size(size) {}
+
+    bool Empty() const {
+        return size == 0;
+    }
+
+    /// 是否与 @a s 相等（区分大小写）
+    bool Equals(const char *s) const;
+
+    /// 是否与 @a s 相等（不区分大小写）
+    bool EqualsNoCase(const char *s) const;
+
+    /// 逗号分隔的列表中是否包含 @a token（不区分大小写）
+    bool HasToken(const char *token) const;
+
+    std::string ToString() const {
+        return std::string(data, size);
+    }
+
+    const char *data;
+    size_t size;
+};
+
+/// HTTP/1.x 头部解析器
+/// 
+/// 可以分多次喂入数据：每次传入迄今收到的全部数据，解析器从上一次停下的
+/// 位置接着扫描，整个头部只扫描一遍。头部字段只记录其在缓冲区中的位置，
+/// 不复制，也不分配内存。
+/// 
+/// 兼容只以 LF 结尾的行；obs-fold（以空白开头的续行）会被就地替换为空格。
+/// 行尾与冒号由 Scanner 一次扫描同时找出。
+class HttpParser {
+public:
+
+    /// 解析的对象
+    enum Type {
+        REQUEST, ///< 浏览器的请求
+        RESPONSE, ///< 服务器的回应
+    };
+
+    /// 解析结果
+    enum Result {
+        PARSE_DONE, ///< 头部已完整
+        PARSE_AGAIN, ///< 数据不完整，需要更多的数据
+        PARSE_ERROR, ///< 格式错误
+    };
+
+    /// 最多容纳的头部字段数
+    static const size_t kMaxFields = 100;
+
+    /// 头部的最大长度
+    static const size_t kMaxHeaderSize = 64 * 1024;
+
+    /// 构造函数
+    explicit HttpParser(Type type);
+
+    /// 重置，准备解析下一个头部
+    void Reset();
+
+    /// 解析 @a buf 中的 @a len 个字节
+    /// 
+    /// @a buf 是迄今收到的所有数据。两次调用之间可以往后追加数据，
+    /// 缓冲区也可以被重新分配，但已经传入的部分不能改变。
+    Result Parse(char *buf, size_t len);
+
+    /// 头部是否已完整
+    bool Done() const {
+        return m_state == ST_DONE;
+    }
+
+    /// 头部（包括结尾的空行）的长度，也就是数据体的偏移
+    size_t HeaderSize() const {
+        return m_headerSize;
+    }
+
+    /// 请求方法（仅请求）
+    StrView Method() const {
+        return View(m_method);
+    }
+
+    /// 请求目标（仅请求）
+    StrView Target() const {
+        return View(m_target);
+    }
+
+    /// HTTP 版本，如 "HTTP/1.1"
+    StrView Version() const {
+        return View(m_version);
+    }
+
+    /// 头部字段数
+    size_t FieldCount() const {
+        return m_fieldCount;
+    }
+
+    /// 第 @a i 个头部字段的名字
+    StrView FieldName(size_t i) const {
+        return View(m_fields[i].name);
+    }
+
+    /// 第 @a i 个头部字段的值（已去掉首尾的空白）
+    StrView FieldValue(size_t i) const {
+        return View(m_fields[i].value);
+    }
+
+    /// 查找第一个名为 @a name 的头部字段（不区分大小写）
+    /// 
+    /// @return 不存在时返回空视图
+    StrView Find(const char *name) const;
+
+    /// 是否保持连接
+    bool KeepAlive() const {
+        return m_keepAlive;
+    }
+
+    /// 根据状态码确定传输是否已然结束
+    bool DetermineFinishedByStatusCode() const;
+
+    /// 是否分段
+    bool IsChunked() const {
+        return m_chunked;
+    }
+
+public:
+
+    /// 状态码（仅回应）
+    int status_code = 0;
+
+    /// Content-Length，-1 表示没有
+    long long contentLength = -1;
+
+private:
+
+    // 缓冲区中的一段，以偏移表示，缓冲区重新分配后依然有效
+    struct Span {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    struct Field {
+        Span name, value;
+    };
+
+    enum State {
+        ST_START_LINE,
+        ST_FIELDS,
+        ST_DONE,
+    };
+
+    StrView View(const Span &span) const {
+        return StrView(m_base + span.offset, span.length);
+    }
+
+    // 处理完整的一行（不包括行尾的 CRLF 或 LF）
+    bool OnLine(char *buf, size_t begin, size_t end, size_t next);
+
+    bool ParseRequestLine(const char *buf, size_t begin, size_t end);
+    bool ParseStatusLine(const char *buf, size_t begin, size_t end);
+    bool ParseField(const char *buf, size_t begin, size_t end);
+
+    // 把 obs-fold 接到上一个字段的值之后
+    bool FoldLine(char *buf, size_t begin, size_t end);
+
+    // 头部完整后提取常用的信息
+    bool OnHeadersComplete();
+
+private:
+
+    Type m_type;
+    State m_state;
+
+    const char *m_base; // 最近一次传入的缓冲区
+    size_t m_pos; // 下一个要扫描的字节
+    size_t m_lineBegin; // 当前行的开头
+    size_t m_headerSize;
+
+    Span m_method, m_target, m_version;
+    int m_minorVersion;
+
+    Field m_fields[kMaxFields];
+    size_t m_fieldCount;
+
+    // 当前行中第一个冒号的位置，没有时为 kNoColon
+    static const size_t kNoColon = (size_t) -1;
+    size_t m_colon;
+
+    bool m_keepAlive;
+    bool m_chunked;
+};
@@ -0,0 +1,243 @@
+#include "IoUring.hpp"
+
+#ifdef HAVE_IO_URING
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////
+
+// 依赖的内核特性。RSRC_TAGS 与 multishot poll 同在 5.13 中加入，
+// 内核没有提供后者的特性位，以前者为准。
+static const unsigned kRequiredFeatures =
+    IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |
+    IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS;
+
+IoUring::IoUring(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+        return;
+    }
+
+    if ((params.features & kRequiredFeatures) != kRequiredFeatures) {
+        close(fd);
+        return;
+    }
+
+    const auto &sq = params.sq_off;
+    const auto &cq = params.cq_off;
+
+    // 提交队列与完成队列共用一块映射
+    m_ringSize = max(sq.array + params.sq_entries * sizeof(unsigned),
+                     cq.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    m_ringPtr = mmap(nullptr, m_ringSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (m_ringPtr == MAP_FAILED) {
+        m_ringPtr = nullptr;
+        close(fd);
+
+        return;
+    }
+
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        munmap(m_ringPtr, m_ringSize);
+        m_ringPtr = nullptr;
+        close(fd);
+
+        return;
+    }
+
+    auto ring = (char *) m_ringPtr;
+    m_sqes = (io_uring_sqe *) sqes;
+
+    m_sqHead = (unsigned *) (ring + sq.head);
+    m_sqTail = (unsigned *) (ring + sq.tail);
+    m_sqMask = *(unsigned *) (ring + sq.ring_mask);
+    m_sqEntries = params.sq_entries;
+    m_sqLocalTail = *m_sqTail;
+
+    // 提交项与其在数组中的位置一一对应
+    auto array = (unsigned *) (ring + sq.array);
+    for (unsigned i = 0; i < m_sqEntries; i++) {
+        array[i] = i;
+    }
+
+    m_cqHead = (unsigned *) (ring + cq.head);
+    m_cqTail = (unsigned *) (ring + cq.tail);
+    m_cqMask = *(unsigned *) (ring + cq.ring_mask);
+    m_cqes = (io_uring_cqe *) (ring + cq.cqes);
+
+    m_fd = fd;
+}
+
+IoUring::~IoUring() {
+    if (m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+
+    if (m_ringPtr) {
+        munmap(m_ringPtr, m_ringSize);
+    }
+
+    if (m_fd != -1) {
+        close(m_fd);
+    }
+
+    // 关闭实例时内核注销缓冲区环
+    if (m_bufRing) {
+        munmap(m_bufRing, m_bufRingSize);
+    }
+}
+
+io_uring_sqe *IoUring::GetSqe() {
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+
+    if (m_sqLocalTail - head == m_sqEntries) {
+        Submit(0);
+
+        head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+        if (m_sqLocalTail - head == m_sqEntries) {
+            return nullptr;
+        }
+    }
+
+    auto sqe = &m_sqes[m_sqLocalTail & m_sqMask];
+    m_sqLocalTail++;
+
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+bool IoUring::Submit(int timeout) {
+    __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+    unsigned toSubmit = m_sqLocalTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+
+    // GETEVENTS 同时会把溢出的完成项搬回完成队列
+    int ret;
+    if (timeout == 0) {
+        ret = Enter(toSubmit, 0, IORING_ENTER_GETEVENTS, nullptr, 0);
+    }
+    else if (timeout < 0) {
+        ret = Enter(toSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+    }
+    else {
+        __kernel_timespec ts;
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000LL;
+
+        io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64_t) (uintptr_t) &ts;
+
+        ret = Enter(toSubmit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                    &arg, sizeof(arg));
+    }
+
+    if (ret < 0) {
+        // 超时、被信号中断，或者完成队列暂时已满
+        return errno == ETIME || errno == EINTR ||
+               errno == EBUSY || errno == EAGAIN;
+    }
+
+    return true;
+}
+
+bool IoUring::PopCqe(io_uring_cqe &cqe) {
+    unsigned head = *m_cqHead;
+    if (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    cqe = m_cqes[head & m_cqMask];
+    __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+bool IoUring::Supports(unsigned opcode) {
+    const unsigned kMaxOps = 256;
+    vector<char> mem(sizeof(io_uring_probe) + kMaxOps * sizeof(io_uring_probe_op));
+
+    auto probe = (io_uring_probe *) mem.data();
+    if (Register(IORING_REGISTER_PROBE, probe, kMaxOps) < 0) {
+        return false;
+    }
+
+    return opcode <= probe->last_op &&
+           (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+}
+
+bool IoUring::SetUpBuffers(char *const *bufs, unsigned count, unsigned size) {
+    // 环由内核与我们共享，须按页对齐
+    size_t ringSize = count * sizeof(io_uring_buf);
+    void *ring = mmap(nullptr, ringSize, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (ring == MAP_FAILED) {
+        return false;
+    }
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) ring;
+    reg.ring_entries = count;
+    reg.bgid = kBufferGroup;
+
+    if (Register(IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        munmap(ring, ringSize);
+        return false;
+    }
+
+    m_bufRing = (io_uring_buf *) ring;
+    m_bufRingTail = &m_bufRing[0].resv;
+    m_bufRingSize = ringSize;
+    m_bufs = bufs;
+    m_bufSize = size;
+    m_bufMask = count - 1;
+
+    for (unsigned i = 0; i < count; i++) {
+        ProvideBuffer(i);
+    }
+
+    __atomic_store_n(m_bufRingTail, m_bufTail, __ATOMIC_RELEASE);
+    return true;
+}
+
+void IoUring::RecycleBuffer(unsigned bid) {
+    ProvideBuffer(bid);
+    __atomic_store_n(m_bufRingTail, m_bufTail, __ATOMIC_RELEASE);
+}
+
+void IoUring::ProvideBuffer(unsigned bid) {
+    // 不能整项赋值，以免覆盖环尾
+    auto &buf = m_bufRing[m_bufTail & m_bufMask];
+    buf.addr = (uint64_t) (uintptr_t) m_bufs[bid];
+    buf.len = m_bufSize;
+    buf.bid = (uint16_t) bid;
+
+    m_bufTail++;
+}
+
+int IoUring::Register(unsigned opcode, const void *arg, unsigned count) {
+    return (int) syscall(__NR_io_uring_register, m_fd, opcode, arg, count);
+}
+
+int IoUring::Enter(unsigned toSubmit, unsigned minComplete, unsigned flags,
+                   const void *arg, size_t argSize) {
+    return (int) syscall(__NR_io_uring_enter, m_fd, toSubmit, minComplete,
+                         flags, arg, argSize);
+}
+
+#endif // HAVE_IO_URING
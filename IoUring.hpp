@@ -0,0 +1,123 @@
+#pragma once
+
+// 需要 Linux 6.0 以上的头文件（multishot recv、缓冲区环）
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_RECV_MULTISHOT
+#define HAVE_IO_URING
+#endif
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <cstddef>
+#include <cstdint>
+
+/// io_uring 实例的简单封装
+/// 
+/// 直接使用系统调用，不依赖 liburing。只供单个线程使用。
+class IoUring {
+public:
+
+    /// 创建一个有 @a entries 个提交项的实例
+    /// 
+    /// 内核不支持（早于 5.13 或被禁用）时 IsOk() 返回 false。
+    explicit IoUring(unsigned entries);
+
+    /// 析构函数
+    ~IoUring();
+
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    /// 是否可用
+    bool IsOk() const {
+        return m_fd != -1;
+    }
+
+    /// 取一个空的提交项
+    /// 
+    /// 提交队列已满时先把已有的提交项交给内核。
+    io_uring_sqe *GetSqe();
+
+    /// 提交所有的提交项，并等待完成项
+    /// 
+    /// @param timeout 最长等待的毫秒数，-1 表示一直等待，0 表示不等待
+    /// @return 出错时返回 false（超时与被信号中断不算出错）
+    bool Submit(int timeout);
+
+    /// 取出下一个完成项
+    /// 
+    /// @return 没有更多的完成项时返回 false
+    bool PopCqe(io_uring_cqe &cqe);
+
+    /// 内核是否支持操作 @a opcode
+    bool Supports(unsigned opcode);
+
+    /// 登记接收用的缓冲区环（provided buffer ring，5.19 以上）
+    /// 
+    /// 带 IOSQE_BUFFER_SELECT、buf_group 为 kBufferGroup 的接收由内核
+    /// 从中挑选缓冲区，完成项的 flags 中带有所用缓冲区的编号。
+    /// 
+    /// @param bufs 各缓冲区的地址，下标即编号，须在实例销毁之前一直有效
+    /// @param count 缓冲区的个数，必须是 2 的幂
+    /// @param size 每个缓冲区的大小
+    bool SetUpBuffers(char *const *bufs, unsigned count, unsigned size);
+
+    /// 把编号为 @a bid 的缓冲区还给内核
+    void RecycleBuffer(unsigned bid);
+
+    /// 缓冲区环的组号
+    static const uint16_t kBufferGroup = 0;
+
+private:
+
+    // 调用 io_uring_enter()
+    int Enter(unsigned toSubmit, unsigned minComplete, unsigned flags,
+              const void *arg, size_t argSize);
+
+    // 调用 io_uring_register()
+    int Register(unsigned opcode, const void *arg, unsigned count);
+
+    // 把缓冲区放进缓冲区环，但不更新环尾
+    void ProvideBuffer(unsigned bid);
+
+private:
+
+    int m_fd = -1;
+
+    void *m_ringPtr = nullptr;
+    size_t m_ringSize = 0;
+
+    io_uring_sqe *m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    // 提交队列
+    unsigned *m_sqHead = nullptr;
+    unsigned *m_sqTail = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned m_sqEntries = 0;
+    unsigned m_sqLocalTail = 0; // 已经填好、尚未提交的提交项之后
+
+    // 完成队列
+    unsigned *m_cqHead = nullptr;
+    unsigned *m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    io_uring_cqe *m_cqes = nullptr;
+
+    // 缓冲区环
+    // 
+    // 头文件中的 bufs 在 C++ 下偏移不对（空结构占一个字节），直接按数组访问，
+    // 环尾与第一项的 resv 共用同一位置。
+    io_uring_buf *m_bufRing = nullptr;
+    uint16_t *m_bufRingTail = nullptr;
+    size_t m_bufRingSize = 0;
+    char *const *m_bufs = nullptr;
+    unsigned m_bufSize = 0;
+    unsigned m_bufMask = 0;
+    uint16_t m_bufTail = 0;
+};
+
+#endif // HAVE_IO_URING
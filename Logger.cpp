@@ -1,24 +1,578 @@
 #include "Logger.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
 #include <mutex>
-#include <sstream>
+#include <thread>
+#include <vector>
 
+#ifdef _WIN32
 #include <Windows.h>
 
+static void gmtime_r(const time_t *t, tm *result) {
+    gmtime_s(result, t);
+}
+#else
+#include <unistd.h>
+#include <sys/syscall.h>
+
+static unsigned long GetCurrentThreadId() {
+    return (unsigned long) syscall(SYS_gettid);
+}
+
+static void OutputDebugStringA(const char *msg) {
+    fputs(msg, stderr);
+}
+#endif
+
+using namespace std;
+
 //////////////////////////////////////////////////////////////////////////
 
 bool Logger::CONSOLE = false;
 Logger::OutputLevel Logger::LEVEL = Logger::OL_ERROR;
+string Logger::PATH;
+string Logger::ACCESS_PATH;
+size_t Logger::MAX_FILE_SIZE = 64 * 1024 * 1024;
+unsigned Logger::MAX_FILES = 5;
+
+namespace {
+
+// 单条消息的最大长度，更长的被截断
+const size_t kMaxMessageSize = 16 * 1024;
+
+// 记录的种类
+enum Kind : uint8_t {
+    RK_INFO,
+    RK_ERROR,
+    RK_ACCESS,
+};
+
+// 记录的头部，之后紧跟着 size 字节的内容
+struct RecordHeader {
+    uint32_t size;
+    uint32_t tid;
+    int64_t time; // 自 1970 年以来的微秒数
+    Kind kind;
+};
+
+// 访问日志的定长部分，之后依次是方法、主机与目标
+struct AccessFields {
+    int32_t status;
+    uint16_t port;
+    uint16_t methodLen;
+    uint32_t hostLen;
+    uint32_t targetLen;
+    uint64_t requestBytes, responseBytes;
+    uint64_t connectUs, firstByteUs, totalUs;
+};
+
+// 记录的一段内容
+struct Part {
+    const void *data;
+    size_t len;
+};
+
+// 单生产者、单消费者的环形缓冲区
+// 
+// 生产者是所属的线程，消费者是输出线程。两个位置只增不减，
+// 取模后才是缓冲区中的偏移。
+class Ring {
+public:
+
+    static const size_t kCapacity = 256 * 1024; // 2 的幂
+
+    // 写入一条记录，空间不足时返回 false
+    bool Push(const RecordHeader &header, const Part *parts, size_t count) {
+        size_t total = sizeof(header) + header.size;
+
+        size_t tail = m_tail.load(memory_order_relaxed);
+        size_t head = m_head.load(memory_order_acquire);
+        if (kCapacity - (tail - head) < total) {
+            return false;
+        }
+
+        CopyIn(tail, &header, sizeof(header));
+        tail += sizeof(header);
+
+        for (size_t i = 0; i < count; i++) {
+            CopyIn(tail, parts[i].data, parts[i].len);
+            tail += parts[i].len;
+        }
+
+        m_tail.store(tail, memory_order_release);
+        return true;
+    }
+
+    // 取出所有记录，依次交给 @a fn
+    template <typename Fn>
+    void Drain(vector<char> &payload, Fn fn) {
+        size_t head = m_head.load(memory_order_relaxed);
+        size_t tail = m_tail.load(memory_order_acquire);
+
+        while (head < tail) {
+            RecordHeader header;
+            CopyOut(head, &header, sizeof(header));
+            head += sizeof(header);
 
-static std::mutex gs_loggerMutex;
-const static char *gs_format = "[%d]------------------------\n%s\n\n";
+            payload.resize(header.size);
+            CopyOut(head, payload.data(), header.size);
+            head += header.size;
+
+            fn(header, payload.data());
+        }
+
+        m_head.store(head, memory_order_release);
+    }
+
+    // 所属的线程
+    uint32_t tid = (uint32_t) GetCurrentThreadId();
+
+    // 所属的线程已经退出
+    atomic_bool retired{ false };
+
+private:
+
+    void CopyIn(size_t pos, const void *src, size_t len) {
+        size_t off = pos & (kCapacity - 1);
+        size_t n = min(len, kCapacity - off);
+
+        memcpy(m_data + off, src, n);
+        memcpy(m_data, (const char *) src + n, len - n);
+    }
+
+    void CopyOut(size_t pos, void *dst, size_t len) const {
+        size_t off = pos & (kCapacity - 1);
+        size_t n = min(len, kCapacity - off);
+
+        memcpy(dst, m_data + off, n);
+        memcpy((char *) dst + n, m_data, len - n);
+    }
+
+    // 两个位置各占一条缓存行
+    atomic<size_t> m_head{ 0 }; // 消费者
+    char m_pad1[64];
+    atomic<size_t> m_tail{ 0 }; // 生产者
+    char m_pad2[64];
+
+    char m_data[kCapacity];
+};
+
+// 带轮转的输出文件
+class LogFile {
+public:
+
+    bool Open(const string &path) {
+        m_path = path;
+        m_fp = fopen(path.c_str(), "ab");
+        if (!m_fp) {
+            return false;
+        }
+
+        fseek(m_fp, 0, SEEK_END);
+        m_size = (size_t) max(ftell(m_fp), 0L);
+
+        return true;
+    }
+
+    void Write(const string &batch) {
+        if (!m_fp || batch.empty()) {
+            return;
+        }
+
+        if (m_size > 0 && m_size + batch.size() > Logger::MAX_FILE_SIZE) {
+            Rotate();
+        }
+
+        if (m_fp) {
+            fwrite(batch.data(), 1, batch.size(), m_fp);
+            fflush(m_fp);
+            m_size += batch.size();
+        }
+    }
 
-std::string Format(const char *msg) {
-    std::ostringstream ss;
-    ss << '[' << GetCurrentThreadId() << ']'
-       << "------------------------\n"
-       << msg << "\n\n";
+private:
+
+    void Rotate() {
+        fclose(m_fp);
+
+        if (Logger::MAX_FILES == 0) {
+            remove(m_path.c_str());
+        }
+        else {
+            for (unsigned i = Logger::MAX_FILES; i > 1; i--) {
+                auto from = m_path + '.' + to_string(i - 1);
+                auto to = m_path + '.' + to_string(i);
+
+                remove(to.c_str());
+                rename(from.c_str(), to.c_str());
+            }
+
+            auto to = m_path + ".1";
+            remove(to.c_str());
+            rename(m_path.c_str(), to.c_str());
+        }
+
+        m_fp = fopen(m_path.c_str(), "ab");
+        m_size = 0;
+    }
+
+    string m_path;
+    FILE *m_fp = nullptr;
+    size_t m_size = 0;
+};
+
+// 异步输出的全部状态，永不销毁：进程退出时可能还有线程在输出日志
+struct Pipeline {
+    mutex m; // 保护 rings
+    vector<Ring *> rings;
+
+    thread writer;
+    mutex wakeMutex;
+    condition_variable wake;
+    bool stop = false;
+
+    LogFile logFile, accessFile;
+    bool toFile = false, access = false;
+
+    atomic<unsigned long long> dropped{ 0 };
+};
+
+Pipeline *gs_pipeline = nullptr;
+
+// 同步输出时使用
+mutex gs_loggerMutex;
+
+// 所属线程的环形缓冲区，线程退出时交由输出线程回收
+struct RingHolder {
+    ~RingHolder() {
+        if (ring) {
+            ring->retired.store(true, memory_order_release);
+        }
+    }
+
+    Ring *ring = nullptr;
+};
+
+thread_local RingHolder t_ring;
+
+Ring *GetRing() {
+    if (!t_ring.ring) {
+        t_ring.ring = new Ring;
+
+        lock_guard<mutex> lock(gs_pipeline->m);
+        gs_pipeline->rings.push_back(t_ring.ring);
+    }
+
+    return t_ring.ring;
+}
+
+int64_t Now() {
+    auto t = chrono::system_clock::now().time_since_epoch();
+    return chrono::duration_cast<chrono::microseconds>(t).count();
+}
+
+// 写入一条记录，返回 false 表示异步输出尚未启动
+bool Push(Kind kind, const Part *parts, size_t count) {
+    if (!gs_pipeline) {
+        return false;
+    }
+
+    auto ring = GetRing();
+
+    RecordHeader header;
+    header.size = 0;
+    header.tid = ring->tid;
+    header.time = Now();
+    header.kind = kind;
+
+    for (size_t i = 0; i < count; i++) {
+        header.size += (uint32_t) parts[i].len;
+    }
+
+    if (!ring->Push(header, parts, count)) {
+        gs_pipeline->dropped.fetch_add(1, memory_order_relaxed);
+    }
+
+    return true;
+}
+
+// 格式化时间，如 "2026-10-18T12:34:56.789012Z"
+void FormatTime(int64_t us, string &out) {
+    time_t secs = (time_t) (us / 1000000);
+    tm t;
+    gmtime_r(&secs, &t);
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%04d-%02d-%02dT%02d:%02d:%02d.%06dZ",
+             t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
+             t.tm_hour, t.tm_min, t.tm_sec, (int) (us % 1000000));
+
+    out += buf;
+}
+
+// 一行文本日志
+void FormatMessage(int64_t time, uint32_t tid, bool error,
+                   const char *msg, size_t len, string &out) {
+    FormatTime(time, out);
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), " [%u] %s ", tid, error ? "ERROR" : "INFO");
+    out += buf;
+
+    out.append(msg, len);
+    out += '\n';
+}
+
+// 以 JSON 字符串的形式输出
+void AppendJsonString(const char *s, size_t len, string &out) {
+    out += '"';
+
+    for (size_t i = 0; i < len; i++) {
+        auto ch = (unsigned char) s[i];
+        if (ch == '"' || ch == '\\') {
+            out += '\\';
+            out += (char) ch;
+        }
+        else if (ch < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", ch);
+            out += buf;
+        }
+        else {
+            out += (char) ch;
+        }
+    }
 
-    return ss.str();
+    out += '"';
+}
+
+// 一行 JSON 的访问日志
+void FormatAccess(int64_t time, const char *payload, string &out) {
+    AccessFields f;
+    memcpy(&f, payload, sizeof(f));
+
+    const char *method = payload + sizeof(f);
+    const char *host = method + f.methodLen;
+    const char *target = host + f.hostLen;
+
+    out += "{\"time\":\"";
+    FormatTime(time, out);
+    out += "\",\"method\":";
+    AppendJsonString(method, f.methodLen, out);
+    out += ",\"host\":";
+    AppendJsonString(host, f.hostLen, out);
+
+    char buf[256];
+    snprintf(buf, sizeof(buf), ",\"port\":%u,\"target\":", (unsigned) f.port);
+    out += buf;
+    AppendJsonString(target, f.targetLen, out);
+
+    snprintf(buf, sizeof(buf),
+             ",\"status\":%d,\"request_bytes\":%llu,\"response_bytes\":%llu,"
+             "\"connect_us\":%llu,\"first_byte_us\":%llu,\"total_us\":%llu}\n",
+             (int) f.status,
+             (unsigned long long) f.requestBytes,
+             (unsigned long long) f.responseBytes,
+             (unsigned long long) f.connectUs,
+             (unsigned long long) f.firstByteUs,
+             (unsigned long long) f.totalUs);
+    out += buf;
+}
+
+// 把文本日志交给控制台
+void WriteConsole(const string &batch, bool error) {
+    if (batch.empty()) {
+        return;
+    }
+
+    if (Logger::CONSOLE) {
+        fputs(batch.c_str(), error ? stderr : stdout);
+        fflush(error ? stderr : stdout);
+    }
+    else {
+        OutputDebugStringA(batch.c_str());
+    }
+}
+
+// 取出所有缓冲区中的记录并输出，回收已退出线程的缓冲区
+// 
+// @return 是否取到了记录
+bool DrainAll(string &info, string &errors, string &access) {
+    auto &p = *gs_pipeline;
+
+    vector<Ring *> rings;
+    {
+        lock_guard<mutex> lock(p.m);
+        rings = p.rings;
+    }
+
+    static vector<char> payload;
+    vector<Ring *> dead;
+
+    for (auto ring : rings) {
+        // 先看是否已退出，再取记录：取完之后不会再有新的记录
+        bool retired = ring->retired.load(memory_order_acquire);
+
+        ring->Drain(payload, [&](const RecordHeader &h, const char *data) {
+            if (h.kind == RK_ACCESS) {
+                if (p.access && h.size >= sizeof(AccessFields)) {
+                    FormatAccess(h.time, data, access);
+                }
+            }
+            else {
+                bool error = (h.kind == RK_ERROR);
+                FormatMessage(h.time, h.tid, error, data, h.size,
+                              (error && !p.toFile) ? errors : info);
+            }
+        });
+
+        if (retired) {
+            dead.push_back(ring);
+        }
+    }
+
+    if (!dead.empty()) {
+        lock_guard<mutex> lock(p.m);
+        for (auto ring : dead) {
+            p.rings.erase(find(p.rings.begin(), p.rings.end(), ring));
+            delete ring;
+        }
+    }
+
+    bool any = !info.empty() || !errors.empty() || !access.empty();
+
+    if (p.toFile) {
+        p.logFile.Write(info);
+    }
+    else {
+        WriteConsole(info, false);
+        WriteConsole(errors, true);
+    }
+
+    p.accessFile.Write(access);
+
+    info.clear();
+    errors.clear();
+    access.clear();
+
+    return any;
+}
+
+void WriterMain() {
+    auto &p = *gs_pipeline;
+    string info, errors, access;
+
+    while (true) {
+        bool any = DrainAll(info, errors, access);
+
+        unique_lock<mutex> lock(p.wakeMutex);
+        if (p.stop) {
+            break;
+        }
+
+        // 生产者从不唤醒输出线程，空闲时定时查看
+        if (!any) {
+            p.wake.wait_for(lock, chrono::milliseconds(50));
+        }
+    }
+
+    DrainAll(info, errors, access);
+}
+
+// 进程退出时写出剩余的记录
+void StopWriter() {
+    auto &p = *gs_pipeline;
+    {
+        lock_guard<mutex> lock(p.wakeMutex);
+        p.stop = true;
+    }
+
+    p.wake.notify_one();
+    p.writer.join();
+}
+
+// 同步输出
+void LogSync(const char *msg, size_t len, bool error) {
+    string line;
+    FormatMessage(Now(), (uint32_t) GetCurrentThreadId(), error, msg, len, line);
+
+    lock_guard<mutex> lock(gs_loggerMutex);
+    WriteConsole(line, error);
+}
+
+void Write(Kind kind, const Part *parts, size_t count) {
+    // 截断过长的消息
+    Part clipped[3];
+    size_t total = 0, n = 0;
+
+    for (size_t i = 0; i < count && total < kMaxMessageSize; i++) {
+        clipped[n] = parts[i];
+        clipped[n].len = min(parts[i].len, kMaxMessageSize - total);
+        total += clipped[n++].len;
+    }
+
+    if (Push(kind, clipped, n)) {
+        return;
+    }
+
+    string msg;
+    for (size_t i = 0; i < n; i++) {
+        msg.append((const char *) clipped[i].data, clipped[i].len);
+    }
+
+    LogSync(msg.data(), msg.size(), kind == RK_ERROR);
+}
+
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+
+bool Logger::Start() {
+    if (gs_pipeline) {
+        return true;
+    }
+
+    unique_ptr<Pipeline> p(new Pipeline);
+
+    if (!PATH.empty()) {
+        if (!p->logFile.Open(PATH)) {
+            LogError("Cannot open the log file " + PATH);
+            return false;
+        }
+
+        p->toFile = true;
+    }
+
+    if (!ACCESS_PATH.empty()) {
+        if (!p->accessFile.Open(ACCESS_PATH)) {
+            LogError("Cannot open the access log " + ACCESS_PATH);
+            return false;
+        }
+
+        p->access = true;
+    }
+
+    gs_pipeline = p.release();
+    gs_pipeline->writer = thread(WriterMain);
+    atexit(StopWriter);
+
+    return true;
+}
+
+bool Logger::AccessEnabled() {
+    return gs_pipeline && gs_pipeline->access;
+}
+
+unsigned long long Logger::Dropped() {
+    return gs_pipeline ? gs_pipeline->dropped.load(memory_order_relaxed) : 0;
 }
 
 void Logger::Log(const char *msg, OutputLevel level) {
@@ -30,32 +584,57 @@ void Logger::Log(const char *msg, OutputLevel level) {
     }
 }
 
-void Logger::LogInfo(const char *msg) {
-    if (LEVEL != OL_INFO) {
+void Logger::Log(const string &context, const string &msg, OutputLevel level) {
+    if (!Enabled(level)) {
         return;
     }
 
-    gs_loggerMutex.lock();
-    
-    if (CONSOLE) {
-        printf(gs_format, GetCurrentThreadId(), msg);
-    }
-    else {
-        OutputDebugStringA(Format(msg).c_str());
+    Part parts[] = {
+        { context.data(), context.size() },
+        { ": ", 2 },
+        { msg.data(), msg.size() },
+    };
+
+    Write(level == OL_INFO ? RK_INFO : RK_ERROR, parts, 3);
+}
+
+void Logger::LogInfo(const char *msg) {
+    if (!Enabled(OL_INFO)) {
+        return;
     }
 
-    gs_loggerMutex.unlock();
+    Part part = { msg, strlen(msg) };
+    Write(RK_INFO, &part, 1);
 }
 
 void Logger::LogError(const char *msg) {
-    gs_loggerMutex.lock();
+    Part part = { msg, strlen(msg) };
+    Write(RK_ERROR, &part, 1);
+}
 
-    if (CONSOLE) {
-        fprintf(stderr, gs_format, GetCurrentThreadId(), msg);
-    }
-    else {
-        OutputDebugStringA(Format(msg).c_str());
+void Logger::LogAccess(const Access &access) {
+    if (!AccessEnabled()) {
+        return;
     }
 
-    gs_loggerMutex.unlock();
+    AccessFields f;
+    f.status = access.status;
+    f.port = access.port;
+    f.methodLen = (uint16_t) min(access.methodLen, (size_t) 64);
+    f.hostLen = (uint32_t) min(access.hostLen, (size_t) 1024);
+    f.targetLen = (uint32_t) min(access.targetLen, (size_t) 4096);
+    f.requestBytes = access.requestBytes;
+    f.responseBytes = access.responseBytes;
+    f.connectUs = access.connectUs;
+    f.firstByteUs = access.firstByteUs;
+    f.totalUs = access.totalUs;
+
+    Part parts[] = {
+        { &f, sizeof(f) },
+        { access.method, f.methodLen },
+        { access.host, f.hostLen },
+        { access.target, f.targetLen },
+    };
+
+    Push(RK_ACCESS, parts, 4);
 }
@@ -1,37 +1,109 @@
 #pragma once
+#include <cstddef>
 #include <string>
 
-/// ־
+/// 日志输出
+/// 
+/// Start() 之后日志是异步的：每个线程把记录写进自己的环形缓冲区
+/// （单生产者、单消费者，无锁），由一个后台线程成批地写到文件或控制台。
+/// 缓冲区满时丢弃记录并计数，从不阻塞调用者。Start() 之前同步输出。
 class Logger {
 public:
 
-    /// Ƿ̨ʹ OutputDebugString WinAPI
+    /// 是否输出到控制台，否则使用 OutputDebugString WinAPI
+    /// 
+    /// 设置了 PATH 时不起作用。
     static bool CONSOLE;
 
     enum OutputLevel {
-        OL_INFO, ///< ͨϢϢ
-        OL_ERROR, ///< ֻϢ
+        OL_INFO, ///< 输出普通信息与错误信息
+        OL_ERROR, ///< 只输出错误信息
     };
 
     static OutputLevel LEVEL;
 
-    /// ־
+    /// 日志文件的路径，为空时输出到控制台
+    static std::string PATH;
+
+    /// 访问日志的路径，为空时不记录访问日志
+    /// 
+    /// 每个请求一行 JSON。
+    static std::string ACCESS_PATH;
+
+    /// 日志文件超过这么多字节时轮转，默认 64 MiB
+    /// 
+    /// 轮转时 PATH 改名为 PATH.1，原来的 PATH.1 改名为 PATH.2，依此类推。
+    /// 同一批写出的记录不会被拆开，所以文件可能略大于这个值。
+    static size_t MAX_FILE_SIZE;
+
+    /// 轮转后最多保留的旧文件数，默认 5
+    static unsigned MAX_FILES;
+
+    /// 启动后台的输出线程
+    /// 
+    /// 在其他线程开始输出日志之前调用一次。进程正常退出时剩余的记录会被写出。
+    static bool Start();
+
+    /// 某一级别的日志是否会被输出
     /// 
-    /// ɲ @a level ṩ
+    /// 在格式化消息之前检查，被过滤的消息不必构造。
+    static bool Enabled(OutputLevel level) {
+        return level >= LEVEL;
+    }
+
+    /// 是否记录访问日志
+    static bool AccessEnabled();
+
+    /// 因缓冲区已满而丢弃的记录数
+    static unsigned long long Dropped();
+
+    /// 输出日志
+    /// 
+    /// 级别由参数 @a level 提供
     static void Log(const char *msg, OutputLevel level);
     static void Log(const std::string &msg, OutputLevel level) {
         Log(msg.c_str(), level);
     }
 
-    /// ͨϢ
+    /// 输出带有上下文（例如所属的主机）的日志，记录为 "context: msg"
+    static void Log(const std::string &context, const std::string &msg,
+                    OutputLevel level);
+
+    /// 输出普通信息
     static void LogInfo(const char *msg);
     static void LogInfo(const std::string &msg) {
         LogInfo(msg.c_str());
     }
 
-    /// Ϣ
+    /// 输出错误信息
     static void LogError(const char *msg);
     static void LogError(const std::string &msg) {
         LogError(msg.c_str());
     }
+
+    /// 一条访问日志
+    /// 
+    /// 字符串不必以 '\0' 结尾，只在 LogAccess() 调用期间使用。
+    struct Access {
+        const char *method;
+        size_t methodLen;
+
+        const char *host;
+        size_t hostLen;
+        unsigned short port;
+
+        const char *target;
+        size_t targetLen;
+
+        int status; ///< 回应的状态码
+        unsigned long long requestBytes; ///< 请求的头部与数据体
+        unsigned long long responseBytes; ///< 回应的头部与数据体
+
+        unsigned long long connectUs; ///< 连接服务器的耗时，复用连接时为 0
+        unsigned long long firstByteUs; ///< 发出请求到收到回应的第一个字节
+        unsigned long long totalUs; ///< 收到请求头部到回应转发完毕
+    };
+
+    /// 记录一次请求
+    static void LogAccess(const Access &access);
 };
@@ -0,0 +1,177 @@
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <vector>
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// 一个线程的数据
+// 
+// 只有所属的线程写入，用 relaxed 的读与写代替原子的累加；
+// 汇总的线程读到的可能是稍旧的值，但不会是写了一半的值。
+struct alignas(64) Block {
+    typedef atomic<uint64_t> Cell;
+
+    struct Histogram {
+        Cell counts[Metrics::Histogram::kBucketCount];
+        Cell count, sum, max;
+    };
+
+    Block();
+    ~Block();
+
+    Cell counters[Metrics::COUNTER_COUNT];
+    Histogram latencies[Metrics::LATENCY_COUNT];
+};
+
+inline void Bump(Block::Cell &cell, uint64_t n) {
+    cell.store(cell.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+inline uint64_t Load(const Block::Cell &cell) {
+    return cell.load(memory_order_relaxed);
+}
+
+// 所有线程的数据
+struct Registry {
+    mutex m;
+    vector<const Block *> blocks;
+
+    // 已退出的线程留下的数据
+    Metrics::Snapshot retired;
+
+    Registry() {
+        memset(&retired, 0, sizeof(retired));
+    }
+};
+
+// 永不销毁：进程退出时可能还有线程在累加
+Registry &GetRegistry() {
+    static Registry *registry = new Registry();
+    return *registry;
+}
+
+void Accumulate(const Block &block, Metrics::Snapshot &snapshot) {
+    for (size_t i = 0; i < Metrics::COUNTER_COUNT; i++) {
+        snapshot.counters[i] += Load(block.counters[i]);
+    }
+
+    for (size_t i = 0; i < Metrics::LATENCY_COUNT; i++) {
+        auto &from = block.latencies[i];
+        auto &to = snapshot.latencies[i];
+
+        for (size_t j = 0; j < Metrics::Histogram::kBucketCount; j++) {
+            to.counts[j] += Load(from.counts[j]);
+        }
+
+        to.count += Load(from.count);
+        to.sum += Load(from.sum);
+        to.max = max(to.max, Load(from.max));
+    }
+}
+
+Block::Block() {
+    // 线程存储期的对象在构造之前已经清零
+    auto &registry = GetRegistry();
+    lock_guard<mutex> lock(registry.m);
+    registry.blocks.push_back(this);
+}
+
+Block::~Block() {
+    auto &registry = GetRegistry();
+    lock_guard<mutex> lock(registry.m);
+
+    Accumulate(*this, registry.retired);
+
+    auto &blocks = registry.blocks;
+    blocks.erase(find(blocks.begin(), blocks.end(), this));
+}
+
+thread_local Block t_block;
+
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+
+void Metrics::Add(Counter counter, uint64_t n) {
+    Bump(t_block.counters[counter], n);
+}
+
+void Metrics::Record(Latency latency, uint64_t us) {
+    auto &h = t_block.latencies[latency];
+
+    Bump(h.counts[Histogram::BucketOf(us)], 1);
+    Bump(h.count, 1);
+    Bump(h.sum, us);
+
+    if (us > Load(h.max)) {
+        h.max.store(us, memory_order_relaxed);
+    }
+}
+
+Metrics::Snapshot Metrics::Collect() {
+    auto &registry = GetRegistry();
+    lock_guard<mutex> lock(registry.m);
+
+    Snapshot snapshot(registry.retired);
+    for (auto block : registry.blocks) {
+        Accumulate(*block, snapshot);
+    }
+
+    return snapshot;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+size_t Metrics::Histogram::BucketOf(uint64_t value) {
+    if (value < 16) {
+        return (size_t) value;
+    }
+
+    // 最高位所在的位置（≥ 4），其后的 3 位决定子区间
+    int exp = 63;
+    while (!(value >> exp)) {
+        exp--;
+    }
+
+    auto sub = (size_t) (value >> (exp - 3)) & 7;
+    return 16 + (exp - 4) * 8 + sub;
+}
+
+uint64_t Metrics::Histogram::UpperBound(size_t bucket) {
+    if (bucket < 16) {
+        return bucket;
+    }
+
+    int exp = (int) (bucket - 16) / 8 + 4;
+    uint64_t sub = (bucket - 16) % 8;
+    uint64_t lower = (8 + sub) << (exp - 3);
+
+    return lower + ((uint64_t) 1 << (exp - 3)) - 1;
+}
+
+uint64_t Metrics::Histogram::Percentile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+
+    // 第 rank 个记录（从 1 开始）
+    auto rank = (uint64_t) (q * count + 0.5);
+    rank = std::min(std::max(rank, (uint64_t) 1), count);
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBucketCount; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return std::min(UpperBound(i), max);
+        }
+    }
+
+    return max;
+}
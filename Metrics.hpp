@@ -0,0 +1,71 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/// 计数器与延迟直方图
+/// 
+/// 每个线程各自累加在一块按缓存行对齐的存储上，线程之间没有共享的写入，
+/// 也不需要原子的读-改-写操作。读取时汇总所有线程，包括已经退出的线程。
+class Metrics {
+public:
+
+    /// 计数器
+    enum Counter {
+        REQUESTS, ///< 请求数（包括 CONNECT）
+        IN_BYTES, ///< 从浏览器读到的字节数
+        OUT_BYTES, ///< 交给浏览器的字节数
+        DNS_QUERIES, ///< 查找服务器地址的次数
+        DNS_CACHE_HITS, ///< 用 DNS 缓存中的地址连上服务器的次数
+        CONNECTIONS_OPENED, ///< 开始处理的浏览器连接数
+        CONNECTIONS_CLOSED, ///< 已结束的浏览器连接数
+        TIMEOUTS, ///< 因超时而关闭的浏览器连接数
+        REJECTED, ///< 超出连接数上限、以 503 拒绝的浏览器连接数
+        COUNTER_COUNT
+    };
+
+    /// 延迟（微秒）
+    enum Latency {
+        CONNECT_TIME, ///< 发起连接到连上服务器（不含 DNS 解析）
+        FIRST_BYTE_TIME, ///< 发出请求到收到回应的第一个字节
+        REQUEST_TIME, ///< 收到完整的请求头部到回应转发完毕
+        LATENCY_COUNT
+    };
+
+    /// 对数分桶的直方图
+    /// 
+    /// 小于 16 的值各占一个桶；更大的值每个 2 的幂区间再等分为 8 个桶，
+    /// 相对误差不超过 12.5%。
+    struct Histogram {
+        /// 桶的个数
+        static const size_t kBucketCount = 16 + 60 * 8;
+
+        /// @a value 所在的桶
+        static size_t BucketOf(uint64_t value);
+
+        /// 桶中的最大值
+        static uint64_t UpperBound(size_t bucket);
+
+        /// 分位数 @a q（0 ~ 1）的估计值，没有数据时返回 0
+        uint64_t Percentile(double q) const;
+
+        uint64_t counts[kBucketCount]; ///< 每个桶的记录数
+        uint64_t count; ///< 总的记录数
+        uint64_t sum; ///< 所有记录之和
+        uint64_t max; ///< 最大的记录
+    };
+
+    /// 某一时刻的汇总数据
+    struct Snapshot {
+        uint64_t counters[COUNTER_COUNT];
+        Histogram latencies[LATENCY_COUNT];
+    };
+
+    /// 累加计数器
+    static void Add(Counter counter, uint64_t n = 1);
+
+    /// 记录一次延迟
+    static void Record(Latency latency, uint64_t us);
+
+    /// 汇总所有线程的数据
+    static Snapshot Collect();
+};
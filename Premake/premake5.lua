@@ -15,6 +15,77 @@ solution "MyProxy"
             ["Sources"] = "../*.cpp",
         }
 
+        filter "system:windows"
+            links { "ws2_32" }
+
+        filter "system:linux"
+            links { "pthread", "resolv" }
+
+        filter "configurations:Debug"
+            defines { "_DEBUG", "DEBUG" }
+            symbols "On"
+
+        filter "configurations:Release"
+            defines { "NDEBUG" }
+            optimize "On"
+
+    project "MicroBench"
+        kind "ConsoleApp"
+        language "C++"
+        cppdialect "C++11"
+        characterset "Unicode"
+
+        files {
+            "../Benchmark/MicroBench.cpp",
+            "../HttpParser.hpp", "../HttpParser.cpp",
+            "../Scanner.hpp", "../Scanner.cpp",
+            "../ChunkedDecoder.hpp", "../ChunkedDecoder.cpp",
+            "../RequestRewriter.hpp", "../RequestRewriter.cpp",
+            "../DNSCache.hpp", "../DNSCache.cpp",
+            "../Resolver.hpp", "../Resolver.cpp",
+            "../EventLoop.hpp", "../EventLoop.cpp",
+            "../TimerWheel.hpp", "../TimerWheel.cpp",
+            "../IoUring.hpp", "../IoUring.cpp",
+            "../BufferPool.hpp", "../BufferPool.cpp",
+            "../ws-util.h", "../ws-util.cpp",
+            "../Logger.hpp", "../Logger.cpp",
+        }
+
+        filter "system:windows"
+            links { "ws2_32" }
+
+        filter "system:linux"
+            links { "pthread", "resolv" }
+
+        filter "configurations:Debug"
+            defines { "_DEBUG", "DEBUG" }
+            symbols "On"
+
+        filter "configurations:Release"
+            defines { "NDEBUG" }
+            optimize "On"
+
+    project "LoadGen"
+        kind "ConsoleApp"
+        language "C++"
+        cppdialect "C++11"
+        characterset "Unicode"
+
+        files {
+            "../Benchmark/LoadGen.cpp",
+            "../HttpParser.hpp", "../HttpParser.cpp",
+            "../Scanner.hpp", "../Scanner.cpp",
+            "../ChunkedDecoder.hpp", "../ChunkedDecoder.cpp",
+            "../ws-util.h", "../ws-util.cpp",
+            "../Logger.hpp", "../Logger.cpp",
+        }
+
+        filter "system:windows"
+            links { "ws2_32" }
+
+        filter "system:linux"
+            links { "pthread" }
+
         filter "configurations:Debug"
             defines { "_DEBUG", "DEBUG" }
             symbols "On"
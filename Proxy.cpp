@@ -1,741 +1,2189 @@
 #include "Proxy.hpp"
 #include "DNSCache.hpp"
+#include "ConnectionPool.hpp"
+#include "Resolver.hpp"
+#include "RequestRewriter.hpp"
 
-#include <Ws2tcpip.h> // for getaddrinfo()
 #include <cstdio> // for sprintf_s()
+#include <cstring>
 
+#ifdef __linux__
+#include <fcntl.h> // for splice()
+#include <sys/sendfile.h>
+#endif
+
+#include <algorithm>
 #include <sstream>
 #include <cassert>
+#include <cerrno>
 
 
 //////////////////////////////////////////////////////////////////////////
 
-string ToLower(const string &s) {
-    string ret(s);
-
-    for (auto &ch : ret) {
-        ch = tolower(ch);
-    }
-
-    return ret;
+bool MyProxy::ZERO_COPY = true;
+unsigned MyProxy::CONNECT_ATTEMPT_DELAY = 250;
+unsigned MyProxy::CONNECT_TIMEOUT = 10000;
+unsigned MyProxy::HEADER_TIMEOUT = 10000;
+unsigned MyProxy::KEEPALIVE_TIMEOUT = 60000;
+unsigned MyProxy::FIRST_BYTE_TIMEOUT = 60000;
+unsigned MyProxy::TUNNEL_TIMEOUT = 300000;
+
+// io_uring 下发往一方的数据积压到这么多时，暂停接收另一方的数据
+static const size_t kMaxUnsent = 4 * BufferPool::SLAB_SIZE;
+
+// 从 @a since 到现在经过的微秒数
+static uint64_t ElapsedMicroseconds(chrono::steady_clock::time_point since) {
+    auto elapsed = chrono::steady_clock::now() - since;
+    return chrono::duration_cast<chrono::microseconds>(elapsed).count();
 }
 
-//////////////////////////////////////////////////////////////////////////
-
-MyProxy::Statistics MyProxy::ms_stat;
-
-MyProxy::MyProxy(SOCKET bsocket)
-    : m_bsocket(bsocket), m_ssocket(INVALID_SOCKET) {
-
+MyProxy::MyProxy(EventLoop &loop, SOCKET bsocket)
+    : m_loop(loop), m_async(loop.HasAsyncIo()),
+      m_self(make_shared<MyProxy *>(this)),
+      m_headers(HttpParser::REQUEST), m_rspHeaders(HttpParser::RESPONSE),
+      m_bsocket(bsocket), m_ssocket(INVALID_SOCKET) {
+    Metrics::Add(Metrics::CONNECTIONS_OPENED);
 }
 
 MyProxy::~MyProxy() {
+    m_loop.CancelTimer(m_timer);
+    LeaveFlight();
+    CloseAttempts();
     ShutdownServerSocket();
+    CloseSplicePipes();
+    Metrics::Add(Metrics::CONNECTIONS_CLOSED);
 }
 
-bool MyProxy::HandleBrowser() {
-    const u_long nBufferSize = GetBestBufferSize(m_bsocket);
-    if (nBufferSize == -1) {
+bool MyProxy::Start() {
+    if (!Admission::Admit(m_bsocket, m_ticket)) {
+        LogInfo(__FUNC__ "Too many connections, rejected.");
+        Admission::Reject(m_bsocket);
+
+        delete this;
         return false;
     }
 
-    Buffer buf(nBufferSize);
-    int nReadBytes;
-
-    do {
-        nReadBytes = recv(m_bsocket, buf.data(), nBufferSize, 0);
-        if (nReadBytes > 0) {
-            m_vbuf.insert(m_vbuf.end(), buf.data(), buf.data() + nReadBytes);
-            m_vbuf.push_back(0);
-
-            if (!m_headers.Parse(m_vbuf.data(), true)) {
-                m_vbuf.pop_back(); // Ƴĩβ '\0'
-                continue;
-            }
-
-            PrintRequest(Logger::OL_INFO);
-
-            //----------------------------------------
-
-            Host lastHost = m_host;
-
-            if (strncmp(m_vbuf.data(), "CONNECT ", 8) == 0) {
-                SplitHost(m_vbuf.data() + 8, 443);
-
-                return RelaySSLConnection();
-            }
-            else {
-                SplitHost(m_headers.m["Host"], 80);
-            }
-
-            if (lastHost != m_host && m_ssocket != INVALID_SOCKET) {
-                ShutdownServerSocket();
-            }
+    m_bevents = EventLoop::EV_READ;
+    if (!m_loop.Add(m_bsocket, m_bevents, this)) {
+        Close();
+        return false;
+    }
 
-            switch (HandleServer()) {
-            case RR_ALIVE:
-                m_vbuf.clear();
-                m_headers.Clear();
-                // Ҫ m_host  m_ssocket
+    // 连上之后一个字节也不发送的连接同样受读取头部的超时限制
+    m_activity = m_headerStart = Clock::now();
+    UpdateTimer();
 
-                continue;
+    return true;
+}
 
-            case RR_CLOSE:
-                return true;
+void MyProxy::OnEvents(SOCKET sd, int /*events*/) {
+    if (m_state == ST_CONNECTING && IsAttempt(sd)) {
+        if (OnConnected(sd) == RR_ERROR) {
+            Logger::LogError(__FUNC__ "Handling browser request failed");
+            Close();
 
-            case RR_ERROR:
-            default:
-                return false;
-            }
-        }
-        else if (nReadBytes == SOCKET_ERROR) {
-            LogError(WSAGetLastErrorMessage(__FUNC__ "recv() failed"));
-            return false;
+            return;
         }
-    } while (nReadBytes != 0);
+    }
 
-    LogInfo(__FUNC__ "Connection closed by browser");
-    return true;
+    // 各个状态都读写到不能继续为止，出错与挂断也由读写得知，不必区分事件
+    Drive();
 }
 
-void MyProxy::PrintRequest(Logger::OutputLevel level) const {
-    Log(string(m_vbuf.data(), strchr(m_vbuf.data(), '\r')), level);
+void MyProxy::OnRecv(SOCKET sd, char *data, long len) {
+    Drive(OnReceived(sd, data, len));
 }
 
-const MyProxy::Statistics &MyProxy::GetStatistics() {
-    return ms_stat;
-}
+void MyProxy::OnSent(SOCKET sd, int error) {
+    if (sd != m_bsocket && sd != m_ssocket) {
+        return;
+    }
 
-void MyProxy::SplitHost(const string &host_decl, int default_port) {
-    m_host.port = default_port;
+    auto &box = sd == m_bsocket ? m_toBrowser : m_toServer;
+    box.sending = false;
 
-    auto pos = host_decl.find(':');
-    if (pos != string::npos) {
-        m_host.port = atoi(host_decl.c_str() + pos + 1);
-    }
-    else {
-        pos = host_decl.length();
+    if (error != 0) {
+        box.failed = true;
+        LogError(WSAGetLastErrorMessage(__FUNC__ "send() failed", error));
     }
 
-    m_host.name = host_decl.substr(0, pos);
+    Drive();
 }
 
-MyProxy::RelayResult MyProxy::HandleServer() {
-    if (m_ssocket != INVALID_SOCKET) {
-        RelayResult rr = DoHandleServer();
-        if (rr == RR_ERROR) {
-            ShutdownServerSocket(); // Դ
-
-            return DoHandleServer();
+void MyProxy::Drive(RelayResult rr) {
+    m_activity = Clock::now();
+
+    // 状态发生了变化，继续推进
+    while (rr == RR_ALIVE) {
+        switch (m_state) {
+        case ST_READ_HEADERS:
+            rr = HandleBrowser();
+            break;
+
+        case ST_RESOLVING:
+        case ST_CONNECTING:
+            rr = RR_AGAIN;
+            break;
+
+        case ST_RELAY_REQUEST:
+            rr = m_async ? RelayToServerAsync() : RelayToServer();
+            break;
+
+        case ST_RELAY_RESPONSE:
+            rr = m_async ? RelayToBrowserAsync() : RelayToBrowser();
+            break;
+
+        case ST_SERVE_CACHE:
+            rr = ServeFromCache();
+            break;
+
+        case ST_FOLLOW:
+            rr = FollowFlight();
+            break;
+
+        case ST_TUNNEL:
+        default:
+            rr = m_async ? RelayTunnelAsync() : RelaySSLConnection();
+            break;
         }
-
-        LogInfo(__FUNC__ "Successfully reused socket.");
-        return rr;
     }
 
-    return DoHandleServer();
-}
-
-MyProxy::RelayResult MyProxy::DoHandleServer() {
-    if (m_ssocket == INVALID_SOCKET && !SetUpServerSocket()) {
-        return RR_ERROR;
+    if (rr == RR_AGAIN) {
+        UpdateEvents();
+        UpdateTimer();
+        return;
     }
 
-    if (!SendBrowserHeaders()) {
-        return RR_ERROR;
+    if (rr == RR_ERROR) {
+        Logger::LogError(__FUNC__ "Handling browser request failed");
     }
 
-    // ʣ
-    auto rr = Write(m_ssocket, m_vbuf.data() + m_headers.bodyOffset,
-                    m_vbuf.size() - 1 - m_headers.bodyOffset);
+    Close();
+}
 
-    if (rr != RR_ALIVE) {
-        return rr;
-    }
+void MyProxy::UpdateEvents() {
+    int bevents = 0, sevents = 0;
 
-    if (!RelayToServer()) {
-        return RR_ERROR;
-    }
+    switch (m_state) {
+    case ST_READ_HEADERS:
+        bevents = EventLoop::EV_READ;
+        break;
 
-    if (!RelayToBrowser()) {
-        return RR_ERROR;
-    }
+    case ST_RESOLVING:
+        // 等待解析结果，暂不关注任何事件
+        break;
 
-    return (m_ssocket != INVALID_SOCKET) ? RR_ALIVE : RR_CLOSE;
-}
+    case ST_CONNECTING:
+        // 各个连接尝试自行关注可写事件
+        break;
 
-bool MyProxy::ShutdownServerSocket() {
-    if (m_ssocket == INVALID_SOCKET) {
-        return true;
-    }
+    // io_uring 下中转的数据由 StartRecv() 接收，不必关注事件
+    case ST_RELAY_REQUEST:
+        if (m_toServer.Empty() && !m_async) {
+            bevents = EventLoop::EV_READ;
+        }
+        break;
 
-    auto ssocket = m_ssocket;
-    m_ssocket = INVALID_SOCKET;
+    case ST_RELAY_RESPONSE:
+        if (m_toBrowser.Empty() && !m_rspDone && !m_async) {
+            sevents = EventLoop::EV_READ;
+        }
+        break;
 
-    return ShutdownConnection(ssocket, false);
-}
+    case ST_SERVE_CACHE:
+        bevents = EventLoop::EV_WRITE;
+        break;
 
-SOCKET DoConnect(const addrinfo &ai) {
-    SOCKET sd = socket(ai.ai_family, ai.ai_socktype, ai.ai_protocol);
-    if (sd != INVALID_SOCKET) {
-        if (connect(sd, ai.ai_addr, ai.ai_addrlen) == 0) {
-            return sd;
+    case ST_FOLLOW:
+        // 等待领头者的通知，有待发的数据时才关注可写
+        break;
+
+    case ST_TUNNEL:
+        if (m_async) {
+            break;
         }
 
-        closesocket(sd);
-        sd = INVALID_SOCKET;
+        if (m_pipeUp.pending > 0) {
+            sevents |= EventLoop::EV_WRITE;
+        }
+        else if (m_toServer.Empty()) {
+            bevents = EventLoop::EV_READ;
+        }
+
+        if (m_pipeDown.pending > 0) {
+            bevents |= EventLoop::EV_WRITE;
+        }
+        else if (m_toBrowser.Empty()) {
+            sevents |= EventLoop::EV_READ;
+        }
+        break;
     }
 
-    return sd;
-}
+    // 对方读得慢时暂停读取另一方，由此形成背压
+    // io_uring 下发完时由 OnSent() 通知
+    if (!m_async && !m_toBrowser.Empty()) {
+        bevents |= EventLoop::EV_WRITE;
+    }
 
-bool MyProxy::SetUpServerSocket() {
-    if (TryDNSCache()) {
-        return true;
+    if (!m_async && !m_toServer.Empty()) {
+        sevents |= EventLoop::EV_WRITE;
     }
 
-    addrinfo hints, *result;
+    if (bevents != m_bevents && m_loop.Modify(m_bsocket, bevents)) {
+        m_bevents = bevents;
+    }
 
-    memset(&hints, 0, sizeof(addrinfo));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
+    if (m_ssocket != INVALID_SOCKET && sevents != m_sevents &&
+        m_loop.Modify(m_ssocket, sevents)) {
+        m_sevents = sevents;
+    }
+}
 
-    char portstr[6];
-    sprintf_s(portstr, sizeof(portstr), "%d", m_host.port);
+void MyProxy::Close() {
+    m_loop.Remove(m_bsocket);
 
-    // Ϊһ IP ַ
-    if (getaddrinfo(m_host.name.c_str(), portstr, &hints, &result) != 0) {
-        LogError(WSAGetLastErrorMessage(__FUNC__ "getaddrinfo() failed"));
-        return false;
+    // 非阻塞的 SOCKET 不能再等待对方的回应
+    if (!ShutdownConnection(m_bsocket, false)) {
+        PrintRequest(Logger::OL_ERROR);
+        Logger::LogError(__FUNC__ "Connection shutdown failed");
     }
-    
-    addrinfo *ai = result;
 
-    do {
-        m_ssocket = DoConnect(*ai);
-        if (m_ssocket != INVALID_SOCKET) {
-            DNSCache::Add(m_host.GetFullName(), *ai);
+    Logger::LogInfo("Connection done!");
 
-            freeaddrinfo(result);
-            return true;
+    delete this;
+}
+
+unsigned MyProxy::GetTimeout(Clock::time_point &since) const {
+    switch (m_state) {
+    case ST_READ_HEADERS:
+        if (m_idle) {
+            since = m_activity;
+            return KEEPALIVE_TIMEOUT;
         }
-    } while (ai = ai->ai_next);
 
-    LogError(__FUNC__ "No appropriate IP address");
+        since = m_headerStart;
+        return HEADER_TIMEOUT;
 
-    freeaddrinfo(result);
-    return false;
-}
+    case ST_RELAY_REQUEST:
+    case ST_RELAY_RESPONSE:
+    case ST_SERVE_CACHE:
+    case ST_FOLLOW:
+        since = m_activity;
+        return FIRST_BYTE_TIMEOUT;
 
-bool MyProxy::TryDNSCache() {
-    ms_stat.dnsQueries++;
+    case ST_TUNNEL:
+        since = m_activity;
+        return TUNNEL_TIMEOUT;
 
-    auto fullName(m_host.GetFullName());
-    auto entry = DNSCache::Resolve(fullName);
-    if (entry) {
-        m_ssocket = DoConnect(entry->ai);
-        if (m_ssocket != INVALID_SOCKET) {
-            ms_stat.dnsCacheHit++;
-            return true;
-        }
+    default:
+        return 0;
+    }
+}
 
-        // ɾʧЧĿ
-        DNSCache::Remove(fullName);
+void MyProxy::UpdateTimer() {
+    Clock::time_point since;
+    unsigned timeout = GetTimeout(since);
+    if (timeout == 0) {
+        return; // 已有的定时器触发时会发现不必再设置
     }
 
-    return false;
+    auto deadline = since + chrono::milliseconds(timeout);
+    if (m_timer == 0 || m_timerDue > deadline) {
+        ArmTimer(deadline);
+    }
 }
 
-bool MyProxy::SendBrowserHeaders() {
-    assert(!m_vbuf.empty());
-    ostringstream ss;
+void MyProxy::ArmTimer(Clock::time_point deadline) {
+    m_loop.CancelTimer(m_timer);
 
-    string first_line(m_vbuf.data(), strstr(m_vbuf.data(), "\r\n"));
-    string needle(" http://" + m_headers.m["Host"]);
+    // 向上取整，以免在截止时间之前触发
+    auto rest = deadline - Clock::now();
+    auto ms = chrono::duration_cast<chrono::milliseconds>
+        (rest + chrono::milliseconds(1) - Clock::duration(1)).count();
 
-    auto pos = first_line.find(needle);
-    if (pos != string::npos) {
-        first_line.replace(pos, needle.length(), " ", 1);
+    m_timerDue = deadline;
+    m_timer = m_loop.AddTimer(ms > 0 ? (unsigned) ms : 0, [this]() {
+        m_timer = 0;
+        OnTimeout();
+    });
+}
+
+void MyProxy::OnTimeout() {
+    Clock::time_point since;
+    unsigned timeout = GetTimeout(since);
+    if (timeout == 0) {
+        return;
     }
 
-    ss << first_line << "\r\n";
+    // 其间有过进展的话，截止时间已经推后
+    auto deadline = since + chrono::milliseconds(timeout);
+    if (deadline > Clock::now()) {
+        ArmTimer(deadline);
+        return;
+    }
 
-    auto it(m_headers.m.find("Proxy-Connection"));
-    if (it != m_headers.m.end()) {
-        auto conn = it->second;
-        m_headers.m.erase(it);
+    static const char *const kWhat[] = {
+        "reading request headers", "resolving", "connecting",
+        "relaying request", "relaying response", "serving from cache",
+        "following in-flight fetch", "relaying tunnel",
+    };
 
-        if (m_headers.m.find("Connection") == m_headers.m.end()) {
-            m_headers.m.emplace("Connection", conn);
-        }
+    const char *what = kWhat[m_state];
+    if (m_idle) {
+        what = "waiting for next request";
     }
-
-    for (auto header : m_headers.m) {
-        ss << header.first << ": " << header.second << "\r\n";
+    else if (m_state == ST_RELAY_RESPONSE && m_rspBytes == 0) {
+        what = "waiting for response";
     }
 
-    ss << "\r\n";
+    LogInfo(__FUNC__ "Timed out " + string(what));
 
-    auto s(ss.str());
-    return Write(m_ssocket, s.c_str(), s.length()) == RR_ALIVE;
+    Metrics::Add(Metrics::TIMEOUTS);
+    Close();
 }
 
-bool MyProxy::RelaySSLConnection() {
-    if (!ShutdownServerSocket() || !SetUpServerSocket()) {
-        return false;
+MyProxy::RelayResult MyProxy::HandleBrowser() {
+    // 上一个回应发完之前不能开始下一个请求
+    auto rr = Flush(m_bsocket, m_toBrowser);
+    if (rr != RR_ALIVE) {
+        return rr;
     }
 
-    const char *confirm = "HTTP/1.1 200 Connection Established\r\n\r\n";
-    if (Write(m_bsocket, confirm, strlen(confirm)) != RR_ALIVE) {
-        return false;
+    // 转发请求数据体的接收结束之前不能读取
+    if (m_loop.IsReceiving(m_bsocket)) {
+        m_loop.StopRecv(m_bsocket);
+        return RR_AGAIN;
     }
 
-    fd_set inputs;
-    Buffer buf;
-
     while (true) {
-        FD_ZERO(&inputs);
-        FD_SET(m_bsocket, &inputs);
-        FD_SET(m_ssocket, &inputs);
-
-        int n = select(0, &inputs, nullptr, nullptr, nullptr);
-        if (n > 0) {
-            if (FD_ISSET(m_bsocket, &inputs)) {
-                auto rr = SimpleRelay(m_bsocket, m_ssocket, buf);
-
-                if (rr == RR_ERROR) {
-                    auto fmt = __FUNC__ "SimpleRelay() browser failed";
-                    LogError(WSAGetLastErrorMessage(fmt));
-
-                    return false;
-                }
-                else if (rr == RR_CLOSE) {
-                    return true;
-                }
+        // 上一个请求之后可能已经收到了下一个请求的数据
+        // 解析器会从上一次停下的位置接着扫描
+        if (!m_vbuf.empty()) {
+            auto pr = m_headers.Parse(m_vbuf.data(), m_vbuf.size());
+            if (pr == HttpParser::PARSE_DONE) {
+                return OnBrowserHeaders();
             }
+            else if (pr == HttpParser::PARSE_ERROR) {
+                LogError(__FUNC__ "Malformed request headers");
+                return RR_ERROR;
+            }
+        }
 
-            if (FD_ISSET(m_ssocket, &inputs)) {
-                auto rr = SimpleRelay(m_ssocket, m_bsocket, buf);
+        // 直接读到 m_vbuf 的末尾
+        char *buf = m_vbuf.Prepare(kBufferSize);
 
-                if (rr == RR_ERROR) {
-                    auto fmt = __FUNC__ "SimpleRelay() server failed";
-                    LogError(WSAGetLastErrorMessage(fmt));
+        int nReadBytes = recv(m_bsocket, buf, (int) m_vbuf.Room(), 0);
+        if (nReadBytes > 0) {
+            m_vbuf.Commit(nReadBytes);
+            Metrics::Add(Metrics::IN_BYTES, nReadBytes);
 
-                    return false;
-                }
-                else if (rr == RR_CLOSE) {
-                    return true;
-                }
+            // 下一个请求开始到来，此后受读取头部的超时限制
+            if (m_idle) {
+                m_idle = false;
+                m_headerStart = m_activity;
             }
         }
-        else { // SOCKET_ERROR
-            LogError(WSAGetLastErrorMessage(__FUNC__ "select() failed"));
-            return false;
+        else if (nReadBytes == 0) {
+            LogInfo(__FUNC__ "Connection closed by browser");
+            return RR_CLOSE;
         }
-    } // while (true)
-}
+        else if (WouldBlock()) {
+            // 空闲的连接不占用缓冲区
+            if (m_vbuf.empty()) {
+                m_vbuf.Clear();
+            }
 
-MyProxy::RelayResult MyProxy::SimpleRelay(SOCKET r, SOCKET w, Buffer &buf) {
-    const u_long nBufferSize = GetBestBufferSize(r);
-    if (nBufferSize == -1) {
-        return RR_ERROR;
+            return RR_AGAIN;
+        }
+        else {
+            LogError(WSAGetLastErrorMessage(__FUNC__ "recv() failed"));
+            return RR_ERROR;
+        }
     }
+}
 
-    buf.resize(nBufferSize);
+MyProxy::RelayResult MyProxy::OnBrowserHeaders() {
+    PrintRequest(Logger::OL_INFO);
 
-    int nRx = recv(r, buf.data(), nBufferSize, 0);
-    if (nRx > 0) {
-        return Write(w, buf.data(), nRx);
-    }
-    else if (nRx == 0) {
-        return RR_CLOSE; // ӱһر
-    }
-    else { // SOCKET_ERROR
-        return RR_ERROR;
-    }
-}
+    Metrics::Add(Metrics::REQUESTS);
+    m_requestStart = Clock::now();
+    m_connectUs = m_firstByteUs = 0;
 
-bool MyProxy::RelayToServer() {
-    auto it(m_headers.m.find("Content-Length"));
-    if (it == m_headers.m.end()) {
-        return true;
-    }
+    //----------------------------------------
 
-    int nContentLength = atoi(it->second.c_str());
-    int nTotalRx = m_headers.bodyOffset + nContentLength;
-    int nRest = nTotalRx - (m_vbuf.size() - 1);
+    m_head = m_headers.Method().Equals("HEAD");
 
-    if (nRest == 0) {
-        return true;
-    }
+    if (m_headers.Method().Equals("CONNECT")) {
+        SplitHost(m_headers.Target(), 443);
 
-    if (nRest < 0) {
-        LogError(__FUNC__ "Invalid `Content-Length`.");
-        return true;
-    }
+        m_tunnel = true;
+        m_requestSize = m_headers.HeaderSize();
 
-    const u_long nBufferSize = GetBestBufferSize(m_bsocket);
-    if (nBufferSize == -1) {
-        return false;
+        if (!ShutdownServerSocket() || !SetUpServerSocket()) {
+            return RR_ERROR;
+        }
+
+        return RR_ALIVE;
+    }
+    else {
+        SplitHost(m_headers.Find("Host"), 80);
     }
 
-    Buffer buf(nBufferSize);
+    m_cacheKey.clear();
+    m_stale.reset();
+    m_conditions.clear();
 
-    while (nRest > 0) {
-        int n = recv(m_bsocket, buf.data(), min(nRest, (int) nBufferSize), 0);
-        if (n > 0) {
-            if (Write(m_ssocket, buf.data(), n) != RR_ALIVE) {
-                return false;
-            }
+    if (ResponseCache::IsCacheableRequest(m_headers)) {
+        m_cacheKey = ResponseCache::MakeKey(m_host.name, m_host.port,
+                                            m_headers.Target());
 
-            nRest -= n;
+        auto found = ResponseCache::Lookup(m_cacheKey, m_headers);
+        if (found.entry) {
+            return StartCacheHit(move(found.entry));
         }
-        else if (n == SOCKET_ERROR) {
-            LogError(WSAGetLastErrorMessage(__FUNC__ "recv() failed"));
-            return false;
+
+        if (found.flight && !found.leader) {
+            return StartFollowing(move(found.flight));
+        }
+
+        // 由我们向服务器获取，回应分享给同时到来的请求
+        m_flight = move(found.flight);
+        m_leader = found.leader;
+
+        if (found.stale) {
+            m_stale = move(found.stale);
+            m_conditions = ResponseCache::MakeConditions(*m_stale);
         }
         else {
-            // Browser closed connection before we could relay
-            // all the data it sent, so bomb out early.
-            LogError("Browser unexpectedly dropped connection!");
-            return true;
+            // 内存中没有的，可能还在磁盘上
+            auto entry = LookupDisk();
+            if (entry) {
+                LeaveFlight();
+                return StartCacheHit(move(entry));
+            }
         }
     }
 
-    return true;
+    return HandleServer();
 }
 
-bool MyProxy::RelayToBrowser() {
-    bool bHeadersParsed = false;
+void MyProxy::PrintRequest(Logger::OutputLevel level) const {
+    if (m_vbuf.empty() || !Logger::Enabled(level)) {
+        return;
+    }
 
-    Buffer hbuf; // Header buffer
-    Headers headers;
-    bool chunked = false;
+    auto lf = (const char *) memchr(m_vbuf.data(), '\n', m_vbuf.size());
+    if (lf) {
+        if (lf > m_vbuf.data() && lf[-1] == '\r') {
+            lf--;
+        }
 
-    Buffer buf(0); // ȲҪκοռ
-    int nReadBytes;
-    int nRest = -1;
+        Log(string(m_vbuf.data(), lf), level);
+    }
+}
 
-    do {
-        const u_long nBufferSize = GetBestBufferSize(m_ssocket);
-        if (nBufferSize == -1) {
-            return false;
-        }
+MyProxy::Statistics MyProxy::GetStatistics() {
+    auto snapshot = Metrics::Collect();
+    auto &counters = snapshot.counters;
 
-        buf.resize(nBufferSize + 1);
-        nReadBytes = recv(m_ssocket, buf.data(), nBufferSize, 0);
+    Statistics stat;
+    stat.requests = counters[Metrics::REQUESTS];
+    stat.inBytes = counters[Metrics::IN_BYTES];
+    stat.outBytes = counters[Metrics::OUT_BYTES];
+    stat.dnsQueries = counters[Metrics::DNS_QUERIES];
+    stat.dnsCacheHit = counters[Metrics::DNS_CACHE_HITS];
+    stat.timeouts = counters[Metrics::TIMEOUTS];
+    stat.rejected = counters[Metrics::REJECTED];
 
-        if (nReadBytes > 0) {
-            buf[nReadBytes] = 0;
-            buf.resize(nReadBytes + 1);
+    // 连接可能在别的线程中结束，两个计数器各自只增不减
+    stat.connections = (int) (counters[Metrics::CONNECTIONS_OPENED] -
+                              counters[Metrics::CONNECTIONS_CLOSED]);
 
-            if (!bHeadersParsed) {
-                // ע hbuf Ҳֱ '\0' β
-                hbuf.insert(hbuf.end(), buf.begin(), buf.end());
+    stat.connectTime = snapshot.latencies[Metrics::CONNECT_TIME];
+    stat.firstByteTime = snapshot.latencies[Metrics::FIRST_BYTE_TIME];
+    stat.requestTime = snapshot.latencies[Metrics::REQUEST_TIME];
 
-                if (headers.Parse(hbuf.data(), false)) {
-                    auto it(headers.m.find("Content-Length"));
-                    if (it != headers.m.end()) {
-                        auto nTotal = atoi(it->second.c_str()) + 
-                                      headers.bodyOffset;
+    return stat;
+}
 
-                        nRest = nTotal - (hbuf.size() - 1);
+void MyProxy::SplitHost(const StrView &decl, int default_port) {
+    string host_decl(decl.ToString());
 
-                        if (nRest < 0) {
-                            LogError("Invalid `Content-Length`!");
-                            nRest = 0;
-                        }
-                    }
-                    else {
-                        if (headers.DetermineFinishedByStatusCode()) {
-                            nRest = 0;
-                        }
-                        else if (headers.IsChunked()) {
-                            chunked = true;
-
-                            nRest = CountChunkRest(hbuf, headers.bodyOffset);
-
-                            if (nRest == -1) {
-                                LogError("Invalid chunk size!");
-                                goto RECV_ERROR;
-                            }
-                        }
-                    }
+    m_host.port = default_port;
 
-                    bHeadersParsed = true;
-                }
-                else {
-                    hbuf.pop_back(); // β '\0'
-                    continue; // ȲҪ
-                }
-            }
-            // bHeadersParsed
-            // nRest ûñû Content-LengthҲǷֶδ䣬
-            // ôӦ Connection: close
-            else if (nRest != -1) {
-                // ע⡰=ţֶθպռֶ֡ν
-                // \r\nзֵһ֡
-                if (nRest == nReadBytes && chunked) {
-                    goto NEXT_CHUNK;
-                }
+    size_t begin = 0, end, pos;
 
-                if (nRest < nReadBytes) {
-                    if (chunked) {
-NEXT_CHUNK:
-                        nRest = CountChunkRest(buf, nRest + 2);
+    if (!host_decl.empty() && host_decl[0] == '[') {
+        // IPv6 字面地址，如 [::1]:8080
+        begin = 1;
+        end = host_decl.find(']');
+        if (end == string::npos) {
+            end = host_decl.length();
+        }
 
-                        if (nRest == -1) {
-                            LogError("Invalid chunk size!");
-                            goto RECV_ERROR;
-                        }
-                    }
-                    else {
-                        LogError("Junk data encountered!");
-                        nRest = 0;
-                    }
-                }
-                // nRest >= nReadBytes
-                else {
-                    nRest -= nReadBytes;
-                }
-            }
+        pos = end + 1;
+        if (pos >= host_decl.length() || host_decl[pos] != ':') {
+            pos = string::npos;
+        }
+    }
+    else {
+        end = pos = host_decl.find(':');
+        if (end == string::npos) {
+            end = host_decl.length();
+        }
+    }
 
-            auto &outbuf = hbuf.empty() ? buf : hbuf;
-            auto rr = Write(m_bsocket, outbuf.data(), outbuf.size() - 1);
+    if (pos != string::npos) {
+        m_host.port = atoi(host_decl.c_str() + pos + 1);
+    }
 
-            if (rr != RR_ALIVE) {
-                return false;
-            }
+    m_host.name = host_decl.substr(begin, end - begin);
+}
 
-            if (bHeadersParsed && !hbuf.empty()) {
-                hbuf.clear();
-            }
+MyProxy::RelayResult MyProxy::HandleServer() {
+    assert(m_ssocket == INVALID_SOCKET);
 
-            if (nRest == 0) {
-                if (m_headers.KeepAlive() && headers.KeepAlive()) {
-                    return true;
-                }
-                else {
-                    break;
-                }
-            }
+    // 优先复用连接池中的空闲连接
+    m_ssocket = ConnectionPool::Checkout(m_host.GetFullName());
+    if (m_ssocket != INVALID_SOCKET) {
+        m_sevents = 0;
+        if (!m_loop.Add(m_ssocket, m_sevents, this)) {
+            closesocket(m_ssocket);
+            m_ssocket = INVALID_SOCKET;
 
-            if (nRest == -1) {
-                // Request received, continuing process
-                if (headers.status_code < 200) {
-                    return true;
-                }
-            }
+            return RR_ERROR;
         }
-        else if (nReadBytes == SOCKET_ERROR) {
-RECV_ERROR:
-            auto fmt = __FUNC__ "recv() failed";
-            LogError(WSAGetLastErrorMessage(fmt));
 
-            ShutdownServerSocket();
-            return false;
-        }
-    } while (nReadBytes > 0);
+        LogInfo(__FUNC__ "Successfully reused socket.");
 
-    LogInfo(__FUNC__ "Connection closed by server.");
+        m_reused = true;
+        return StartRequest();
+    }
 
-    return ShutdownServerSocket();
+    m_reused = false;
+    return SetUpServerSocket() ? RR_ALIVE : RR_ERROR;
 }
 
-int MyProxy::CountChunkRest(Buffer &buf, int offset) {
-    if (offset >= static_cast<int>(buf.size() - 1)) {
-        if (!ReadMore(buf, kExtraBytes)) {
-            return -1;
-        }
-    }
+MyProxy::RelayResult MyProxy::StartRequest() {
+    assert(!m_vbuf.empty());
+
+    m_toServer.Clear();
+    m_reqStreamed = false;
+
+    // 已经收到的数据体与头部一起发送
+    size_t nHeaderSize = m_headers.HeaderSize();
+    long long nBuffered = m_vbuf.size() - nHeaderSize;
+    long long nBody, nRest;
 
-    char *endptr;
-    int nChunk = strtol(buf.data() + offset, &endptr, 16);
+    m_reqDecoder.Reset();
 
-    // δС
-    if (*endptr == 0) {
-        if (!ReadMore(buf, kExtraBytes)) {
-            return -1;
+    if (m_headers.IsChunked()) {
+        // 分段传输的数据体解码之后才知道在哪里结束
+        size_t n;
+        auto dr = m_reqDecoder.Feed(m_vbuf.data() + nHeaderSize,
+                                    (size_t) nBuffered, n);
+        if (dr == ChunkedDecoder::DECODE_ERROR) {
+            LogError(__FUNC__ "Invalid chunked encoding in request!");
+            return RR_ERROR;
         }
 
-        nChunk = strtol(buf.data() + offset, &endptr, 16);
+        nBody = (long long) n;
+        nRest = dr == ChunkedDecoder::DECODE_DONE ? 0 : -1;
     }
+    else {
+        long long nContentLength = max(m_headers.contentLength, 0LL);
 
-    if (nChunk == 0) {
-        if (!*endptr) {
-            LogError("Invalid chunk size!");
-        }
+        nBody = min(nBuffered, nContentLength);
+        nRest = nContentLength - nBody;
+    }
 
-        return 0;
+    if (!SendBrowserHeaders((size_t) nBody)) {
+        return RetryRequest();
     }
 
-    while (true) {
-        endptr = strstr(endptr, "\r\n");
-        if (endptr) {
-            endptr += 2;
+    m_requestSent = Clock::now();
 
-            int nRest = nChunk - (buf.data() + buf.size() - 1 - endptr);
-            if (nRest < 0) {
-                return CountChunkRest(buf, endptr - buf.data() + nChunk + 2);
-            }
+    m_requestSize = nHeaderSize + (size_t) nBody;
+    m_reqRest = nRest;
 
-            return nRest;
-        }
+    // 准备接收回应
+    m_rspHeaders.Reset();
+    m_rspParsed = false;
+    m_hbuf.Clear();
+    m_rspRest = -1;
+    m_chunked = m_rspDone = false;
+    m_rspBytes = 0;
+    m_serverClosed = false;
+    m_store.reset();
+    m_refreshed.reset();
+    m_diskStore.reset();
 
-        if (!ReadMore(buf, kExtraBytes)) {
-            return -1;
-        }
+    m_state = ST_RELAY_REQUEST;
+    return RR_ALIVE;
+}
 
-        endptr = buf.data() + offset;
+MyProxy::RelayResult MyProxy::FinishResponse() {
+    // 确认之后由缓存回应的请求在发送完时才记录
+    if (!m_refreshed) {
+        auto totalUs = ElapsedMicroseconds(m_requestStart);
+        Metrics::Record(Metrics::REQUEST_TIME, totalUs);
+        LogAccess(m_rspHeaders.status_code, totalUs);
     }
 
-    // 
-    assert(0);
-    return -1;
-}
+    // 服务器中途关闭了连接的回应是不完整的
+    bool complete = !m_serverClosed;
 
-bool MyProxy::ReadMore(Buffer &buf, int len) {
-    auto nOldSize = buf.size(); // Ѿһ'\0'λ
-    buf.resize(buf.size() + len);
-    auto p = buf.data() + nOldSize - 1; // ԭ'\0'ڵλ
+    if (m_flight && !m_flight->IsStorable()) {
+        m_store.reset();
+    }
 
-    int nExtraRead = recv(m_ssocket, p, len, 0);
-    if (nExtraRead <= 0) {
-        return false;
+    if (m_store && complete) {
+        ResponseCache::Add(m_cacheKey, m_store);
     }
 
-    *(p + nExtraRead) = 0;
-    buf.resize(nOldSize + nExtraRead);
+    if (m_diskStore && complete) {
+        m_diskStore->Commit();
+    }
 
-    return true;
-}
+    m_diskStore.reset();
 
-u_long MyProxy::GetBestBufferSize(SOCKET sd) const {
-    u_long nBufferSize = kBufferSize;
-    if (ioctlsocket(sd, FIONREAD, &nBufferSize) != 0) {
-        LogError(WSAGetLastErrorMessage(__FUNC__ "ioctlsocket() failed"));
-        return -1;
+    if (m_refreshed && m_refreshed->freshness > m_refreshed->initialAge) {
+        ResponseCache::Add(m_cacheKey, m_refreshed);
     }
 
-    return max(nBufferSize, kBufferSize);
-}
-
-MyProxy::RelayResult MyProxy::Write(SOCKET sd, const char *buf, size_t len) {
-    size_t nSentBytes = 0;
-    while (nSentBytes < len) {
-        int n = send(sd, buf + nSentBytes, len - nSentBytes, 0);
-        if (n > 0) {
-            nSentBytes += n;
-        }
-        else if (n == SOCKET_ERROR) {
-            LogError(WSAGetLastErrorMessage(__FUNC__ "send() failed"));
-            return RR_ERROR;
-        }
-        else {
-            // Browser or server closed connection before we could reply to
-            // all the data it sent, so bomb out early.
-            LogError("Connection unexpectedly dropped!");
-            return RR_CLOSE;
+    // 先存入缓存再结束获取，之后到来的请求总能命中
+    if (m_flight) {
+        if (m_refreshed) {
+            m_flight->Begin(m_refreshed);
         }
+
+        m_flight->Finish(complete);
+        m_flight.reset();
+    }
+
+    m_store.reset();
+    m_stale.reset();
+
+    // 不安全的请求成功之后，缓存中的回应可能已经过时
+    auto method = m_headers.Method();
+    if (ResponseCache::IsEnabled() && m_rspHeaders.status_code < 400 &&
+        !method.Equals("GET") && !method.Equals("HEAD") &&
+        !method.Equals("OPTIONS") && !method.Equals("TRACE")) {
+        auto key = ResponseCache::MakeKey(m_host.name, m_host.port,
+                                          m_headers.Target());
+        ResponseCache::Remove(key);
+        DiskCache::Remove(key);
+    }
+
+    if (m_serverClosed) {
+        LogInfo(__FUNC__ "Connection closed by server.");
+        ShutdownServerSocket();
+
+        return RR_CLOSE;
+    }
+
+    // 服务器保持连接的话，把连接还给连接池
+    if (m_rspHeaders.KeepAlive()) {
+        ReleaseServerSocket();
+    }
+    else {
+        ShutdownServerSocket();
+    }
+
+    if (m_refreshed) {
+        return StartCacheHit(move(m_refreshed));
+    }
+
+    if (!m_headers.KeepAlive() || !m_rspHeaders.KeepAlive()) {
+        return RR_CLOSE;
+    }
+
+    return ReadNextRequest();
+}
+
+MyProxy::RelayResult MyProxy::ReadNextRequest() {
+    // 保留下一个请求的数据
+    // 不要重置 m_host
+    m_vbuf.Consume(m_requestSize);
+
+    m_headers.Reset();
+    m_requestSize = 0;
+
+    // 解析器不再指向 m_vbuf，可以把多收到的数据接上了
+    if (!m_ahead.empty()) {
+        m_vbuf.Append(m_ahead.data(), m_ahead.size());
+        m_ahead.Clear();
     }
 
+    // 已经收到了下一个请求的一部分时，读取头部的计时随即开始
+    m_idle = m_vbuf.empty();
+    m_headerStart = Clock::now();
+
+    m_state = ST_READ_HEADERS;
     return RR_ALIVE;
 }
 
-void MyProxy::LogInfo(const string &msg) const {
-    Log(msg, Logger::OL_INFO);
+MyProxy::RelayResult MyProxy::StartCacheHit(ResponseCache::EntryPtr entry) {
+    LogInfo(__FUNC__ "Served from cache.");
+
+    m_hit = move(entry);
+    m_hitSent = 0;
+    m_rspBytes = 0;
+    m_requestSize = m_headers.HeaderSize();
+
+    SetHitHeaders();
+
+    m_state = ST_SERVE_CACHE;
+    return RR_ALIVE;
 }
 
-void MyProxy::LogError(const string &msg) const {
-    Log(msg, Logger::OL_ERROR);
+void MyProxy::SetHitHeaders() {
+    // 条目中没有的字段：年龄与连接的去留
+    char buf[80];
+    snprintf(buf, sizeof(buf), "Age: %lld\r\nConnection: %s\r\n\r\n",
+             (long long) m_hit->Age(time(nullptr)),
+             m_headers.KeepAlive() ? "keep-alive" : "close");
+
+    m_hitHeaders.assign(buf);
 }
 
-void MyProxy::Log(const string &msg, Logger::OutputLevel level) const {
-    if (m_host.port > 0) {
-        ostringstream ss;
-        ss << m_host.name << ':' << m_host.port << '\n';
-        ss << msg;
+MyProxy::RelayResult MyProxy::ServeFromCache() {
+    // SendV() 直接写 SOCKET，积压的数据必须先发出
+    auto rr = Flush(m_bsocket, m_toBrowser);
+    if (rr != RR_ALIVE) {
+        return rr;
+    }
 
-        Logger::Log(ss.str(), level);
+    // HEAD 请求只发送头部
+    const IoSlice parts[] = {
+        { m_hit->head.data(), m_hit->head.size() },
+        { m_hitHeaders.data(), m_hitHeaders.size() },
+        { m_hit->body.data(), m_head ? 0 : m_hit->body.size() },
+    };
+
+    size_t total = 0;
+    for (auto &part : parts) {
+        total += part.len;
     }
-    else {
-        Logger::Log(msg, level);
+
+    while (m_hitSent < total) {
+        // 跳过已经发送的部分
+        IoSlice slices[3];
+        size_t count = 0, skip = m_hitSent;
+
+        for (auto &part : parts) {
+            if (skip >= part.len) {
+                skip -= part.len;
+                continue;
+            }
+
+            slices[count].data = part.data + skip;
+            slices[count].len = part.len - skip;
+            count++;
+
+            skip = 0;
+        }
+
+        long n = SendV(m_bsocket, slices, count);
+        if (n > 0) {
+            m_hitSent += n;
+            Metrics::Add(Metrics::OUT_BYTES, n);
+        }
+        else if (n == SOCKET_ERROR && WouldBlock()) {
+            return RR_AGAIN;
+        }
+        else {
+            LogError(WSAGetLastErrorMessage(__FUNC__ "sendmsg() failed"));
+            return RR_ERROR;
+        }
+    }
+
+    if (m_diskBody && !m_head) {
+        auto rr = SendDiskBody(m_hitSent - total);
+        if (rr != RR_ALIVE) {
+            return rr;
+        }
     }
+
+    m_rspBytes = m_hitSent;
+    return FinishCacheHit();
 }
 
-//////////////////////////////////////////////////////////////////////////
+ResponseCache::EntryPtr MyProxy::LookupDisk() {
+    ResponseCache::EntryPtr entry;
+    if (DiskCache::IsEnabled()) {
+        m_diskBody = DiskCache::Lookup(m_cacheKey, m_headers, entry);
+    }
+
+    return entry;
+}
+
+MyProxy::RelayResult MyProxy::SendDiskBody(size_t sent) {
+    auto &body = *m_diskBody;
+
+    while (sent < body.size) {
+        auto len = body.size - sent;
+        long n;
+
+#ifdef __linux__
+        // 数据不经过用户空间，直接从页缓存发出
+        off_t offset = body.offset + (off_t) sent;
+        n = (long) sendfile(m_bsocket, body.fd, &offset, len);
+#elif !defined(_WIN32)
+        PooledSlab buf;
+        len = min(len, buf.size());
 
-bool MyProxy::Headers::Parse(const char *buf, bool browser) {
-    this->Clear();
+        n = (long) pread(body.fd, buf.data(), len, body.offset + (off_t) sent);
+        if (n > 0) {
+            n = send(m_bsocket, buf.data(), (int) n, 0);
+        }
+#else
+        n = SOCKET_ERROR; // 磁盘缓存不支持 Windows，不会走到这里
+#endif
+
+        if (n > 0) {
+            sent += n;
+            m_hitSent += n;
+            Metrics::Add(Metrics::OUT_BYTES, n);
+        }
+        else if (n == SOCKET_ERROR && WouldBlock()) {
+            return RR_AGAIN;
+        }
+        else {
+            LogError(WSAGetLastErrorMessage(__FUNC__ "sendfile() failed"));
+            return RR_ERROR;
+        }
+    }
+
+    return RR_ALIVE;
+}
+
+MyProxy::RelayResult MyProxy::FinishCacheHit() {
+    // 关闭连接会丢掉积压的数据，下一个回应也会插到它们前面
+    if (!m_toBrowser.Empty()) {
+        LogError(__FUNC__ "Finished a cache hit with unsent data");
+        return RR_ERROR;
+    }
+
+    auto totalUs = ElapsedMicroseconds(m_requestStart);
+    Metrics::Record(Metrics::REQUEST_TIME, totalUs);
+    LogAccess(m_hit->status, totalUs);
+
+    m_hit.reset();
+    m_diskBody.reset();
+
+    if (!m_headers.KeepAlive()) {
+        return RR_CLOSE;
+    }
+
+    return ReadNextRequest();
+}
+
+MyProxy::RelayResult MyProxy::StartFollowing(ResponseCache::FlightPtr flight) {
+    // 通知可能来自任意线程，转交给自己的事件循环处理
+    weak_ptr<MyProxy *> self(m_self);
+    auto &loop = m_loop;
+
+    auto wake = [self, &loop]() {
+        loop.Post([self]() {
+            auto proxy(self.lock());
+            if (proxy) {
+                (*proxy)->OnFlightProgress();
+            }
+        });
+    };
+
+    if (!flight->Follow(this, move(wake))) {
+        return HandleServer();
+    }
+
+    LogInfo(__FUNC__ "Joined an in-flight fetch.");
+
+    m_flight = move(flight);
+    m_leader = false;
+
+    m_hit.reset();
+    m_hitSent = 0;
+    m_rspBytes = 0;
+    m_requestSize = m_headers.HeaderSize();
+
+    m_state = ST_FOLLOW;
+    return RR_ALIVE;
+}
+
+MyProxy::RelayResult MyProxy::FollowFlight() {
+    PooledSlab buf;
+
+    while (true) {
+        auto rr = Flush(m_bsocket, m_toBrowser);
+        if (rr != RR_ALIVE) {
+            return rr;
+        }
 
-    const char *p = strstr(buf, "\r\n\r\n");
-    if (p) {
-        if (!browser && strncmp(buf, "HTTP/", 5) == 0) {
-            this->status_code = atoi(buf + 9);
+        // HEAD 请求只发送头部，头部发完才算结束
+        if (m_hit && m_head) {
+            LeaveFlight();
+            return FinishCacheHit();
         }
 
-        const char *b = strstr(buf, "\r\n") + 2;
+        size_t n;
+        ResponseCache::EntryPtr entry;
+        auto state = m_flight->Read(this, m_hitSent, buf.data(), buf.size(),
+                                    n, entry);
+
+        if (!m_hit) {
+            if (state == ResponseCache::Flight::FL_WAITING) {
+                return RR_AGAIN;
+            }
+
+            // 浏览器还什么都没有收到，自己向服务器请求即可
+            if (state == ResponseCache::Flight::FL_FAILED ||
+                !ResponseCache::Matches(*entry, m_headers)) {
+                LogInfo(__FUNC__ "In-flight fetch unusable, fetching alone.");
+                LeaveFlight();
 
-        while (*b != '\r') {
-            const char *e = strstr(b, "\r\n");
-            const char *colon = strstr(b, ": ");
-            if (!colon || colon > e) {
-                colon = strchr(b, ':');
+                // 领头者可能是因为回应太大而放弃的，它也许已在磁盘上
+                auto disk = LookupDisk();
+                if (disk) {
+                    return StartCacheHit(move(disk));
+                }
+
+                return HandleServer();
+            }
+
+            m_hit = move(entry);
+            SetHitHeaders();
+
+            const IoSlice slices[] = {
+                { m_hit->head.data(), m_hit->head.size() },
+                { m_hitHeaders.data(), m_hitHeaders.size() },
+            };
+
+            m_rspBytes = slices[0].len + slices[1].len;
+
+            if (WriteV(m_bsocket, m_toBrowser, slices, 2) != RR_ALIVE) {
+                return RR_ERROR;
             }
 
-            if (colon && colon + 2 < e) {
-                string k(b, colon), v(colon + 2, e);
-                this->m.emplace(make_pair(k, v));
+            // 头部没能一次发完的话，等发完再读取数据体
+            continue;
+        }
+
+        if (n > 0) {
+            m_hitSent += n;
+            m_rspBytes += n;
+
+            if (Write(m_bsocket, m_toBrowser, buf.data(), n) != RR_ALIVE) {
+                return RR_ERROR;
             }
 
-            b = e + 2;
+            continue;
+        }
+
+        if (state == ResponseCache::Flight::FL_DONE) {
+            LeaveFlight();
+            return FinishCacheHit();
+        }
+
+        if (state == ResponseCache::Flight::FL_FAILED) {
+            LogError(__FUNC__ "In-flight fetch failed midway");
+            return RR_ERROR;
         }
 
-        this->bodyOffset = p + 4 - buf;
+        return RR_AGAIN;
+    }
+}
+
+void MyProxy::OnFlightProgress() {
+    if (m_state != ST_FOLLOW) {
+        return;
+    }
+
+    Drive();
+}
+
+void MyProxy::LeaveFlight() {
+    if (!m_flight) {
+        return;
+    }
+
+    if (m_leader) {
+        m_flight->Finish(false);
+    }
+    else {
+        m_flight->Unfollow(this);
+    }
+
+    m_flight.reset();
+}
+
+MyProxy::RelayResult MyProxy::RetryRequest() {
+    if (!m_reused || m_reqStreamed || m_rspBytes > 0) {
+        return RR_ERROR;
+    }
+
+    ShutdownServerSocket(); // 忽略错误处理
+
+    m_reused = false;
+    return SetUpServerSocket() ? RR_ALIVE : RR_ERROR;
+}
+
+bool MyProxy::ShutdownServerSocket() {
+    if (m_ssocket == INVALID_SOCKET) {
         return true;
     }
 
-    return false;
+    auto ssocket = m_ssocket;
+    m_ssocket = INVALID_SOCKET;
+    m_sevents = 0;
+
+    m_loop.Remove(ssocket);
+    m_toServer.Clear();
+
+    return ShutdownConnection(ssocket, false);
+}
+
+void MyProxy::ReleaseServerSocket() {
+    if (m_ssocket == INVALID_SOCKET) {
+        return;
+    }
+
+    // 请求还没有发完的连接不能复用
+    if (!m_toServer.Empty()) {
+        ShutdownServerSocket();
+        return;
+    }
+
+    auto ssocket = m_ssocket;
+    m_ssocket = INVALID_SOCKET;
+    m_sevents = 0;
+
+    m_loop.Remove(ssocket);
+    ConnectionPool::Checkin(m_host.GetFullName(), ssocket);
 }
 
-void MyProxy::Headers::Clear() {
-    this->status_code = 0;
-    this->m.clear();
-    this->bodyOffset = -1;
+static SOCKET DoConnect(const sockaddr *addr, int addrlen,
+                        int family, int socktype, int protocol) {
+    SOCKET sd = socket(family, socktype, protocol);
+    if (sd != INVALID_SOCKET) {
+        if (SetNonBlocking(sd) &&
+            (connect(sd, addr, addrlen) == 0 || WouldBlock())) {
+            return sd;
+        }
+
+        closesocket(sd);
+        sd = INVALID_SOCKET;
+    }
+
+    return sd;
 }
 
-bool MyProxy::Headers::KeepAlive() const {
-    auto it(m.find("Connection"));
-    if (it != m.end()) {
-        return ToLower(it->second) != "close";
+bool MyProxy::SetUpServerSocket() {
+    m_endpoints.clear();
+    m_nextEndpoint = 0;
+
+    Metrics::Add(Metrics::DNS_QUERIES);
+    m_fromCache = false;
+
+    auto entry = DNSCache::Resolve(m_host.GetFullName());
+    if (!entry) {
+        return ResolveHost();
+    }
+
+    if (entry->IsNegative()) {
+        // 最近解析失败过，暂不重试
+        LogError(__FUNC__ "Resolving " + m_host.name + " failed (cached): " +
+                 Resolver::ErrorMessage(entry->error));
+
+        return false;
     }
 
-    // TODO: HTTP/1.1 ĬǱ
+    entry->GetEndpoints(m_endpoints);
+    m_fromCache = true;
+
+    m_connectStart = Clock::now();
+    return ConnectNextEndpoint();
+}
+
+bool MyProxy::ResolveHost() {
+    m_state = ST_RESOLVING;
+
+    // 回调时代理对象可能已被销毁
+    weak_ptr<MyProxy *> self(m_self);
+
+    Resolver::Resolve(m_host.name, m_host.port, m_loop,
+                      [self](const Resolver::Result &result) {
+        auto proxy(self.lock());
+        if (proxy) {
+            (*proxy)->OnResolved(result);
+        }
+    });
+
     return true;
 }
 
-bool MyProxy::Headers::DetermineFinishedByStatusCode() const {
-    if (status_code == 0) {
-        return false;
+void MyProxy::OnResolved(const Resolver::Result &result) {
+    if (m_state != ST_RESOLVING) {
+        return;
+    }
+
+    if (result.error != 0) {
+        LogError(__FUNC__ "Resolving " + m_host.name + " failed: " +
+                 Resolver::ErrorMessage(result.error));
+
+        Logger::LogError(__FUNC__ "Handling browser request failed");
+        Close();
+
+        return;
+    }
+
+    m_endpoints = result.endpoints;
+    m_nextEndpoint = 0;
+
+    m_connectStart = Clock::now();
+    if (!ConnectNextEndpoint()) {
+        Logger::LogError(__FUNC__ "Handling browser request failed");
+        Close();
+
+        return;
+    }
+
+    Drive();
+}
+
+bool MyProxy::ConnectNextEndpoint() {
+    m_loop.CancelTimer(m_attemptTimer);
+    m_attemptTimer = 0;
+
+    while (m_nextEndpoint < m_endpoints.size()) {
+        auto &ep = m_endpoints[m_nextEndpoint++];
+
+        SOCKET sd = DoConnect((const sockaddr *) &ep.addr, ep.addrlen,
+                              ep.family, ep.socktype, ep.protocol);
+
+        if (sd == INVALID_SOCKET) {
+            LogInfo(WSAGetLastErrorMessage(__FUNC__ "connect() failed"));
+            continue;
+        }
+
+        if (!m_loop.Add(sd, EventLoop::EV_WRITE, this)) {
+            closesocket(sd);
+            continue;
+        }
+
+        Attempt attempt;
+        attempt.sd = sd;
+        attempt.timer = m_loop.AddTimer(CONNECT_TIMEOUT, [this, sd]() {
+            OnConnectTimeout(sd);
+        });
+
+        m_attempts.push_back(attempt);
+
+        // 迟迟没有结果就并行地尝试下一个地址
+        if (m_nextEndpoint < m_endpoints.size()) {
+            m_attemptTimer = m_loop.AddTimer(CONNECT_ATTEMPT_DELAY, [this]() {
+                m_attemptTimer = 0;
+                ConnectNextEndpoint();
+            });
+        }
+
+        m_state = ST_CONNECTING;
+        return true;
     }
 
-    if (status_code < 200 || status_code == 304) {
+    if (!m_attempts.empty()) {
+        // 等待进行中的尝试
         return true;
     }
 
+    if (m_fromCache) {
+        // 所有地址都连不上，记录可能已经变了
+        DNSCache::Remove(m_host.GetFullName());
+
+        m_endpoints.clear();
+        m_nextEndpoint = 0;
+        m_fromCache = false;
+
+        return ResolveHost();
+    }
+
+    LogError(__FUNC__ "No appropriate IP address");
     return false;
 }
 
-bool MyProxy::Headers::IsChunked() const {
-    auto it(this->m.find("Transfer-Encoding"));
-    if (it != this->m.end()) {
-        return ToLower(it->second) == "chunked";
+void MyProxy::CloseAttempt(SOCKET sd) {
+    for (auto it = m_attempts.begin(); it != m_attempts.end(); ++it) {
+        if (it->sd == sd) {
+            m_loop.CancelTimer(it->timer);
+            m_loop.Remove(sd);
+            closesocket(sd);
+
+            m_attempts.erase(it);
+            return;
+        }
+    }
+}
+
+void MyProxy::CloseAttempts() {
+    m_loop.CancelTimer(m_attemptTimer);
+    m_attemptTimer = 0;
+
+    while (!m_attempts.empty()) {
+        CloseAttempt(m_attempts.back().sd);
+    }
+}
+
+bool MyProxy::IsAttempt(SOCKET sd) const {
+    for (auto &attempt : m_attempts) {
+        if (attempt.sd == sd) {
+            return true;
+        }
     }
 
     return false;
 }
 
+void MyProxy::OnConnectTimeout(SOCKET sd) {
+    LogInfo(__FUNC__ "connect() timed out");
+    CloseAttempt(sd);
+
+    if (!ConnectNextEndpoint()) {
+        Logger::LogError(__FUNC__ "Handling browser request failed");
+        Close();
+
+        return;
+    }
+
+    Drive();
+}
+
+MyProxy::RelayResult MyProxy::OnConnected(SOCKET sd) {
+    int nError = 0;
+    socklen_t len = sizeof(nError);
+
+    if (getsockopt(sd, SOL_SOCKET, SO_ERROR,
+                   (char *) &nError, &len) != 0) {
+        nError = WSAGetLastError();
+    }
+
+    if (nError != 0) {
+        LogInfo(WSAGetLastErrorMessage(__FUNC__ "connect() failed", nError));
+        CloseAttempt(sd);
+
+        // 立即尝试下一个地址，不必等到错开的时间
+        return ConnectNextEndpoint() ? RR_AGAIN : RR_ERROR;
+    }
+
+    // 胜出者接管服务器连接，放弃其余的尝试
+    for (auto it = m_attempts.begin(); it != m_attempts.end(); ++it) {
+        if (it->sd == sd) {
+            m_loop.CancelTimer(it->timer);
+            m_attempts.erase(it);
+            break;
+        }
+    }
+
+    CloseAttempts();
+
+    m_ssocket = sd;
+    m_sevents = EventLoop::EV_WRITE;
+
+    m_connectUs = ElapsedMicroseconds(m_connectStart);
+    Metrics::Record(Metrics::CONNECT_TIME, m_connectUs);
+
+    if (m_fromCache) {
+        Metrics::Add(Metrics::DNS_CACHE_HITS);
+    }
+
+    if (m_tunnel) {
+        const char *confirm = "HTTP/1.1 200 Connection Established\r\n\r\n";
+        if (Write(m_bsocket, m_toBrowser, confirm, strlen(confirm)) != RR_ALIVE) {
+            return RR_ERROR;
+        }
+
+        // 浏览器可能已经发来了隧道中的数据
+        size_t nBuffered = m_vbuf.size() - m_requestSize;
+        if (nBuffered > 0) {
+            auto data = m_vbuf.data() + m_requestSize;
+            if (Write(m_ssocket, m_toServer, data, nBuffered) != RR_ALIVE) {
+                return RR_ERROR;
+            }
+        }
+
+        m_vbuf.Clear();
+
+        // io_uring 下由 multishot recv 中转，不用 splice()
+        m_splice = ZERO_COPY && !m_async && SetUpSplicePipes();
+
+        LogAccess(200, ElapsedMicroseconds(m_requestStart));
+
+        m_state = ST_TUNNEL;
+        return RR_ALIVE;
+    }
+
+    return StartRequest();
+}
+
+bool MyProxy::SendBrowserHeaders(size_t nBody) {
+    assert(!m_vbuf.empty());
+
+    // 原始的请求就在 m_vbuf 中，只替换需要改动的部分，其余原样引用
+    IoSlice slices[kMaxIoSlices];
+    auto body = m_vbuf.data() + m_headers.HeaderSize();
+
+    // 确认过期的条目时附上条件字段
+    StrView conditions(m_conditions.data(), m_conditions.size());
+
+    size_t count = RequestRewriter::ToOrigin(m_headers, body, body + nBody,
+                                             slices, conditions);
+    if (count == 0) {
+        LogError(__FUNC__ "Too many Proxy-Connection fields");
+        return false;
+    }
+
+    return WriteV(m_ssocket, m_toServer, slices, count) == RR_ALIVE;
+}
+
+MyProxy::RelayResult MyProxy::RelaySSLConnection() {
+    while (true) {
+        RelayResult rrb, rrs;
+
+        if (m_splice) {
+            rrb = SpliceRelay(m_bsocket, m_ssocket, m_pipeUp, m_toServer);
+        }
+        else {
+            rrb = SimpleRelay(m_bsocket, m_ssocket, m_toServer);
+        }
+
+        if (rrb == RR_ERROR) {
+            auto fmt = __FUNC__ "SimpleRelay() browser failed";
+            LogError(WSAGetLastErrorMessage(fmt));
+
+            return RR_ERROR;
+        }
+        else if (rrb == RR_CLOSE) {
+            return RR_CLOSE;
+        }
+
+        if (m_splice) {
+            rrs = SpliceRelay(m_ssocket, m_bsocket, m_pipeDown, m_toBrowser);
+        }
+        else {
+            rrs = SimpleRelay(m_ssocket, m_bsocket, m_toBrowser);
+        }
+
+        if (rrs == RR_ERROR) {
+            auto fmt = __FUNC__ "SimpleRelay() server failed";
+            LogError(WSAGetLastErrorMessage(fmt));
+
+            return RR_ERROR;
+        }
+        else if (rrs == RR_CLOSE) {
+            return RR_CLOSE;
+        }
+
+        if (rrb == RR_AGAIN && rrs == RR_AGAIN) {
+            return RR_AGAIN;
+        }
+    } // while (true)
+}
+
+MyProxy::RelayResult MyProxy::SimpleRelay(SOCKET r, SOCKET w, Outbox &box) {
+    auto rr = Flush(w, box);
+    if (rr != RR_ALIVE) {
+        return rr; // 对方还没有读完，暂不读取新数据
+    }
+
+    PooledSlab buf;
+
+    int nRx = recv(r, buf.data(), (int) buf.size(), 0);
+    if (nRx > 0) {
+        if (r == m_bsocket) {
+            Metrics::Add(Metrics::IN_BYTES, nRx);
+        }
+
+        return Write(w, box, buf.data(), nRx);
+    }
+    else if (nRx == 0) {
+        return RR_CLOSE; // 连接被一方关闭
+    }
+    else if (WouldBlock()) {
+        return RR_AGAIN;
+    }
+    else { // SOCKET_ERROR
+        return RR_ERROR;
+    }
+}
+
+bool MyProxy::SetUpSplicePipes() {
+#ifdef __linux__
+    if (pipe2(m_pipeUp.fds, O_NONBLOCK | O_CLOEXEC) == 0) {
+        if (pipe2(m_pipeDown.fds, O_NONBLOCK | O_CLOEXEC) == 0) {
+            return true;
+        }
+    }
+
+    LogError(WSAGetLastErrorMessage(__FUNC__ "pipe2() failed"));
+    CloseSplicePipes();
+#endif
+
+    return false;
+}
+
+void MyProxy::CloseSplicePipes() {
+#ifdef __linux__
+    for (auto pipe : { &m_pipeUp, &m_pipeDown }) {
+        for (auto &fd : pipe->fds) {
+            if (fd != -1) {
+                close(fd);
+                fd = -1;
+            }
+        }
+
+        pipe->pending = 0;
+    }
+#endif
+}
+
+MyProxy::RelayResult MyProxy::SpliceRelay(SOCKET r, SOCKET w,
+                                          SplicePipe &pipe, Outbox &box) {
+#ifdef __linux__
+    // 一次最多搬运的字节数（管道的默认容量）
+    const size_t kPipeSize = 65536;
+    const unsigned flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+
+    auto rr = Flush(w, box);
+    if (rr != RR_ALIVE) {
+        return rr;
+    }
+
+    while (true) {
+        // 先写出管道中积压的数据
+        while (pipe.pending > 0) {
+            auto n = splice(pipe.fds[0], nullptr, w, nullptr, pipe.pending, flags);
+            if (n > 0) {
+                pipe.pending -= n;
+
+                if (w == m_bsocket) {
+                    Metrics::Add(Metrics::OUT_BYTES, n);
+                }
+            }
+            else if (n < 0 && errno == EAGAIN) {
+                return RR_AGAIN; // 对方还没有读完，暂不读取新数据
+            }
+            else {
+                return RR_ERROR;
+            }
+        }
+
+        // 管道已空，EAGAIN 只可能是因为 r 上没有数据
+        auto n = splice(r, nullptr, pipe.fds[1], nullptr, kPipeSize, flags);
+        if (n > 0) {
+            pipe.pending = n;
+
+            if (r == m_bsocket) {
+                Metrics::Add(Metrics::IN_BYTES, n);
+            }
+        }
+        else if (n == 0) {
+            return RR_CLOSE; // 连接被一方关闭
+        }
+        else if (errno == EAGAIN) {
+            return RR_AGAIN;
+        }
+        else if ((errno == EINVAL || errno == ENOSYS) &&
+                 m_pipeUp.pending == 0 && m_pipeDown.pending == 0) {
+            // 内核不支持，退回普通的读写
+            LogInfo(__FUNC__ "splice() unsupported, falling back to recv()/send()");
+
+            CloseSplicePipes();
+            m_splice = false;
+
+            return SimpleRelay(r, w, box);
+        }
+        else {
+            return RR_ERROR;
+        }
+    }
+#else
+    return SimpleRelay(r, w, box);
+#endif
+}
+
+MyProxy::RelayResult MyProxy::RelayToServer() {
+    PooledSlab buf;
+
+    while (true) {
+        auto rr = Flush(m_ssocket, m_toServer);
+        if (rr == RR_ERROR) {
+            return RetryRequest();
+        }
+        else if (rr != RR_ALIVE) {
+            return rr;
+        }
+
+        if (m_reqRest == 0) {
+            m_state = ST_RELAY_RESPONSE;
+            return RR_ALIVE;
+        }
+
+        int nWanted = (int) buf.size();
+        if (m_reqRest > 0) {
+            nWanted = (int) min(m_reqRest, (long long) nWanted);
+        }
+
+        int n = recv(m_bsocket, buf.data(), nWanted, 0);
+        if (n > 0) {
+            m_reqStreamed = true;
+
+            if (ForwardRequestBody(buf.data(), n) != RR_ALIVE) {
+                return RR_ERROR;
+            }
+        }
+        else if (n == 0) {
+            // Browser closed connection before we could relay
+            // all the data it sent, so bomb out early.
+            LogError("Browser unexpectedly dropped connection!");
+            return RR_CLOSE;
+        }
+        else if (WouldBlock()) {
+            return RR_AGAIN;
+        }
+        else {
+            LogError(WSAGetLastErrorMessage(__FUNC__ "recv() failed"));
+            return RR_ERROR;
+        }
+    }
+}
+
+MyProxy::RelayResult MyProxy::ForwardRequestBody(const char *data, size_t len) {
+    Metrics::Add(Metrics::IN_BYTES, len);
+
+    if (m_reqRest >= 0) {
+        m_reqRest -= len;
+        return Write(m_ssocket, m_toServer, data, len);
+    }
+
+    size_t n;
+    auto dr = m_reqDecoder.Feed(data, len, n);
+    if (dr == ChunkedDecoder::DECODE_ERROR) {
+        LogError(__FUNC__ "Invalid chunked encoding in request!");
+        return RR_ERROR;
+    }
+
+    if (dr == ChunkedDecoder::DECODE_DONE) {
+        m_reqRest = 0;
+        m_ahead.Append(data + n, len - n);
+    }
+
+    return Write(m_ssocket, m_toServer, data, n);
+}
+
+MyProxy::RelayResult MyProxy::RelayToBrowser() {
+    PooledSlab buf;
+
+    while (true) {
+        auto rr = Flush(m_bsocket, m_toBrowser);
+        if (rr != RR_ALIVE) {
+            return rr;
+        }
+
+        if (m_rspDone) {
+            return FinishResponse();
+        }
+
+        int nReadBytes = recv(m_ssocket, buf.data(), (int) buf.size(), 0);
+        if (nReadBytes > 0) {
+            rr = OnServerData(buf.data(), nReadBytes);
+            if (rr != RR_ALIVE) {
+                return rr;
+            }
+        }
+        else if (nReadBytes == 0) {
+            if (m_rspBytes == 0 && m_reused) {
+                return RetryRequest();
+            }
+
+            // nRest 没有设置表明既没有设置 Content-Length，也不是分段传输，
+            // 那么应该是 Connection: close
+            if (!m_rspParsed || m_rspRest != -1) {
+                LogError(__FUNC__ "Connection closed by server prematurely.");
+            }
+
+            m_rspDone = true;
+            m_serverClosed = true;
+        }
+        else if (WouldBlock()) {
+            return RR_AGAIN;
+        }
+        else {
+            auto fmt = __FUNC__ "recv() failed";
+            LogError(WSAGetLastErrorMessage(fmt));
+
+            if (m_rspBytes == 0 && m_reused) {
+                return RetryRequest();
+            }
+
+            ShutdownServerSocket();
+            return RR_ERROR;
+        }
+    }
+}
+
+MyProxy::RelayResult MyProxy::RelayToServerAsync() {
+    auto rr = Flush(m_ssocket, m_toServer);
+    if (rr == RR_ERROR) {
+        return RetryRequest();
+    }
+
+    if (m_reqRest == 0) {
+        if (rr != RR_ALIVE) {
+            return rr;
+        }
+
+        m_state = ST_RELAY_RESPONSE;
+        return RR_ALIVE;
+    }
+
+    // 头部发出之前不读取数据体，复用的连接已经失效时还可以重发请求
+    if (!m_reqStreamed && rr != RR_ALIVE) {
+        return rr;
+    }
+
+    // 接收开始之后数据随时可能被读走，请求就不能再重发了
+    m_reqStreamed = true;
+
+    size_t limit = m_reqRest > 0 ? (size_t) m_reqRest : BufferPool::SLAB_SIZE;
+    if (!ReceiveUnlessBacklogged(m_bsocket, m_ssocket, limit)) {
+        return RR_ERROR;
+    }
+
+    return RR_AGAIN;
+}
+
+MyProxy::RelayResult MyProxy::RelayToBrowserAsync() {
+    auto rr = Flush(m_bsocket, m_toBrowser);
+    if (rr == RR_ERROR) {
+        return rr;
+    }
+
+    // 回应发完才能结束，下一个回应或者关闭连接都不能越过它
+    if (m_rspDone) {
+        return rr == RR_ALIVE ? FinishResponse() : rr;
+    }
+
+    return ReceiveUnlessBacklogged(m_ssocket, m_bsocket) ? RR_AGAIN : RR_ERROR;
+}
+
+MyProxy::RelayResult MyProxy::RelayTunnelAsync() {
+    auto rrb = Flush(m_ssocket, m_toServer);
+    auto rrs = Flush(m_bsocket, m_toBrowser);
+
+    if (rrb == RR_ERROR || rrs == RR_ERROR) {
+        return RR_ERROR;
+    }
+
+    // 一方关闭之后，把已经收到的数据转交完再关闭
+    if (m_browserClosed || m_serverClosed) {
+        return rrb == RR_ALIVE && rrs == RR_ALIVE ? RR_CLOSE : RR_AGAIN;
+    }
+
+    if (!ReceiveUnlessBacklogged(m_bsocket, m_ssocket) ||
+        !ReceiveUnlessBacklogged(m_ssocket, m_bsocket)) {
+        return RR_ERROR;
+    }
+
+    return RR_AGAIN;
+}
+
+bool MyProxy::ReceiveUnlessBacklogged(SOCKET r, SOCKET w, size_t limit) {
+    // 积压的数据发完时 OnSent() 会再次推进，那时重新开始接收
+    if (m_loop.Unsent(w) >= kMaxUnsent) {
+        m_loop.StopRecv(r);
+        return true;
+    }
+
+    if (!m_loop.StartRecv(r, limit)) {
+        LogError(__FUNC__ "StartRecv() failed");
+        return false;
+    }
+
+    return true;
+}
+
+MyProxy::RelayResult MyProxy::OnReceived(SOCKET sd, char *data, long len) {
+    bool fromBrowser = sd == m_bsocket;
+
+    if (len < 0) {
+        if (len == -ECANCELED) {
+            return RR_ALIVE; // 由 StopRecv() 撤销
+        }
+
+        LogError(WSAGetLastErrorMessage(__FUNC__ "recv() failed", (int) -len));
+
+        if (!fromBrowser && m_state == ST_RELAY_RESPONSE &&
+            m_rspBytes == 0 && m_reused) {
+            return RetryRequest();
+        }
+
+        return RR_ERROR;
+    }
+
+    if (m_state == ST_TUNNEL) {
+        if (len == 0) {
+            (fromBrowser ? m_browserClosed : m_serverClosed) = true;
+            return RR_ALIVE;
+        }
+
+        if (fromBrowser) {
+            Metrics::Add(Metrics::IN_BYTES, len);
+            return Write(m_ssocket, m_toServer, data, len);
+        }
+
+        return Write(m_bsocket, m_toBrowser, data, len);
+    }
+
+    // 浏览器的数据只在转发请求数据体时接收，且不超过剩下的字节数
+    if (fromBrowser) {
+        if (m_state != ST_RELAY_REQUEST ||
+            (m_reqRest >= 0 && len > m_reqRest)) {
+            LogError(__FUNC__ "Unexpected data from browser");
+            return RR_ERROR;
+        }
+
+        if (len == 0) {
+            LogError("Browser unexpectedly dropped connection!");
+            return RR_CLOSE;
+        }
+
+        return ForwardRequestBody(data, (size_t) len);
+    }
+
+    if (m_state != ST_RELAY_RESPONSE) {
+        LogError(__FUNC__ "Unexpected data from server");
+        ShutdownServerSocket();
+
+        return RR_ALIVE;
+    }
+
+    if (len == 0) {
+        // 回应之后服务器关闭了连接，不能再复用
+        if (m_rspDone) {
+            ShutdownServerSocket();
+            return RR_ALIVE;
+        }
+
+        if (m_rspBytes == 0 && m_reused) {
+            return RetryRequest();
+        }
+
+        // 同 RelayToBrowser()
+        if (!m_rspParsed || m_rspRest != -1) {
+            LogError(__FUNC__ "Connection closed by server prematurely.");
+        }
+
+        m_rspDone = true;
+        m_serverClosed = true;
+
+        return RR_ALIVE;
+    }
+
+    // 回应完整之后收到的数据由 OnServerData() 当作多余的数据处理
+    auto rr = OnServerData(data, len);
+    if (rr == RR_ALIVE && m_rspDone) {
+        m_loop.StopRecv(m_ssocket);
+    }
+
+    return rr;
+}
+
+MyProxy::RelayResult MyProxy::OnServerData(char *data, size_t len) {
+    if (m_rspBytes == 0) {
+        m_firstByteUs = ElapsedMicroseconds(m_requestSent);
+        Metrics::Record(Metrics::FIRST_BYTE_TIME, m_firstByteUs);
+    }
+
+    m_rspBytes += len;
+
+    // 之前还有未处理完的数据，拼接到它们之后
+    if (!m_hbuf.empty() || !m_rspParsed) {
+        m_hbuf.Append(data, len);
+
+        data = m_hbuf.data();
+        len = m_hbuf.size();
+    }
+
+    size_t pos = 0; // 已处理的字节数
+    size_t fwd = 0; // 可以转发给浏览器的字节数
+    size_t bodyFrom = m_rspParsed ? 0 : len; // 数据体的开头
+
+    while (pos < len && !m_rspDone) {
+        if (!m_rspParsed) {
+            auto head = data + pos;
+
+            // 不完整的头部保存在 m_hbuf 的开头，解析器接着上次的位置扫描
+            auto pr = m_rspHeaders.Parse(data + pos, len - pos);
+            if (pr == HttpParser::PARSE_AGAIN) {
+                break; // 先不要输出
+            }
+            else if (pr == HttpParser::PARSE_ERROR) {
+                LogError(__FUNC__ "Malformed response headers");
+                ShutdownServerSocket();
+
+                return RR_ERROR;
+            }
+
+            pos += m_rspHeaders.HeaderSize();
+            fwd = pos;
+
+            // Request received, continuing process
+            if (m_rspHeaders.status_code < 200) {
+                m_rspHeaders.Reset();
+                continue;
+            }
+
+            m_rspParsed = true;
+            BeginResponseBody();
+
+            bodyFrom = pos;
+
+            if (!m_cacheKey.empty() && !m_head) {
+                auto delay = (time_t) (m_firstByteUs / 1000000);
+
+                if (m_stale && m_rspHeaders.status_code == 304) {
+                    m_refreshed = ResponseCache::Refresh(m_stale, m_rspHeaders,
+                                                         delay);
+                }
+                else {
+                    // 磁盘缓存可以存储更大的回应
+                    auto limit = ResponseCache::MAX_ENTRY_SIZE;
+                    if (DiskCache::IsEnabled()) {
+                        limit = max(limit, DiskCache::SEGMENT_SIZE);
+                    }
+
+                    m_store = ResponseCache::Prepare(m_headers, m_rspHeaders,
+                                                     head, delay, limit);
+
+                    auto length = m_rspHeaders.contentLength;
+                    if (m_store && length >= 0) {
+                        m_diskStore = DiskCache::Store(m_cacheKey, *m_store,
+                                                       (size_t) length);
+                    }
+
+                    // 放不进内存的只存在磁盘上
+                    if (m_store && length > 0 &&
+                        m_store->head.size() + (size_t) length >
+                        ResponseCache::MAX_ENTRY_SIZE) {
+                        m_store.reset();
+                    }
+                }
+
+                // 回应不能分享，跟随者各自向服务器请求
+                if (m_flight) {
+                    if (m_store) {
+                        m_flight->Begin(m_store);
+                    }
+                    else if (!m_refreshed) {
+                        m_flight->Finish(false);
+                        m_flight.reset();
+                    }
+                }
+            }
+        }
+        else if (m_chunked) {
+            // 解码器处理掉本次所有的数据，不需要缓存不完整的分段大小
+            size_t n;
+            auto dr = m_chunkDecoder.Feed(data + pos, len - pos, n);
+            if (dr == ChunkedDecoder::DECODE_ERROR) {
+                LogError("Invalid chunked encoding!");
+                ShutdownServerSocket();
+
+                return RR_ERROR;
+            }
+
+            pos += n;
+            fwd = pos;
+
+            if (dr == ChunkedDecoder::DECODE_DONE) {
+                m_rspDone = true;
+            }
+        }
+        else if (m_rspRest == -1) {
+            pos = fwd = len;
+        }
+        else {
+            auto n = min(m_rspRest, (long long) (len - pos));
+
+            pos += (size_t) n;
+            fwd = pos;
+
+            m_rspRest -= n;
+            if (m_rspRest == 0) {
+                m_rspDone = true;
+            }
+        }
+    }
+
+    if (m_rspDone && pos < len) {
+        LogError("Junk data encountered!");
+        len = pos;
+
+        // 连接的状态已不可信，不能再复用
+        ShutdownServerSocket();
+    }
+
+    if (m_diskStore && fwd > bodyFrom &&
+        !m_diskStore->Write(data + bodyFrom, fwd - bodyFrom)) {
+        m_diskStore.reset();
+    }
+
+    // 要存入缓存的回应，收集转发出去的数据体
+    if (m_store && fwd > bodyFrom) {
+        auto n = fwd - bodyFrom;
+
+        if (m_flight) {
+            // 跟随者经由获取读取，太大时它只为已有的跟随者保留数据
+            if (!m_flight->Append(data + bodyFrom, n)) {
+                m_flight->Finish(false);
+                m_flight.reset();
+                m_store.reset();
+            }
+        }
+        else if (m_store->head.size() + m_store->body.size() + n >
+                 ResponseCache::MAX_ENTRY_SIZE) {
+            m_store.reset(); // 太大了，不再收集
+        }
+        else {
+            m_store->body.append(data + bodyFrom, n);
+        }
+    }
+
+    // 确认过期条目的 304 是给我们的，浏览器收到的是刷新后的条目
+    if (m_refreshed) {
+        m_hbuf.Clear();
+        return RR_ALIVE;
+    }
+
+    if (fwd > 0 && Write(m_bsocket, m_toBrowser, data, fwd) != RR_ALIVE) {
+        return RR_ERROR;
+    }
+
+    // 保留不完整的头部，等待更多的数据
+    if (data == m_hbuf.data()) {
+        if (fwd == len) {
+            m_hbuf.Clear();
+        }
+        else {
+            m_hbuf.Consume(fwd);
+        }
+    }
+    else if (fwd < len) {
+        m_hbuf.Append(data + fwd, len - fwd);
+    }
+
+    return RR_ALIVE;
+}
+
+void MyProxy::BeginResponseBody() {
+    m_rspRest = -1;
+
+    if (m_head || m_rspHeaders.DetermineFinishedByStatusCode()) {
+        m_rspRest = 0;
+    }
+    else {
+        if (m_rspHeaders.contentLength != -1) {
+            m_rspRest = m_rspHeaders.contentLength;
+        }
+        else if (m_rspHeaders.IsChunked()) {
+            m_chunked = true;
+            m_chunkDecoder.Reset();
+
+            return;
+        }
+    }
+
+    if (m_rspRest == 0) {
+        m_rspDone = true;
+    }
+}
+
+MyProxy::RelayResult MyProxy::Write(SOCKET sd, Outbox &box,
+                                    const char *buf, size_t len) {
+    size_t nSentBytes = 0;
+
+    // 暂存的数据稍后总会发出，或者连接出错而被关闭
+    if (sd == m_bsocket) {
+        Metrics::Add(Metrics::OUT_BYTES, len);
+    }
+
+    if (m_async) {
+        box.data.Append(buf, len);
+        return Flush(sd, box) == RR_ERROR ? RR_ERROR : RR_ALIVE;
+    }
+
+    // 必须先发送之前积压的数据
+    if (box.Empty()) {
+        box.Clear();
+
+        while (nSentBytes < len) {
+            int n = send(sd, buf + nSentBytes, (int) (len - nSentBytes),
+                         MSG_NOSIGNAL);
+            if (n > 0) {
+                nSentBytes += n;
+            }
+            else if (n == SOCKET_ERROR && WouldBlock()) {
+                break;
+            }
+            else {
+                LogError(WSAGetLastErrorMessage(__FUNC__ "send() failed"));
+                return RR_ERROR;
+            }
+        }
+    }
+
+    box.data.Append(buf + nSentBytes, len - nSentBytes);
+    return RR_ALIVE;
+}
+
+MyProxy::RelayResult MyProxy::WriteV(SOCKET sd, Outbox &box,
+                                     const IoSlice *slices, size_t count) {
+    size_t i = 0; // 第一个尚未发送完的段
+    size_t offset = 0; // 该段已发送的字节数
+
+    // io_uring 下拼接之后一并交给事件循环
+    if (box.Empty() && !m_async) {
+        box.Clear();
+
+        while (i < count) {
+            IoSlice rest[kMaxIoSlices];
+            size_t n = 0;
+
+            for (size_t j = i; j < count && n < kMaxIoSlices; j++) {
+                rest[n] = slices[j];
+                if (j == i) {
+                    rest[n].data += offset;
+                    rest[n].len -= offset;
+                }
+
+                n++;
+            }
+
+            long nSent = SendV(sd, rest, n);
+            if (nSent > 0) {
+                offset += nSent;
+                while (i < count && offset >= slices[i].len) {
+                    offset -= slices[i].len;
+                    i++;
+                }
+            }
+            else if (nSent == SOCKET_ERROR && WouldBlock()) {
+                break;
+            }
+            else {
+                LogError(WSAGetLastErrorMessage(__FUNC__ "sendmsg() failed"));
+                return RR_ERROR;
+            }
+        }
+    }
+
+    for (; i < count; i++) {
+        box.data.Append(slices[i].data + offset, slices[i].len - offset);
+        offset = 0;
+    }
+
+    if (m_async) {
+        return Flush(sd, box) == RR_ERROR ? RR_ERROR : RR_ALIVE;
+    }
+
+    return RR_ALIVE;
+}
+
+MyProxy::RelayResult MyProxy::Flush(SOCKET sd, Outbox &box) {
+    // io_uring 下交给事件循环发送，发完时由 OnSent() 接着推进
+    if (m_async) {
+        if (box.failed) {
+            return RR_ERROR;
+        }
+
+        if (!box.data.empty()) {
+            if (!m_loop.Send(sd, box.data)) {
+                LogError(__FUNC__ "Send() failed");
+                return RR_ERROR;
+            }
+
+            box.sending = true;
+        }
+
+        return box.sending ? RR_AGAIN : RR_ALIVE;
+    }
+
+    while (!box.Empty()) {
+        int n = send(sd, box.data.data(), (int) box.data.size(), MSG_NOSIGNAL);
+        if (n > 0) {
+            box.data.Consume(n);
+        }
+        else if (n == SOCKET_ERROR && WouldBlock()) {
+            return RR_AGAIN;
+        }
+        else {
+            // Browser or server closed connection before we could reply to
+            // all the data it sent, so bomb out early.
+            LogError(WSAGetLastErrorMessage(__FUNC__ "send() failed"));
+            return RR_ERROR;
+        }
+    }
+
+    box.Clear();
+    return RR_ALIVE;
+}
+
+void MyProxy::LogInfo(const string &msg) const {
+    Log(msg, Logger::OL_INFO);
+}
+
+void MyProxy::LogError(const string &msg) const {
+    Log(msg, Logger::OL_ERROR);
+}
+
+void MyProxy::Log(const string &msg, Logger::OutputLevel level) const {
+    if (!Logger::Enabled(level)) {
+        return;
+    }
+
+    if (m_host.port > 0) {
+        Logger::Log(m_host.GetFullName(), msg, level);
+    }
+    else {
+        Logger::Log(msg, level);
+    }
+}
+
+void MyProxy::LogAccess(int status, uint64_t totalUs) const {
+    if (!Logger::AccessEnabled()) {
+        return;
+    }
+
+    auto method = m_headers.Method();
+    auto target = m_headers.Target();
+
+    Logger::Access access;
+    access.method = method.data;
+    access.methodLen = method.size;
+    access.host = m_host.name.data();
+    access.hostLen = m_host.name.size();
+    access.port = m_host.port;
+    access.target = target.data;
+    access.targetLen = target.size;
+    access.status = status;
+    access.requestBytes = m_headers.HeaderSize() + max(m_headers.contentLength, 0LL);
+    access.responseBytes = m_rspBytes;
+    access.connectUs = m_connectUs;
+    access.firstByteUs = m_firstByteUs;
+    access.totalUs = totalUs;
+
+    Logger::LogAccess(access);
+}
+
 //////////////////////////////////////////////////////////////////////////
 
 string MyProxy::Host::GetFullName() const {
@@ -1,108 +1,376 @@
 #pragma once
 #include "Logger.hpp"
+#include "Admission.hpp"
+#include "EventLoop.hpp"
+#include "Resolver.hpp"
+#include "HttpParser.hpp"
+#include "ChunkedDecoder.hpp"
+#include "BufferPool.hpp"
+#include "ResponseCache.hpp"
+#include "DiskCache.hpp"
+#include "Metrics.hpp"
 #include "ws-util.h"
 
 #include <vector>
-#include <map>
-#include <atomic>
+#include <chrono>
+#include <memory>
 using namespace std;
 
-/// 
-class MyProxy {
+/// 代理对象
+/// 
+/// 每个浏览器连接对应一个代理对象，由其所属的事件循环驱动。
+/// 连接结束后代理对象自行销毁。
+class MyProxy : public EventLoop::Handler {
 public:
 
-    /// 캯
-    MyProxy(SOCKET bsocket);
+    /// 构造函数
+    /// 
+    /// @param bsocket 浏览器连接，必须已是非阻塞模式（见 AcceptNonBlocking()）
+    MyProxy(EventLoop &loop, SOCKET bsocket);
 
-    /// 
+    /// 析构函数
     ~MyProxy();
 
-    /// 
-    bool HandleBrowser();
+    /// 开始处理来自浏览器的连接
+    /// 
+    /// 必须在 @a loop 所在的线程中调用。失败时对象已被销毁。
+    /// 超出连接数上限（见 Admission）时以 503 回应并关闭连接。
+    bool Start();
 
-    /// ӡ HTTP ͷĵһУ GETPOST Ϣ
+    /// 处理 SOCKET 上的事件
+    virtual void OnEvents(SOCKET sd, int events) override;
+
+    /// 处理 io_uring 收到的数据
+    virtual void OnRecv(SOCKET sd, char *data, long len) override;
+
+    /// 交给 io_uring 的数据已经发出
+    virtual void OnSent(SOCKET sd, int error) override;
+
+    /// 打印 HTTP 头的第一行，包含 GET、POST 等信息
     void PrintRequest(Logger::OutputLevel level) const;
 
-    /// ͳϢ
+    /// 统计信息
     struct Statistics {
-        /// ܵ
-        atomic_int requests;
+        /// 总的请求数
+        unsigned long long requests;
+
+        /// 从浏览器读到、交给浏览器的字节数
+        unsigned long long inBytes, outBytes;
 
-        /// 롢ֽ
-        atomic_llong inBytes, outBytes;
+        /// DNS 查询数
+        unsigned long long dnsQueries;
 
-        /// DNS ѯ
-        atomic_int dnsQueries;
+        /// DNS 缓存命中数
+        unsigned long long dnsCacheHit;
 
-        /// DNS 
-        atomic_int dnsCacheHit;
+        /// 因超时而关闭的连接数
+        unsigned long long timeouts;
+
+        /// 超出连接数上限而被拒绝的连接数
+        unsigned long long rejected;
+
+        /// 当前的浏览器连接数
+        int connections;
+
+        /// 连接服务器、等待回应的第一个字节、整个请求的耗时（微秒）
+        Metrics::Histogram connectTime, firstByteTime, requestTime;
     };
 
-    /// ȡͳϢ
-    static const Statistics &GetStatistics();
+    /// 获取统计信息（汇总所有线程）
+    static Statistics GetStatistics();
+
+    /// 是否使用 splice() 零拷贝地中转 SSL 隧道
+    /// 
+    /// 仅 Linux 支持，默认开启。不可用时自动退回普通的读写。
+    /// 由 io_uring 收发时（见 EventLoop::HasAsyncIo()）不使用。
+    static bool ZERO_COPY;
+
+    /// 连接服务器时，前一个地址多久（毫秒）没有结果就并行尝试下一个
+    /// 
+    /// 即 RFC 8305 (Happy Eyeballs) 中的 Connection Attempt Delay，默认 250。
+    static unsigned CONNECT_ATTEMPT_DELAY;
+
+    /// 单个地址的连接超时（毫秒），默认 10000
+    static unsigned CONNECT_TIMEOUT;
+
+    /// 读取请求头部的超时（毫秒），默认 10000
+    /// 
+    /// 从连接建立、或者收到请求的第一个字节算起，不因陆续收到数据而顺延，
+    /// 一点一点发送头部的连接（slowloris）也会被关闭。
+    static unsigned HEADER_TIMEOUT;
+
+    /// 保持的连接上两个请求之间的最长空闲时间（毫秒），默认 60000
+    static unsigned KEEPALIVE_TIMEOUT;
+
+    /// 等待服务器回应的超时（毫秒），默认 60000
+    /// 
+    /// 发出请求之后迟迟没有收到回应的第一个字节，或者转发请求、回应期间
+    /// 两个方向都没有任何进展，超过这一时间就关闭连接。
+    static unsigned FIRST_BYTE_TIMEOUT;
+
+    /// SSL 隧道的最长空闲时间（毫秒），默认 300000
+    static unsigned TUNNEL_TIMEOUT;
+
+    // 以上超时为 0 时不限
 
 private:
 
-    // 
-    typedef vector<char> Buffer;
+    typedef chrono::steady_clock Clock;
 
-    // 
-    void SplitHost(const string &host_decl, int default_port);
+    // 等待发送的数据
+    struct Outbox {
+        bool Empty() const {
+            return data.empty() && !sending;
+        }
+
+        void Clear() {
+            data.Clear();
+            sending = failed = false;
+        }
+
+        IoBuffer data; // 已发送的部分随即移除
+
+        // io_uring 下数据交给事件循环发送（见 EventLoop::Send()）
+        bool sending = false; // 尚未发完
+        bool failed = false; // 发送出错
+    };
 
-    // ת
+    // 连接状态
+    enum State {
+        ST_READ_HEADERS, // 读取浏览器的 HTTP 头部
+        ST_RESOLVING, // 正在解析服务器的域名
+        ST_CONNECTING, // 正在连接服务器
+        ST_RELAY_REQUEST, // 转发请求给服务器
+        ST_RELAY_RESPONSE, // 取回服务器的回应给浏览器
+        ST_SERVE_CACHE, // 从缓存发送回应
+        ST_FOLLOW, // 跟随别人进行中的获取，边收边发
+        ST_TUNNEL, // 中转 SSL 连接
+    };
+
+    // 解析主机
+    void SplitHost(const StrView &host_decl, int default_port);
+
+    // 中转操作结果
     enum RelayResult {
-        RR_ERROR, // ˴
-        RR_CLOSE, // Զѹر
-        RR_ALIVE, // ûзκδԶȻ
+        RR_ERROR, // 发生了错误
+        RR_CLOSE, // 远程连接已关闭
+        RR_ALIVE, // 没有发生任何错误，远程连接仍然保持
+        RR_AGAIN, // 操作会阻塞，需等待下一次事件
     };
 
-    // ת
+    // 推进状态机，直至需要等待事件
+    // 
+    // @param rr 不是 RR_ALIVE 时直接按它结束
+    void Drive(RelayResult rr = RR_ALIVE);
+
+    // 根据当前状态更新关注的事件
+    void UpdateEvents();
+
+    // 关闭所有连接并销毁自身
+    void Close();
+
+    // 当前状态适用的超时
+    // 
+    // @param since 计时的起点
+    // @return 超时的毫秒数，0 表示不限（解析与连接另有各自的超时）
+    unsigned GetTimeout(Clock::time_point &since) const;
+
+    // 按当前状态确保超时定时器不晚于截止时间触发
+    // 
+    // 截止时间推后时不动定时器，等它触发时再顺延，
+    // 频繁的读写不会反复地取消、设置定时器。
+    void UpdateTimer();
+
+    // 让超时定时器在 @a deadline 触发
+    void ArmTimer(Clock::time_point deadline);
+
+    // 超时定时器触发
+    void OnTimeout();
+
+    // 读取、解析来自浏览器的 HTTP 头部
+    // 
+    // 先发完 m_toBrowser 中上一个回应剩下的数据。
+    RelayResult HandleBrowser();
+
+    // 已读到完整的 HTTP 头部
+    RelayResult OnBrowserHeaders();
+
+    // 转发至服务器
     RelayResult HandleServer();
-    RelayResult DoHandleServer();
 
-    // Ͽ
+    // 开始一次新的请求（已连接到服务器）
+    RelayResult StartRequest();
+
+    // 结束一次请求/回应
+    RelayResult FinishResponse();
+
+    // 准备读取同一连接上的下一个请求
+    RelayResult ReadNextRequest();
+
+    // 用缓存中的条目回应当前请求
+    RelayResult StartCacheHit(ResponseCache::EntryPtr entry);
+
+    // 发送缓存中的回应
+    // 
+    // 头部与数据体直接从条目中用 sendmsg() 发出，不经过 m_toBrowser。
+    // 来自磁盘缓存的数据体随后用 sendfile() 发出。
+    RelayResult ServeFromCache();
+
+    // 在磁盘缓存中查找，命中时设置 m_diskBody
+    ResponseCache::EntryPtr LookupDisk();
+
+    // 把 m_diskBody 中自 @a sent 字节起的部分发给浏览器
+    RelayResult SendDiskBody(size_t sent);
+
+    // 为命中的条目生成 Age 与 Connection 字段
+    void SetHitHeaders();
+
+    // 缓存中的回应已发送完毕
+    // 
+    // m_toBrowser 必须已经清空。
+    RelayResult FinishCacheHit();
+
+    // 跟随同一个键进行中的获取，不自己向服务器请求
+    RelayResult StartFollowing(ResponseCache::FlightPtr flight);
+
+    // 把跟随的获取已收到的部分发给浏览器
+    // 
+    // 获取在回应头部确定之前失败，或者回应的 Vary 与本请求不符时，
+    // 改为自己向服务器请求。
+    RelayResult FollowFlight();
+
+    // 跟随的获取有了新的进展（由领头者经事件循环通知）
+    void OnFlightProgress();
+
+    // 退出进行中的获取：领头者放弃获取，跟随者不再跟随
+    void LeaveFlight();
+
+    // 复用的连接已被服务器关闭，重新连接后再次发送请求
+    RelayResult RetryRequest();
+
+    // 断开与服务器的连接
     bool ShutdownServerSocket();
 
-    // ӵ
+    // 把服务器连接还给连接池
+    void ReleaseServerSocket();
+
+    // 连接到服务器
+    // 
+    // 优先使用 DNS 缓存中的地址。连接是异步的，完成后调用 OnConnected()。
     bool SetUpServerSocket();
 
-    // ʹ DNS  IP ַӵ
-    bool TryDNSCache();
+    // 异步解析主机的 IP 地址
+    // 
+    // 完成后调用 OnResolved()。
+    bool ResolveHost();
 
-    //  HTTP ͷ
-    bool SendBrowserHeaders();
+    // 域名解析完成
+    void OnResolved(const Resolver::Result &result);
 
-    // ת SSL 
-    bool RelaySSLConnection();
+    // 发起下一个地址的连接尝试
+    // 
+    // 各个地址错开 CONNECT_ATTEMPT_DELAY 依次发起，多个尝试同时进行，
+    // 先连上的胜出。
+    bool ConnectNextEndpoint();
+
+    // 放弃一个连接尝试
+    void CloseAttempt(SOCKET sd);
+
+    // 放弃所有进行中的连接尝试
+    void CloseAttempts();
+
+    // @a sd 是否为进行中的连接尝试
+    bool IsAttempt(SOCKET sd) const;
 
-    // 򵥡еת
+    // 连接尝试超时
+    void OnConnectTimeout(SOCKET sd);
+
+    // 异步连接完成
+    RelayResult OnConnected(SOCKET sd);
+
+    // 整理、发送来自浏览器的 HTTP 头部，以及已经收到的 @a nBody 字节数据体
     // 
-    //  @a r  @a w д
-    RelayResult SimpleRelay(SOCKET r, SOCKET w, Buffer &buf);
+    // 改写后的请求由 m_vbuf 中未改动的部分与少量替换的片段组成，
+    // 用一次 sendmsg() 发送，不复制数据。
+    bool SendBrowserHeaders(size_t nBody);
 
-    // תʣݸ
-    bool RelayToServer();
+    // 中转 SSL 连接
+    RelayResult RelaySSLConnection();
 
-    // ȡطĻӦ
-    bool RelayToBrowser();
+    // 简单、机械的中转
+    // 
+    // 从 @a r 读，往 @a w 写，写不完的数据暂存在 @a box 中
+    RelayResult SimpleRelay(SOCKET r, SOCKET w, Outbox &box);
 
-    // ָ HTTP ֶεʣֽ
+    // 经由管道的单向零拷贝通道
+    struct SplicePipe {
+        int fds[2] = { -1, -1 };
+        size_t pending = 0; // 管道中尚未写出的字节数
+    };
+
+    // 为隧道创建管道
+    bool SetUpSplicePipes();
+
+    // 关闭隧道的管道
+    void CloseSplicePipes();
+
+    // 零拷贝的中转：socket → 管道 → socket
     // 
-    // @param buf ݻ
-    // @param offset ʾֶδСʮַڻеƫ
-    // @return ʣδֽΪ -1˶
-    int CountChunkRest(Buffer &buf, int offset);
+    // 数据不经过用户空间。@a box 中暂存的数据会先被写出。
+    RelayResult SpliceRelay(SOCKET r, SOCKET w, SplicePipe &pipe, Outbox &box);
+
+    // 转发浏览器剩余的数据给服务器
+    RelayResult RelayToServer();
+
+    // 转发从浏览器收到的 @a len 字节请求数据体
+    // 
+    // 分段传输的数据体结束之后多收到的数据属于下一个请求，暂存在 m_ahead 中。
+    RelayResult ForwardRequestBody(const char *data, size_t len);
+
+    // 取回服务器的回应给浏览器
+    RelayResult RelayToBrowser();
 
-    //  @a len ֽڵ
-    bool ReadMore(Buffer &buf, int len);
+    // 以下三个函数用于 io_uring 的收发（见 EventLoop::HasAsyncIo()）：
+    // 数据由 OnRecv() 交来，发送完成时由 OnSent() 推进，这里只负责
+    // 开始、暂停接收以及判断是否已经结束
 
-    // ȡѵĻС
+    // 转发请求的数据体
     // 
-    // @return  -1˴
-    u_long GetBestBufferSize(SOCKET sd) const;
+    // 每次只接收数据体剩余的部分，同一连接上的下一个请求仍然留在
+    // SOCKET 中，由 HandleBrowser() 读取。
+    RelayResult RelayToServerAsync();
 
-    //  SOCKET д
-    RelayResult Write(SOCKET sd, const char *buf, size_t len);
+    // 转发回应，服务器连接上持续接收（multishot recv）
+    RelayResult RelayToBrowserAsync();
+
+    // 中转 SSL 连接，两个方向都持续接收
+    RelayResult RelayTunnelAsync();
+
+    // 发往 @a w 的数据积压不多时从 @a r 接收，否则暂停接收（背压）
+    bool ReceiveUnlessBacklogged(SOCKET r, SOCKET w, size_t limit = 0);
+
+    // 处理 io_uring 从 @a sd 收到的数据，参数同 OnRecv()
+    RelayResult OnReceived(SOCKET sd, char *data, long len);
+
+    // 处理从服务器读到的一段数据
+    RelayResult OnServerData(char *data, size_t len);
+
+    // 回应头部解析完毕，确定数据体的长度
+    void BeginResponseBody();
+
+    // 往 SOCKET 写入数据
+    // 
+    // 一次写不完的数据暂存在 @a box 中，待 SOCKET 可写时再发送。
+    RelayResult Write(SOCKET sd, Outbox &box, const char *buf, size_t len);
+
+    // 往 SOCKET 写入多段数据，尽量用一次系统调用
+    // 
+    // 一次写不完的数据暂存在 @a box 中。io_uring 下拼接之后交给事件循环。
+    RelayResult WriteV(SOCKET sd, Outbox &box,
+                       const IoSlice *slices, size_t count);
+
+    // 发送 @a box 中暂存的数据
+    RelayResult Flush(SOCKET sd, Outbox &box);
 
 private:
 
@@ -111,11 +379,29 @@ private:
 
     void Log(const string &msg, Logger::OutputLevel level) const;
 
+    // 记录一条访问日志
+    void LogAccess(int status, uint64_t totalUs) const;
+
 private:
 
-    // İ HTTP ͷһ
-    // ֻܲ HTTP ͷϢ
-    Buffer m_vbuf;
+    EventLoop &m_loop;
+
+    // 收发经由事件循环的 io_uring 完成（见 EventLoop::HasAsyncIo()）
+    const bool m_async;
+
+    // 占用的连接名额
+    Admission::Ticket m_ticket;
+
+    // 供异步回调判断代理对象是否仍然存在
+    shared_ptr<MyProxy *> m_self;
+    State m_state = ST_READ_HEADERS;
+
+    // 保存由浏览器发来的包含完整 HTTP 头部的一段数据
+    // 可能不单单只是 HTTP 头部信息。
+    IoBuffer m_vbuf;
+
+    // m_vbuf 中属于当前请求的字节数
+    size_t m_requestSize = 0;
 
     struct Host {
         void Clear() {
@@ -127,7 +413,7 @@ private:
             return this->name != other.name || this->port != other.port;
         }
 
-        // ȡȫ϶˿ڣ
+        // 获取全名（加上端口）
         string GetFullName() const;
 
         string name;
@@ -136,40 +422,129 @@ private:
 
     Host m_host;
 
-    // HTTP ͷ
-    struct Headers {
-    public:
+    // 浏览器请求的 HTTP 头部，字段指向 m_vbuf
+    HttpParser m_headers;
 
-        // ͷ
-        // 
-        // @param buf 뱣֤ 0 β
-        // @param browser Ƿ
-        bool Parse(const char *buf, bool browser);
+    // 当前请求是否为 HEAD 请求
+    bool m_head = false;
 
-        // 
-        void Clear();
+    // 是否为 CONNECT 隧道
+    bool m_tunnel = false;
 
-        // Ƿ񱣳
-        bool KeepAlive() const;
+    // 隧道的两个方向：浏览器 → 服务器，服务器 → 浏览器
+    SplicePipe m_pipeUp, m_pipeDown;
+    bool m_splice = false;
 
-        // ״̬ȷǷȻ
-        bool DetermineFinishedByStatusCode() const;
+    // 请求数据体尚未转发的字节数，分段传输时为 -1，由 m_reqDecoder 判断结束
+    long long m_reqRest = 0;
+    ChunkedDecoder m_reqDecoder;
 
-        // Ƿֶ
-        bool IsChunked() const;
+    // 读取分段传输的数据体时多收到的、属于下一个请求的数据
+    IoBuffer m_ahead;
 
-    public:
+    // 是否已经从浏览器读取过数据体（无法再重发请求）
+    bool m_reqStreamed = false;
 
-        int status_code = 0;
+    // 服务器连接是否取自连接池
+    bool m_reused = false;
 
-        map<string, string> m;
-        int bodyOffset = -1;
+    // 候选的服务器地址
+    vector<Resolver::Endpoint> m_endpoints;
+    size_t m_nextEndpoint = 0;
+
+    // 进行中的连接尝试
+    struct Attempt {
+        SOCKET sd;
+        EventLoop::TimerId timer; // 超时定时器
     };
 
-    Headers m_headers;
+    vector<Attempt> m_attempts;
+
+    // 发起下一个连接尝试的定时器
+    EventLoop::TimerId m_attemptTimer = 0;
+
+    // 候选地址是否来自 DNS 缓存
+    bool m_fromCache = false;
+
+    // 计时的起点：收到完整的请求头部、发起连接、发出请求
+    Clock::time_point m_requestStart, m_connectStart, m_requestSent;
+
+    // 本次请求连接服务器、等待回应的第一个字节的耗时（微秒）
+    uint64_t m_connectUs = 0, m_firstByteUs = 0;
+
+    // 上一次有进展（收到事件、被唤醒）的时间
+    Clock::time_point m_activity;
+
+    // 开始等待请求头部的时间：连接建立，或者收到请求的第一个字节
+    Clock::time_point m_headerStart;
+
+    // 保持的连接正在空闲，下一个请求还一个字节也没有收到
+    bool m_idle = false;
+
+    // 超时定时器，以及它触发的时间
+    EventLoop::TimerId m_timer = 0;
+    Clock::time_point m_timerDue;
+
+    // 服务器回应的 HTTP 头部
+    HttpParser m_rspHeaders;
+    bool m_rspParsed = false;
+
+    // 尚未转发给浏览器的不完整的回应头部
+    IoBuffer m_hbuf;
+
+    // 当前数据体的剩余字节数。-1 表示一直读到连接关闭
+    long long m_rspRest = -1;
+
+    // 分段传输时，由解码器确定数据体在哪里结束
+    bool m_chunked = false;
+    ChunkedDecoder m_chunkDecoder;
+
+    bool m_rspDone = false;
+
+    // 已收到的回应字节数
+    long long m_rspBytes = 0;
+
+    // 服务器是否已关闭连接
+    bool m_serverClosed = false;
+
+    // 浏览器是否已关闭连接（io_uring 下的隧道）
+    bool m_browserClosed = false;
+
+    // 当前请求在缓存中的键，不使用缓存时为空
+    string m_cacheKey;
+
+    // 正在收集、完整之后存入缓存的回应
+    shared_ptr<ResponseCache::Entry> m_store;
+
+    // 命中时正在发送的条目，以及随它发送的 Age 等字段
+    // 跟随时 m_hitSent 是已从获取中读出的数据体字节数
+    ResponseCache::EntryPtr m_hit;
+    string m_hitHeaders;
+    size_t m_hitSent = 0;
+
+    // 领头或者跟随的进行中的获取
+    ResponseCache::FlightPtr m_flight;
+    bool m_leader = false;
+
+    // 正在向服务器确认的过期条目，以及随请求发送的条件字段
+    ResponseCache::EntryPtr m_stale;
+    string m_conditions;
+
+    // 服务器回应 304 之后刷新的条目
+    shared_ptr<ResponseCache::Entry> m_refreshed;
+
+    // 命中磁盘缓存时数据体的位置
+    unique_ptr<DiskCache::Body> m_diskBody;
+
+    // 正在写入磁盘缓存的回应
+    unique_ptr<DiskCache::Writer> m_diskStore;
+
+    Outbox m_toServer;
+    Outbox m_toBrowser;
 
-    // ͳϢ
-    static Statistics ms_stat;
+    // 当前关注的事件
+    int m_bevents = 0;
+    int m_sevents = 0;
 
     SOCKET m_bsocket;
     SOCKET m_ssocket;
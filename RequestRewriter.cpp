@@ -0,0 +1,80 @@
+#include "RequestRewriter.hpp"
+#include <cstring>
+
+size_t RequestRewriter::ToOrigin(const HttpParser &headers, const char *body,
+                                 const char *end, IoSlice *slices, const StrView &extra) {
+    size_t count = 0;
+    const char *from = headers.Method().data; // 尚未加入的部分的开头
+
+    // 绝对形式的目标改为源服务器形式：http://host/path → /path
+    auto target = headers.Target();
+    if (target.size > 7 && StrView(target.data, 7).EqualsNoCase("http://")) {
+        auto slash = (const char *) memchr(target.data + 7, '/',
+                                           target.size - 7);
+
+        slices[count++] = IoSlice{ from, (size_t) (target.data - from) };
+        if (slash) {
+            slices[count++] = IoSlice{ slash,
+                                       (size_t) (target.data + target.size - slash) };
+        }
+        else {
+            slices[count++] = IoSlice{ "/", 1 };
+        }
+
+        from = target.data + target.size;
+    }
+
+    // Proxy-Connection 只对代理有意义：已有 Connection 时去掉，否则改名
+    bool hasConn = false;
+    for (size_t i = 0; i < headers.FieldCount(); i++) {
+        if (headers.FieldName(i).EqualsNoCase("Connection")) {
+            hasConn = true;
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < headers.FieldCount(); i++) {
+        auto name = headers.FieldName(i);
+        if (!name.EqualsNoCase("Proxy-Connection")) {
+            continue;
+        }
+
+        // 最后还要留一段给剩余的部分
+        if (count + 2 >= kMaxIoSlices) {
+            return 0;
+        }
+
+        slices[count++] = IoSlice{ from, (size_t) (name.data - from) };
+
+        if (hasConn) {
+            auto lf = (const char *) memchr(name.data, '\n', end - name.data);
+            from = lf + 1;
+        }
+        else {
+            slices[count++] = IoSlice{ "Connection", 10 };
+            from = name.data + name.size;
+        }
+    }
+
+    // 附加的字段放在结尾的空行之前
+    if (!extra.Empty()) {
+        if (count + 3 > kMaxIoSlices) {
+            return 0;
+        }
+
+        // HeaderSize() 包括请求行之前被跳过的空行，不能从 Method() 算起
+        auto blank = body - 1;
+        if (blank[-1] == '\r') {
+            blank--;
+        }
+
+        slices[count++] = IoSlice{ from, (size_t) (blank - from) };
+        slices[count++] = IoSlice{ extra.data, extra.size };
+        from = blank;
+    }
+
+    // 剩余的头部以及紧随其后的数据体
+    slices[count++] = IoSlice{ from, (size_t) (end - from) };
+
+    return count;
+}
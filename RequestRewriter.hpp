@@ -0,0 +1,26 @@
+#pragma once
+#include "HttpParser.hpp"
+#include "ws-util.h"
+
+/// 把发给代理的请求改写为发给源服务器的请求
+/// 
+/// 不复制数据：结果是一组分段，除了替换进去的常量字符串以外，
+/// 都指向原始的请求，可以直接交给 SendV()。
+class RequestRewriter {
+public:
+
+    /// 改写请求
+    /// 
+    /// 绝对形式的目标改为源服务器形式；Proxy-Connection 在已有 Connection
+    /// 时去掉，否则改名为 Connection。其余部分原样保留。
+    /// 
+    /// @param headers 已解析完成的请求头部，解析时的缓冲区必须仍然有效
+    /// @param body 头部的末尾，也就是数据体的开头
+    /// @param end 要发送的数据（头部以及紧随其后的数据体）的末尾
+    /// @param slices 至少能容纳 kMaxIoSlices 个分段
+    /// @param extra 插入到头部末尾（空行之前）的字段，每行以 CRLF 结尾，
+    ///              调用者须保证它在发送完之前有效
+    /// @return 分段数，分段不够用时返回 0
+    static size_t ToOrigin(const HttpParser &headers, const char *body,
+                           const char *end, IoSlice *slices, const StrView &extra = StrView());
+};
@@ -0,0 +1,380 @@
+#include "Resolver.hpp"
+#include "DNSCache.hpp"
+#include "EventLoop.hpp"
+#include "Logger.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <resolv.h>
+#include <arpa/nameser.h>
+#endif
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////
+
+int Resolver::THREADS = 4;
+string Resolver::NAMESERVER;
+
+namespace {
+
+// 一个等待结果的请求者
+struct Waiter {
+    EventLoop *loop;
+    Resolver::Callback cb;
+};
+
+// 一次排队中的查询
+struct Query {
+    string key;
+    string host;
+    unsigned short port;
+};
+
+mutex gs_mutex;
+condition_variable gs_cond;
+
+deque<Query> gs_queue;
+
+// 进行中（包括排队中）的查询，以 "主机:端口" 为键
+unordered_map<string, vector<Waiter>> gs_inflight;
+
+once_flag gs_startOnce;
+
+unsigned long long gs_queries = 0;
+unsigned long long gs_coalesced = 0;
+
+Resolver::Endpoint MakeEndpoint(const sockaddr *addr, size_t addrlen,
+                                int family, int socktype, int protocol) {
+    Resolver::Endpoint ep;
+    memset(&ep.addr, 0, sizeof(ep.addr));
+    memcpy(&ep.addr, addr, addrlen);
+    ep.addrlen = (int) addrlen;
+    ep.family = family;
+    ep.socktype = socktype;
+    ep.protocol = protocol;
+
+    return ep;
+}
+
+// 使用系统的解析器
+void LookupSystem(const string &host, unsigned short port,
+                  Resolver::Result &result) {
+    addrinfo hints, *ai_list;
+
+    memset(&hints, 0, sizeof(addrinfo));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    char portstr[6];
+    sprintf_s(portstr, sizeof(portstr), "%d", port);
+
+    result.error = getaddrinfo(host.c_str(), portstr, &hints, &ai_list);
+    if (result.error != 0) {
+        return;
+    }
+
+    for (addrinfo *ai = ai_list; ai; ai = ai->ai_next) {
+        if (ai->ai_addrlen > sizeof(sockaddr_storage)) {
+            continue;
+        }
+
+        result.endpoints.push_back(MakeEndpoint(ai->ai_addr, ai->ai_addrlen,
+                                                ai->ai_family,
+                                                ai->ai_socktype,
+                                                ai->ai_protocol));
+    }
+
+    freeaddrinfo(ai_list);
+
+    if (result.endpoints.empty()) {
+        result.error = EAI_NONAME;
+    }
+}
+
+#ifdef __linux__
+
+// 解析 NAMESERVER
+bool ParseNameServer(const string &decl, sockaddr_in &sin) {
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(NAMESERVER_PORT);
+
+    string ip(decl);
+    auto colon = decl.find(':');
+    if (colon != string::npos) {
+        ip = decl.substr(0, colon);
+        sin.sin_port = htons((unsigned short) atoi(decl.c_str() + colon + 1));
+    }
+
+    return inet_pton(AF_INET, ip.c_str(), &sin.sin_addr) == 1;
+}
+
+// 查询一种地址记录（A 或 AAAA）
+// 
+// @return 0 表示成功，否则为 EAI_* 错误码
+int QueryRecords(res_state rs, const string &host, ns_type type,
+                 unsigned short port, Resolver::Result &result) {
+    unsigned char answer[4096];
+    int len = res_nquery(rs, host.c_str(), ns_c_in, type,
+                         answer, sizeof(answer));
+
+    if (len < 0) {
+        switch (rs->res_h_errno) {
+        case HOST_NOT_FOUND:
+        case NO_DATA:
+            return EAI_NONAME;
+
+        case TRY_AGAIN:
+            return EAI_AGAIN;
+
+        default:
+            return EAI_FAIL;
+        }
+    }
+
+    ns_msg msg;
+    if (ns_initparse(answer, len, &msg) != 0) {
+        return EAI_FAIL;
+    }
+
+    int count = ns_msg_count(msg, ns_s_an);
+    for (int i = 0; i < count; i++) {
+        ns_rr rr;
+        if (ns_parserr(&msg, ns_s_an, i, &rr) != 0) {
+            break;
+        }
+
+        // 取各条记录（包括 CNAME）中最小的 TTL，0 视同 1 秒
+        unsigned ttl = ns_rr_ttl(rr) > 0 ? ns_rr_ttl(rr) : 1;
+        if (result.ttl == 0 || ttl < result.ttl) {
+            result.ttl = ttl;
+        }
+
+        if (ns_rr_type(rr) == ns_t_a && ns_rr_rdlen(rr) == 4) {
+            sockaddr_in sin;
+            memset(&sin, 0, sizeof(sin));
+            sin.sin_family = AF_INET;
+            sin.sin_port = htons(port);
+            memcpy(&sin.sin_addr, ns_rr_rdata(rr), 4);
+
+            result.endpoints.push_back(MakeEndpoint((const sockaddr *) &sin,
+                                                    sizeof(sin), AF_INET,
+                                                    SOCK_STREAM, IPPROTO_TCP));
+        }
+        else if (ns_rr_type(rr) == ns_t_aaaa && ns_rr_rdlen(rr) == 16) {
+            sockaddr_in6 sin6;
+            memset(&sin6, 0, sizeof(sin6));
+            sin6.sin6_family = AF_INET6;
+            sin6.sin6_port = htons(port);
+            memcpy(&sin6.sin6_addr, ns_rr_rdata(rr), 16);
+
+            result.endpoints.push_back(MakeEndpoint((const sockaddr *) &sin6,
+                                                    sizeof(sin6), AF_INET6,
+                                                    SOCK_STREAM, IPPROTO_TCP));
+        }
+
+        // 跳过 CNAME 等其他记录
+    }
+
+    return 0;
+}
+
+// 直接向 NAMESERVER 查询 AAAA 与 A 记录
+void LookupNameServer(const string &host, unsigned short port,
+                      Resolver::Result &result) {
+    sockaddr_in ns;
+    if (!ParseNameServer(Resolver::NAMESERVER, ns)) {
+        Logger::LogError(string(__FUNC__ "Invalid name server: ") +
+                         Resolver::NAMESERVER);
+
+        result.error = EAI_FAIL;
+        return;
+    }
+
+    struct __res_state rs;
+    memset(&rs, 0, sizeof(rs));
+
+    if (res_ninit(&rs) != 0) {
+        result.error = EAI_FAIL;
+        return;
+    }
+
+    rs.nsaddr_list[0] = ns;
+    rs.nscount = 1;
+
+    // 优先 IPv6
+    QueryRecords(&rs, host, ns_t_aaaa, port, result);
+    int error = QueryRecords(&rs, host, ns_t_a, port, result);
+
+    res_nclose(&rs);
+
+    if (result.endpoints.empty()) {
+        result.error = error != 0 ? error : EAI_NONAME;
+    }
+}
+
+// 主机名本身就是 IP 地址
+bool IsNumericHost(const string &host) {
+    in6_addr addr;
+    return inet_pton(AF_INET, host.c_str(), &addr) == 1 ||
+           inet_pton(AF_INET6, host.c_str(), &addr) == 1;
+}
+
+#endif // __linux__
+
+// 完成一次查询，把结果投递给所有请求者
+void Complete(const string &key, const Resolver::Result &result) {
+    DNSCache::Add(key, result);
+
+    vector<Waiter> waiters;
+
+    {
+        lock_guard<mutex> lock(gs_mutex);
+
+        auto it(gs_inflight.find(key));
+        if (it != gs_inflight.end()) {
+            waiters.swap(it->second);
+            gs_inflight.erase(it);
+        }
+    }
+
+    for (auto &w : waiters) {
+        auto cb(move(w.cb));
+        w.loop->Post([cb, result]() {
+            cb(result);
+        });
+    }
+}
+
+void ResolverThread() {
+    while (true) {
+        Query query;
+
+        {
+            unique_lock<mutex> lock(gs_mutex);
+            gs_cond.wait(lock, []() {
+                return !gs_queue.empty();
+            });
+
+            query = move(gs_queue.front());
+            gs_queue.pop_front();
+        }
+
+        Complete(query.key, Resolver::Lookup(query.host, query.port));
+    }
+}
+
+void StartThreads() {
+    int n = Resolver::THREADS > 0 ? Resolver::THREADS : 1;
+
+    for (int i = 0; i < n; i++) {
+        thread(ResolverThread).detach();
+    }
+}
+
+}
+
+void Resolver::Resolve(const string &host, unsigned short port,
+                       EventLoop &loop, Callback cb) {
+    call_once(gs_startOnce, StartThreads);
+
+    string key(host);
+    key += ':';
+    key += to_string(port);
+
+    lock_guard<mutex> lock(gs_mutex);
+
+    auto &waiters = gs_inflight[key];
+    waiters.push_back(Waiter{ &loop, move(cb) });
+
+    if (waiters.size() > 1) {
+        // 已经有相同的查询在进行中
+        gs_coalesced++;
+        return;
+    }
+
+    gs_queries++;
+    gs_queue.push_back(Query{ key, host, port });
+    gs_cond.notify_one();
+}
+
+Resolver::Result Resolver::Lookup(const string &host, unsigned short port) {
+    Result result;
+
+#ifdef __linux__
+    if (!NAMESERVER.empty() && !IsNumericHost(host)) {
+        LookupNameServer(host, port, result);
+        Interleave(result.endpoints);
+
+        return result;
+    }
+#endif
+
+    LookupSystem(host, port, result);
+    Interleave(result.endpoints);
+
+    return result;
+}
+
+void Resolver::Interleave(vector<Endpoint> &endpoints, unsigned rotation) {
+    if (endpoints.empty()) {
+        return;
+    }
+
+    int first = endpoints.front().family;
+
+    vector<Endpoint> preferred, others;
+    for (auto &ep : endpoints) {
+        (ep.family == first ? preferred : others).push_back(ep);
+    }
+
+    if (!preferred.empty()) {
+        rotate(preferred.begin(),
+               preferred.begin() + rotation % preferred.size(),
+               preferred.end());
+    }
+
+    if (!others.empty()) {
+        rotate(others.begin(),
+               others.begin() + rotation % others.size(),
+               others.end());
+    }
+
+    endpoints.clear();
+
+    for (size_t i = 0; i < max(preferred.size(), others.size()); i++) {
+        if (i < preferred.size()) {
+            endpoints.push_back(preferred[i]);
+        }
+
+        if (i < others.size()) {
+            endpoints.push_back(others[i]);
+        }
+    }
+}
+
+string Resolver::ErrorMessage(int error) {
+#ifdef _WIN32
+    return gai_strerrorA(error);
+#else
+    return gai_strerror(error);
+#endif
+}
+
+Resolver::Statistics Resolver::GetStatistics() {
+    lock_guard<mutex> lock(gs_mutex);
+
+    Statistics stat;
+    stat.queries = gs_queries;
+    stat.coalesced = gs_coalesced;
+
+    return stat;
+}
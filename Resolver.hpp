@@ -0,0 +1,74 @@
+#pragma once
+#include "ws-util.h"
+
+#include <string>
+#include <vector>
+#include <functional>
+
+class EventLoop;
+
+/// 异步域名解析器
+/// 
+/// 解析工作交给少量专门的线程完成，工作线程不会因为 DNS 而阻塞。
+/// 同一主机同时发起的多个查询合并为一次，结果分别回调给各个请求者。
+/// 每次查询的结果（包括失败）都会存入 DNSCache。
+class Resolver {
+public:
+
+    /// 解析线程数
+    static int THREADS;
+
+    /// 使用的 DNS 服务器，形如 "IPv4" 或 "IPv4:端口"
+    /// 
+    /// 为空时使用系统的解析器（getaddrinfo）。仅 Linux 支持指定服务器。
+    static std::string NAMESERVER;
+
+    /// 一个候选的服务器地址
+    struct Endpoint {
+        sockaddr_storage addr;
+        int addrlen;
+        int family, socktype, protocol;
+    };
+
+    /// 解析结果
+    struct Result {
+        /// 0 表示成功，否则为 EAI_* 错误码
+        int error = 0;
+
+        /// 记录的 TTL（秒），0 表示未知
+        unsigned ttl = 0;
+
+        std::vector<Endpoint> endpoints;
+    };
+
+    /// 完成回调
+    typedef std::function<void(const Result &)> Callback;
+
+    /// 异步解析 @a host
+    /// 
+    /// 完成后在 @a loop 所在的线程中调用 @a cb。可以在任意线程中调用。
+    static void Resolve(const std::string &host, unsigned short port,
+                        EventLoop &loop, Callback cb);
+
+    /// 在调用者的线程中同步解析 @a host
+    static Result Lookup(const std::string &host, unsigned short port);
+
+    /// 将地址按地址族交替排列（RFC 8305）
+    /// 
+    /// 以第一个地址的地址族打头，各地址族内部的顺序不变。
+    /// @param rotation 各地址族内部先轮换的位置数
+    static void Interleave(std::vector<Endpoint> &endpoints,
+                           unsigned rotation = 0);
+
+    /// 获取错误码对应的描述
+    static std::string ErrorMessage(int error);
+
+    /// 统计信息
+    struct Statistics {
+        unsigned long long queries; ///< 实际发出的查询数
+        unsigned long long coalesced; ///< 被合并到进行中查询的请求数
+    };
+
+    /// 获取统计信息
+    static Statistics GetStatistics();
+};
@@ -0,0 +1,1082 @@
+#include "ResponseCache.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////
+
+size_t ResponseCache::CAPACITY = 64 * 1024 * 1024;
+size_t ResponseCache::MAX_ENTRY_SIZE = 4 * 1024 * 1024;
+unsigned ResponseCache::HEURISTIC_MAX = 24 * 60 * 60;
+
+namespace {
+
+// 分片数
+const size_t kShards = 16;
+
+// 保护段最多占分片容量的百分比
+const size_t kProtectedPercent = 80;
+
+// 一个缓存节点
+struct Node {
+    string key; // 包括 Vary 的值
+    string base; // 不包括 Vary 的值
+    ResponseCache::EntryPtr entry;
+    size_t charge; // 计入容量的字节数
+    bool hot; // 是否在保护段中
+};
+
+// 一个分片
+// 
+// 按缓存行对齐，避免不同分片的锁互相干扰。
+struct alignas(64) Shard {
+    typedef list<Node> LRU;
+
+    mutex m;
+
+    // 两段的队首都是最近访问的节点
+    LRU probation; // 试用段：只被访问过一次
+    LRU hot; // 保护段：被再次访问过
+    unordered_map<string, LRU::iterator> index;
+
+    // 某个键的回应带有 Vary 时，记下所列的字段名
+    struct Vary {
+        string names;
+        size_t count; // 带有 Vary 的节点数
+    };
+
+    unordered_map<string, Vary> varies;
+
+    // 进行中的获取，以不包括 Vary 的值的键索引
+    unordered_map<string, ResponseCache::FlightPtr> flights;
+
+    size_t bytes = 0;
+    size_t hotBytes = 0;
+
+    unsigned long long hits = 0;
+    unsigned long long misses = 0;
+    unsigned long long stores = 0;
+    unsigned long long evictions = 0;
+    unsigned long long collapsed = 0;
+    unsigned long long revalidations = 0;
+};
+
+Shard gs_shards[kShards];
+
+Shard &GetShard(const string &key) {
+    return gs_shards[hash<string>()(key) % kShards];
+}
+
+// 每个分片的容量
+size_t GetShardCapacity() {
+    return max((size_t) 1, ResponseCache::CAPACITY / kShards);
+}
+
+// 把节点移出分片，放入 @a out（在锁外销毁）
+void Unlink(Shard &shard, Shard::LRU::iterator node, Shard::LRU &out) {
+    shard.index.erase(node->key);
+
+    if (node->key.size() != node->base.size()) {
+        auto it(shard.varies.find(node->base));
+        if (it != shard.varies.end() && --it->second.count == 0) {
+            shard.varies.erase(it);
+        }
+    }
+
+    shard.bytes -= node->charge;
+
+    if (node->hot) {
+        shard.hotBytes -= node->charge;
+        out.splice(out.end(), shard.hot, node);
+    }
+    else {
+        out.splice(out.end(), shard.probation, node);
+    }
+}
+
+// 命中：试用段的节点升入保护段，保护段超出份额时把最旧的降回试用段
+void Touch(Shard &shard, Shard::LRU::iterator node) {
+    if (node->hot) {
+        shard.hot.splice(shard.hot.begin(), shard.hot, node);
+        return;
+    }
+
+    node->hot = true;
+    shard.hot.splice(shard.hot.begin(), shard.probation, node);
+    shard.hotBytes += node->charge;
+
+    auto limit = GetShardCapacity() / 100 * kProtectedPercent;
+    while (shard.hotBytes > limit && shard.hot.size() > 1) {
+        auto last = prev(shard.hot.end());
+
+        last->hot = false;
+        shard.hotBytes -= last->charge;
+        shard.probation.splice(shard.probation.begin(), shard.hot, last);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Cache-Control 中我们关心的指令
+struct CacheControl {
+    bool present = false; // 是否有 Cache-Control 字段
+
+    bool noStore = false;
+    bool noCache = false;
+    bool isPrivate = false;
+    bool isPublic = false;
+    bool mustRevalidate = false;
+
+    // 秒数，-1 表示没有
+    long long maxAge = -1;
+    long long sMaxAge = -1;
+    long long minFresh = -1;
+};
+
+// 解析 delta-seconds，格式错误时返回 -1
+long long ParseSeconds(const char *p, const char *end) {
+    if (p == end) {
+        return -1;
+    }
+
+    long long n = 0;
+    for (; p < end; p++) {
+        if (!isdigit((unsigned char) *p)) {
+            return -1;
+        }
+
+        // RFC 7234 1.2.1：过大的值按 2^31 处理
+        n = min(n * 10 + (*p - '0'), 2147483648LL);
+    }
+
+    return n;
+}
+
+long long ParseSeconds(const StrView &s) {
+    return ParseSeconds(s.data, s.data + s.size);
+}
+
+// 去掉首尾的空白
+StrView Trim(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+
+    return StrView(p, end - p);
+}
+
+void OnDirective(const StrView &directive, CacheControl &cc) {
+    auto eq = (const char *) memchr(directive.data, '=', directive.size);
+    auto end = directive.data + directive.size;
+
+    auto name = Trim(directive.data, eq ? eq : end);
+    StrView arg;
+
+    if (eq) {
+        arg = Trim(eq + 1, end);
+        if (arg.size >= 2 && arg.data[0] == '"' && arg.data[arg.size - 1] == '"') {
+            arg = StrView(arg.data + 1, arg.size - 2);
+        }
+    }
+
+    // 带字段名参数的 no-cache 与 private 按整个回应处理，宁可不缓存
+    if (name.EqualsNoCase("no-store")) {
+        cc.noStore = true;
+    }
+    else if (name.EqualsNoCase("no-cache")) {
+        cc.noCache = true;
+    }
+    else if (name.EqualsNoCase("private")) {
+        cc.isPrivate = true;
+    }
+    else if (name.EqualsNoCase("public")) {
+        cc.isPublic = true;
+    }
+    else if (name.EqualsNoCase("must-revalidate") ||
+             name.EqualsNoCase("proxy-revalidate")) {
+        cc.mustRevalidate = true;
+    }
+    else if (name.EqualsNoCase("max-age")) {
+        // 无效的值视为已过期
+        cc.maxAge = max(ParseSeconds(arg), 0LL);
+    }
+    else if (name.EqualsNoCase("s-maxage")) {
+        cc.sMaxAge = max(ParseSeconds(arg), 0LL);
+    }
+    else if (name.EqualsNoCase("min-fresh")) {
+        cc.minFresh = ParseSeconds(arg);
+    }
+}
+
+// 解析所有的 Cache-Control 字段
+CacheControl ParseCacheControl(const HttpParser &headers) {
+    CacheControl cc;
+
+    for (size_t i = 0; i < headers.FieldCount(); i++) {
+        if (!headers.FieldName(i).EqualsNoCase("Cache-Control")) {
+            continue;
+        }
+
+        cc.present = true;
+
+        auto value = headers.FieldValue(i);
+        auto p = value.data, end = value.data + value.size;
+
+        while (p < end) {
+            // 逗号分隔的指令，引号中的逗号不算
+            auto q = p;
+            bool quoted = false;
+
+            while (q < end && (quoted || *q != ',')) {
+                if (*q == '"') {
+                    quoted = !quoted;
+                }
+
+                q++;
+            }
+
+            OnDirective(Trim(p, q), cc);
+            p = q + 1;
+        }
+    }
+
+    return cc;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// 1970-01-01 以来的天数（公历）
+long long DaysFromCivil(int y, int m, int d) {
+    y -= m <= 2;
+
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097LL + doe - 719468;
+}
+
+// 解析 HTTP-date（RFC 7231 7.1.1.1 的三种格式）
+bool ParseHttpDate(const StrView &s, time_t &t) {
+    char buf[64];
+    if (s.Empty() || s.size >= sizeof(buf)) {
+        return false;
+    }
+
+    memcpy(buf, s.data, s.size);
+    buf[s.size] = '\0';
+
+    char month[4] = {};
+    int day, year, hour, minute, second;
+
+    auto comma = strchr(buf, ',');
+    if (comma) {
+        // Sun, 06 Nov 1994 08:49:37 GMT
+        if (sscanf(comma + 1, " %d %3s %d %d:%d:%d", &day, month, &year,
+                   &hour, &minute, &second) != 6) {
+            // Sunday, 06-Nov-94 08:49:37 GMT
+            if (sscanf(comma + 1, " %d-%3s-%d %d:%d:%d", &day, month, &year,
+                       &hour, &minute, &second) != 6) {
+                return false;
+            }
+
+            if (year < 100) {
+                year += year < 70 ? 2000 : 1900;
+            }
+        }
+    }
+    else {
+        // Sun Nov  6 08:49:37 1994
+        if (sscanf(buf, "%*s %3s %d %d:%d:%d %d", month, &day,
+                   &hour, &minute, &second, &year) != 6) {
+            return false;
+        }
+    }
+
+    static const char kMonths[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+    auto found = strstr(kMonths, month);
+    if (strlen(month) != 3 || !found || (found - kMonths) % 3 != 0) {
+        return false;
+    }
+
+    int mon = (int) (found - kMonths) / 3 + 1;
+
+    if (day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60 ||
+        hour < 0 || minute < 0 || second < 0) {
+        return false;
+    }
+
+    t = (time_t) (DaysFromCivil(year, mon, day) * 86400 +
+                  hour * 3600 + minute * 60 + second);
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// 没有明确的有效期时也可以缓存的状态码（RFC 7231 6.1）
+bool IsHeuristicallyCacheable(int status) {
+    switch (status) {
+    case 200: case 203: case 204: case 300: case 301: case 308:
+    case 404: case 405: case 410: case 414: case 501:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// 给出了明确的有效期时可以缓存的状态码
+bool IsCacheableStatus(int status) {
+    return IsHeuristicallyCacheable(status) || status == 302 || status == 307;
+}
+
+string ToLower(const StrView &s) {
+    string lower(s.data, s.size);
+    for (auto &c : lower) {
+        c = (char) tolower((unsigned char) c);
+    }
+
+    return lower;
+}
+
+// 收集所有 Vary 字段列出的字段名（小写，逗号分隔）
+// 
+// @return 含有 "*" 时返回 false，这样的回应无法复用
+bool GetVaryNames(const HttpParser &response, string &names) {
+    for (size_t i = 0; i < response.FieldCount(); i++) {
+        if (!response.FieldName(i).EqualsNoCase("Vary")) {
+            continue;
+        }
+
+        auto value = response.FieldValue(i);
+        auto p = value.data, end = value.data + value.size;
+
+        while (p < end) {
+            auto comma = (const char *) memchr(p, ',', end - p);
+            auto q = comma ? comma : end;
+
+            auto name = Trim(p, q);
+            if (name.Equals("*")) {
+                return false;
+            }
+
+            if (!name.Empty()) {
+                if (!names.empty()) {
+                    names += ',';
+                }
+
+                names += ToLower(name);
+            }
+
+            p = q + 1;
+        }
+    }
+
+    return true;
+}
+
+// 请求中 @a names 所列字段的值
+string GetVaryValues(const HttpParser &request, const string &names) {
+    string values;
+    size_t begin = 0;
+
+    while (begin < names.size()) {
+        auto end = names.find(',', begin);
+        if (end == string::npos) {
+            end = names.size();
+        }
+
+        auto name = names.substr(begin, end - begin);
+        bool first = true;
+
+        for (size_t i = 0; i < request.FieldCount(); i++) {
+            if (request.FieldName(i).EqualsNoCase(name.c_str())) {
+                auto value = request.FieldValue(i);
+
+                if (!first) {
+                    values += ',';
+                }
+
+                values.append(value.data, value.size);
+                first = false;
+            }
+        }
+
+        values += '\n';
+        begin = end + 1;
+    }
+
+    return values;
+}
+
+// 不应存入缓存的逐跳字段
+bool IsHopByHop(const HttpParser &response, const StrView &name) {
+    if (name.EqualsNoCase("Connection") ||
+        name.EqualsNoCase("Keep-Alive") ||
+        name.EqualsNoCase("Proxy-Connection") ||
+        name.EqualsNoCase("Age")) {
+        return true;
+    }
+
+    // Connection 中列出的字段也是逐跳的
+    auto connection = response.Find("Connection");
+    return !connection.Empty() && connection.HasToken(name.ToString().c_str());
+}
+
+// 确定新鲜期（RFC 7234 4.2.1）
+time_t GetFreshness(const HttpParser &response, const CacheControl &cc,
+                    time_t date) {
+    if (cc.sMaxAge >= 0) {
+        return (time_t) cc.sMaxAge;
+    }
+
+    if (cc.maxAge >= 0) {
+        return (time_t) cc.maxAge;
+    }
+
+    auto expires = response.Find("Expires");
+    if (!expires.Empty()) {
+        // 无效的日期（例如 "0"）表示已经过期
+        time_t t;
+        return ParseHttpDate(expires, t) && t > date ? t - date : 0;
+    }
+
+    // 启发式：Last-Modified 距今的 10%
+    time_t lastModified;
+    if (IsHeuristicallyCacheable(response.status_code) &&
+        ParseHttpDate(response.Find("Last-Modified"), lastModified) &&
+        lastModified < date) {
+        return min((date - lastModified) / 10,
+                   (time_t) ResponseCache::HEURISTIC_MAX);
+    }
+
+    return 0;
+}
+
+// 请求是否要求向服务器确认
+bool IsNoCache(const HttpParser &request, const CacheControl &cc) {
+    return cc.noCache ||
+        (!cc.present && request.Find("Pragma").HasToken("no-cache"));
+}
+
+// 条目在 @a now 时是否新鲜，且满足请求对新鲜度的要求
+bool IsFreshEnough(const ResponseCache::Entry &entry, const CacheControl &cc,
+                   time_t now) {
+    auto age = entry.Age(now);
+
+    return age < entry.freshness &&
+           (cc.maxAge < 0 || age <= cc.maxAge) &&
+           (cc.minFresh < 0 || entry.freshness - age >= cc.minFresh);
+}
+
+// 根据回应设置条目的状态码、年龄（RFC 7234 4.2.3）、新鲜期与验证器
+void SetMetadata(ResponseCache::Entry &entry, const HttpParser &response,
+                 const CacheControl &cc, time_t responseDelay) {
+    auto now = time(nullptr);
+
+    time_t date;
+    if (!ParseHttpDate(response.Find("Date"), date)) {
+        date = now;
+    }
+
+    auto apparentAge = max(now - date, (time_t) 0);
+    auto ageValue = max(ParseSeconds(response.Find("Age")), 0LL);
+
+    entry.status = response.status_code;
+    entry.responseTime = now;
+    entry.initialAge = max(apparentAge, (time_t) ageValue + responseDelay);
+    entry.freshness = GetFreshness(response, cc, date);
+
+    entry.etag = response.Find("ETag").ToString();
+    entry.lastModified = response.Find("Last-Modified").ToString();
+}
+
+void AppendField(string &head, const StrView &name, const StrView &value) {
+    head.append(name.data, name.size);
+    head += ": ";
+    head.append(value.data, value.size);
+    head += "\r\n";
+}
+
+// 请求是否带有条件或者范围
+// 
+// 这样的回应（304、206）只对发出请求的浏览器有意义，不能分享给别人。
+bool IsConditional(const HttpParser &request) {
+    static const char *const kFields[] = {
+        "If-None-Match", "If-Modified-Since", "If-Match",
+        "If-Unmodified-Since", "If-Range", "Range",
+    };
+
+    for (size_t i = 0; i < request.FieldCount(); i++) {
+        auto name = request.FieldName(i);
+
+        for (auto field : kFields) {
+            if (name.EqualsNoCase(field)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+
+bool ResponseCache::IsCacheableRequest(const HttpParser &request) {
+    if (!IsEnabled()) {
+        return false;
+    }
+
+    auto method = request.Method();
+    if (!method.Equals("GET") && !method.Equals("HEAD")) {
+        return false;
+    }
+
+    if (request.contentLength > 0 || request.IsChunked()) {
+        return false;
+    }
+
+    return !ParseCacheControl(request).noStore;
+}
+
+string ResponseCache::MakeKey(const string &host, unsigned short port,
+                              const StrView &target) {
+    // 绝对形式的目标只取路径部分，主机以 Host 为准
+    auto path = target;
+
+    if (path.Empty() || path.data[0] != '/') {
+        static const char kSeparator[] = "://";
+
+        auto end = path.data + path.size;
+        auto scheme = search(path.data, end, kSeparator, kSeparator + 3);
+
+        if (scheme != end) {
+            auto slash = (const char *) memchr(scheme + 3, '/', end - scheme - 3);
+            path = slash ? StrView(slash, end - slash) : StrView("/", 1);
+        }
+    }
+
+    string key;
+    key.reserve(host.size() + path.size + 8);
+
+    key += ToLower(StrView(host.data(), host.size()));
+    key += ':';
+    key += to_string(port);
+    key.append(path.data, path.size);
+
+    return key;
+}
+
+ResponseCache::Found ResponseCache::Lookup(const string &key,
+                                           const HttpParser &request) {
+    auto cc = ParseCacheControl(request);
+
+    auto &shard = GetShard(key);
+    Shard::LRU expired; // 在锁外销毁
+    Found found;
+
+    lock_guard<mutex> lock(shard.m);
+
+    // 浏览器要求向服务器确认
+    if (IsNoCache(request, cc)) {
+        shard.misses++;
+        return found;
+    }
+
+    auto full(key);
+
+    auto vary(shard.varies.find(key));
+    if (vary != shard.varies.end()) {
+        full += '\n';
+        full += GetVaryValues(request, vary->second.names);
+    }
+
+    auto it(shard.index.find(full));
+    if (it != shard.index.end()) {
+        auto node = it->second;
+        auto &entry = *node->entry;
+
+        // 浏览器对新鲜度可能有更高的要求
+        auto now = time(nullptr);
+        if (IsFreshEnough(entry, cc, now)) {
+            Touch(shard, node);
+            shard.hits++;
+
+            found.entry = node->entry;
+            return found;
+        }
+
+        if (!entry.etag.empty() || !entry.lastModified.empty()) {
+            found.stale = node->entry;
+        }
+        else if (entry.Age(now) >= entry.freshness) {
+            Unlink(shard, node, expired); // 无法确认，没有用了
+        }
+    }
+
+    shard.misses++;
+
+    // 已经有人在向服务器获取了
+    auto flight(shard.flights.find(key));
+    if (flight != shard.flights.end()) {
+        shard.collapsed++;
+
+        found.flight = flight->second;
+        found.stale.reset();
+
+        return found;
+    }
+
+    if (!request.Method().Equals("GET") || IsConditional(request)) {
+        found.stale.reset();
+        return found;
+    }
+
+    found.flight = make_shared<Flight>(key);
+    found.leader = true;
+    shard.flights.emplace(key, found.flight);
+
+    if (found.stale) {
+        shard.revalidations++;
+    }
+
+    return found;
+}
+
+shared_ptr<ResponseCache::Entry>
+ResponseCache::Prepare(const HttpParser &request, const HttpParser &response,
+                       const char *head, time_t responseDelay, size_t maxSize) {
+    if (!IsEnabled() || !request.Method().Equals("GET")) {
+        return nullptr;
+    }
+
+    if (!IsCacheableStatus(response.status_code)) {
+        return nullptr;
+    }
+
+    // 一直读到连接关闭的回应没有长度，无法原样重放
+    if (response.contentLength == -1 && !response.IsChunked() &&
+        !response.DetermineFinishedByStatusCode()) {
+        return nullptr;
+    }
+
+    if (response.contentLength > (long long) maxSize ||
+        response.HeaderSize() > maxSize) {
+        return nullptr;
+    }
+
+    auto cc = ParseCacheControl(response);
+    if (cc.noStore || cc.noCache || cc.isPrivate) {
+        return nullptr;
+    }
+
+    // 带认证的请求，除非服务器明确允许，否则回应只属于这个用户
+    if (!request.Find("Authorization").Empty() &&
+        !cc.isPublic && !cc.mustRevalidate && cc.sMaxAge < 0) {
+        return nullptr;
+    }
+
+    // 设置 Cookie 的回应通常是针对某个用户的，共享缓存不存储
+    if (!response.Find("Set-Cookie").Empty()) {
+        return nullptr;
+    }
+
+    shared_ptr<Entry> entry(make_shared<Entry>());
+    if (!GetVaryNames(response, entry->varyNames)) {
+        return nullptr;
+    }
+
+    SetMetadata(*entry, response, cc, responseDelay);
+
+    if (entry->freshness <= entry->initialAge) {
+        return nullptr; // 已经过期
+    }
+
+    if (!entry->varyNames.empty()) {
+        entry->varyValues = GetVaryValues(request, entry->varyNames);
+    }
+
+    // 状态行原样保留，头部字段去掉逐跳的部分
+    auto lf = (const char *) memchr(head, '\n', response.HeaderSize());
+    auto eol = lf;
+    if (eol > head && eol[-1] == '\r') {
+        eol--;
+    }
+
+    entry->head.reserve(response.HeaderSize());
+    entry->head.append(head, eol);
+    entry->head += "\r\n";
+
+    for (size_t i = 0; i < response.FieldCount(); i++) {
+        auto name = response.FieldName(i);
+        if (IsHopByHop(response, name)) {
+            continue;
+        }
+
+        AppendField(entry->head, name, response.FieldValue(i));
+    }
+
+    if (response.contentLength > 0 &&
+        response.contentLength <= (long long) MAX_ENTRY_SIZE) {
+        entry->body.reserve((size_t) response.contentLength);
+    }
+
+    return entry;
+}
+
+shared_ptr<ResponseCache::Entry>
+ResponseCache::Refresh(const EntryPtr &stale, const HttpParser &response,
+                       time_t responseDelay) {
+    shared_ptr<Entry> entry(make_shared<Entry>(*stale));
+    entry->responseTime = time(nullptr);
+    entry->initialAge = 0;
+    entry->freshness = 0; // 解析失败时只用于回应当前的请求
+
+    // 重新解析条目的头部，以便逐个字段比较
+    string old(stale->head);
+    old += "\r\n";
+
+    HttpParser stored(HttpParser::RESPONSE);
+    if (stored.Parse(&old[0], old.size()) != HttpParser::PARSE_DONE) {
+        return entry;
+    }
+
+    // 304 没有数据体，其中描述数据体的字段不可信
+    auto replaceable = [&response](const StrView &name) {
+        return !IsHopByHop(response, name) &&
+               !name.EqualsNoCase("Content-Length") &&
+               !name.EqualsNoCase("Transfer-Encoding");
+    };
+
+    auto merged(old.substr(0, old.find('\n') + 1));
+
+    for (size_t i = 0; i < stored.FieldCount(); i++) {
+        auto name = stored.FieldName(i);
+
+        auto value = response.Find(name.ToString().c_str());
+        if (value.data && replaceable(name)) {
+            continue;
+        }
+
+        AppendField(merged, name, stored.FieldValue(i));
+    }
+
+    for (size_t i = 0; i < response.FieldCount(); i++) {
+        auto name = response.FieldName(i);
+        if (replaceable(name)) {
+            AppendField(merged, name, response.FieldValue(i));
+        }
+    }
+
+    // 合并后的头部决定新的新鲜期
+    merged += "\r\n";
+
+    HttpParser headers(HttpParser::RESPONSE);
+    if (headers.Parse(&merged[0], merged.size()) != HttpParser::PARSE_DONE) {
+        return entry;
+    }
+
+    auto cc = ParseCacheControl(headers);
+    SetMetadata(*entry, headers, cc, responseDelay);
+
+    if (cc.noStore || cc.noCache || cc.isPrivate) {
+        entry->freshness = 0;
+    }
+
+    merged.resize(merged.size() - 2);
+    entry->head = move(merged);
+
+    return entry;
+}
+
+string ResponseCache::MakeConditions(const Entry &stale) {
+    string conditions;
+
+    if (!stale.etag.empty()) {
+        conditions += "If-None-Match: " + stale.etag + "\r\n";
+    }
+
+    if (!stale.lastModified.empty()) {
+        conditions += "If-Modified-Since: " + stale.lastModified + "\r\n";
+    }
+
+    return conditions;
+}
+
+bool ResponseCache::IsFresh(const Entry &entry, const HttpParser &request) {
+    auto cc = ParseCacheControl(request);
+    return !IsNoCache(request, cc) && IsFreshEnough(entry, cc, time(nullptr));
+}
+
+bool ResponseCache::Matches(const Entry &entry, const HttpParser &request) {
+    return entry.varyNames.empty() ||
+           GetVaryValues(request, entry.varyNames) == entry.varyValues;
+}
+
+void ResponseCache::Add(const string &key, shared_ptr<Entry> entry) {
+    if (!IsEnabled() || !entry) {
+        return;
+    }
+
+    auto full(key);
+    if (!entry->varyNames.empty()) {
+        full += '\n';
+        full += entry->varyValues;
+    }
+
+    size_t charge = sizeof(Node) + sizeof(Entry) + full.size() + key.size() +
+                    entry->head.size() + entry->body.size();
+
+    auto capacity = GetShardCapacity();
+    if (charge > capacity) {
+        return;
+    }
+
+    auto &shard = GetShard(key);
+    Shard::LRU evicted; // 在锁外销毁
+
+    lock_guard<mutex> lock(shard.m);
+
+    auto it(shard.index.find(full));
+    if (it != shard.index.end()) {
+        Unlink(shard, it->second, evicted);
+    }
+
+    // 以最新的回应所列的 Vary 为准
+    if (entry->varyNames.empty()) {
+        shard.varies.erase(key);
+    }
+    else {
+        auto &vary = shard.varies[key];
+        vary.names = entry->varyNames;
+        vary.count++;
+    }
+
+    Node node;
+    node.key = move(full);
+    node.base = key;
+    node.entry = move(entry);
+    node.charge = charge;
+    node.hot = false;
+
+    shard.probation.push_front(move(node));
+    shard.index.emplace(shard.probation.front().key, shard.probation.begin());
+
+    shard.bytes += charge;
+    shard.stores++;
+
+    // 先淘汰试用段，试用段空了才轮到保护段
+    while (shard.bytes > capacity) {
+        auto &lru = shard.probation.empty() ? shard.hot : shard.probation;
+
+        Unlink(shard, prev(lru.end()), evicted);
+        shard.evictions++;
+    }
+}
+
+bool ResponseCache::Remove(const string &key) {
+    auto &shard = GetShard(key);
+    Shard::LRU removed; // 在锁外销毁
+
+    lock_guard<mutex> lock(shard.m);
+
+    // 带有 Vary 的条目不再能被找到，随后被淘汰
+    bool found = shard.varies.erase(key) > 0;
+
+    auto it(shard.index.find(key));
+    if (it != shard.index.end()) {
+        Unlink(shard, it->second, removed);
+        found = true;
+    }
+
+    return found;
+}
+
+ResponseCache::Statistics ResponseCache::GetStatistics() {
+    Statistics stat = {};
+
+    for (auto &shard : gs_shards) {
+        lock_guard<mutex> lock(shard.m);
+
+        stat.size += shard.index.size();
+        stat.bytes += shard.bytes;
+        stat.hits += shard.hits;
+        stat.misses += shard.misses;
+        stat.stores += shard.stores;
+        stat.evictions += shard.evictions;
+        stat.collapsed += shard.collapsed;
+        stat.revalidations += shard.revalidations;
+    }
+
+    return stat;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+ResponseCache::Flight::Flight(const string &key) : m_key(key) {}
+
+bool ResponseCache::Flight::Follow(const void *follower,
+                                   function<void()> wake) {
+    lock_guard<mutex> lock(m_mutex);
+
+    // 数据体的开头可能已被丢弃
+    if (m_state == FL_FAILED || !m_storable) {
+        return false;
+    }
+
+    m_followers.push_back(Follower{ follower, move(wake), 0, false });
+    return true;
+}
+
+void ResponseCache::Flight::Unfollow(const void *follower) {
+    lock_guard<mutex> lock(m_mutex);
+
+    for (auto it = m_followers.begin(); it != m_followers.end(); ++it) {
+        if (it->id == follower) {
+            m_followers.erase(it);
+            break;
+        }
+    }
+}
+
+ResponseCache::Flight::State
+ResponseCache::Flight::Read(const void *follower, size_t offset,
+                            char *buf, size_t size, size_t &n,
+                            EntryPtr &entry) {
+    lock_guard<mutex> lock(m_mutex);
+
+    n = 0;
+
+    if (m_entry) {
+        if (offset < m_discarded) {
+            return FL_FAILED;
+        }
+
+        auto &body = m_entry->body;
+        auto from = offset - m_discarded;
+
+        if (from < body.size()) {
+            n = min(size, body.size() - from);
+            memcpy(buf, body.data() + from, n);
+        }
+
+        entry = m_entry;
+    }
+
+    for (auto &f : m_followers) {
+        if (f.id == follower) {
+            f.offset = offset + n;
+            f.woken = false;
+
+            break;
+        }
+    }
+
+    return m_state;
+}
+
+void ResponseCache::Flight::Begin(const shared_ptr<Entry> &entry) {
+    lock_guard<mutex> lock(m_mutex);
+
+    m_entry = entry;
+    m_state = FL_STREAMING;
+
+    WakeFollowers();
+}
+
+bool ResponseCache::Flight::Append(const char *data, size_t len) {
+    bool unregister = false, wanted;
+
+    {
+        lock_guard<mutex> lock(m_mutex);
+
+        auto &body = m_entry->body;
+        body.append(data, len);
+
+        if (m_storable &&
+            m_entry->head.size() + m_discarded + body.size() > MAX_ENTRY_SIZE) {
+            m_storable = false;
+            unregister = true;
+        }
+
+        if (!m_storable) {
+            // 丢弃所有跟随者都已读取的部分，攒够一半再挪动，均摊下来是线性的
+            // 落后超过 MAX_ENTRY_SIZE 的跟随者不再等待，以免读得慢的浏览器
+            // 让这里的内存无限增长；它们随后读取时得到 FL_FAILED
+            auto total = m_discarded + body.size();
+            auto floor = total > MAX_ENTRY_SIZE ? total - MAX_ENTRY_SIZE : 0;
+
+            auto read = total;
+            for (auto &f : m_followers) {
+                read = min(read, max(f.offset, floor));
+            }
+
+            auto n = read - m_discarded;
+            if (n > 0 && n * 2 >= body.size()) {
+                body.erase(0, n);
+                m_discarded += n;
+            }
+        }
+
+        WakeFollowers();
+        wanted = m_storable || !m_followers.empty();
+    }
+
+    if (unregister) {
+        Unregister();
+    }
+
+    return wanted;
+}
+
+bool ResponseCache::Flight::IsStorable() const {
+    lock_guard<mutex> lock(m_mutex);
+    return m_storable;
+}
+
+void ResponseCache::Flight::Finish(bool complete) {
+    {
+        lock_guard<mutex> lock(m_mutex);
+
+        m_state = complete && m_entry ? FL_DONE : FL_FAILED;
+        WakeFollowers();
+    }
+
+    Unregister();
+}
+
+void ResponseCache::Flight::Unregister() {
+    auto &shard = GetShard(m_key);
+    FlightPtr removed; // 在锁外释放
+
+    lock_guard<mutex> lock(shard.m);
+
+    auto it(shard.flights.find(m_key));
+    if (it != shard.flights.end() && it->second.get() == this) {
+        removed = move(it->second);
+        shard.flights.erase(it);
+    }
+}
+
+void ResponseCache::Flight::WakeFollowers() {
+    for (auto &f : m_followers) {
+        if (!f.woken) {
+            f.woken = true;
+            f.wake();
+        }
+    }
+}
@@ -0,0 +1,285 @@
+#pragma once
+#include "HttpParser.hpp"
+
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// HTTP 回应缓存（共享缓存，遵循 RFC 7234 的新鲜度规则）
+/// 
+/// 以主机与请求目标为键，只存储 GET 的回应，HEAD 请求也可以使用它们；
+/// 回应带有 Vary 时，请求中相应字段的值也是键的一部分。
+/// 
+/// 与 DNSCache 一样按键的哈希值分片，每片各有一把锁。按字节数限制容量，
+/// 使用分段 LRU（SLRU）：新条目先进入试用段，再次命中才升入保护段，
+/// 一次性的访问不会把常用的条目挤出去。
+/// 
+/// 条目一经加入便不再改变，由引用计数管理。命中时直接从条目发送，
+/// 条目被淘汰后，正在发送它的连接手中的引用仍然有效。
+/// 
+/// 同一个键的并发未命中只向服务器请求一次（见 Flight）；过期但带有
+/// ETag 或 Last-Modified 的条目不会被丢弃，下次请求时向服务器确认，
+/// 得到 304 便刷新后继续使用。
+class ResponseCache {
+public:
+
+    /// 缓存的总容量（字节），默认 64 MiB，为 0 时不使用缓存
+    static size_t CAPACITY;
+
+    /// 单个回应（头部与数据体）的最大字节数，默认 4 MiB
+    /// 
+    /// 更大的回应照常转发，但不缓存。
+    static size_t MAX_ENTRY_SIZE;
+
+    /// 启发式新鲜期的上限（秒），默认一天
+    /// 
+    /// 回应没有给出有效期、但带有 Last-Modified 时，新鲜期取其距今的 10%。
+    static unsigned HEURISTIC_MAX;
+
+    /// 一个缓存条目
+    struct Entry {
+        /// 状态行与头部字段（以 CRLF 结尾，不含结尾的空行）
+        /// 
+        /// 已去掉 Connection、Keep-Alive 等逐跳字段以及 Age，
+        /// 发送时再补上。
+        std::string head;
+
+        /// 数据体，保持服务器发来的原样（可能是分段编码的）
+        std::string body;
+
+        /// 状态码
+        int status = 0;
+
+        /// 收到回应的时间
+        time_t responseTime = 0;
+
+        /// 收到回应时的年龄（秒），即 RFC 7234 的 corrected_initial_age
+        time_t initialAge = 0;
+
+        /// 新鲜期（秒）
+        time_t freshness = 0;
+
+        /// Vary 列出的字段名（小写，逗号分隔），没有 Vary 时为空
+        std::string varyNames;
+
+        /// 请求中 Vary 所列字段的值
+        std::string varyValues;
+
+        /// 验证器：ETag 与 Last-Modified 的值，没有时为空
+        std::string etag, lastModified;
+
+        /// 当前的年龄（秒）
+        time_t Age(time_t now) const {
+            return initialAge + (now > responseTime ? now - responseTime : 0);
+        }
+    };
+
+    /// 条目的引用
+    typedef std::shared_ptr<const Entry> EntryPtr;
+
+    /// 是否启用了缓存
+    static bool IsEnabled() {
+        return CAPACITY > 0;
+    }
+
+    /// 请求是否可能由缓存处理（GET 或 HEAD，没有数据体，没有 no-store）
+    static bool IsCacheableRequest(const HttpParser &request);
+
+    /// 生成缓存的键
+    /// 
+    /// @param target 请求目标，绝对形式（http://host/path）与
+    ///               origin 形式（/path）得到相同的键
+    static std::string MakeKey(const std::string &host, unsigned short port,
+                               const StrView &target);
+
+    class Flight;
+
+    /// 进行中的获取的引用
+    typedef std::shared_ptr<Flight> FlightPtr;
+
+    /// 查找的结果
+    struct Found {
+        /// 可以直接使用的新鲜条目
+        EntryPtr entry;
+
+        /// 同一个键进行中的获取，@a leader 为 false 时跟随它即可
+        FlightPtr flight;
+
+        /// 是否由本请求向服务器获取，并通过 @a flight 分享回应
+        bool leader = false;
+
+        /// 需要向服务器确认的过期条目（仅当 @a leader 为 true）
+        EntryPtr stale;
+    };
+
+    /// 查找条目
+    /// 
+    /// 请求的 Cache-Control（no-cache、max-age、min-fresh）与
+    /// Pragma: no-cache 都会被考虑。没有可用的条目时，若同一个键已有
+    /// 进行中的获取，就跟随它；否则 GET 请求成为领头者，领头者完成之后
+    /// 必须调用 Flight::Finish()。
+    /// 
+    /// 要求向服务器确认的请求（no-cache）既不跟随也不领头。
+    static Found Lookup(const std::string &key, const HttpParser &request);
+
+    /// 回应的头部已经收到，判断它能否存储
+    /// 
+    /// @param head 回应头部的原始数据（HeaderSize() 个字节）
+    /// @param responseDelay 发出请求到收到回应的耗时（秒）
+    /// @param maxSize 回应的大小上限，磁盘缓存可以存储更大的回应
+    /// @return 可以存储时返回尚未填入数据体的条目，否则返回空引用
+    static std::shared_ptr<Entry> Prepare(const HttpParser &request,
+                                          const HttpParser &response,
+                                          const char *head,
+                                          time_t responseDelay,
+                                          size_t maxSize = MAX_ENTRY_SIZE);
+
+    /// 过期的条目经服务器确认（304）仍然有效，生成刷新后的条目
+    /// 
+    /// 304 中的字段替换条目中的同名字段（RFC 7234 4.3.4），
+    /// 新鲜期据此重新计算，数据体不变。
+    /// 
+    /// @return 刷新后的条目。不可再存储（例如 304 带有 no-store）时
+    ///         其新鲜期为 0，仍可用于回应当前的请求
+    static std::shared_ptr<Entry> Refresh(const EntryPtr &stale,
+                                          const HttpParser &response,
+                                          time_t responseDelay);
+
+    /// 向服务器确认过期条目的条件字段（If-None-Match、If-Modified-Since）
+    /// 
+    /// @return 每行以 CRLF 结尾，可以直接加入请求的头部
+    static std::string MakeConditions(const Entry &stale);
+
+    /// 条目对 @a request 而言是否足够新鲜
+    /// 
+    /// 考虑请求的 no-cache、max-age 与 min-fresh，不检查 Vary。
+    static bool IsFresh(const Entry &entry, const HttpParser &request);
+
+    /// 条目能否用于回应 @a request（Vary 所列字段的值一致）
+    static bool Matches(const Entry &entry, const HttpParser &request);
+
+    /// 加入完整的回应
+    /// 
+    /// 同一个键（与 Vary 的值）原有的条目被替换。
+    static void Add(const std::string &key, std::shared_ptr<Entry> entry);
+
+    /// 删除某个键的所有条目
+    /// 
+    /// 用于 POST 等不安全的请求成功之后（RFC 7234 4.4 节）。
+    static bool Remove(const std::string &key);
+
+    /// 统计信息
+    struct Statistics {
+        size_t size; ///< 当前的条目数
+        size_t bytes; ///< 当前占用的字节数
+        unsigned long long hits; ///< 命中数
+        unsigned long long misses; ///< 未命中数（包括已过期）
+        unsigned long long stores; ///< 加入的条目数
+        unsigned long long evictions; ///< 因容量不足而被淘汰的条目数
+        unsigned long long collapsed; ///< 跟随进行中的获取的请求数
+        unsigned long long revalidations; ///< 向服务器确认过期条目的次数
+    };
+
+    /// 获取统计信息（汇总所有分片）
+    static Statistics GetStatistics();
+};
+
+/// 进行中的获取
+/// 
+/// 领头者收到可以存储的回应头部后调用 Begin()，此后每收到一段数据体就
+/// Append() 一次，最后 Finish()。跟随者在任意线程中用 Read() 读取，
+/// 回应头部确定之后就可以开始发送，数据体边收边转，不必等到完整。
+/// 
+/// 回应不能存储、或者领头者中途出错时获取失败；尚未开始发送的跟随者
+/// 应当自行向服务器请求。
+class ResponseCache::Flight {
+public:
+
+    /// 获取的状态
+    enum State {
+        FL_WAITING, ///< 等待回应的头部
+        FL_STREAMING, ///< 正在接收数据体
+        FL_DONE, ///< 回应已完整
+        FL_FAILED, ///< 获取失败
+    };
+
+    /// 构造函数（由 Lookup() 创建）
+    explicit Flight(const std::string &key);
+
+    /// 开始跟随
+    /// 
+    /// 之后应当立即 Read() 一次，此前的进展不会通知。
+    /// 
+    /// @param follower 跟随者的标识
+    /// @param wake 有了新的进展时调用（在领头者的线程中，持有内部的锁，
+    ///             只应把工作转交给跟随者的事件循环），在跟随者下一次
+    ///             Read() 之前不会再次调用
+    /// @return 获取已经失败、或者数据体已开始丢弃时返回 false
+    bool Follow(const void *follower, std::function<void()> wake);
+
+    /// 不再跟随（跟随者完成或者放弃时）
+    void Unfollow(const void *follower);
+
+    /// 读取数据体
+    /// 
+    /// @param offset 已经读取的字节数
+    /// @param buf 复制 @a offset 之后最多 @a size 个字节
+    /// @param n 实际复制的字节数
+    /// @param entry 头部确定之后设置为正在接收的条目，只能使用其中的
+    ///              头部与元数据，数据体仍在变化，只能经由本函数读取
+    /// @return 当前的状态
+    State Read(const void *follower, size_t offset, char *buf, size_t size,
+               size_t &n, EntryPtr &entry);
+
+    /// 回应头部可以存储，开始接收数据体
+    /// 
+    /// @param entry Prepare() 或 Refresh() 得到的条目，此后只能经由
+    ///              Append() 修改
+    void Begin(const std::shared_ptr<Entry> &entry);
+
+    /// 收到一段数据体
+    /// 
+    /// 超过 MAX_ENTRY_SIZE 之后条目不再存储，新的请求不再跟随，
+    /// 已读取的部分随即丢弃，只为已有的跟随者继续转发。落后超过
+    /// MAX_ENTRY_SIZE 的跟随者被放弃，保留的数据不会超过这一大小。
+    /// 
+    /// @return 既不能存储、也没有跟随者时返回 false，领头者应当 Finish()
+    bool Append(const char *data, size_t len);
+
+    /// 条目能否存入缓存（没有超过 MAX_ENTRY_SIZE）
+    bool IsStorable() const;
+
+    /// 结束获取
+    /// 
+    /// @param complete 回应是否完整。Begin() 之前结束的获取总是失败的
+    void Finish(bool complete);
+
+private:
+
+    // 不再接受新的跟随者
+    void Unregister();
+
+    // 唤醒所有尚未被唤醒的跟随者（须持有 m_mutex）
+    void WakeFollowers();
+
+    struct Follower {
+        const void *id;
+        std::function<void()> wake;
+        size_t offset; // 已读取的字节数
+        bool woken; // 已被唤醒，尚未读取
+    };
+
+    const std::string m_key;
+
+    mutable std::mutex m_mutex;
+    State m_state = FL_WAITING;
+    std::shared_ptr<Entry> m_entry;
+    std::vector<Follower> m_followers;
+
+    // 不再存储时，数据体开头已被所有跟随者读取、丢弃的字节数
+    size_t m_discarded = 0;
+    bool m_storable = true;
+};
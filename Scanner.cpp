@@ -0,0 +1,344 @@
+#include "Scanner.hpp"
+
+#include <cstring>
+
+// x86-64 必然支持 SSE2，AVX2 则要在运行时检测
+#if defined(__x86_64__) || defined(_M_X64)
+#define SCANNER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// 只有 AVX2 的内核按 AVX2 编译，其余代码仍可在任何 x86-64 上运行
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+
+typedef const char *(*FindLineEndFn)(const char *, size_t, const char **);
+typedef size_t (*ParseHexFn)(const char *, size_t, unsigned long long &);
+
+static inline unsigned CountTrailingZeros(unsigned mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+static inline int HexValue(char ch) {
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+
+    ch |= 0x20; // 转为小写
+    if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+    }
+
+    return -1;
+}
+
+//// Scalar //////////////////////////////////////////////////////////////
+
+static const char *FindLineEndScalar(const char *p, size_t len,
+                                     const char **colon) {
+    const char *c = nullptr;
+
+    for (const char *end = p + len; p < end; p++) {
+        if (*p == '\n') {
+            if (colon) {
+                *colon = c;
+            }
+
+            return p;
+        }
+
+        if (*p == ':' && !c) {
+            c = p;
+        }
+    }
+
+    if (colon) {
+        *colon = c;
+    }
+
+    return nullptr;
+}
+
+static size_t ParseHexScalar(const char *p, size_t len,
+                             unsigned long long &value) {
+    value = 0;
+    size_t n = 0;
+
+    for (; n < len; n++) {
+        int v = HexValue(p[n]);
+        if (v < 0) {
+            break;
+        }
+
+        if (n == 15) {
+            return 0; // 太长
+        }
+
+        value = (value << 4) | (unsigned) v;
+    }
+
+    return n;
+}
+
+#ifdef SCANNER_X86
+
+//// SSE2 ////////////////////////////////////////////////////////////////
+
+static const char *FindLineEndSSE2(const char *p, size_t len,
+                                   const char **colon) {
+    const char *end = p + len;
+    const char *c = nullptr;
+
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i co = _mm_set1_epi8(':');
+
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+
+        unsigned mlf = _mm_movemask_epi8(_mm_cmpeq_epi8(v, lf));
+        unsigned mco = 0;
+
+        if (colon && !c) {
+            mco = _mm_movemask_epi8(_mm_cmpeq_epi8(v, co));
+        }
+
+        if (mlf) {
+            unsigned i = CountTrailingZeros(mlf);
+
+            // 只要 LF 之前的冒号
+            mco &= (1u << i) - 1;
+            if (mco) {
+                c = p + CountTrailingZeros(mco);
+            }
+
+            if (colon) {
+                *colon = c;
+            }
+
+            return p + i;
+        }
+
+        if (mco) {
+            c = p + CountTrailingZeros(mco);
+        }
+
+        p += 16;
+    }
+
+    const char *c2;
+    const char *ret = FindLineEndScalar(p, end - p, colon ? &c2 : nullptr);
+
+    if (colon) {
+        *colon = c ? c : c2;
+    }
+
+    return ret;
+}
+
+// 16 个字节中哪些是十六进制数字
+static inline unsigned HexDigitMask(__m128i v) {
+    const __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+
+    // 非 ASCII 字节作为有符号数是负的，两个比较都不会成立
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                  _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+
+    return _mm_movemask_epi8(_mm_or_si128(digit, alpha));
+}
+
+static size_t ParseHexSSE2(const char *p, size_t len,
+                           unsigned long long &value) {
+    if (len < 16) {
+        return ParseHexScalar(p, len, value);
+    }
+
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    unsigned mask = HexDigitMask(v);
+
+    // 数字的个数就是末尾连续的 1 的个数
+    unsigned n = CountTrailingZeros(~mask);
+    if (n > 15) {
+        return 0;
+    }
+
+    value = 0;
+    for (unsigned i = 0; i < n; i++) {
+        value = (value << 4) | (unsigned) HexValue(p[i]);
+    }
+
+    return n;
+}
+
+//// AVX2 ////////////////////////////////////////////////////////////////
+
+TARGET_AVX2
+static const char *FindLineEndAVX2(const char *p, size_t len,
+                                   const char **colon) {
+    const char *end = p + len;
+    const char *c = nullptr;
+
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i co = _mm256_set1_epi8(':');
+
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) p);
+
+        unsigned mlf = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lf));
+        unsigned mco = 0;
+
+        if (colon && !c) {
+            mco = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, co));
+        }
+
+        if (mlf) {
+            unsigned i = CountTrailingZeros(mlf);
+
+            mco &= (1u << i) - 1;
+            if (mco) {
+                c = p + CountTrailingZeros(mco);
+            }
+
+            if (colon) {
+                *colon = c;
+            }
+
+            return p + i;
+        }
+
+        if (mco) {
+            c = p + CountTrailingZeros(mco);
+        }
+
+        p += 32;
+    }
+
+    // 剩下不足 32 字节的部分交给 SSE2
+    const char *c2;
+    const char *ret = FindLineEndSSE2(p, end - p, colon ? &c2 : nullptr);
+
+    if (colon) {
+        *colon = c ? c : c2;
+    }
+
+    return ret;
+}
+
+static bool CpuHasAVX2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+
+    // 操作系统须保存 YMM 寄存器
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // SCANNER_X86
+
+//////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Kernels {
+    Scanner::Level level;
+    FindLineEndFn findLineEnd;
+    ParseHexFn parseHex;
+};
+
+Kernels GetKernels(Scanner::Level level) {
+    switch (level) {
+#ifdef SCANNER_X86
+    case Scanner::AVX2:
+        return Kernels{ level, FindLineEndAVX2, ParseHexSSE2 };
+
+    case Scanner::SSE2:
+        return Kernels{ level, FindLineEndSSE2, ParseHexSSE2 };
+#endif
+
+    default:
+        return Kernels{ Scanner::SCALAR, FindLineEndScalar, ParseHexScalar };
+    }
+}
+
+Scanner::Level DetectBestLevel() {
+#ifdef SCANNER_X86
+    return CpuHasAVX2() ? Scanner::AVX2 : Scanner::SSE2;
+#else
+    return Scanner::SCALAR;
+#endif
+}
+
+const Scanner::Level gs_bestLevel = DetectBestLevel();
+Kernels gs_kernels = GetKernels(gs_bestLevel);
+
+}
+
+Scanner::Level Scanner::GetLevel() {
+    return gs_kernels.level;
+}
+
+Scanner::Level Scanner::GetBestLevel() {
+    return gs_bestLevel;
+}
+
+bool Scanner::SetLevel(Level level) {
+    if (level > gs_bestLevel) {
+        return false;
+    }
+
+    gs_kernels = GetKernels(level);
+    return true;
+}
+
+const char *Scanner::GetLevelName(Level level) {
+    switch (level) {
+    case AVX2:
+        return "AVX2";
+
+    case SSE2:
+        return "SSE2";
+
+    default:
+        return "scalar";
+    }
+}
+
+const char *Scanner::FindLineEnd(const char *p, size_t len,
+                                 const char **colon) {
+    return gs_kernels.findLineEnd(p, len, colon);
+}
+
+size_t Scanner::ParseHex(const char *p, size_t len,
+                         unsigned long long &value) {
+    return gs_kernels.parseHex(p, len, value);
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+
+/// 字节扫描内核
+/// 
+/// 解析 HTTP 头部和分段大小时用到的查找操作。x86 上按 CPU 的能力
+/// 在运行时选用 AVX2（一次 32 字节）、SSE2（一次 16 字节）或逐字节的实现。
+class Scanner {
+public:
+
+    /// 实现的级别
+    enum Level {
+        SCALAR, ///< 逐字节
+        SSE2, ///< 一次 16 字节
+        AVX2, ///< 一次 32 字节
+    };
+
+    /// 当前选用的实现
+    static Level GetLevel();
+
+    /// CPU 支持的最高级别
+    static Level GetBestLevel();
+
+    /// 强制使用某一级别的实现（测试、基准用）
+    /// 
+    /// @return CPU 不支持时返回 false，当前的实现保持不变
+    static bool SetLevel(Level level);
+
+    /// 级别的名字
+    static const char *GetLevelName(Level level);
+
+    /// 在 [p, p + len) 中查找第一个 LF
+    /// 
+    /// @param colon 非空时返回 LF 之前的第一个冒号，没有时为 nullptr
+    /// @return LF 的位置，没有时返回 nullptr（此时 @a colon 仍然有效）
+    static const char *FindLineEnd(const char *p, size_t len,
+                                   const char **colon = nullptr);
+
+    /// 解析开头的十六进制数
+    /// 
+    /// @param value 返回解析出的值
+    /// @return 十六进制数字的个数；0 表示开头不是十六进制数字，
+    ///         超过 15 个数字（可能溢出）时也返回 0
+    static size_t ParseHex(const char *p, size_t len,
+                           unsigned long long &value);
+};
@@ -0,0 +1,233 @@
+#include "TimerWheel.hpp"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////
+
+static inline unsigned CountTrailingZeros(uint64_t mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return index;
+#else
+    return __builtin_ctzll(mask);
+#endif
+}
+
+static inline unsigned HighestBit(uint64_t mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, mask);
+    return index;
+#else
+    return 63 - __builtin_clzll(mask);
+#endif
+}
+
+TimerWheel::TimerWheel(Tick now) : m_now(now) {
+    for (auto &head : m_heads) {
+        head = kNone;
+    }
+
+    for (auto &occupied : m_occupied) {
+        occupied = 0;
+    }
+}
+
+TimerWheel::Id TimerWheel::Add(Tick expire, function<void()> fn) {
+    if (expire <= m_now) {
+        expire = m_now + 1;
+    }
+
+    uint32_t index;
+    if (m_free != kNone) {
+        index = m_free;
+        m_free = m_nodes[index].next;
+    }
+    else {
+        index = (uint32_t) m_nodes.size();
+        m_nodes.emplace_back();
+        m_nodes[index].gen = 1;
+    }
+
+    auto &node = m_nodes[index];
+    node.fn = move(fn);
+    node.expire = expire;
+
+    Link(index);
+    m_size++;
+
+    return (Id) node.gen << 32 | index;
+}
+
+bool TimerWheel::Cancel(Id id) {
+    auto index = (uint32_t) id;
+    if (id == 0 || index >= m_nodes.size()) {
+        return false;
+    }
+
+    auto &node = m_nodes[index];
+    if (node.gen != (uint32_t) (id >> 32) || node.list == kNone) {
+        return false;
+    }
+
+    Unlink(index);
+    Free(index);
+
+    return true;
+}
+
+bool TimerWheel::NextTick(Tick &tick) const {
+    // 低层的槽总是先于高层的槽需要处理，找到第一个即可
+    for (unsigned level = 0; level < kLevels; level++) {
+        unsigned shift = level * kBits;
+        unsigned pos = (unsigned) (m_now >> shift) & (kSlots - 1);
+
+        // 槽号总是大于当前时刻在本层的值
+        uint64_t later = pos == kSlots - 1 ? 0 : ~0ULL << (pos + 1);
+        uint64_t bits = m_occupied[level] & later;
+
+        if (bits != 0) {
+            unsigned above = shift + kBits;
+            Tick high = above >= 64 ? 0 : m_now >> above << above;
+
+            tick = high | (Tick) CountTrailingZeros(bits) << shift;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void TimerWheel::Advance(Tick now) {
+    while (m_now < now) {
+        // 其间没有需要处理的时刻就直接跳过去
+        Tick next;
+        if (!NextTick(next) || next > now) {
+            m_now = now;
+            break;
+        }
+
+        m_now = next;
+
+        // 从高层到低层，把起点恰为当前时刻的槽往下移
+        for (unsigned level = kLevels - 1; level > 0; level--) {
+            unsigned shift = level * kBits;
+            if ((m_now & (((Tick) 1 << shift) - 1)) != 0) {
+                continue;
+            }
+
+            unsigned slot = (unsigned) (m_now >> shift) & (kSlots - 1);
+            if (m_occupied[level] & (uint64_t) 1 << slot) {
+                Cascade(level, slot);
+            }
+        }
+
+        unsigned slot = (unsigned) m_now & (kSlots - 1);
+        if (m_occupied[0] & (uint64_t) 1 << slot) {
+            Cascade(0, slot);
+        }
+
+        // 先摘下再执行，回调中可以增删定时器
+        while (m_heads[kDue] != kNone) {
+            auto index = m_heads[kDue];
+            auto fn(move(m_nodes[index].fn));
+
+            Unlink(index);
+            Free(index);
+
+            fn();
+        }
+    }
+}
+
+void TimerWheel::Link(uint32_t index) {
+    auto expire = m_nodes[index].expire;
+    if (expire <= m_now) {
+        Append(index, kDue);
+        return;
+    }
+
+    unsigned level = HighestBit(expire ^ m_now) / kBits;
+    unsigned slot = (unsigned) (expire >> (level * kBits)) & (kSlots - 1);
+
+    Append(index, level * kSlots + slot);
+    m_occupied[level] |= (uint64_t) 1 << slot;
+}
+
+void TimerWheel::Append(uint32_t index, uint32_t list) {
+    auto &node = m_nodes[index];
+    auto &head = m_heads[list];
+
+    node.list = list;
+
+    // 循环链表，表头的 prev 即为表尾
+    if (head == kNone) {
+        node.prev = node.next = index;
+        head = index;
+    }
+    else {
+        auto tail = m_nodes[head].prev;
+
+        node.prev = tail;
+        node.next = head;
+        m_nodes[tail].next = index;
+        m_nodes[head].prev = index;
+    }
+}
+
+void TimerWheel::Unlink(uint32_t index) {
+    auto &node = m_nodes[index];
+    auto &head = m_heads[node.list];
+
+    if (node.next == index) {
+        head = kNone;
+
+        if (node.list != kDue) {
+            m_occupied[node.list / kSlots] &= ~((uint64_t) 1 << node.list % kSlots);
+        }
+    }
+    else {
+        m_nodes[node.prev].next = node.next;
+        m_nodes[node.next].prev = node.prev;
+
+        if (head == index) {
+            head = node.next;
+        }
+    }
+
+    node.list = kNone;
+}
+
+void TimerWheel::Free(uint32_t index) {
+    auto &node = m_nodes[index];
+
+    // 在最后销毁，它捕获的对象的析构函数可能会添加定时器
+    auto fn(move(node.fn));
+    node.fn = nullptr;
+
+    if (++node.gen == 0) {
+        node.gen = 1;
+    }
+
+    node.list = kNone;
+    node.next = m_free;
+    m_free = index;
+    m_size--;
+}
+
+void TimerWheel::Cascade(unsigned level, unsigned slot) {
+    auto &head = m_heads[level * kSlots + slot];
+
+    // 重新放置的定时器总是落在更低的层，不会回到这个槽
+    while (head != kNone) {
+        auto index = head;
+
+        Unlink(index);
+        Link(index);
+    }
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/// 分层的时间轮
+/// 
+/// 时刻以整数的滴答（EventLoop 中为毫秒）表示。每层 64 个槽，第 n 层的
+/// 一个槽跨越 64^n 个滴答；定时器按到期时刻与当前时刻最高的不同位放入
+/// 相应的层，随着时间推进逐层下移（cascade），到第 0 层时到期执行。
+/// 11 层覆盖全部 64 位的时刻，不必另外处理溢出。
+/// 
+/// 添加、取消都是 O(1)：定时器存放在一个数组中，以下标串成各槽的双向
+/// 链表，释放的位置重复使用。每层另有一个位图记录非空的槽，找下一个
+/// 需要处理的时刻不必逐个槽扫描，长时间没有定时器到期时可以直接跳过。
+/// 
+/// 不是线程安全的，由事件循环在自己的线程中使用。
+class TimerWheel {
+public:
+
+    /// 时刻（滴答）
+    typedef unsigned long long Tick;
+
+    /// 定时器标识，0 表示无效
+    /// 
+    /// 高 32 位为代数，低 32 位为数组中的下标；位置被重用后，
+    /// 旧的标识不会误取消新的定时器。
+    typedef unsigned long long Id;
+
+    /// 构造函数
+    /// 
+    /// @param now 起始时刻
+    explicit TimerWheel(Tick now = 0);
+
+    /// 已经推进到的时刻
+    Tick Now() const {
+        return m_now;
+    }
+
+    /// 当前的定时器数
+    size_t Size() const {
+        return m_size;
+    }
+
+    /// 在 @a expire 时刻执行 @a fn（只执行一次）
+    /// 
+    /// 不晚于 Now() 的时刻按 Now() + 1 处理。
+    Id Add(Tick expire, std::function<void()> fn);
+
+    /// 取消尚未执行的定时器
+    /// 
+    /// @return 定时器不存在（已执行或已取消）时返回 false
+    bool Cancel(Id id);
+
+    /// 下一个需要处理的时刻（定时器到期，或者需要下移一层）
+    /// 
+    /// @return 没有定时器时返回 false
+    bool NextTick(Tick &tick) const;
+
+    /// 推进到 @a now，执行其间到期的定时器
+    /// 
+    /// 回调中可以添加、取消定时器。
+    void Advance(Tick now);
+
+private:
+
+    static const unsigned kBits = 6;
+    static const unsigned kSlots = 1 << kBits;
+    static const unsigned kLevels = (64 + kBits - 1) / kBits;
+
+    // 到期、等待执行的定时器所在的链表
+    static const unsigned kDue = kLevels * kSlots;
+
+    static const uint32_t kNone = UINT32_MAX;
+
+    struct Node {
+        std::function<void()> fn;
+        Tick expire;
+        uint32_t prev, next; // 所在链表中的前后，空闲时 next 串起空闲链表
+        uint32_t gen; // 代数，每次释放时递增
+        uint32_t list; // 所在的链表，kNone 表示空闲
+    };
+
+    // 按到期时刻放入相应的槽
+    void Link(uint32_t index);
+
+    // 放入 @a list 的末尾
+    void Append(uint32_t index, uint32_t list);
+
+    // 从所在的链表中摘下
+    void Unlink(uint32_t index);
+
+    // 释放，标识随即失效
+    void Free(uint32_t index);
+
+    // 把 @a level 层的 @a slot 槽中的定时器按当前时刻重新放置
+    void Cascade(unsigned level, unsigned slot);
+
+private:
+
+    std::vector<Node> m_nodes;
+    uint32_t m_free = kNone; // 空闲链表
+
+    uint32_t m_heads[kLevels * kSlots + 1];
+    uint64_t m_occupied[kLevels]; // 每层非空的槽
+
+    Tick m_now;
+    size_t m_size = 0;
+};
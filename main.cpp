@@ -8,10 +8,23 @@
  ABSOLUTELY NO WARRANTY WHATSOEVER for this product.  Caveat hacker.
 ***********************************************************************/
 
+#ifdef _WIN32
 #include <winsock2.h>
 #pragma comment(lib, "ws2_32.lib")
+#else
+#include <signal.h>
+#endif
+
+#include "Resolver.hpp"
+#include "EventLoop.hpp"
+#include "ResponseCache.hpp"
+#include "DiskCache.hpp"
+#include "Logger.hpp"
+#include "Proxy.hpp"
+#include "Admission.hpp"
 
 #include <stdlib.h>
+#include <string.h>
 #include <iostream>
 
 using namespace std;
@@ -21,6 +34,11 @@ using namespace std;
 
 extern int DoWinsock(const char *pcHost, const char *pcPort);
 
+extern int g_numWorkers;
+extern bool g_reusePort;
+extern const char *g_adminAddr;
+extern int g_backlog;
+
 
 //// Constants /////////////////////////////////////////////////////////
 
@@ -33,18 +51,104 @@ const char *kDefaultServerPort = "1990";
 int main(int argc, char *argv[]) {
 	const char *pcPort = kDefaultServerPort;
 
-    // Do we have enough command line arguments?
-    if (argc >= 2) {
-        pcPort = argv[1];
+    // The port comes first, followed by any of these switches:
+    //   -workers N   number of worker threads (default: one per core)
+    //   -reuseport   one SO_REUSEPORT listener per worker
+    //   -nameserver IP[:PORT]   query this DNS server directly
+    //   -io_uring    use io_uring instead of epoll where supported
+    //   -admin [HOST:]PORT   serve Prometheus metrics on this address
+    //   -log FILE    write the log to FILE instead of the console
+    //   -access-log FILE   write one JSON line per request to FILE
+    //   -cache MB    size of the response cache, 0 to disable (default 64)
+    //   -disk-cache DIR   keep a second cache tier in segment files in DIR
+    //   -disk-cache-size MB   size of the disk tier (default 1024)
+    //   -header-timeout SEC   time allowed for a request's headers (default 10)
+    //   -keepalive-timeout SEC   idle time between requests (default 60)
+    //   -connect-timeout SEC   time allowed per origin address (default 10)
+    //   -first-byte-timeout SEC   time allowed for the origin to respond,
+    //                and for any stall while relaying (default 60)
+    //   -tunnel-timeout SEC   idle time allowed in CONNECT tunnels (default 300)
+    //   (a timeout of 0 means no limit)
+    //   -max-connections N   connections served at once, 0 = no limit
+    //   -max-per-client N   connections per client IP, 0 = no limit
+    //   -accept-queue N   accepted connections waiting for a worker
+    //                (default 1024, 0 = no limit)
+    //   -backlog N   length of the kernel's listen queue (default SOMAXCONN)
+    //   (connections over a limit get a 503 and are closed)
+    int nNumArgsIgnored = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-reuseport") == 0) {
+            g_reusePort = true;
+        }
+        else if (strcmp(argv[i], "-workers") == 0 && i + 1 < argc) {
+            g_numWorkers = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-nameserver") == 0 && i + 1 < argc) {
+            Resolver::NAMESERVER = argv[++i];
+        }
+        else if (strcmp(argv[i], "-io_uring") == 0) {
+            EventLoop::IO_URING = true;
+        }
+        else if (strcmp(argv[i], "-admin") == 0 && i + 1 < argc) {
+            g_adminAddr = argv[++i];
+        }
+        else if (strcmp(argv[i], "-log") == 0 && i + 1 < argc) {
+            Logger::PATH = argv[++i];
+        }
+        else if (strcmp(argv[i], "-access-log") == 0 && i + 1 < argc) {
+            Logger::ACCESS_PATH = argv[++i];
+        }
+        else if (strcmp(argv[i], "-cache") == 0 && i + 1 < argc) {
+            ResponseCache::CAPACITY = (size_t) atoi(argv[++i]) * 1024 * 1024;
+        }
+        else if (strcmp(argv[i], "-disk-cache") == 0 && i + 1 < argc) {
+            DiskCache::DIRECTORY = argv[++i];
+        }
+        else if (strcmp(argv[i], "-disk-cache-size") == 0 && i + 1 < argc) {
+            DiskCache::CAPACITY = (size_t) atoi(argv[++i]) * 1024 * 1024;
+        }
+        else if (strcmp(argv[i], "-header-timeout") == 0 && i + 1 < argc) {
+            MyProxy::HEADER_TIMEOUT = (unsigned) atoi(argv[++i]) * 1000;
+        }
+        else if (strcmp(argv[i], "-keepalive-timeout") == 0 && i + 1 < argc) {
+            MyProxy::KEEPALIVE_TIMEOUT = (unsigned) atoi(argv[++i]) * 1000;
+        }
+        else if (strcmp(argv[i], "-connect-timeout") == 0 && i + 1 < argc) {
+            MyProxy::CONNECT_TIMEOUT = (unsigned) atoi(argv[++i]) * 1000;
+        }
+        else if (strcmp(argv[i], "-first-byte-timeout") == 0 && i + 1 < argc) {
+            MyProxy::FIRST_BYTE_TIMEOUT = (unsigned) atoi(argv[++i]) * 1000;
+        }
+        else if (strcmp(argv[i], "-tunnel-timeout") == 0 && i + 1 < argc) {
+            MyProxy::TUNNEL_TIMEOUT = (unsigned) atoi(argv[++i]) * 1000;
+        }
+        else if (strcmp(argv[i], "-max-connections") == 0 && i + 1 < argc) {
+            Admission::MAX_CONNECTIONS = (unsigned) atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-max-per-client") == 0 && i + 1 < argc) {
+            Admission::MAX_PER_CLIENT = (unsigned) atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-accept-queue") == 0 && i + 1 < argc) {
+            Admission::ACCEPT_QUEUE = (unsigned) atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-backlog") == 0 && i + 1 < argc) {
+            g_backlog = atoi(argv[++i]);
+        }
+        else if (i == 1) {
+            pcPort = argv[i];
+        }
+        else {
+            nNumArgsIgnored++;
+        }
     }
 
     // Do a little sanity checking because we're anal.
-    int nNumArgsIgnored = (argc - 2);
     if (nNumArgsIgnored > 0) {
         cerr << nNumArgsIgnored << " extra argument" <<
                (nNumArgsIgnored == 1 ? "" : "s") << " ignored.  FYI." << endl;
     }
 
+#ifdef _WIN32
     // Start Winsock up.
     WSAData wsaData;
 	int nCode;
@@ -52,11 +156,18 @@ int main(int argc, char *argv[]) {
 		cerr << "WSAStartup() returned error code " << nCode << "." << endl;
         return 255;
     }
+#else
+    // Writing to a connection the peer has already closed must not
+    // kill the whole proxy.
+    signal(SIGPIPE, SIG_IGN);
+#endif
 
     // Call the main example routine.
     int retval = DoWinsock("127.0.0.1", pcPort);
 
+#ifdef _WIN32
     // Shut Winsock back down and take off.
     WSACleanup();
+#endif
     return retval;
 }
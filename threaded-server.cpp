@@ -1,42 +1,66 @@
 /***********************************************************************
  threaded-server.cpp - Implements a simple Winsock server that accepts
-    connections and spins each one off into its own thread, where it's
-    treated as a blocking socket.
+    connections and hands each one off to one of a few worker threads,
+    each running an event loop over non-blocking sockets.
 
-    Each connection thread reads data off the socket and echoes it
-    back verbatim.
-
- Compiling:
-    VC++: cl -GX threaded-server.cpp main.cpp ws-util.cpp wsock32.lib
-    BC++: bcc32 threaded-server.cpp main.cpp ws-util.cpp
+    Each connection is driven by a MyProxy state machine that relays
+    the browser's requests to the origin servers and back.
     
  This program is hereby released into the public domain.  There is
  ABSOLUTELY NO WARRANTY WHATSOEVER for this product.  Caveat hacker.
 ***********************************************************************/
 
 #include "Proxy.hpp"
-#include "ThreadPool.hpp"
+#include "DiskCache.hpp"
+#include "EventLoop.hpp"
+#include "Acceptor.hpp"
+#include "AdminServer.hpp"
+#include "Metrics.hpp"
 #include "Logger.hpp"
 
 #include "ws-util.h"
-#include <Ws2tcpip.h>
 
-#include <atomic>
+#include <algorithm>
 #include <iostream>
-#include <sstream>
+#include <memory>
+#include <thread>
+#include <vector>
 using namespace std;
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 
 //// Global variables //////////////////////////////////////////////////
 
-atomic_int g_numThreads;
+// Number of worker threads (event loops); 0 means one per core.
+int g_numWorkers = 0;
 
+// Give every worker its own SO_REUSEPORT listener instead of sharing
+// a single accept loop.
+bool g_reusePort = false;
 
-//// SetUpListener /////////////////////////////////////////////////////
-// Sets up a listener on the given interface and port, returning the
-// listening socket if successful; if not, returns INVALID_SOCKET.
+// Where to serve the metrics, as [HOST:]PORT; NULL means nowhere.
+const char *g_adminAddr = NULL;
+
+// How many connections the kernel may queue on each listener before
+// we accept them.
+int g_backlog = SOMAXCONN;
+
+vector<unique_ptr<EventLoop>> g_loops;
 
-SOCKET SetUpListener(const char *pcHost, const char *pcPort) {
+
+//// SetUpListener /////////////////////////////////////////////////////
+// Sets up a listener on the given port, returning the listening socket
+// if successful; if not, returns INVALID_SOCKET.  The listener accepts
+// on all interfaces; the host argument is not used.
+// With bReusePort, several listeners may be bound to the same port and
+// the kernel balances incoming connections among them.
+
+SOCKET SetUpListener(const char * /*pcHost*/, const char *pcPort,
+                     bool bReusePort = false) {
 	addrinfo *result = NULL;
 	addrinfo hints;
 
@@ -64,6 +88,16 @@ SOCKET SetUpListener(const char *pcHost, const char *pcPort) {
 	int opt = 1;
 	setsockopt(ListenSocket, SOL_SOCKET, SO_REUSEADDR, (const char *) &opt, sizeof(opt));
 
+#ifdef SO_REUSEPORT
+	if (bReusePort &&
+		setsockopt(ListenSocket, SOL_SOCKET, SO_REUSEPORT, (const char *) &opt, sizeof(opt)) != 0) {
+		cerr << WSAGetLastErrorMessage("setsockopt(SO_REUSEPORT) failed") << endl;
+		freeaddrinfo(result);
+		closesocket(ListenSocket);
+		return INVALID_SOCKET;
+	}
+#endif
+
 	// Setup the TCP listening socket.
 	iResult = bind(ListenSocket, result->ai_addr, (int) result->ai_addrlen);
 	if (iResult == SOCKET_ERROR) {
@@ -75,7 +109,7 @@ SOCKET SetUpListener(const char *pcHost, const char *pcPort) {
 
 	freeaddrinfo(result);
 
-	iResult = listen(ListenSocket, SOMAXCONN);
+	iResult = listen(ListenSocket, g_backlog);
 	if (iResult == SOCKET_ERROR) {
 		cerr << WSAGetLastErrorMessage("listen() failed") << endl;
 		closesocket(ListenSocket);
@@ -87,73 +121,197 @@ SOCKET SetUpListener(const char *pcHost, const char *pcPort) {
 }
 
 
-//// EchoHandler ///////////////////////////////////////////////////////
-// Handles the incoming data by reflecting it back to the sender.
-VOID CALLBACK ProxyHandler(PTP_CALLBACK_INSTANCE, PVOID sd_) {
-    ++g_numThreads;
+//// GetNumWorkers ///////////////////////////////////////////////////
+// Returns the configured number of worker threads, defaulting to one
+// per core.
 
-    if (true) {
-        SOCKET sd = (SOCKET) sd_;
-        MyProxy proxy(sd);
+int GetNumWorkers() {
+    if (g_numWorkers > 0) {
+        return g_numWorkers;
+    }
 
-        if (!proxy.HandleBrowser()) {
-            Logger::LogError(__FUNC__ "Handling browser request failed");
-        }
+    return max(1, (int) thread::hardware_concurrency());
+}
+
+
+//// PinCurrentThread ////////////////////////////////////////////////
+// Binds the calling thread to the given core so that its event loop,
+// its listener and all the connections it owns stay on one CPU.
+
+void PinCurrentThread(int nCore) {
+    int nCores = max(1, (int) thread::hardware_concurrency());
+
+#ifdef __linux__
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(nCore % nCores, &cpus);
 
-        if (!ShutdownConnection(sd)) {
-            proxy.PrintRequest(Logger::OL_ERROR);
-            Logger::LogError(__FUNC__ "Connection shutdown failed");
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+        Logger::LogError(__FUNC__ "pthread_setaffinity_np() failed");
+    }
+#elif defined(_WIN32)
+    SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << (nCore % nCores));
+#endif
+}
+
+
+//// StartWorkers ////////////////////////////////////////////////////
+// Creates one event loop per worker thread.  Each loop owns the
+// connections handed to it and drives them without ever blocking, so a
+// handful of threads can serve any number of connections.
+
+bool StartWorkers() {
+    int nWorkers = GetNumWorkers();
+
+    for (int i = 0; i < nWorkers; i++) {
+        unique_ptr<EventLoop> loop(new EventLoop);
+        if (!loop->IsOk()) {
+            Logger::LogError(__FUNC__ "Creating event loop failed");
+            return false;
         }
+
+        g_loops.push_back(move(loop));
+    }
+
+    for (auto &loop : g_loops) {
+        EventLoop *pLoop = loop.get();
+        thread([pLoop] { pLoop->Run(); }).detach();
     }
 
-    Logger::LogInfo("Threadpool work done!");
+    return true;
+}
+
+
+//// ReportConnectionRate //////////////////////////////////////////////
+// Once a second, prints how many connections were accepted during the
+// last second and how many are active, instead of a line per
+// connection.  Stays quiet while nothing changes.
 
-    --g_numThreads;
+void ReportConnectionRate(EventLoop &loop, uint64_t nLastOpened = 0,
+                          int nLastActive = 0) {
+    loop.AddTimer(1000, [&loop, nLastOpened, nLastActive] {
+        auto snapshot = Metrics::Collect();
+        uint64_t nOpened = snapshot.counters[Metrics::CONNECTIONS_OPENED];
+        int nActive = (int) (nOpened -
+                             snapshot.counters[Metrics::CONNECTIONS_CLOSED]);
+
+        if (nOpened != nLastOpened || nActive != nLastActive) {
+            cout << "-- Accepted " << (nOpened - nLastOpened) <<
+                    " connections/s, " << nActive << " active" << endl;
+        }
+
+        ReportConnectionRate(loop, nOpened, nActive);
+    });
 }
 
 
 //// AcceptConnections /////////////////////////////////////////////////
-// Spins forever waiting for connections.  For each one that comes in, 
-// we create a thread to handle it and go back to waiting for
-// connections.  If an error occurs, we return.
+// Runs an event loop of its own on the calling thread that accepts
+// connections as they come in and hands them to the worker event loops
+// in turn, a whole batch per wakeup.  If an error occurs, we return.
 
 void AcceptConnections(SOCKET ListeningSocket) {
     Logger::LEVEL = Logger::OL_ERROR;
     Logger::CONSOLE = false;
 
-    ThreadPool pool;
+    EventLoop loop;
+    if (!loop.IsOk()) {
+        Logger::LogError(__FUNC__ "Creating event loop failed");
+        closesocket(ListeningSocket);
+        return;
+    }
 
-    ostringstream ss;
-    char szIPv4[24] = {};
+    if (!StartWorkers()) {
+        closesocket(ListeningSocket);
+        return;
+    }
 
-    sockaddr_in sinRemote;
-    int nAddrSize = sizeof(sinRemote);
+    vector<EventLoop *> workers;
+    for (auto &worker : g_loops) {
+        workers.push_back(worker.get());
+    }
 
-    while (true) {
-        SOCKET sd = accept
-            (ListeningSocket, (sockaddr *) &sinRemote, &nAddrSize);
+    Acceptor acceptor(loop, ListeningSocket, workers);
+    if (!acceptor.Start()) {
+        return;
+    }
 
-        if (sd != INVALID_SOCKET) {
-            inet_ntop(AF_INET, &sinRemote.sin_addr, szIPv4, sizeof(szIPv4));
+    ReportConnectionRate(loop);
+    loop.Run();
+}
 
-            cout << "Accepted connection from " << szIPv4 << ":" <<
-                     ntohs(sinRemote.sin_port) << endl <<
-                    "-- Threads count: " << (g_numThreads + 1) << endl;
 
-            pool.SetThreadMinimum(g_numThreads + 1);
-            if (!pool.CreateWork(ProxyHandler, (void *) sd)) {
-                pool.SetThreadMinimum(g_numThreads);
+//// CloseListeners ////////////////////////////////////////////////
+// Closes listeners that were set up before a later step failed.
 
-                ss << "ThreadPool::CreateWork() failed --" << GetLastError();
-                Logger::LogError(ss.str());
-                ss.str(string());
-            }
+void CloseListeners(const vector<SOCKET> &listeners) {
+    for (SOCKET sd : listeners) {
+        closesocket(sd);
+    }
+}
+
+
+//// RunReusePortWorkers ///////////////////////////////////////////
+// Opens one SO_REUSEPORT listener per worker.  Each worker is pinned to
+// its own core and accepts from its own listener inside its own event
+// loop, so there is no shared accept loop or lock at all.  All the
+// listeners and loops are set up before any worker starts, so a failure
+// leaves no thread behind.  Only returns if something goes wrong.
+
+int RunReusePortWorkers(const char *pcAddr, const char *pcPort) {
+    int nWorkers = GetNumWorkers();
+    vector<SOCKET> listeners;
+
+    for (int i = 0; i < nWorkers; i++) {
+        SOCKET ListeningSocket = SetUpListener(pcAddr, pcPort, true);
+        if (ListeningSocket == INVALID_SOCKET) {
+            cout << endl << WSAGetLastErrorMessage("establish listener") << endl;
+            CloseListeners(listeners);
+            return 3;
         }
-        else {
-            Logger::LogError(WSAGetLastErrorMessage("accept() failed"));
-            return;
+
+        listeners.push_back(ListeningSocket);
+
+        unique_ptr<EventLoop> loop(new EventLoop);
+        if (!loop->IsOk()) {
+            Logger::LogError(__FUNC__ "Creating event loop failed");
+            CloseListeners(listeners);
+            return 3;
         }
+
+        g_loops.push_back(move(loop));
+    }
+
+    vector<thread> threads;
+
+    for (int i = 0; i < nWorkers; i++) {
+        EventLoop *pLoop = g_loops[i].get();
+        SOCKET ListeningSocket = listeners[i];
+
+        threads.emplace_back([pLoop, ListeningSocket, i] {
+            PinCurrentThread(i);
+
+            Acceptor acceptor(*pLoop, ListeningSocket);
+            if (acceptor.Start()) {
+                pLoop->Run();
+            }
+        });
     }
+
+    cout << "Waiting for connections on " << nWorkers << " workers..." << endl;
+
+    // The main thread has nothing else to do but report.
+    EventLoop reporter;
+    if (reporter.IsOk()) {
+        ReportConnectionRate(reporter);
+        reporter.Run();
+    }
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    return 0;
 }
 
 
@@ -162,6 +320,43 @@ void AcceptConnections(SOCKET ListeningSocket) {
 // interpret their results.
 
 int DoWinsock(const char *pcAddr, const char *pcPort) {
+    // From here on the workers hand their log records to a background
+    // writer instead of writing them out themselves.
+    if (!Logger::Start()) {
+        return 3;
+    }
+
+    // The disk tier's index is mapped before any worker can look at it.
+    if (!DiskCache::DIRECTORY.empty()) {
+        cout << "Opening the disk cache in " << DiskCache::DIRECTORY <<
+                "..." << endl;
+        if (!DiskCache::Open()) {
+            cout << endl << "Could not open the disk cache." << endl;
+            return 3;
+        }
+    }
+
+    if (g_adminAddr) {
+        cout << "Serving metrics on " << g_adminAddr << "..." << endl;
+        if (!AdminServer::Start(g_adminAddr, GetNumWorkers())) {
+            cout << endl << "Could not start the admin listener." << endl;
+            return 3;
+        }
+    }
+
+    if (g_reusePort) {
+#ifdef SO_REUSEPORT
+        Logger::LEVEL = Logger::OL_ERROR;
+        Logger::CONSOLE = false;
+
+        cout << "Establishing the listeners on port " << pcPort << "..." << endl;
+        return RunReusePortWorkers(pcAddr, pcPort);
+#else
+        cout << "SO_REUSEPORT is not supported; " <<
+                "falling back to a single listener." << endl;
+#endif
+    }
+
     cout << "Establishing the listener on port " << pcPort << "..." << endl;
     SOCKET ListeningSocket = SetUpListener(pcAddr, pcPort);
     if (ListeningSocket == INVALID_SOCKET) {
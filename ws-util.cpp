@@ -13,7 +13,7 @@
 #include <algorithm> // for lower_bound()
 using namespace std;
 
-#if !defined(_WINSOCK2API_) 
+#if defined(_WIN32) && !defined(_WINSOCK2API_)
 // Winsock 2 header defines this, but Winsock 1.1 header doesn't.  In
 // the interest of not requiring the Winsock 2 SDK which we don't really
 // need, we'll just define this one constant ourselves.
@@ -23,6 +23,8 @@ using namespace std;
 
 //// Statics ///////////////////////////////////////////////////////////
 
+#ifdef _WIN32
+
 // List of Winsock error constants mapped to an interpretation string.
 // Note that this list must remain sorted by the error constants'
 // values, because we do a binary search on the list when looking up
@@ -91,6 +93,7 @@ static struct ErrorEntry {
     ErrorEntry(WSANO_DATA,         "No host data of that type was found")
 };
 const int kNumMessages = sizeof(g_ErrorList) / sizeof(ErrorEntry);
+#endif
 
 
 //// WSAGetLastErrorMessage ////////////////////////////////////////////
@@ -109,6 +112,14 @@ string WSAGetLastErrorMessage(const char *pcMessagePrefix, int nErrorID) {
     ostringstream ss;
     ss << pcMessagePrefix << ": ";
 
+#ifndef _WIN32
+    // POSIX systems already have a canned interpretation for every
+    // errno value.
+    int nID = nErrorID ? nErrorID : errno;
+    ss << strerror(nID) << " (" << nID << ")";
+    return ss.str();
+#else
+
     // Tack appropriate canned message onto end of supplied message 
     // prefix. Note that we do a binary search here: g_ErrorList must be
 	// sorted by the error constant's value.
@@ -126,6 +137,7 @@ string WSAGetLastErrorMessage(const char *pcMessagePrefix, int nErrorID) {
 
     // Finish error message off and return it.
     return ss.str();
+#endif
 }
 
 
@@ -187,3 +199,140 @@ bool ShutdownConnection(SOCKET sd, bool rx) {
 
     return true;
 }
+
+
+//// SetNonBlocking ////////////////////////////////////////////////////
+// Puts the socket into non-blocking mode, so that recv(), send() and
+// connect() return immediately instead of waiting.  Returns true if
+// we're successful, false otherwise.
+
+bool SetNonBlocking(SOCKET sd) {
+#ifdef _WIN32
+    u_long nNonBlocking = 1;
+    return ioctlsocket(sd, FIONBIO, &nNonBlocking) == 0;
+#else
+    int flags = fcntl(sd, F_GETFL, 0);
+    if (flags == -1) {
+        return false;
+    }
+
+    return fcntl(sd, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+
+//// AcceptNonBlocking /////////////////////////////////////////////////
+// Accepts a connection from the listening socket and returns it in
+// non-blocking mode.  On Linux accept4() does both in one system call.
+// Returns INVALID_SOCKET if there's nothing to accept or on error.
+
+SOCKET AcceptNonBlocking(SOCKET listener) {
+#ifdef __linux__
+    return accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    SOCKET sd = accept(listener, nullptr, nullptr);
+    if (sd != INVALID_SOCKET && !SetNonBlocking(sd)) {
+        closesocket(sd);
+        return INVALID_SOCKET;
+    }
+
+    return sd;
+#endif
+}
+
+
+//// WouldBlock ////////////////////////////////////////////////////////
+// Returns true if the last socket call failed only because the socket
+// is non-blocking and the operation couldn't complete right away.
+
+bool WouldBlock() {
+    int nError = WSAGetLastError();
+
+#ifndef _WIN32
+    if (nError == EAGAIN || nError == EINTR) {
+        return true;
+    }
+#endif
+
+    return nError == WSAEWOULDBLOCK || nError == WSAEINPROGRESS;
+}
+
+
+//// AcceptAborted /////////////////////////////////////////////////////
+// Returns true if the last accept() failed only because the queued
+// connection went away (e.g. the client reset it) before it could be
+// accepted.  The next queued connection can still be accepted.
+
+bool AcceptAborted() {
+    int nError = WSAGetLastError();
+
+#ifdef _WIN32
+    return nError == WSAECONNRESET || nError == WSAECONNABORTED;
+#elif defined(__linux__)
+    // Linux also passes pending network errors and firewall verdicts on
+    // the new connection up through accept().
+    return nError == ECONNABORTED || nError == EPROTO || nError == EINTR ||
+           nError == EPERM || nError == ENETDOWN || nError == ENOPROTOOPT ||
+           nError == EHOSTDOWN || nError == ENONET || nError == EHOSTUNREACH ||
+           nError == EOPNOTSUPP || nError == ENETUNREACH;
+#else
+    return nError == ECONNABORTED || nError == EPROTO || nError == EINTR;
+#endif
+}
+
+
+//// OutOfDescriptors //////////////////////////////////////////////////
+// Returns true if the last socket call failed because the process or
+// the system ran out of file descriptors or socket buffers.
+
+bool OutOfDescriptors() {
+    int nError = WSAGetLastError();
+
+#ifdef _WIN32
+    return nError == WSAEMFILE || nError == WSAENOBUFS;
+#else
+    return nError == EMFILE || nError == ENFILE ||
+           nError == ENOBUFS || nError == ENOMEM;
+#endif
+}
+
+
+//// SendV /////////////////////////////////////////////////////////////
+// Sends several separate buffers with a single system call: sendmsg()
+// on POSIX, WSASend() on Windows.  At most kMaxIoSlices buffers are
+// sent per call; like send(), it may send less than was asked for.
+// Returns the number of bytes sent, or SOCKET_ERROR.
+
+long SendV(SOCKET sd, const IoSlice *slices, size_t count) {
+    if (count > kMaxIoSlices) {
+        count = kMaxIoSlices;
+    }
+
+#ifdef _WIN32
+    WSABUF bufs[kMaxIoSlices];
+    for (size_t i = 0; i < count; i++) {
+        bufs[i].buf = (CHAR *) slices[i].data;
+        bufs[i].len = (ULONG) slices[i].len;
+    }
+
+    DWORD nSent = 0;
+    if (WSASend(sd, bufs, (DWORD) count, &nSent, 0, NULL, NULL) != 0) {
+        return SOCKET_ERROR;
+    }
+
+    return (long) nSent;
+#else
+    iovec iov[kMaxIoSlices];
+    for (size_t i = 0; i < count; i++) {
+        iov[i].iov_base = (void *) slices[i].data;
+        iov[i].iov_len = slices[i].len;
+    }
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+
+    return (long) sendmsg(sd, &msg, MSG_NOSIGNAL);
+#endif
+}
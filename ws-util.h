@@ -4,16 +4,62 @@
 
 #pragma once
 
-#define FD_SETSIZE 2
+#ifdef _WIN32
 #define _WINSOCK_DEPRECATED_NO_WARNINGS
 #include <winsock2.h>
+#include <Ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
 #include <string>
 
 #define STRINGIFY(x) #x
 #define TOSTRING(x) STRINGIFY(x)
 #define LINE_NO TOSTRING(__LINE__)
 
+#ifdef _MSC_VER
 #define __FUNC__ __FUNCTION__ "() [" LINE_NO "] --> "
+#else
+// GCC 的 __FUNCTION__ 不是字符串字面值，无法拼接
+#define __FUNC__ __FILE__ " [" LINE_NO "] --> "
+#endif
+
+
+//// POSIX compatibility /////////////////////////////////////////////////
+
+#ifndef _WIN32
+typedef int SOCKET;
+
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define SD_SEND SHUT_WR
+
+#define closesocket close
+#define ioctlsocket ioctl
+#define WSAGetLastError() (errno)
+#define WSAEWOULDBLOCK EWOULDBLOCK
+#define WSAEINPROGRESS EINPROGRESS
+
+#define WSACleanup() ((void) 0)
+
+#define sprintf_s snprintf
+#define ZeroMemory(p, n) memset((p), 0, (n))
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
 
 
 //// Constants ///////////////////////////////////////////////////////////
@@ -22,6 +68,16 @@ enum {
     kBufferSize = 8192,
     kExtraBytes = 256,
     kSafeBufferSize = kBufferSize + kExtraBytes,
+    kMaxIoSlices = 16,
+};
+
+
+//// Types ///////////////////////////////////////////////////////////////
+
+/// 待发送的一段数据
+struct IoSlice {
+    const char *data;
+    size_t len;
 };
 
 
@@ -30,7 +86,35 @@ enum {
 std::string WSAGetLastErrorMessage
     (const char* pcMessagePrefix, int nErrorID = 0);
 
-/// ܺƽعرһ
+/// 尽可能和平地关闭一个连接
 /// 
-/// @param rx Ƿδ
+/// @param rx 是否继续接收未读的数据
 bool ShutdownConnection(SOCKET sd, bool rx = true);
+
+/// 将 SOCKET 设为非阻塞模式
+bool SetNonBlocking(SOCKET sd);
+
+/// 从监听 SOCKET 接受一个连接，得到的 SOCKET 已是非阻塞模式
+/// 
+/// Linux 上用 accept4() 一次完成，不再另外调用 fcntl()。
+/// 
+/// @return 没有待接受的连接或出错时返回 INVALID_SOCKET，用 WouldBlock() 区分
+SOCKET AcceptNonBlocking(SOCKET listener);
+
+/// 上一个套接字操作是否只是因为非阻塞而未能完成
+bool WouldBlock();
+
+/// 上一次 accept() 失败是否只是因为排队中的那个连接已经失效
+/// 
+/// 如对方在连接被接受之前重置了它。此时应当接着接受下一个连接。
+bool AcceptAborted();
+
+/// 上一个套接字操作是否因为文件描述符（或内核缓冲区）用尽而失败
+bool OutOfDescriptors();
+
+/// 用一次系统调用发送多段数据
+/// 
+/// 一次最多发送 kMaxIoSlices 段，与 send() 一样可能只发送了一部分。
+/// 
+/// @return 发送的字节数，失败时返回 SOCKET_ERROR
+long SendV(SOCKET sd, const IoSlice *slices, size_t count);